@@ -159,7 +159,8 @@ WMPixmap *WMCreatePixmapFromFile(WMScreen *scrPtr, const char *fileName)
   WMPixmap *pixPtr;
   RImage *image;
 
-  image = RLoadImage(scrPtr->rcontext, fileName, 0);
+  /* the image is only read, no need for a private copy of the cached one */
+  image = RLoadSharedImage(scrPtr->rcontext, fileName, 0);
   if (!image)
     return NULL;
 
@@ -221,7 +222,7 @@ WMPixmap *WMCreateScaledBlendedPixmapFromFile(WMScreen *scrPtr, const char *file
   WMPixmap *pixPtr;
   RImage *image;
 
-  image = RLoadImage(scrPtr->rcontext, fileName, 0);
+  image = RLoadSharedImage(scrPtr->rcontext, fileName, 0);
   if (!image)
     return NULL;
 
@@ -246,6 +247,10 @@ WMPixmap *WMCreateScaledBlendedPixmapFromFile(WMScreen *scrPtr, const char *file
     image = new_image;
   }
 
+  image = RGetWritableImage(image);
+  if (!image)
+    return NULL;
+
   RCombineImageWithColor(image, color);
   pixPtr = WMCreatePixmapFromRImage(scrPtr, image, 0);
   RReleaseImage(image);
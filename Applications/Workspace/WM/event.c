@@ -314,6 +314,14 @@ static void _runLoopHandleEvent(CFFileDescriptorRef fdref, CFOptionFlags callBac
   CFFileDescriptorEnableCallBacks(fdref, kCFFileDescriptorReadCallBack);
 }
 
+/* Results of the images loaded with RLoadImageAsync() */
+static void _runLoopHandleImageRequests(CFFileDescriptorRef fdref, CFOptionFlags callBackTypes,
+                                        void *info)
+{
+  RDispatchImageRequests();
+  CFFileDescriptorEnableCallBacks(fdref, kCFFileDescriptorReadCallBack);
+}
+
 void WMRunLoop_V0()
 {
   XEvent event;
@@ -342,6 +350,8 @@ void WMRunLoop_V1()
   CFRunLoopRef run_loop = CFRunLoopGetCurrent();
   CFFileDescriptorRef xfd;
   CFRunLoopSourceRef xfd_source;
+  CFFileDescriptorRef ifd = NULL;
+  CFRunLoopSourceRef ifd_source = NULL;
 
   WMLogError("WMRunLoop_V1: Entering WM runloop with X connection: %i", ConnectionNumber(dpy));
 
@@ -355,6 +365,16 @@ void WMRunLoop_V1()
   CFRelease(xfd_source);
   CFRelease(xfd);
 
+  // Asynchronous image loading results
+  if (RImageRequestFD() >= 0) {
+    ifd = CFFileDescriptorCreate(kCFAllocatorDefault, RImageRequestFD(), false,
+                                 _runLoopHandleImageRequests, NULL);
+    CFFileDescriptorEnableCallBacks(ifd, kCFFileDescriptorReadCallBack);
+    ifd_source = CFFileDescriptorCreateRunLoopSource(kCFAllocatorDefault, ifd, 0);
+    CFRunLoopAddSource(run_loop, ifd_source, kCFRunLoopDefaultMode);
+    CFRelease(ifd_source);
+  }
+
   WMLogError("WMRunLoop_V1: Going into CFRunLoop...");
 
   wm_runloop = run_loop;
@@ -363,6 +383,11 @@ void WMRunLoop_V1()
   CFRunLoopRemoveSource(run_loop, xfd_source, kCFRunLoopDefaultMode);
   /* Do not call CFFileDescriptorInvalidate(xfd)!
      This FD is a connection of Workspace application to X server. */
+  if (ifd) {
+    CFFileDescriptorDisableCallBacks(ifd, kCFFileDescriptorReadCallBack);
+    CFRunLoopRemoveSource(run_loop, ifd_source, kCFRunLoopDefaultMode);
+    CFRelease(ifd);
+  }
 
   WMLogError("V1: CFRunLoop finished.");
 }
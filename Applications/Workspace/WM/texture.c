@@ -441,8 +441,9 @@ RImage *wTextureRenderImage(WTexture *texture, int width, int height, int relief
       if (!image)
         break;
 
-      grad = RRenderGradient(width, height, &texture->tgradient.color1, &texture->tgradient.color2,
-                             subtype);
+      /* only read, it can be the cached one */
+      grad = RRenderSharedGradient(width, height, &texture->tgradient.color1,
+                                   &texture->tgradient.color2, subtype);
       if (!grad) {
         RReleaseImage(image);
         image = NULL;
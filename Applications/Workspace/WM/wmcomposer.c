@@ -28,7 +28,6 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <math.h>
 #include <sys/poll.h>
 #include <sys/time.h>
 #include <time.h>
@@ -42,6 +41,8 @@
 #include <X11/extensions/Xrender.h>
 #include <X11/extensions/shape.h>
 
+#include <wraster.h>
+
 typedef struct _ignore {
   struct _ignore *next;
   unsigned long sequence;
@@ -76,11 +77,6 @@ typedef struct _win {
   struct _win *prev_trans;
 } CMPWindow;
 
-typedef struct _conv {
-  int size;
-  double *data;
-} conv;
-
 typedef struct _fade {
   struct _fade *next;
   Display *dpy;
@@ -130,8 +126,6 @@ static Atom winNormalAtom;
 #define TRANSLUCENT 0xe0000000
 #define OPAQUE 0xffffffff
 
-static conv *gaussianMap;
-
 #define WINDOW_SOLID 0
 #define WINDOW_TRANS 1
 #define WINDOW_ARGB 2
@@ -157,9 +151,9 @@ static int wComposerShouldIgnoreEvent(Display *dpy, unsigned long sequence);
 
 static CompMode compMode = CompSimple;
 
-static int shadowRadius = 20;       // 12;
-static int shadowOffsetX = -30;     // -15;
-static int shadowOffsetY = -30;     // -15;
+static float shadowRadius = 10;     // standard deviation of the blur
+static int shadowOffsetX = -30;     // set to center the shadows in wComposerInitialize()
+static int shadowOffsetY = -30;
 static double shadowOpacity = .20;  //.75;
 
 static Bool fadeWindows = False;
@@ -171,11 +165,6 @@ static int fade_time = 0;
 static Bool excludeDockShadows = False;
 static Bool autoRedirect = False;
 
-/* For shadow precomputation */
-static int Gsize = -1;
-static unsigned char *shadowCorner = NULL;
-static unsigned char *shadowTop = NULL;
-
 static int get_time_in_milliseconds(void)
 {
   struct timeval tv;
@@ -341,152 +330,6 @@ static void run_fades(Display *dpy)
   fade_time = now + fade_delta;
 }
 
-// ----------------------------------------------------------------------------------------------
-// Gaussian blur
-// ----------------------------------------------------------------------------------------------
-static double gaussian(double r, double x, double y)
-{
-  return ((1 / (sqrt(2 * M_PI * r))) * exp((-(x * x + y * y)) / (2 * r * r)));
-}
-
-static conv *make_gaussian_map(Display *dpy, double r)
-{
-  conv *c;
-  int size = ((int)ceil((r * 3)) + 1) & ~1;
-  int center = size / 2;
-  int x, y;
-  double t;
-  double g;
-
-  c = malloc(sizeof(conv) + size * size * sizeof(double));
-  c->size = size;
-  c->data = (double *)(c + 1);
-  t = 0.0;
-  for (y = 0; y < size; y++)
-    for (x = 0; x < size; x++) {
-      g = gaussian(r, (double)(x - center), (double)(y - center));
-      t += g;
-      c->data[y * size + x] = g;
-    }
-  for (y = 0; y < size; y++) {
-    for (x = 0; x < size; x++) {
-      c->data[y * size + x] /= t;
-    }
-  }
-  return c;
-}
-
-/*
- * A picture will help
- *
- *	-center   0                width  width+center
- *  -center +-----+-------------------+-----+
- *	    |     |                   |     |
- *	    |     |                   |     |
- *        0 +-----+-------------------+-----+
- *	    |     |                   |     |
- *	    |     |                   |     |
- *	    |     |                   |     |
- *   height +-----+-------------------+-----+
- *	    |     |                   |     |
- * height+  |     |                   |     |
- *  center  +-----+-------------------+-----+
- */
-
-static unsigned char sum_gaussian(conv *map, double opacity, int x, int y, int width, int height)
-{
-  int fx, fy;
-  double *g_line = map->data;
-  int g_size = map->size;
-  int center = g_size / 2;
-  int fx_start, fx_end;
-  int fy_start, fy_end;
-  double v;
-
-  /*
-   * Compute set of filter values which are "in range",
-   * that's the set with:
-   *	0 <= x + (fx-center) && x + (fx-center) < width &&
-   *  0 <= y + (fy-center) && y + (fy-center) < height
-   *
-   *  0 <= x + (fx - center)	x + fx - center < width
-   *  center - x <= fx	fx < width + center - x
-   */
-
-  fx_start = center - x;
-  if (fx_start < 0) {
-    fx_start = 0;
-  }
-  fx_end = width + center - x;
-  if (fx_end > g_size) {
-    fx_end = g_size;
-  }
-
-  fy_start = center - y;
-  if (fy_start < 0) {
-    fy_start = 0;
-  }
-  fy_end = height + center - y;
-  if (fy_end > g_size) {
-    fy_end = g_size;
-  }
-
-  g_line = g_line + fy_start * g_size + fx_start;
-
-  v = 0;
-  for (fy = fy_start; fy < fy_end; fy++) {
-    double *g_data = g_line;
-    g_line += g_size;
-
-    for (fx = fx_start; fx < fx_end; fx++) {
-      v += *g_data++;
-    }
-  }
-  if (v > 1) {
-    v = 1;
-  }
-
-  return ((unsigned char)(v * opacity * 255.0));
-}
-
-/* precompute shadow corners and sides to save time for large windows */
-static void presum_gaussian(conv *map)
-{
-  int center = map->size / 2;
-  int opacity, x, y;
-
-  Gsize = map->size;
-
-  if (shadowCorner) {
-    free(shadowCorner);
-  }
-  if (shadowTop) {
-    free(shadowTop);
-  }
-
-  shadowCorner = malloc((Gsize + 1) * (Gsize + 1) * 26);
-  shadowTop = malloc((Gsize + 1) * 26);
-
-  for (x = 0; x <= Gsize; x++) {
-    shadowTop[25 * (Gsize + 1) + x] =
-        sum_gaussian(map, 1, x - center, center, Gsize * 2, Gsize * 2);
-    for (opacity = 0; opacity < 25; opacity++) {
-      shadowTop[opacity * (Gsize + 1) + x] = shadowTop[25 * (Gsize + 1) + x] * opacity / 25;
-    }
-    for (y = 0; y <= x; y++) {
-      shadowCorner[25 * (Gsize + 1) * (Gsize + 1) + y * (Gsize + 1) + x] =
-          sum_gaussian(map, 1, x - center, y - center, Gsize * 2, Gsize * 2);
-      shadowCorner[25 * (Gsize + 1) * (Gsize + 1) + x * (Gsize + 1) + y] =
-          shadowCorner[25 * (Gsize + 1) * (Gsize + 1) + y * (Gsize + 1) + x];
-      for (opacity = 0; opacity < 25; opacity++) {
-        shadowCorner[opacity * (Gsize + 1) * (Gsize + 1) + y * (Gsize + 1) + x] =
-            shadowCorner[opacity * (Gsize + 1) * (Gsize + 1) + x * (Gsize + 1) + y] =
-                shadowCorner[25 * (Gsize + 1) * (Gsize + 1) + y * (Gsize + 1) + x] * opacity / 25;
-      }
-    }
-  }
-}
-
 // ----------------------------------------------------------------------------------------------
 // Pictures, images and painting
 // ----------------------------------------------------------------------------------------------
@@ -494,16 +337,11 @@ static XImage *create_shadow_image(Display *dpy, double opacity, int width, int
 {
   XImage *ximage;
   unsigned char *data;
-  int gsize = gaussianMap->size;
-  int ylimit, xlimit;
-  int swidth = width + gsize;
-  int sheight = height + gsize;
-  int center = gsize / 2;
-  int x, y;
-  unsigned char d;
-  int x_diff;
-  int opacity_int = (int)(opacity * 25);
-  data = malloc(swidth * sheight * sizeof(unsigned char));
+  int margin = RShadowMargin(shadowRadius);
+  int swidth = width + 2 * margin;
+  int sheight = height + 2 * margin;
+
+  data = RMakeShadowMask(width, height, shadowRadius, (int)(opacity * 255));
   if (!data)
     return NULL;
   ximage = XCreateImage(dpy, DefaultVisual(dpy, DefaultScreen(dpy)), 8, ZPixmap, 0, (char *)data,
@@ -512,75 +350,6 @@ static XImage *create_shadow_image(Display *dpy, double opacity, int width, int
     free(data);
     return NULL;
   }
-  /*
-   * Build the gaussian in sections
-   */
-
-  /*
-   * center (fill the complete data array)
-   */
-  if (Gsize > 0)
-    d = shadowTop[opacity_int * (Gsize + 1) + Gsize];
-  else
-    d = sum_gaussian(gaussianMap, opacity, center, center, width, height);
-  memset(data, d, sheight * swidth);
-
-  /*
-   * corners
-   */
-  ylimit = gsize;
-  if (ylimit > sheight / 2) {
-    ylimit = (sheight + 1) / 2;
-  }
-  xlimit = gsize;
-  if (xlimit > swidth / 2) {
-    xlimit = (swidth + 1) / 2;
-  }
-
-  for (y = 0; y < ylimit; y++) {
-    for (x = 0; x < xlimit; x++) {
-      if (xlimit == Gsize && ylimit == Gsize) {
-        d = shadowCorner[opacity_int * (Gsize + 1) * (Gsize + 1) + y * (Gsize + 1) + x];
-      } else {
-        d = sum_gaussian(gaussianMap, opacity, x - center, y - center, width, height);
-      }
-      data[y * swidth + x] = d;
-      data[(sheight - y - 1) * swidth + x] = d;
-      data[(sheight - y - 1) * swidth + (swidth - x - 1)] = d;
-      data[y * swidth + (swidth - x - 1)] = d;
-    }
-  }
-  /*
-   * top/bottom
-   */
-  x_diff = swidth - (gsize * 2);
-  if (x_diff > 0 && ylimit > 0) {
-    for (y = 0; y < ylimit; y++) {
-      if (ylimit == Gsize) {
-        d = shadowTop[opacity_int * (Gsize + 1) + y];
-      } else {
-        d = sum_gaussian(gaussianMap, opacity, center, y - center, width, height);
-      }
-      memset(&data[y * swidth + gsize], d, x_diff);
-      memset(&data[(sheight - y - 1) * swidth + gsize], d, x_diff);
-    }
-  }
-
-  /*
-   * sides
-   */
-
-  for (x = 0; x < xlimit; x++) {
-    if (xlimit == Gsize) {
-      d = shadowTop[opacity_int * (Gsize + 1) + x];
-    } else {
-      d = sum_gaussian(gaussianMap, opacity, x - center, center, width, height);
-    }
-    for (y = gsize; y < sheight - gsize; y++) {
-      data[y * swidth + x] = d;
-      data[y * swidth + (swidth - x - 1)] = d;
-    }
-  }
 
   return ximage;
 }
@@ -1848,7 +1617,7 @@ static Bool wComposerExtensionsCheck(Display *dpy)
   //       synchronize = True;
   // Specifies the blur radius for client-side shadows. (default 12)
   //     case 'r':
-  //       shadowRadius = atoi(optarg);
+  //       shadowRadius = atof(optarg);
   // Specifies the translucency for client-side shadows. (default .75)
   //     case 'o':
   //       shadowOpacity = atof(optarg);
@@ -1903,8 +1672,8 @@ Bool wComposerInitialize()
   pa.subwindow_mode = IncludeInferiors;
 
   if (compMode == CompClientShadows) {
-    gaussianMap = make_gaussian_map(dpy, shadowRadius);
-    presum_gaussian(gaussianMap);
+    shadowOffsetX = -RShadowMargin(shadowRadius);
+    shadowOffsetY = -RShadowMargin(shadowRadius);
   }
 
   root_width = DisplayWidth(dpy, scr);
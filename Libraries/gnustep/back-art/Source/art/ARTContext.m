@@ -30,7 +30,10 @@
 
 #import "ARTGState.h"
 #import "FTFontInfo.h"
+#import "bands.h"
 #import "blit.h"
+#import "image_cache.h"
+#import "path_cache.h"
 
 #import "x11/XWindowBuffer.h"
 
@@ -38,6 +41,7 @@
 
 + (void)initializeBackend
 {
+  NSUserDefaults *ud = [NSUserDefaults standardUserDefaults];
   float gamma;
 
   NSDebugLLog(@"back-art", @"Initializing libart/freetype backend");
@@ -45,8 +49,20 @@
   [NSGraphicsContext setDefaultContextClass:[ARTContext class]];
   [FTFontInfo initializeBackend];
 
-  gamma = [[NSUserDefaults standardUserDefaults] floatForKey:@"back-art-text-gamma"];
+  gamma = [ud floatForKey:@"back-art-text-gamma"];
   artcontext_setup_gamma(gamma);
+
+  artcontext_setup_simd([[ud stringForKey:@"back-art-simd"] UTF8String]);
+
+  /* in kilobytes, 0 disables it */
+  if ([ud objectForKey:@"back-art-image-cache"])
+    image_cache_set_limit([ud integerForKey:@"back-art-image-cache"] * 1024);
+  if ([ud objectForKey:@"back-art-path-cache"])
+    path_cache_set_limit([ud integerForKey:@"back-art-path-cache"] * 1024);
+
+  /* threads drawing large fills and images in bands, 0 for one per
+     processor, 1 to draw in the main thread only */
+  art_band_set_threads([ud integerForKey:@"back-art-threads"]);
 }
 
 + (Class)GStateClass
@@ -99,6 +115,13 @@
   [(XWindowBuffer *)driver _exposeRect:rect];
 }
 
+/* bitmaps drawn at their size are drawn from the image cache */
+- (void)GSDrawImage:(NSRect)rect :(void *)imageref
+{
+  if (![(ARTGState *)gstate _image_draw_cached:(NSBitmapImageRep *)imageref:rect])
+    [super GSDrawImage:rect:imageref];
+}
+
 - (BOOL)isCompatibleBitmap:(NSBitmapImageRep *)bitmap
 {
   NSString *colorSpaceName;
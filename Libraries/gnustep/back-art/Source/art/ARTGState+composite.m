@@ -26,7 +26,6 @@
 
 #include <AppKit/NSAffineTransform.h>
 #include <AppKit/NSGraphics.h>
-#include <AppKit/NSBitmapImageRep.h>
 
 #include "ARTGState.h"
 #include "x11/XWindowBuffer.h"
@@ -1130,170 +1129,296 @@ static BOOL _rect_advance(rect_trace_t *t, int *x0, int *x1)
 }
 
 
-- (unsigned char *)artScale
+/*
+Scaled compositing. The source rectangle is resampled into a row of the
+destination size on the stack, in the pixel format of the buffers, and the
+row is then composited with the same functions as in compositeGState:. A
+destination pixel is a bilinear blend of the four source pixels around
+its center, in 16.16 fixed point. The buffers hold premultiplied alpha, so
+each byte can be blended separately. 16-bit formats pack their channels, so
+they take the nearest pixel instead.
+*/
+typedef struct {
+  const unsigned char *src, *srca; /* top left of the source rectangle */
+  int sbpl, asbpl;                 /* 0 if there is no source alpha */
+  int sw, sh;                      /* source rectangle size */
+  int dw, dh;                      /* destination rectangle size */
+  int step_x;                      /* source pixels per destination pixel, 16.16 */
+} scale_t;
+
+/* source coordinate of the center of destination pixel 'i', 16.16 */
+static int _scale_coordinate(int i, int s, int d)
 {
-  // art_u8 *dest_buffer = art_new(art_u8, dest_buffer_width * dest_buffer_height *
-  // sizeof(ags->wi->data)); double affine[6] = {0, 0, 0, 0, 0, 0}; affine[0] = source_ts.m11;
-  // affine[1] = source_ts.m12;
-  // affine[2] = source_ts.m21;
-  // affine[3] = source_ts.m22;
-  // affine[4] = source_ts.tX;
-  // affine[5] = source_ts.tY;
-  // art_rgb_rgba_affine(dest_buffer, 0, 0, dest_buffer_width, dest_buffer_height,
-  //                     dest_buffer_width * ags->wi->bytes_per_pixel, ags->wi->data, ags->wi->sx,
-  //                     ags->wi->sy, ags->wi->bytes_per_line, affine, ART_FILTER_NEAREST, NULL);
-  // art_rgb_bitmap_affine(dest_buffer, 0, 0, dest_buffer_width, dest_buffer_height,
-  //                       dest_buffer_width * 4, ags->wi->data, ags->wi->sx, ags->wi->sy,
-  //                       ags->wi->bytes_per_line, 0x00000001, affine, ART_FILTER_NEAREST, NULL);
-  // art_rgb_rgba_affine(dest_buffer, 0, 0, dest_buffer_width, dest_buffer_height,
-  //                     ags->wi->bytes_per_line, ags->wi->data,
-  //                     aRect.size.width, aRect.size.height,
-  //                     ags->wi->bytes_per_line, affine, ART_FILTER_NEAREST,
-  //                     NULL);
-  return NULL;
+  return (((2 * i + 1) * (long long)s) << 16) / (2 * d) - 0x8000;
 }
 
-unsigned char *_scaleImage(unsigned char *data, unsigned new_width, unsigned new_height,
-                           unsigned old_width, unsigned old_height)
+/* clamps f (16.16) to the source, with the pixel and weight of the next one */
+static inline void _scale_split(int f, int size, int *p, int *w)
 {
-  int ox;
-  int px, py;
-  register int x, y, t;
-  int dx, dy;
-  unsigned char *src;
-  unsigned char *dest;
+  if (f <= 0) {
+    *p = 0;
+    *w = 0;
+  } else if ((f >> 16) >= size - 1) {
+    *p = size - 1;
+    *w = 0;
+  } else {
+    *p = f >> 16;
+    *w = (f >> 8) & 0xff;
+  }
+}
 
-  if (data == NULL)
-    return NULL;
+/* resamples destination pixels [x0, x1) of row y into dst and dsta */
+static void _scale_row(scale_t *s, int y, int x0, int x1, unsigned char *dst, unsigned char *dsta)
+{
+  const unsigned char *row0, *row1, *a0, *a1;
+  int bpp = DI.bytes_per_pixel;
+  int sy, wy, sx, wx, fx, x, i;
+
+  _scale_split(_scale_coordinate(y, s->sh, s->dh), s->sh, &sy, &wy);
+  row0 = s->src + sy * s->sbpl;
+  row1 = wy ? row0 + s->sbpl : row0;
+  a0 = s->srca + sy * s->asbpl;
+  a1 = wy ? a0 + s->asbpl : a0;
+
+  fx = _scale_coordinate(x0, s->sw, s->dw);
+  for (x = x0; x < x1; x++, fx += s->step_x, dst += bpp) {
+    _scale_split(fx, s->sw, &sx, &wx);
+
+    if (bpp == 2) {
+      const unsigned char *p = (wy < 128 ? row0 : row1) + (sx + (wx >= 128)) * 2;
+
+      dst[0] = p[0];
+      dst[1] = p[1];
+      if (s->asbpl)
+        *dsta++ = (wy < 128 ? a0 : a1)[sx + (wx >= 128)];
+      continue;
+    }
 
-  NSLog(@"_scaleImage from: %ix%i to: %ix%i", old_width, old_height, new_width, new_height);
+    {
+      const unsigned char *p00 = row0 + sx * bpp, *p10 = row1 + sx * bpp;
+      int dx = wx ? bpp : 0;
+      int w00 = (256 - wx) * (256 - wy), w01 = wx * (256 - wy);
+      int w10 = (256 - wx) * wy, w11 = wx * wy;
 
-  unsigned char *new_data = malloc(sizeof(unsigned char) * new_height * new_width * 4);
-  memset(new_data, 0, sizeof(unsigned char) * new_height * new_width * 4);
-  // RImage *img = RCreateImage(new_width, new_height, False);
-  // d = img->data;
-  dest = new_data;
+      for (i = 0; i < bpp; i++)
+        dst[i] = (p00[i] * w00 + p00[i + dx] * w01 + p10[i] * w10 + p10[i + dx] * w11 + 0x8000) >>
+                 16;
 
-  /* fixed point math idea taken from Imlib by
-   * Carsten Haitzler (Rasterman) */
-  dx = (old_width << 16) / new_width;
-  dy = (old_height << 16) / new_height;
-  NSLog(@"dx: %i, dy: %i", dx, dy);
+      if (s->asbpl) {
+        int ax = wx ? 1 : 0;
 
-  py = 0;
+        *dsta++ = (a0[sx] * w00 + a0[sx + ax] * w01 + a1[sx] * w10 + a1[sx + ax] * w11 + 0x8000) >>
+                  16;
+      }
+    }
+  }
+}
+
+/* the corners of 'r' in device space, made integers */
+static void _device_rect(NSRect r, NSAffineTransform *m, NSPoint offset, int *x0, int *y0, int *x1,
+                         int *y1)
+{
+  NSPoint p0 = [m transformPoint:r.origin];
+  NSPoint p1 = [m transformPoint:NSMakePoint(NSMaxX(r), NSMaxY(r))];
+
+  p0.x -= offset.x;
+  p1.x -= offset.x;
+  p0.y = offset.y - p0.y;
+  p1.y = offset.y - p1.y;
+  *x0 = floor(MIN(p0.x, p1.x) + 0.5);
+  *x1 = floor(MAX(p0.x, p1.x) + 0.5);
+  *y0 = floor(MIN(p0.y, p1.y) + 0.5);
+  *y1 = floor(MAX(p0.y, p1.y) + 0.5);
+}
+
+- (void)_scaledCompositeGState:(ARTGState *)ags
+                      fromRect:(NSRect)aRect
+                       toPoint:(NSPoint)aPoint
+                            op:(NSCompositingOperation)composite_op
+                      fraction:(CGFloat)delta
+{
+  void (*blit_func)(composite_run_t * c, int num) = NULL;
+  scale_t s;
+  composite_run_t c;
+  int sx0, sy0, sx1, sy1;
+  int dx0, dy0, dx1, dy1;
+  int cx0, cy0, cx1, cy1;
+  int op, y;
 
-  // if (img->format == RRGBAFormat) {
-    for (y = 0; y < new_height; y++) {
-      t = old_width * (py >> 16);
-      NSLog(@"py: %i, py >> 16: %i, t: %i", py, py >> 16, t);
+  if (!wi || !wi->data || !ags->wi || !ags->wi->data)
+    return;
+  if (all_clipped)
+    return;
 
-      src = data + (t << 2); /* data+t*4 */
+  _device_rect(aRect, ags->ctm, ags->offset, &sx0, &sy0, &sx1, &sy1);
+  _device_rect(NSMakeRect(aPoint.x, aPoint.y, aRect.size.width, aRect.size.height), ctm, offset,
+               &dx0, &dy0, &dx1, &dy1);
+  if (sx1 <= sx0 || sy1 <= sy0 || dx1 <= dx0 || dy1 <= dy0)
+    return;
 
-      ox = 0;
-      px = 0;
-      for (x = 0; x < new_width; x++) {
-        px += dx;
+  /* Only the size comes from the destination CTM. As in compositeGState:,
+     the corner of the source rectangle at aRect.origin is put at aPoint,
+     so a flip of one of the CTMs moves the rectangle without mirroring it. */
+  {
+    NSPoint sp = [ags->ctm transformPoint:aRect.origin];
+    NSPoint dp = [ctm transformPoint:aPoint];
+    int w = dx1 - dx0, h = dy1 - dy0;
+
+    dx0 = floor(dp.x - offset.x + 0.5);
+    dy0 = floor(offset.y - dp.y + 0.5);
+    if (floor(sp.x - ags->offset.x + 0.5) == sx1)
+      dx0 -= w;
+    if (floor(ags->offset.y - sp.y + 0.5) == sy1)
+      dy0 -= h;
+    dx1 = dx0 + w;
+    dy1 = dy0 + h;
+  }
 
-        *(dest++) = *(src);
-        *(dest++) = *(src + 1);
-        *(dest++) = *(src + 2);
-        *(dest++) = *(src + 3);
+  /* Only the part of the source rectangle inside the source buffer is
+     drawn, in the matching part of the destination rectangle. */
+  if (sx0 < 0) {
+    dx0 += (long long)-sx0 * (dx1 - dx0) / (sx1 - sx0);
+    sx0 = 0;
+  }
+  if (sy0 < 0) {
+    dy0 += (long long)-sy0 * (dy1 - dy0) / (sy1 - sy0);
+    sy0 = 0;
+  }
+  if (sx1 > ags->wi->sx) {
+    dx1 -= (long long)(sx1 - ags->wi->sx) * (dx1 - dx0) / (sx1 - sx0);
+    sx1 = ags->wi->sx;
+  }
+  if (sy1 > ags->wi->sy) {
+    dy1 -= (long long)(sy1 - ags->wi->sy) * (dy1 - dy0) / (sy1 - sy0);
+    sy1 = ags->wi->sy;
+  }
+  if (sx1 <= sx0 || sy1 <= sy0 || dx1 <= dx0 || dy1 <= dy0)
+    return;
 
-        t = (px - ox) >> 16;
-        ox += t << 16;
+  cx0 = MAX(dx0, clip_x0);
+  cy0 = MAX(dy0, clip_y0);
+  cx1 = MIN(dx1, clip_x1);
+  cy1 = MIN(dy1, clip_y1);
+  if (cx1 <= cx0 || cy1 <= cy0)
+    return;
 
-        src += t << 2; /* t*4 */
-      }
-      py += dy;
+  if (composite_op == NSCompositeSourceOver && delta < 1) {
+    if (ags->wi->has_alpha && wi->has_alpha)
+      blit_func = DI.dissolve_aa;
+    else if (wi->has_alpha)
+      blit_func = DI.dissolve_oa;
+    else if (ags->wi->has_alpha)
+      blit_func = DI.dissolve_ao;
+    else
+      blit_func = DI.dissolve_oo;
+    op = composite_op;
+  } else {
+    BOOL dst_needs_alpha;
+
+    op = [self _composite_func:!ags->wi->has_alpha
+                              :NO
+                              :!wi->has_alpha
+                              :&dst_needs_alpha
+                              :composite_op
+                              :&blit_func];
+    if (op == -1)
+      return;
+
+    if (dst_needs_alpha) {
+      [wi needsAlpha];
+      if (!wi->has_alpha)
+        return;
     }
-  // } else {
-  //   for (y = 0; y < new_height; y++) {
-  //     t = old_width * (py >> 16);
 
-  //     s = data + (t << 1) + t; /* image->data+t*3 */
+    /* these ignore the source window */
+    if (op == NSCompositeClear || op == GSCompositeHighlight) {
+      [self compositerect:NSMakeRect(aPoint.x, aPoint.y, aRect.size.width, aRect.size.height)
+                       op:op];
+      return;
+    }
 
-  //     ox = 0;
-  //     px = 0;
-  //     for (x = 0; x < new_width; x++) {
-  //       px += dx;
+    if (op == NSCompositeCopy) {
+      if (ags->wi->has_alpha) {
+        [wi needsAlpha];
+        if (!wi->has_alpha)
+          return;
+        blit_func = copy_aa;
+      } else if (wi->has_alpha)
+        blit_func = copy_oa;
+      else
+        blit_func = copy_oo;
+    }
+  }
 
-  //       *(d++) = *(s);
-  //       *(d++) = *(s + 1);
-  //       *(d++) = *(s + 2);
+  if (!blit_func) {
+    NSLog(@"unimplemented: drawGState: %p fromRect: (%g %g)+(%g %g) toPoint: (%g %g)  op: %i",
+          ags, aRect.origin.x, aRect.origin.y, aRect.size.width, aRect.size.height, aPoint.x,
+          aPoint.y, op);
+    return;
+  }
 
-  //       t = (px - ox) >> 16;
-  //       ox += t << 16;
+  s.sbpl = ags->wi->bytes_per_line;
+  s.src = ags->wi->data + sx0 * DI.bytes_per_pixel + sy0 * s.sbpl;
+  if (ags->wi->has_alpha && !DI.inline_alpha) {
+    s.asbpl = ags->wi->sx;
+    s.srca = ags->wi->alpha + sx0 + sy0 * s.asbpl;
+  } else {
+    s.asbpl = 0;
+    s.srca = NULL;
+  }
+  s.sw = sx1 - sx0;
+  s.sh = sy1 - sy0;
+  s.dw = dx1 - dx0;
+  s.dh = dy1 - dy0;
+  s.step_x = ((long long)s.sw << 16) / s.dw;
+
+  /* When the source is this window, rows that were already drawn may be
+     read again. Like order 2 in compositeGState:, this only matters for
+     overlapping rectangles, which scaled drawing doesn't produce in
+     practice. */
+  {
+    int w = cx1 - cx0;
+    unsigned char row[w * DI.bytes_per_pixel];
+    unsigned char rowa[w];
 
-  //       s += (t << 1) + t; /* t*3 */
-  //     }
-  //     py += dy;
-  //   }
-  // }
+    c.fraction = delta * 255;
+    for (y = cy0; y < cy1; y++) {
+      unsigned char *dst = wi->data + y * wi->bytes_per_line;
+      unsigned char *dsta = NULL;
 
-    // return img->data;
-    return new_data;
-}
+      if (wi->has_alpha)
+        dsta = DI.inline_alpha ? dst : wi->alpha + y * wi->sx;
 
-// Convert RGBA unpacked to ARGB packed.
-// Packed ARGB values are layed out as ARGB on big endian systems
-// and as BGRA on little endian systems
-static void _swapColors(unsigned char *image_data, NSBitmapImageRep *rep) {
-  unsigned char *target = image_data;
-  unsigned char *source = [rep bitmapData];
-  NSInteger width = [rep pixelsWide];
-  NSInteger height = [rep pixelsHigh];
-  NSInteger samples_per_pixel = [rep samplesPerPixel];
-  NSInteger bytes_per_row = [rep bytesPerRow];
-  unsigned char *r, *g, *b, *a;
-  NSInteger x, y;
-
-#if GS_WORDS_BIGENDIAN
-  // RGBA -> ARGB
-  r = target + 1;
-  g = target + 2;
-  b = target + 3;
-  a = target;
-#else
-  // RGBA -> BGRA
-  r = target + 2;
-  g = target + 1;
-  b = target;
-  a = target + 3;
-#endif
-
-  if (samples_per_pixel == 4) {
-    for (y = 0; y < height; y++) {
-      unsigned char *d = source;
-      for (x = 0; x < width; x++) {
-        *r = d[0];
-        *g = d[1];
-        *b = d[2];
-        *a = d[3];
-        r += 4;
-        g += 4;
-        b += 4;
-        a += 4;
-        d += samples_per_pixel;
-      }
-      source += bytes_per_row;
-    }
-  } else if (samples_per_pixel == 3) {
-    for (y = 0; y < height; y++) {
-      unsigned char *d = source;
-      for (x = 0; x < width; x++) {
-        *r = d[0];
-        *g = d[1];
-        *b = d[2];
-        *a = 255;
-        r += 4;
-        g += 4;
-        b += 4;
-        a += 4;
-        d += samples_per_pixel;
+      if (!clip_span) {
+        _scale_row(&s, y - dy0, cx0 - dx0, cx1 - dx0, row, rowa);
+        c.dst = dst + cx0 * DI.bytes_per_pixel;
+        c.dsta = dsta + cx0;
+        c.src = row;
+        c.srca = rowa;
+        blit_func(&c, w);
+      } else {
+        unsigned int *span, *end;
+        int x0, x1;
+
+        /* spans are counted from clip_x0, and each pair is a visible run */
+        span = &clip_span[clip_index[y - clip_y0]];
+        end = &clip_span[clip_index[y - clip_y0 + 1]];
+        for (; span < end; span += 2) {
+          x0 = MAX((int)span[0] + clip_x0, cx0);
+          x1 = MIN((int)span[1] + clip_x0, cx1);
+          if (x1 <= x0)
+            continue;
+          _scale_row(&s, y - dy0, x0 - dx0, x1 - dx0, row, rowa);
+          c.dst = dst + x0 * DI.bytes_per_pixel;
+          c.dsta = dsta + x0;
+          c.src = row;
+          c.srca = rowa;
+          blit_func(&c, x1 - x0);
+        }
       }
-      source += bytes_per_row;
     }
   }
+  UPDATE_UNBUFFERED
 }
 
 - (void)drawGState:(GSGState *)source
@@ -1302,100 +1427,25 @@ static void _swapColors(unsigned char *image_data, NSBitmapImageRep *rep) {
                 op:(NSCompositingOperation)op
           fraction:(CGFloat)delta
 {
-  ARTGState *ags = (ARTGState *)source;
+  NSAffineTransformStruct local_ts = [ctm transformStruct];
 
   aRect.origin.x = round(aRect.origin.x);
   aRect.origin.y = round(aRect.origin.y);
   aRect.size.width = round(aRect.size.width);
   aRect.size.height = round(aRect.size.height);
 
-  NSAffineTransformStruct local_ts = [ctm transformStruct];
-  NSAffineTransformStruct source_ts = [source->ctm transformStruct];
-  // NSAffineTransform *backup_ctm = [[NSAffineTransform alloc] initWithTransform:source->ctm];
-
-  // NSLog(@"drawGState: rect %@ point: %@", NSStringFromRect(aRect), NSStringFromPoint(aPoint));
-  // NSLog(@"drawGState: source CTM: %@", source->ctm);
-  // NSLog(@"drawGState:        CTM: %@", ctm);
-  // NSLog(@"drawGState: NEW    CTM: %@", source->ctm);
-  if ((1 - local_ts.m11) > 0.01 /*&& source_ts.m11 != local_ts.m11*/) {
-    // source_ts.m11 = local_ts.m11;
-    // source_ts.m12 = local_ts.m12;
-    // source_ts.m21 = local_ts.m21;
-    // source_ts.m22 = local_ts.m22;
-    // [source->ctm setTransformStruct:source_ts];
-    [source DPSscale:local_ts.m11:local_ts.m22];
-
-    // int dest_buffer_width = aRect.size.width;
-    // int dest_buffer_height = aRect.size.height;
-    // int dest_buffer_width = ceil(aRect.size.width * local_ts.m11);
-    // int dest_buffer_height = ceil(aRect.size.height * local_ts.m22);
-    // wi - window buffer
-    // ags->wi - image buffer
-    // NSLog(@"drawGState:AGS->WI: width: %i, height: %i -- WI: width: %i, height: %i", ags->wi->sx,
-    //       ags->wi->sy, wi->sx, wi->sy);
-
-    NSLog(@"Buffer size: %lu, bytes: _per_pixel: %i, _per_line: %i, unsigned char size: %lu",
-          sizeof(ags->wi->data), ags->wi->bytes_per_pixel, ags->wi->bytes_per_line,
-          sizeof(unsigned char));
-
-    NSBitmapImageRep *imageRep =
-        [[NSBitmapImageRep alloc] initWithBitmapDataPlanes:NULL
-                                                pixelsWide:ags->wi->sx
-                                                pixelsHigh:ags->wi->sy
-                                             bitsPerSample:8
-                                           samplesPerPixel:4
-                                                  hasAlpha:ags->wi->has_alpha ? YES : NO
-                                                  isPlanar:NO
-                                            colorSpaceName:NSDeviceRGBColorSpace
-                                               bytesPerRow:ags->wi->bytes_per_line
-                                              bitsPerPixel:ags->wi->bits_per_pixel];
-    int buffer_size = ags->wi->sy * ags->wi->bytes_per_line;
-    // unsigned char *dest_buffer = malloc(buffer_size);
-    memcpy([imageRep bitmapData], ags->wi->data, buffer_size);
-    // _swapColors(dest_buffer, imageRep);
-    // memcpy([imageRep bitmapData], dest_buffer, buffer_size);
-    // free(dest_buffer);
-    [drawcontext GSDrawImage:aRect:imageRep];
-
-    // unsigned char *dest_buffer =
-    //     _scaleImage(ags->wi->data, dest_buffer_width, dest_buffer_height,
-    //                 (unsigned)aRect.size.width, (unsigned)aRect.size.height);
-    // unsigned char *dest_buffer =
-    //     _scaleImage(ags->wi->data, dest_buffer_width, dest_buffer_height, ags->wi->sx,
-    //     ags->wi->sy);
-    // free(ags->wi->data);
-    // ags->wi->data = dest_buffer;
-    // ags->wi->sx = dest_buffer_width;
-    // ags->wi->sy = dest_buffer_height;
-    // ags->wi->bytes_per_line = (unsigned)aRect.size.width * ags->wi->bytes_per_pixel;
-
-    // unsigned char *dest_buffer =
-    //     malloc(sizeof(unsigned char) * dest_buffer_height * dest_buffer_width * 4);
-    // memset(
-    //     dest_buffer, 0,
-    //     sizeof(unsigned char) * dest_buffer_width * dest_buffer_height * ags->wi->bytes_per_pixel);
-    // // int y;
-    // for (y = 0; y < dest_buffer_height; y += ags->wi->bytes_per_line) {
-
-    // }
-    // memcpy(dest_buffer, ags->wi->data,
-    //        sizeof(unsigned char) * dest_buffer_height * dest_buffer_width * 4);
-
-    // free(ags->wi->data);
-    // ags->wi->data = dest_buffer;
-    // ags->wi->sx = dest_buffer_width;
-    // ags->wi->sy = dest_buffer_height;
-    // ags->wi->bytes_per_line = dest_buffer_width * ags->wi->bytes_per_pixel;
+  /* Rotated drawing isn't handled by either path; compositeGState: at
+     least draws the pixels in place. Flips alone are not scaling. */
+  if ((fabs(fabs(local_ts.m11) - 1) > 0.01 || fabs(fabs(local_ts.m22) - 1) > 0.01) &&
+      local_ts.m12 == 0 && local_ts.m21 == 0) {
+    [self _scaledCompositeGState:(ARTGState *)source
+                        fromRect:aRect
+                         toPoint:aPoint
+                              op:op
+                        fraction:delta];
   } else {
-    // NSDictionary *rr = [self GSReadRect:aRect];
-    // NSLog(@"ReadRect Size: %@", [rr objectForKey:@"Size"]);
-    // NSLog(@"ReadRect Matrix: %@", [rr objectForKey:@"Matrix"]);
-
     [self compositeGState:source fromRect:aRect toPoint:aPoint op:op fraction:delta];
   }
-
-  // [source->ctm initWithTransform:backup_ctm];
-  // [backup_ctm release];
 }
 
 - (void)compositerect:(NSRect)aRect op:(NSCompositingOperation)op
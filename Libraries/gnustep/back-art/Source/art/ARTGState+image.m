@@ -29,14 +29,19 @@ Image drawing. DPSimage and helpers.
 #include <math.h>
 
 #include <AppKit/NSAffineTransform.h>
+#include <AppKit/NSBitmapImageRep.h>
 #include <AppKit/NSGraphics.h>
+#include <Foundation/NSDebug.h>
 
 #include "ARTGState.h"
 
 #ifndef RDS
 #include "x11/XWindowBuffer.h"
 #endif
+#include "bands.h"
 #include "blit.h"
+#include "image.h"
+#include "image_cache.h"
 
 static unsigned int _get_8_bits(const unsigned char *ptr, int bit_ofs, int num_bits)
 {
@@ -585,6 +590,109 @@ static void _image_get_color_rgb_cmyk_gray(image_info_t *ii, render_run_t *ri, i
   }
 }
 
+/* the window coordinate of a point of the image, like the corners in
+   -_image_do_rgb_transform::: */
+static int _image_snap(float f)
+{
+  if (fabs(f - floor(f + .5)) < 0.001)
+    f = floor(f + .5);
+  return floor(f);
+}
+
+/*
+Sets the window position and size of an image drawn with the matrix, which
+mustn't rotate, flip or shear it. Returns NO if it is empty.
+*/
+- (BOOL)_image_place:(image_draw_t *)d :(NSAffineTransform *)matrix :(int)width :(int)height
+{
+  NSPoint p0, p1;
+
+  p0 = [matrix transformPoint:NSMakePoint(0, 0)];
+  p1 = [matrix transformPoint:NSMakePoint(width, height)];
+
+  d->x = _image_snap(p0.x) - offset.x;
+  d->y = offset.y - _image_snap(p1.y);
+  d->sx = _image_snap(p1.x) - offset.x - d->x;
+  d->sy = offset.y - _image_snap(p0.y) - d->y;
+
+  return width >= 1 && height >= 1 && d->sx >= 1 && d->sy >= 1;
+}
+
+/*
+Draws the placed image 'd' into the window, inside the clip. Returns NO if
+memory is short.
+*/
+- (BOOL)_image_draw_placed:(image_draw_t *)d
+{
+  int y1;
+
+  d->di = &DI;
+  d->data = wi->data;
+  d->alpha = wi->alpha;
+  d->bytes_per_line = wi->bytes_per_line;
+  d->alpha_per_line = wi->sx;
+  d->window_alpha = wi->has_alpha;
+
+  d->clip_x0 = clip_x0;
+  d->clip_y0 = clip_y0;
+  d->clip_span = clip_span;
+  d->clip_index = clip_index;
+
+  d->x0 = MAX(d->x, clip_x0);
+  d->x1 = MIN(d->x + d->sx, clip_x1);
+  d->y0 = MAX(d->y, clip_y0);
+  y1 = MIN(d->y + d->sy, clip_y1);
+  if (d->x0 >= d->x1 || d->y0 >= y1)
+    return YES;
+
+  if (d->kind == IMAGE_DOWNSCALE && !image_setup_downscale(d))
+    return NO;
+
+  art_run_band_rows(y1 - d->y0, d->x1 - d->x0, image_draw_rows, d);
+
+  image_free(d);
+  return YES;
+}
+
+/*
+Draws an image the matrix doesn't rotate, flip or shear with the kernels
+of image.m. Returns NO if it isn't drawn at its size, at a multiple of its
+size or smaller, which the general code handles.
+*/
+- (BOOL)_image_draw:(NSAffineTransform *)matrix
+                   :(int)width
+                   :(int)height
+                   :(int)bytes_per_row
+                   :(BOOL)has_alpha
+                   :(const unsigned char *)src
+{
+  image_draw_t d;
+
+  memset(&d, 0, sizeof(d));
+  if (![self _image_place:&d:matrix:width:height])
+    return NO;
+
+  if (d.sx == width && d.sy == height) {
+    d.kind = IMAGE_TRANSLATE;
+  } else if (d.sx % width == 0 && d.sy % height == 0 && d.sx >= width && d.sy >= height) {
+    d.kind = IMAGE_UPSCALE;
+    d.scale_x = d.sx / width;
+    d.scale_y = d.sy / height;
+  } else if (d.sx <= width && d.sy <= height) {
+    d.kind = IMAGE_DOWNSCALE;
+  } else {
+    return NO;
+  }
+
+  d.src = src;
+  d.width = width;
+  d.height = height;
+  d.bytes_per_row = bytes_per_row;
+  d.has_alpha = has_alpha;
+
+  return [self _image_draw_placed:&d];
+}
+
 - (void)DPSimage:(NSAffineTransform *)matrix
                 :(NSInteger)pixelsWide
                 :(NSInteger)pixelsHigh
@@ -597,7 +705,7 @@ static void _image_get_color_rgb_cmyk_gray(image_info_t *ii, render_run_t *ri, i
                 :(NSString *)colorSpaceName
                 :(const unsigned char *const[5])data
 {
-  BOOL identity_transform, is_rgb;
+  BOOL is_rgb;
   image_info_t ii;
   NSAffineTransformStruct ts;
 
@@ -608,84 +716,21 @@ static void _image_get_color_rgb_cmyk_gray(image_info_t *ii, render_run_t *ri, i
 
   [matrix prependTransform:ctm];
   ts = [matrix transformStruct];
-  if (fabs(ts.m11 - 1.0) < 0.001 && fabs(ts.m12) < 0.001 && fabs(ts.m22 - 1.0) < 0.001 &&
-      fabs(ts.m21) < 0.001)
-    identity_transform = YES;
-  else
-    identity_transform = NO;
 
   if (colorSpaceName == NSDeviceRGBColorSpace || colorSpaceName == NSCalibratedRGBColorSpace)
     is_rgb = YES;
   else
     is_rgb = NO;
 
-  /* optimize common case */
-  if (identity_transform && is_rgb && !clip_span && bitsPerSample == 8 && !isPlanar &&
-      bytesPerRow == samplesPerPixel * pixelsWide &&
+  /* not rotated, flipped or sheared: see image.h */
+  if (is_rgb && bitsPerSample == 8 && !isPlanar &&
       ((samplesPerPixel == 3 && bitsPerPixel == 24 && !hasAlpha) ||
-       (samplesPerPixel == 4 && bitsPerPixel == 32 && hasAlpha))) {
-    int x, y, ox, oy;
-    const unsigned char *src = data[0];
-    unsigned char *alpha_dest;
-    render_run_t ri;
-
-    if (wi->has_alpha) {
-      if (DI.inline_alpha)
-        alpha_dest = wi->data + DI.inline_alpha_ofs;
-      else
-        alpha_dest = wi->alpha;
-    } else
-      alpha_dest = NULL;
-
-    ox = [matrix transformPoint:NSMakePoint(0, 0)].x - offset.x;
-    oy = offset.y - [matrix transformPoint:NSMakePoint(0, 0)].y - pixelsHigh;
-
-    for (y = 0; y < pixelsHigh; y++) {
-      for (x = 0; x < pixelsWide; x++) {
-        if (x + ox < clip_x0 || x + ox >= clip_x1 || y + oy < clip_y0 || y + oy >= clip_y1) {
-          if (hasAlpha)
-            src += 4;
-          else
-            src += 3;
-          continue;
-        }
-        ri.dst = wi->data + (x + ox) * DI.bytes_per_pixel + (y + oy) * wi->bytes_per_line;
-        ri.dsta = wi->alpha + (x + ox) + (y + oy) * wi->sx;
-        ri.r = src[0];
-        ri.g = src[1];
-        ri.b = src[2];
-        if (hasAlpha) {
-          ri.a = src[3];
-          /* Undo premultiply  */
-          if (ri.a && ri.a != 255) {
-            ri.r = (255 * ri.r) / ri.a;
-            ri.g = (255 * ri.g) / ri.a;
-            ri.b = (255 * ri.b) / ri.a;
-          }
-          if (alpha_dest) {
-            if (src[3] == 255)
-              RENDER_RUN_OPAQUE_A(&ri, 1);
-            else if (src[3])
-              RENDER_RUN_ALPHA_A(&ri, 1);
-          } else {
-            if (src[3] == 255)
-              RENDER_RUN_OPAQUE(&ri, 1);
-            else if (src[3])
-              RENDER_RUN_ALPHA(&ri, 1);
-          }
-          src += 4;
-        } else {
-          ri.a = 255;
-          if (alpha_dest)
-            RENDER_RUN_OPAQUE_A(&ri, 1);
-          else
-            RENDER_RUN_OPAQUE(&ri, 1);
-          src += 3;
-        }
-      }
+       (samplesPerPixel == 4 && bitsPerPixel == 32 && hasAlpha)) &&
+      fabs(ts.m12) < 0.001 && fabs(ts.m21) < 0.001 && ts.m11 > 0.0 && ts.m22 > 0.0) {
+    if ([self _image_draw:matrix:pixelsWide:pixelsHigh:bytesPerRow:hasAlpha:data[0]]) {
+      UPDATE_UNBUFFERED
+      return;
     }
-    UPDATE_UNBUFFERED
-    return;
   }
 
   ii.bits_per_sample = bitsPerSample;
@@ -730,4 +775,79 @@ static void _image_get_color_rgb_cmyk_gray(image_info_t *ii, render_run_t *ri, i
         isPlanar, hasAlpha);
 }
 
+/*
+Draws a bitmap drawn at its size with its pixels in the image cache (see
+image_cache.h), for -GSDrawImage::. Returns NO if the bitmap or the matrix
+don't suit the cache, and the bitmap has to go through DPSimage.
+*/
+- (BOOL)_image_draw_cached:(NSBitmapImageRep *)bitmap :(NSRect)rect
+{
+  NSAffineTransform *matrix;
+  NSAffineTransformStruct ts;
+  NSString *colorSpaceName;
+  unsigned char *data[5];
+  unsigned long hits, misses, invalidations, evictions, last_misses;
+  size_t memory;
+  NSInteger width, height;
+  BOOL has_alpha;
+  image_cache_t *e;
+  image_draw_t d;
+
+  if (!image_cache_enabled() || !wi || !wi->data || all_clipped)
+    return NO;
+
+  width = [bitmap pixelsWide];
+  height = [bitmap pixelsHigh];
+  has_alpha = [bitmap hasAlpha];
+  colorSpaceName = [bitmap colorSpaceName];
+  if ([bitmap bitmapFormat] != 0 || [bitmap bitsPerSample] != 8 || [bitmap isPlanar] ||
+      !([colorSpaceName isEqualToString:NSDeviceRGBColorSpace] ||
+        [colorSpaceName isEqualToString:NSCalibratedRGBColorSpace]))
+    return NO;
+  if (!((has_alpha && [bitmap samplesPerPixel] == 4 && [bitmap bitsPerPixel] == 32) ||
+        (!has_alpha && [bitmap samplesPerPixel] == 3 && [bitmap bitsPerPixel] == 24)))
+    return NO;
+  if (width < 1 || height < 1)
+    return NO;
+
+  /* the matrix of -NSDrawBitmap::::::::::: */
+  matrix = [NSAffineTransform transform];
+  [matrix translateToPoint:rect.origin];
+  [matrix scaleXBy:NSWidth(rect) / width yBy:NSHeight(rect) / height];
+  [matrix prependTransform:ctm];
+  ts = [matrix transformStruct];
+  if (fabs(ts.m12) >= 0.001 || fabs(ts.m21) >= 0.001 || ts.m11 <= 0.0 || ts.m22 <= 0.0)
+    return NO;
+
+  memset(&d, 0, sizeof(d));
+  if (![self _image_place:&d:matrix:width:height] || d.sx != width || d.sy != height)
+    return NO;
+
+  [bitmap getBitmapDataPlanes:data];
+  last_misses = image_cache_misses();
+  e = image_cache_get(bitmap, &DI, data[0], width, height, [bitmap bytesPerRow], has_alpha);
+  if (image_cache_misses() != last_misses && GSDebugSet(@"back-art-image-cache")) {
+    image_cache_statistics(&hits, &misses, &invalidations, &evictions, &memory);
+    NSDebugLLog(@"back-art-image-cache", @"%@ %lix%li: %s; %lu hits, %lu misses, %lu "
+                @"invalidations, %lu evictions, %lu bytes",
+                bitmap, (long)width, (long)height, e ? "converted" : "not cached", hits, misses,
+                invalidations, evictions, (unsigned long)memory);
+  }
+  if (!e)
+    return NO;
+
+  d.kind = IMAGE_DEVICE;
+  d.src = e->data;
+  d.width = width;
+  d.height = height;
+  d.bytes_per_row = width * DI.bytes_per_pixel;
+  d.src_alpha = e->alpha;
+  d.opaque = e->opaque;
+  if (![self _image_draw_placed:&d])
+    return NO;
+
+  UPDATE_UNBUFFERED
+  return YES;
+}
+
 @end
@@ -30,13 +30,16 @@ Path handling.
 
 #include <AppKit/NSAffineTransform.h>
 #include <AppKit/NSBezierPath.h>
+#include <Foundation/NSDebug.h>
 
 #include "ARTGState.h"
 
 #ifndef RDS
 #include "x11/XWindowBuffer.h"
 #endif
+#include "bands.h"
 #include "blit.h"
+#include "path_cache.h"
 
 
 #include <libart_lgpl/libart.h>
@@ -348,6 +351,29 @@ static void render_svp_clipped_callback(void *data, int y, int start,
   ri->ri.dsta = dsta;
 }
 
+/* a band of rows of an SVP, see artcontext_render_svp */
+typedef struct
+{
+  const ArtSVP *svp;
+  svp_render_info_t ri;
+  int first_y; /* the row of the SVP the first band starts at */
+} svp_render_bands_t;
+
+static void render_svp_rows(void *data, int first, int last)
+{
+  svp_render_bands_t *b = data;
+  svp_render_info_t ri = b->ri;
+
+  first += b->first_y;
+  last += b->first_y;
+  ri.ri.dst += (first - ri.y0) * ri.rowstride;
+  if (ri.ri.dsta)
+    ri.ri.dsta += (first - ri.y0) * ri.arowstride;
+
+  art_svp_render_aa(b->svp, ri.x0, first, ri.x1, last,
+    ri.clip_span? render_svp_clipped_callback : render_svp_callback, &ri);
+}
+
 static void artcontext_render_svp(const ArtSVP *svp, int x0, int y0, int x1, int y1,
 	unsigned char r, unsigned char g, unsigned char b, unsigned char a,
 	unsigned char *dst, int rowstride,
@@ -355,40 +381,81 @@ static void artcontext_render_svp(const ArtSVP *svp, int x0, int y0, int x1, int
 	draw_info_t *di,
 	unsigned int *clip_span, unsigned int *clip_index)
 {
-  svp_render_info_t ri;
+  svp_render_bands_t bands;
+  svp_render_info_t *ri = &bands.ri;
+  double sy0, sy1, sx0, sx1;
+  int i, first_y, last_y, width;
 
-  ri.x0 = x0;
-  ri.x1 = x1;
-  ri.y0 = y0;
+  if (!svp->n_segs)
+    return;
 
-  ri.ri.r = r;
-  ri.ri.g = g;
-  ri.ri.b = b;
-  ri.real_a = ri.ri.a = a;
+  /* only the rows of the SVP are drawn, in bands if it is large */
+  sx0 = sy0 = 1e30;
+  sx1 = sy1 = -1e30;
+  for (i = 0; i < svp->n_segs; i++)
+    {
+      sx0 = MIN(sx0, svp->segs[i].bbox.x0);
+      sx1 = MAX(sx1, svp->segs[i].bbox.x1);
+      sy0 = MIN(sy0, svp->segs[i].bbox.y0);
+      sy1 = MAX(sy1, svp->segs[i].bbox.y1);
+    }
+  first_y = MAX(y0, floor(sy0));
+  last_y = MIN(y1, ceil(sy1));
+  width = MIN(x1, ceil(sx1)) - MAX(x0, floor(sx0));
+  if (first_y >= last_y)
+    return;
+
+  bands.svp = svp;
+  bands.first_y = first_y;
 
-  ri.bpp = di->bytes_per_pixel;
+  ri->x0 = x0;
+  ri->x1 = x1;
+  ri->y0 = y0;
 
-  ri.ri.dst = dst;
-  ri.rowstride = rowstride;
+  ri->ri.r = r;
+  ri->ri.g = g;
+  ri->ri.b = b;
+  ri->real_a = ri->ri.a = a;
+
+  ri->bpp = di->bytes_per_pixel;
+
+  ri->ri.dst = dst;
+  ri->rowstride = rowstride;
 
-  ri.clip_span = clip_span;
-  ri.clip_index = clip_index;
+  ri->clip_span = clip_span;
+  ri->clip_index = clip_index;
 
   if (has_alpha)
     {
-      ri.ri.dsta = dsta;
-      ri.arowstride = arowstride;
-      ri.run_alpha = di->render_run_alpha_a;
-      ri.run_opaque = di->render_run_opaque_a;
+      ri->ri.dsta = dsta;
+      ri->arowstride = arowstride;
+      ri->run_alpha = di->render_run_alpha_a;
+      ri->run_opaque = di->render_run_opaque_a;
     }
   else
     {
-      ri.run_alpha = di->render_run_alpha;
-      ri.run_opaque = di->render_run_opaque;
+      ri->ri.dsta = NULL;
+      ri->arowstride = 0;
+      ri->run_alpha = di->render_run_alpha;
+      ri->run_opaque = di->render_run_opaque;
     }
 
-  art_svp_render_aa(svp, x0, y0, x1, y1,
-    clip_span? render_svp_clipped_callback : render_svp_callback, &ri);
+  art_run_band_rows(last_y - first_y, width, render_svp_rows, &bands);
+}
+
+static void path_cache_log(void)
+{
+  unsigned long hits, misses, evictions;
+  size_t memory;
+
+  if (!path_cache_enabled() || !GSDebugSet(@"back-art-path-cache"))
+    return;
+
+  path_cache_statistics(&hits, &misses, &evictions, &memory);
+  NSDebugLLog(@"back-art-path-cache",
+	      @"%lu hits, %lu misses (%.1f%% hits), %lu evictions, %lu bytes",
+	      hits, misses, 100.0 * hits / (hits + misses), evictions,
+	      (unsigned long)memory);
 }
 
 
@@ -640,18 +707,33 @@ typedef struct
 {
   int x0, x1, y0, sy;
 
-  int minx,maxx;
-  int first_y,last_y;
-
   unsigned int *span;
   unsigned int *index;
   int span_size, num_span;
-
-  unsigned int *cur_span;
-  unsigned int *cur_index;
+  BOOL failed; /* out of memory, the spans are incomplete */
 } clip_info_t;
 
 
+static BOOL clip_add_span(clip_info_t *ci, int x)
+{
+  if (ci->num_span == ci->span_size)
+    {
+      unsigned int *span;
+
+      span = realloc(ci->span, sizeof(unsigned int) * (ci->span_size + 16));
+      if (!span)
+	{
+	  ci->failed = YES;
+	  return NO;
+	}
+      ci->span = span;
+      ci->span_size += 16;
+    }
+  ci->span[ci->num_span++] = x;
+  return YES;
+}
+
+/* Stores the spans of every row, relative to the clipping rectangle. */
 static void clip_svp_callback(void *data, int y, int start,
 	ArtSVPRenderAAStep *steps, int n_steps)
 {
@@ -662,35 +744,24 @@ static void clip_svp_callback(void *data, int y, int start,
 
   alpha = start;
 
-  ci->index[y - ci->y0 - ci->first_y] = ci->num_span;
+  if (ci->failed)
+    return;
+
   if (y-ci->y0<0 || y-ci->y0>=ci->sy)
   {
 	printf("weird y=%i (%i)\n",y,y-ci->y0);
+	return;
   }
+  ci->index[y - ci->y0] = ci->num_span;
 
   /* empty line; very common case */
   if (alpha < 0x10000 && !n_steps)
-    {
-      if (ci->first_y == y - ci->y0)
-        ci->first_y++;
-      return;
-    }
-
-  ci->last_y = y - ci->y0 + 1;
+    return;
 
   x = 0;
   state = alpha >= 0x10000;
-  if (state)
-    {
-      if (ci->num_span == ci->span_size)
-	{
-	  ci->span_size += 16;
-	  ci->span = realloc(ci->span, sizeof(unsigned int) * ci->span_size);
-	}
-      ci->span[ci->num_span++] = x;
-      if (x < ci->minx) ci->minx = x;
-    }
-
+  if (state && !clip_add_span(ci, x))
+    return;
 
   for (; n_steps; n_steps--, steps++)
     {
@@ -699,103 +770,214 @@ static void clip_svp_callback(void *data, int y, int start,
       nstate = alpha >= 0x10000;
       if (state != nstate)
 	{
-	  if (ci->num_span == ci->span_size)
-	    {
-	      ci->span_size += 16;
-	      ci->span = realloc(ci->span, sizeof(unsigned int) * ci->span_size);
-	    }
-	  ci->span[ci->num_span++] = x;
-	  if (x < ci->minx) ci->minx = x;
-	  if (x > ci->maxx) ci->maxx = x;
+	  if (!clip_add_span(ci, x))
+	    return;
 	  state = nstate;
 	}
     }
   if (state)
+    clip_add_span(ci, ci->x1 - ci->x0);
+}
+
+/*
+Intersects the clipping spans a and b of 'sy' rows, both relative to the
+clipping rectangle, by merging the rows. The spans are returned in *span,
+and the index of each row in 'index' (sy + 1 entries).
+*/
+static int clip_intersect_spans(const unsigned int *a_span, const unsigned int *a_index,
+				const unsigned int *b_span, const unsigned int *b_index,
+				int sy, unsigned int **span, unsigned int *index)
+{
+  const unsigned int *a, *a_end, *b, *b_end;
+  unsigned int x;
+  BOOL in_a, in_b, in;
+  int y, n;
+
+  /* every coordinate of the result is one of a or b */
+  *span = malloc(sizeof(unsigned int) * (a_index[sy] + b_index[sy] + 1));
+  if (!*span)
+    return -1;
+
+  n = 0;
+  for (y = 0; y < sy; y++)
     {
-      if (ci->num_span == ci->span_size)
+      index[y] = n;
+      a = &a_span[a_index[y]];
+      a_end = &a_span[a_index[y + 1]];
+      b = &b_span[b_index[y]];
+      b_end = &b_span[b_index[y + 1]];
+      in_a = in_b = in = NO;
+
+      while (a != a_end && b != b_end)
 	{
-	  ci->span_size += 16;
-	  ci->span = realloc(ci->span, sizeof(unsigned int) * ci->span_size);
+	  x = *a < *b ? *a : *b;
+	  if (*a == x)
+	    {
+	      in_a = !in_a;
+	      a++;
+	    }
+	  if (*b == x)
+	    {
+	      in_b = !in_b;
+	      b++;
+	    }
+	  if ((in_a && in_b) != in)
+	    {
+	      in = !in;
+	      (*span)[n++] = x;
+	    }
 	}
-      x = ci->x1 - ci->x0;
-      ci->span[ci->num_span++] = x;
-      if (x > ci->maxx) ci->maxx = x;
+      /* rows end off, so the rest of the other one is outside */
     }
+  index[sy] = n;
+
+  return n;
+}
+/*
+Makes the spans (relative to the clipping rectangle, with clip_sy + 1 row
+indexes) the clip, and takes them. The clipping rectangle shrinks to the
+bounds of the spans, and if they cover all of it, they are dropped: a
+rectangular clip draws with the unclipped code.
+*/
+- (void) _clip_set_spans: (unsigned int *)span : (unsigned int *)index
+			 : (int)num_span
+{
+  int first_y, last_y, minx, maxx;
+  BOOL rectangle;
+  int i, y;
+
+  for (first_y = 0; first_y < clip_sy && index[first_y] == index[first_y + 1];
+       first_y++)
+    ;
+  for (last_y = clip_sy; last_y > first_y && index[last_y - 1] == index[last_y];
+       last_y--)
+    ;
+
+  if (first_y == last_y)
+    {
+      /* This can happen if the path is empty, or doesn't intersect the
+	 current clipping path.  The result then is that everything
+	 is clipped.  */
+      free(span);
+      free(index);
+      all_clipped = YES;
+      clip_x0 = clip_x1 = clip_sx = 0;
+      clip_y0 = clip_y1 = clip_sy = 0;
+      return;
+    }
+
+  /* the spans of a row are sorted */
+  minx = clip_sx;
+  maxx = 0;
+  for (y = first_y; y < last_y; y++)
+    {
+      if (index[y] == index[y + 1])
+	continue;
+      if (span[index[y]] < minx)
+	minx = span[index[y]];
+      if (span[index[y + 1] - 1] > maxx)
+	maxx = span[index[y + 1] - 1];
+    }
+
+  rectangle = YES;
+  for (y = first_y; y < last_y && rectangle; y++)
+    {
+      rectangle = index[y + 1] - index[y] == 2
+	&& span[index[y]] == minx && span[index[y] + 1] == maxx;
+    }
+
+  clip_x1 = clip_x0 + maxx;
+  clip_x0 += minx;
+  clip_sx = clip_x1 - clip_x0;
+  clip_y1 = clip_y0 + last_y;
+  clip_y0 += first_y;
+  clip_sy = clip_y1 - clip_y0;
+
+  if (rectangle)
+    {
+      free(span);
+      free(index);
+      return;
+    }
+
+  if (first_y)
+    memmove(index, index + first_y, sizeof(unsigned int) * (clip_sy + 1));
+  if (minx)
+    {
+      for (i = 0; i < num_span; i++)
+	span[i] -= minx;
+    }
+
+  clip_span = span;
+  clip_index = index;
+  clip_num_span = num_span;
 }
 
 /* will free the passed in svp */
 - (void) _clip_add_svp: (ArtSVP *)svp
 {
   clip_info_t ci;
+  unsigned int *span, *index;
+  int num_span;
+
+  if (all_clipped)
+    {
+      art_svp_free(svp);
+      return;
+    }
+
   ci.span = NULL;
-  ci.index = malloc(sizeof(unsigned int) * (clip_sy + 1));
+  ci.index = calloc(clip_sy + 1, sizeof(unsigned int));
   if (!ci.index)
     {
       NSLog(@"Warning: out of memory calculating clipping spans (%lu bytes)",
 	    sizeof(unsigned int) * (clip_sy + 1));
+      art_svp_free(svp);
       return;
     }
   ci.span_size = ci.num_span = 0;
+  ci.failed = NO;
   ci.x0 = clip_x0;
   ci.x1 = clip_x1;
   ci.y0 = clip_y0;
   ci.sy = clip_sy;
 
-  ci.minx = ci.x1 - ci.x0;
-  ci.maxx = 0;
-  ci.first_y = 0;
-  ci.last_y = -1;
-
-  if (clip_span)
+  art_svp_render_aa(svp, clip_x0, clip_y0, clip_x1, clip_y1, clip_svp_callback, &ci);
+  art_svp_free(svp);
+  if (ci.failed)
     {
-      NSLog(@"TODO: _clip_add_svp: with existing clip_span not implemented");
+      /* an odd number of spans in a row would invert the clip */
+      NSLog(@"Warning: out of memory calculating clipping spans");
+      free(ci.span);
       free(ci.index);
       return;
     }
-  else
-    {
-      art_svp_render_aa(svp, clip_x0, clip_y0, clip_x1, clip_y1, clip_svp_callback, &ci);
-      if (!ci.span)
-	{
-	  /* This can happen if the path is empty, or doesn't intersect the
-	     current clipping path.  The result then is that everything
-	     is clipped.  */
-	  free(ci.index);
-	  all_clipped = YES;
-	  clip_x0 = clip_x1 = clip_sx = 0;
-	  clip_y0 = clip_y1 = clip_sy = 0;
-	  return;
-	}
-      clip_span = ci.span;
-      clip_index = ci.index;
-      clip_index[clip_sy - ci.first_y] = clip_num_span = ci.num_span;
-
-      clip_y1 = clip_y0 + ci.last_y;
-      clip_y0 += ci.first_y;
-      clip_sy = clip_y1 - clip_y0;
-      if (clip_y1 <= clip_y0)
-	all_clipped = YES;
+  ci.index[clip_sy] = ci.num_span;
 
-      if (ci.minx > 0)
-	{
-	  int i;
-	  for (i = 0; i < clip_num_span; i++)
-	    {
-	      if (clip_span[i] < ci.minx)
-	        NSLog(@"_clip_add_svp: clip_span[i]<0 when adjusting for minx");
-	      clip_span[i] -= ci.minx;
-	      if (clip_span[i] > ci.maxx - ci.minx)
-	        NSLog(@"_clip_add_svp: clip_span[i] too large when adjusting for minx");
-	    }
-	}
+  if (!clip_span)
+    {
+      [self _clip_set_spans: ci.span : ci.index : ci.num_span];
+      return;
+    }
 
-      clip_x1 = clip_x0 + ci.maxx;
-      clip_x0 += ci.minx;
-      clip_sx = clip_x1 - clip_x0;
-      if (clip_x1 <= clip_x0)
-	all_clipped = YES;
+  /* both are relative to the current clipping rectangle */
+  index = malloc(sizeof(unsigned int) * (clip_sy + 1));
+  num_span = index ? clip_intersect_spans(clip_span, clip_index, ci.span, ci.index,
+					  clip_sy, &span, index) : -1;
+  free(ci.span);
+  free(ci.index);
+  if (num_span < 0)
+    {
+      NSLog(@"Warning: out of memory intersecting clipping spans");
+      free(index);
+      return;
     }
-  art_svp_free(svp);
+
+  free(clip_span);
+  free(clip_index);
+  clip_span = clip_index = NULL;
+  clip_num_span = 0;
+  [self _clip_set_spans: span : index : num_span];
 }
 
 - (void) _clip: (int)rule
@@ -913,6 +1095,9 @@ static void clip_svp_callback(void *data, int y, int start,
 {
   ArtVpath *vp;
   ArtSVP *svp;
+  const ArtSVP *cached;
+  path_cache_params_t params;
+  int dx, dy;
 
   if (!wi || !wi->data) return;
   if (all_clipped) return;
@@ -921,29 +1106,44 @@ static void clip_svp_callback(void *data, int y, int start,
   vp = [self _vpath_from_current_path: YES];
   if (!vp)
     return;
-  svp = art_svp_from_vpath(vp);
-  art_free(vp);
 
-  {
-    ArtSVP *svp2;
-    ArtSvpWriter *svpw;
+  /* the SVP of the path moved to the origin, see path_cache.h */
+  path_cache_translate(vp, &dx, &dy);
+  memset(&params, 0, sizeof(params));
+  params.kind = PATH_CACHE_FILL;
+  params.rule = rule;
 
-    svpw = art_svp_writer_rewind_new(rule);
-    art_svp_intersector(svp, svpw);
-    svp2 = art_svp_writer_rewind_reap(svpw);
-    art_svp_free(svp);
-    svp = svp2;
-  }
+  svp = NULL;
+  cached = path_cache_enabled() ? path_cache_lookup(&params, vp) : NULL;
+  if (!cached)
+    {
+      ArtSVP *svp2;
+      ArtSvpWriter *svpw;
 
+      svp = art_svp_from_vpath(vp);
+      svpw = art_svp_writer_rewind_new(rule);
+      art_svp_intersector(svp, svpw);
+      svp2 = art_svp_writer_rewind_reap(svpw);
+      art_svp_free(svp);
+      svp = svp2;
+      cached = svp;
+    }
 
-  artcontext_render_svp(svp, clip_x0, clip_y0, clip_x1, clip_y1,
+  artcontext_render_svp(cached,
+    clip_x0 - dx, clip_y0 - dy, clip_x1 - dx, clip_y1 - dy,
     fill_color[0], fill_color[1], fill_color[2], fill_color[3],
     CLIP_DATA, wi->bytes_per_line,
     wi->has_alpha? wi->alpha + clip_x0 + clip_y0 * wi->sx : NULL, wi->sx,
     wi->has_alpha,
     &DI, clip_span, clip_index);
 
-  art_svp_free(svp);
+  if (svp)
+    {
+      if (!path_cache_add(&params, vp, svp))
+	art_svp_free(svp);
+      path_cache_log();
+    }
+  art_free(vp);
 
   [path removeAllPoints];
 
@@ -972,6 +1172,32 @@ static void clip_svp_callback(void *data, int y, int start,
   [self _fill: ART_WIND_RULE_NONZERO];
 }
 
+/* the rows of an axis- and pixel-aligned rectangle */
+typedef struct
+{
+  render_run_t ri;
+  int width;
+  int rowstride, arowstride;
+  void (*run)(render_run_t *ri, int num);
+} rect_fill_t;
+
+static void rect_fill_rows(void *data, int first, int last)
+{
+  rect_fill_t *f = data;
+  render_run_t ri = f->ri;
+
+  ri.dst += first * f->rowstride;
+  if (ri.dsta)
+    ri.dsta += first * f->arowstride;
+  for (; first < last; first++)
+    {
+      f->run(&ri, f->width);
+      ri.dst += f->rowstride;
+      if (ri.dsta)
+	ri.dsta += f->arowstride;
+    }
+}
+
 - (void) DPSrectfill: (CGFloat)x : (CGFloat)y : (CGFloat)w : (CGFloat)h
 {
   ArtVpath vp[6];
@@ -1021,7 +1247,7 @@ static void clip_svp_callback(void *data, int y, int start,
   {
     unsigned char *dst = CLIP_DATA;
     unsigned char *dsta = wi->alpha + clip_x0 + clip_y0 * wi->sx;
-    render_run_t ri;
+    rect_fill_t f;
 
     x0 -= clip_x0;
     x1 -= clip_x0;
@@ -1052,57 +1278,26 @@ static void clip_svp_callback(void *data, int y, int start,
     if (y1 <= y0)
       return;
 
-    ri.dst = dst;
-    ri.r = fill_color[0];
-    ri.g = fill_color[1];
-    ri.b = fill_color[2];
-    ri.a = fill_color[3];
+    f.ri.dst = dst;
+    f.ri.r = fill_color[0];
+    f.ri.g = fill_color[1];
+    f.ri.b = fill_color[2];
+    f.ri.a = fill_color[3];
+    f.width = x1;
+    f.rowstride = wi->bytes_per_line;
     if (wi->has_alpha)
       {
-	ri.dsta = dsta;
-
-	if (fill_color[3] == 255)
-	  {
-	    while (y0 < y1)
-	      {
-		RENDER_RUN_OPAQUE_A(&ri, x1);
-		y0++;
-		ri.dst += wi->bytes_per_line;
-		ri.dsta += wi->sx;
-	      }
-	  }
-	else
-	  {
-	    while (y0 < y1)
-	      {
-		RENDER_RUN_ALPHA_A(&ri, x1);
-		y0++;
-		ri.dst += wi->bytes_per_line;
-		ri.dsta += wi->sx; 
-	      }
-	  }
+	f.ri.dsta = dsta;
+	f.arowstride = wi->sx;
+	f.run = fill_color[3] == 255 ? RENDER_RUN_OPAQUE_A : RENDER_RUN_ALPHA_A;
       }
     else
       {
-	if (fill_color[3] == 255)
-	  {
-	    while (y0 < y1)
-	      {
-		RENDER_RUN_OPAQUE(&ri, x1);
-		y0++;
-		ri.dst += wi->bytes_per_line;
-	      }
-	  }
-	else
-	  {
-	    while (y0 < y1)
-	      {
-		RENDER_RUN_ALPHA(&ri, x1);
-		y0++;
-		ri.dst += wi->bytes_per_line;
-	      }
-	  }
+	f.ri.dsta = NULL;
+	f.arowstride = 0;
+	f.run = fill_color[3] == 255 ? RENDER_RUN_OPAQUE : RENDER_RUN_ALPHA;
       }
+    art_run_band_rows(y1 - y0, x1, rect_fill_rows, &f);
     UPDATE_UNBUFFERED
   }
 }
@@ -1110,20 +1305,27 @@ static void clip_svp_callback(void *data, int y, int start,
 
 /** Stroking **/
 
-/* will free the passed in vpath */
-- (void) _stroke: (ArtVpath *)vp
+static double stroke_scale(NSAffineTransformStruct ts)
 {
   double temp_scale;
-  ArtSVP *svp;
-  NSAffineTransformStruct	ts = [ctm transformStruct];
-  float dash_adjust;
-
 
   /* TODO: this is a hack, but it's better than nothing */
   /* since we flip vertically, the signs here should really be
      inverted, but the fabs() means that it doesn't matter */
   temp_scale = sqrt(fabs(ts.m11 * ts.m22 - ts.m12 * ts.m21));
   if (temp_scale <= 0) temp_scale = 1;
+  return temp_scale;
+}
+
+/* will free the passed in vpath */
+- (ArtSVP *) _stroke_svp: (ArtVpath *)vp
+{
+  double temp_scale;
+  ArtSVP *svp;
+  float dash_adjust;
+
+
+  temp_scale = stroke_scale([ctm transformStruct]);
 
 
   /*
@@ -1292,14 +1494,74 @@ static void clip_svp_callback(void *data, int y, int start,
 			     temp_scale * line_width, miter_limit, 0.5);
   art_free(vp);
 
-  artcontext_render_svp(svp, clip_x0, clip_y0, clip_x1, clip_y1,
+  return svp;
+}
+
+/* will free the passed in vpath */
+- (void) _stroke: (ArtVpath *)vp
+{
+  ArtSVP *svp;
+  const ArtSVP *cached;
+  ArtVpath *key_vp;
+  path_cache_params_t params;
+  int dx, dy, i;
+
+  /* the SVP of the path moved to the origin, see path_cache.h */
+  path_cache_translate(vp, &dx, &dy);
+  memset(&params, 0, sizeof(params));
+  params.kind = PATH_CACHE_STROKE;
+  params.width = line_width;
+  params.scale = stroke_scale([ctm transformStruct]);
+  params.miter_limit = miter_limit;
+  params.join = linejoinstyle;
+  params.cap = linecapstyle;
+  params.stroke_adjust = strokeadjust;
+  if (do_dash)
+    {
+      params.dash_offset = dash.offset;
+      params.num_dash = dash.n_dash;
+      for (i = 0; i < dash.n_dash && i < 8; i++)
+	params.dash[i] = dash.dash[i];
+    }
+
+  svp = NULL;
+  key_vp = NULL;
+  cached = path_cache_enabled() ? path_cache_lookup(&params, vp) : NULL;
+  if (cached)
+    {
+      art_free(vp);
+    }
+  else
+    {
+      /* -_stroke_svp: adjusts and frees the path */
+      if (path_cache_enabled())
+	{
+	  for (i = 0; vp[i].code != ART_END; i++)
+	    ;
+	  key_vp = art_new(ArtVpath, i + 1);
+	  memcpy(key_vp, vp, (i + 1) * sizeof(ArtVpath));
+	}
+      svp = [self _stroke_svp: vp];
+      cached = svp;
+    }
+
+  artcontext_render_svp(cached,
+    clip_x0 - dx, clip_y0 - dy, clip_x1 - dx, clip_y1 - dy,
     stroke_color[0], stroke_color[1], stroke_color[2], stroke_color[3],
     CLIP_DATA, wi->bytes_per_line,
     wi->has_alpha? wi->alpha + clip_x0 + clip_y0 * wi->sx : NULL, wi->sx,
     wi->has_alpha,
     &DI, clip_span, clip_index);
 
-  art_svp_free(svp);
+  if (svp)
+    {
+      if (!key_vp || !path_cache_add(&params, key_vp, svp))
+	art_svp_free(svp);
+      path_cache_log();
+    }
+  if (key_vp)
+    art_free(key_vp);
+
   UPDATE_UNBUFFERED
 }
 
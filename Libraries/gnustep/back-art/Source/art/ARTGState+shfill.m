@@ -34,6 +34,7 @@ this code is rather experimental
 #include "x11/XWindowBuffer.h"
 #endif
 #include "blit.h"
+#include "bands.h"
 
 #include <AppKit/NSAffineTransform.h>
 #include <AppKit/NSGraphics.h>
@@ -546,12 +547,244 @@ static void function_free(function_t *f)
   f->decode = NULL;
 }
 
+/*
+The function of a type 1 shading, as drawn. Its samples are decoded once
+per fill into code values in 8.8 fixed point, and interpolated with 12 bit
+fractions, which gives the values of function_eval_in2_out3() within one
+code value. When the shading isn't rotated, the sample and the fraction of
+each column of the fill are computed once too, and each row only blends
+its two rows of samples.
+*/
+#define LUT_FRAC_BITS 12
+#define LUT_ONE (1 << LUT_FRAC_BITS)
+
+typedef struct {
+  int size[2];
+  int dx, dy;    /* offsets to the next sample, 0 if size is 1 */
+  int *samples; /* size[0] * size[1] * 3 */
+  double domain[4], scale[2], encode[4];
+} shading_lut_t;
+
+static BOOL lut_setup(function_t *f, shading_lut_t *l)
+{
+  int i, c, n;
+  double v;
+
+  for (i = 0; i < 2; i++) {
+    if (f->size[i] < 1 || f->domain[i * 2 + 1] == f->domain[i * 2]) {
+      NSDebugLLog(@"GSArt -shfill", @"Empty Size or Domain.");
+      return NO;
+    }
+    l->size[i] = f->size[i];
+    l->domain[i * 2] = f->domain[i * 2];
+    l->domain[i * 2 + 1] = f->domain[i * 2 + 1];
+    l->scale[i] = 1.0 / (f->domain[i * 2 + 1] - f->domain[i * 2]);
+    l->encode[i * 2] = f->encode[i * 2];
+    l->encode[i * 2 + 1] = f->encode[i * 2 + 1];
+  }
+  l->dx = l->size[0] > 1 ? 3 : 0;
+  l->dy = l->size[1] > 1 ? 3 * l->size[0] : 0;
+
+  n = l->size[0] * l->size[1];
+  l->samples = malloc(sizeof(int) * 3 * n);
+  if (!l->samples) {
+    NSDebugLLog(@"GSArt -shfill", @"Memory allocation failed.");
+    return NO;
+  }
+
+  for (i = 0; i < n; i++) {
+    for (c = 0; c < 3; c++) {
+      v = function_getsample(f, i, c);
+      if (v < 0.0)
+        v = 0.0;
+      if (v > 1.0)
+        v = 1.0;
+      l->samples[i * 3 + c] = v * (255 * 256) + 0.5;
+    }
+  }
+
+  return YES;
+}
+
+/* the sample before input 'in' of dimension 'i', and the fraction to the
+   next one */
+static inline void lut_coordinate(shading_lut_t *l, int i, double in, int *sample, int *frac)
+{
+  double t;
+  int s;
+
+  t = (in - l->domain[i * 2]) * l->scale[i];
+  if (t < 0.0)
+    t = 0.0;
+  if (t > 1.0)
+    t = 1.0;
+
+  t = l->encode[i * 2] + t * (l->encode[i * 2 + 1] - l->encode[i * 2]);
+  s = floor(t);
+  if (s >= l->size[i] - 1)
+    s = l->size[i] - 2;
+  if (s < 0)
+    s = 0;
+
+  t -= s;
+  if (t < 0.0)
+    t = 0.0;
+  if (t > 1.0)
+    t = 1.0;
+
+  *sample = s;
+  *frac = t * LUT_ONE + 0.5;
+}
+
+static inline int lut_lerp(int a, int b, int frac)
+{
+  return a + (((b - a) * frac) >> LUT_FRAC_BITS);
+}
+
+/* everything the bands of a fill need, outside of Objective-C */
+typedef struct {
+  shading_lut_t *lut;
+  BOOL has_alpha;
+
+  /* the rows of the fill, from 'y0': x0 and x1 relative to clip_x0 */
+  int y0;
+  int *rows;
+
+  unsigned char *dst, *dsta; /* at clip_x0, y0 */
+  int bytes_per_line, alpha_per_line;
+
+  int clip_x0, clip_y0;
+  unsigned int *clip_span, *clip_index;
+
+  /* device space to shading space */
+  NSAffineTransformStruct ts;
+  NSPoint offset;
+
+  /* the sample and fraction of each column, if not rotated */
+  int *column_sample, *column_frac;
+} shfill_t;
+
+static void shfill_run(shfill_t *s, int y, int x0, int x1, unsigned char *dst,
+                       unsigned char *dsta)
+{
+  shading_lut_t *l = s->lut;
+  void (*render_run)(render_run_t *ri, int num) =
+      s->has_alpha ? DI.render_run_opaque_a : DI.render_run_opaque;
+  render_run_t ri;
+  int row[s->column_sample ? l->size[0] * 3 : 1];
+  int rgb[3], sample[2], frac[2], n, x, i;
+  const int *a, *b, *c, *d;
+  double in[2], px, py;
+
+  px = s->clip_x0 + x0 - s->offset.x;
+  py = s->offset.y - y;
+  in[0] = s->ts.m11 * px + s->ts.m21 * py + s->ts.tX;
+  in[1] = s->ts.m12 * px + s->ts.m22 * py + s->ts.tY;
+
+  /* the samples of the row, blended once */
+  if (s->column_sample) {
+    lut_coordinate(l, 1, in[1], &sample[1], &frac[1]);
+    a = l->samples + sample[1] * l->size[0] * 3;
+    c = a + l->dy;
+    for (i = 0; i < l->size[0] * 3; i++)
+      row[i] = lut_lerp(a[i], c[i], frac[1]);
+  }
+
+  ri.dst = dst + x0 * DI.bytes_per_pixel;
+  ri.dsta = dsta + x0;
+  ri.a = 255;
+  n = 0;
+  for (x = x0; x < x1; x++) {
+    if (s->column_sample) {
+      a = row + s->column_sample[x] * 3;
+      b = a + l->dx;
+      for (i = 0; i < 3; i++)
+        rgb[i] = lut_lerp(a[i], b[i], s->column_frac[x]) >> 8;
+    } else {
+      lut_coordinate(l, 0, in[0], &sample[0], &frac[0]);
+      lut_coordinate(l, 1, in[1], &sample[1], &frac[1]);
+      a = l->samples + (sample[1] * l->size[0] + sample[0]) * 3;
+      b = a + l->dx;
+      c = a + l->dy;
+      d = c + l->dx;
+      for (i = 0; i < 3; i++)
+        rgb[i] = lut_lerp(lut_lerp(a[i], b[i], frac[0]), lut_lerp(c[i], d[i], frac[0]), frac[1]) >> 8;
+      in[0] += s->ts.m11;
+      in[1] += s->ts.m12;
+    }
+
+    /* pixels of the same color are drawn as one run */
+    if (n && rgb[0] == ri.r && rgb[1] == ri.g && rgb[2] == ri.b) {
+      n++;
+      continue;
+    }
+    if (n) {
+      render_run(&ri, n);
+      ri.dst += n * DI.bytes_per_pixel;
+      ri.dsta += n;
+    }
+    ri.r = rgb[0];
+    ri.g = rgb[1];
+    ri.b = rgb[2];
+    n = 1;
+  }
+  if (n)
+    render_run(&ri, n);
+}
+
+static void shfill_rows(void *data, int first, int last)
+{
+  shfill_t *s = data;
+  unsigned char *dst, *dsta;
+  int i, y, x0, x1;
+
+  for (i = first; i < last; i++) {
+    y = s->y0 + i;
+    x0 = s->rows[i * 2];
+    x1 = s->rows[i * 2 + 1];
+    if (x0 >= x1)
+      continue;
+
+    dst = s->dst + s->bytes_per_line * i;
+    dsta = s->dsta + s->alpha_per_line * i;
+
+    if (!s->clip_span) {
+      shfill_run(s, y, x0, x1, dst, dsta);
+    } else {
+      unsigned int *span, *end;
+      BOOL state = NO;
+
+      span = &s->clip_span[s->clip_index[y - s->clip_y0]];
+      end = &s->clip_span[s->clip_index[y - s->clip_y0 + 1]];
+
+      while (span != end && *span < x0) {
+        state = !state;
+        span++;
+      }
+      while (span != end && *span < x1) {
+        if (state)
+          shfill_run(s, y, x0, *span, dst, dsta);
+        x0 = *span;
+        state = !state;
+        span++;
+      }
+      if (state)
+        shfill_run(s, y, x0, x1, dst, dsta);
+    }
+  }
+}
+
 - (void)DPSshfill:(NSDictionary *)shader
 {
   NSNumber *v;
   NSDictionary *function_dict;
   function_t function;
+  shading_lut_t lut;
+  shfill_t fill;
   NSAffineTransform *matrix, *inverse;
+  rect_trace_t rt;
+  NSRect rect;
+  int y, x0, x1, x, num_rows;
 
   if (!wi || !wi->data || all_clipped)
     return;
@@ -588,6 +821,11 @@ static void function_free(function_t *f)
     return;
   }
 
+  if (!lut_setup(&function, &lut)) {
+    function_free(&function);
+    return;
+  }
+
   matrix = [ctm copy];
   if ([shader objectForKey:@"Matrix"]) {
     [matrix prependTransform:[shader objectForKey:@"Matrix"]];
@@ -596,154 +834,75 @@ static void function_free(function_t *f)
   inverse = [matrix copy];
   [inverse invert];
 
-  {
-    rect_trace_t rt;
-    NSRect rect;
-    int y, x0, x1, x;
-    render_run_t r;
-    unsigned char *dst, *dsta;
-    NSAffineTransformStruct ts;
-    double in[2], out[3];
-    NSPoint p;
-
-    ts = [inverse transformStruct];
-
-    rect.origin.x = function.domain[0];
-    rect.size.width = function.domain[1] - function.domain[0];
-    rect.origin.y = function.domain[2];
-    rect.size.height = function.domain[3] - function.domain[2];
-
-    /*    printf("rect =(%g %g)+(%g %g)\n",
-          rect.origin.x, rect.origin.y,
-          rect.size.width, rect.size.height);*/
-
-    dst = wi->data + wi->bytes_per_line * clip_y0 + clip_x0 * DI.bytes_per_pixel;
-    dsta = wi->alpha + wi->sx * clip_y0 + clip_x0;
-
-    _rect_setup(&rt, rect, clip_x0, clip_x1, matrix, 0, &y, offset);
-
-    while (y < clip_y0) {
-      //      printf("skip initial clip y =%i, %i \n", y, clip_y0);
-      if (!_rect_advance(&rt, &x0, &x1))
-        goto done;
-      //      printf("   %i %i \n", x0, x1);
-      y++;
-    }
-
-    if (y > clip_y0) {
-      dst += wi->bytes_per_line * (y - clip_y0);
-      dsta += wi->sx * (y - clip_y0);
-    }
+  memset(&fill, 0, sizeof(fill));
+  fill.lut = &lut;
+  fill.has_alpha = wi->has_alpha;
+  fill.ts = [inverse transformStruct];
+  fill.offset = offset;
+  fill.clip_x0 = clip_x0;
+  fill.clip_y0 = clip_y0;
+  fill.clip_span = clip_span;
+  fill.clip_index = clip_index;
+  fill.bytes_per_line = wi->bytes_per_line;
+  fill.alpha_per_line = wi->sx;
+
+  rect.origin.x = function.domain[0];
+  rect.size.width = function.domain[1] - function.domain[0];
+  rect.origin.y = function.domain[2];
+  rect.size.height = function.domain[3] - function.domain[2];
+
+  /*    printf("rect =(%g %g)+(%g %g)\n",
+        rect.origin.x, rect.origin.y,
+        rect.size.width, rect.size.height);*/
+
+  _rect_setup(&rt, rect, clip_x0, clip_x1, matrix, 0, &y, offset);
+
+  while (y < clip_y0) {
+    //      printf("skip initial clip y =%i, %i \n", y, clip_y0);
+    if (!_rect_advance(&rt, &x0, &x1))
+      goto done;
+    //      printf("   %i %i \n", x0, x1);
+    y++;
+  }
 
-    while (y < clip_y1 && _rect_advance(&rt, &x0, &x1)) {
-      if (!clip_span) {
-        r.dst = dst + x0 * DI.bytes_per_pixel;
-        r.dsta = dsta + x0;
-
-        p = [inverse transformPoint:NSMakePoint(clip_x0 + x0 - offset.x, offset.y - y)];
-        in[0] = p.x;
-        in[1] = p.y;
-
-        out[0] = out[1] = out[2] = 0.0;
-        for (x = x0; x < x1; x++) {
-          function.eval(&function, in, out);
-          r.r = out[0] * 255;
-          r.g = out[1] * 255;
-          r.b = out[2] * 255;
-          if (wi->has_alpha)
-            DI.render_run_opaque_a(&r, 1);
-          else
-            DI.render_run_opaque(&r, 1);
-          r.dsta++;
-          r.dst += DI.bytes_per_pixel;
-
-          in[0] += ts.m11;
-          in[1] += ts.m12;
-        }
-      } else {
-        unsigned int *span, *end;
-        BOOL state = NO;
-
-        span = &clip_span[clip_index[y - clip_y0]];
-        end = &clip_span[clip_index[y - clip_y0 + 1]];
-
-        while (span != end && *span < x0) {
-          state = !state;
-          span++;
-        }
-        if (span != end) {
-          while (span != end && *span < x1) {
-            if (state) {
-              p = [inverse transformPoint:NSMakePoint(clip_x0 + x0 - offset.x, offset.y - y)];
-
-              in[0] = p.x;
-              in[1] = p.y;
-
-              out[0] = out[1] = out[2] = 0.0;
-              r.dst = dst + x0 * DI.bytes_per_pixel;
-              r.dsta = dsta + x0;
-              for (x = x0; x < *span; x++) {
-                function.eval(&function, in, out);
-                r.r = out[0] * 255;
-                r.g = out[1] * 255;
-                r.b = out[2] * 255;
-                if (wi->has_alpha)
-                  DI.render_run_opaque_a(&r, 1);
-                else
-                  DI.render_run_opaque(&r, 1);
-                r.dsta++;
-                r.dst += DI.bytes_per_pixel;
-
-                in[0] += ts.m11;
-                in[1] += ts.m12;
-              }
-            }
-            x0 = *span;
-
-            state = !state;
-            span++;
-            if (span == end)
-              break;
-          }
-          if (state) {
-            p = [inverse transformPoint:NSMakePoint(clip_x0 + x0 - offset.x, offset.y - y)];
-
-            in[0] = p.x;
-            in[1] = p.y;
-
-            out[0] = out[1] = out[2] = 0.0;
-            r.dst = dst + x0 * DI.bytes_per_pixel;
-            r.dsta = dsta + x0;
-            for (x = x0; x < x1; x++) {
-              function.eval(&function, in, out);
-              r.r = out[0] * 255;
-              r.g = out[1] * 255;
-              r.b = out[2] * 255;
-              if (wi->has_alpha)
-                DI.render_run_opaque_a(&r, 1);
-              else
-                DI.render_run_opaque(&r, 1);
-              r.dsta++;
-              r.dst += DI.bytes_per_pixel;
-
-              in[0] += ts.m11;
-              in[1] += ts.m12;
-            }
-          }
-        }
-      }
+  /* The edges of the rectangle are traced here, the rows are drawn in
+     bands. */
+  fill.y0 = y;
+  fill.rows = malloc(sizeof(int) * 2 * (clip_y1 > y ? clip_y1 - y : 1));
+  if (!fill.rows) {
+    NSDebugLLog(@"GSArt -shfill", @"Memory allocation failed.");
+    goto done;
+  }
+  for (num_rows = 0; y < clip_y1 && _rect_advance(&rt, &x0, &x1); y++, num_rows++) {
+    fill.rows[num_rows * 2] = x0;
+    fill.rows[num_rows * 2 + 1] = x1;
+  }
 
-      y++;
-      dst += wi->bytes_per_line;
-      dsta += wi->sx;
+  fill.dst = wi->data + wi->bytes_per_line * fill.y0 + clip_x0 * DI.bytes_per_pixel;
+  fill.dsta = wi->alpha + wi->sx * fill.y0 + clip_x0;
+
+  /* Not rotated: the samples of the columns don't depend on the row. */
+  if (fill.ts.m12 == 0.0 && fill.ts.m21 == 0.0 && lut.size[0] <= 1024) {
+    fill.column_sample = malloc(sizeof(int) * 2 * (clip_x1 - clip_x0));
+    if (fill.column_sample) {
+      fill.column_frac = fill.column_sample + (clip_x1 - clip_x0);
+      for (x = 0; x < clip_x1 - clip_x0; x++)
+        lut_coordinate(&lut, 0, fill.ts.m11 * (clip_x0 + x - offset.x) + fill.ts.tX,
+                       &fill.column_sample[x], &fill.column_frac[x]);
     }
   }
 
+  art_run_band_rows(num_rows, clip_x1 - clip_x0, shfill_rows, &fill);
+
+  free(fill.column_sample);
+  free(fill.rows);
+
   UPDATE_UNBUFFERED
 
 done:
   DESTROY(matrix);
   DESTROY(inverse);
+  free(lut.samples);
   function_free(&function);
 }
 
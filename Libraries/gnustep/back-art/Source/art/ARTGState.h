@@ -46,6 +46,7 @@
 
 
 @class XWindowBuffer;
+@class NSBitmapImageRep;
 
 
 @interface ARTGState : GSGState
@@ -84,6 +85,10 @@
 	To make things easier, each line also ends in the off state (so the
 	last entry in clip_span might be a dummy entry at the end of the
 	line).
+
+	A clip that is a rectangle has no spans (clip_span is NULL), so it is
+	drawn with the unclipped code; clips are intersected by merging the
+	spans of each line (see -_clip_add_svp:).
 	*/
 	unsigned int *clip_span;
 	unsigned int *clip_index;
@@ -96,6 +101,7 @@
 @interface ARTGState (internal_stuff)
 -(void) GSSetDevice: (gswindow_device_t *)win : (int)x : (int)y;
 -(void) GSCurrentDevice: (void **)device : (int *)x : (int *)y;
+-(BOOL) _image_draw_cached: (NSBitmapImageRep *)bitmap : (NSRect)rect;
 @end
 
 #define UPDATE_UNBUFFERED \
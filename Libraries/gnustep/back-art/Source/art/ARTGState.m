@@ -389,6 +389,14 @@ draw_info_t ART_DI;
   UPDATE_UNBUFFERED
 }
 
+- (void)GSShowGlyphs:(const NSGlyph *)glyphs :(size_t)length
+{
+  NSSize advances[length];
+
+  [(id<FTFontInfo>)font advancementsForGlyphs:glyphs count:length advancements:advances];
+  [self GSShowGlyphsWithAdvances:glyphs :advances :length];
+}
+
 - (void)GSShowGlyphsWithAdvances:(const NSGlyph *)glyphs :(const NSSize *)advances :(size_t)length
 {
   // FIXME: Currently advances is ignored
@@ -687,7 +695,6 @@ typedef struct _SavedClip {
 - (void *)saveClip
 {
   SavedClip *savedClip = malloc(sizeof(SavedClip));
-  int i;
 
   savedClip->clip_x0 = clip_x0;
   savedClip->clip_y0 = clip_y0;
@@ -696,20 +703,26 @@ typedef struct _SavedClip {
   savedClip->all_clipped = all_clipped;
   savedClip->clip_sx = clip_sx;
   savedClip->clip_sy = clip_sy;
-  if (clip_num_span == 0) {
-    savedClip->clip_span = NULL;
-    savedClip->clip_index = NULL;
-  } else {
-    savedClip->clip_span = malloc(sizeof(int) * clip_num_span);
-    savedClip->clip_index = malloc(sizeof(int) * clip_num_span);
-    for (i = 0; i < clip_num_span; i++) {
-      savedClip->clip_span[i] = clip_span[i];
-    }
-    for (i = 0; i < clip_num_span; i++) {
-      savedClip->clip_index[i] = clip_index[i];
+  savedClip->clip_span = NULL;
+  savedClip->clip_index = NULL;
+  savedClip->clip_num_span = 0;
+  if (clip_span) {
+    /* like in -deepen, there is an index entry per row, plus one */
+    savedClip->clip_span = malloc(sizeof(unsigned int) * clip_num_span);
+    savedClip->clip_index = malloc(sizeof(unsigned int) * (clip_sy + 1));
+    if (savedClip->clip_span && savedClip->clip_index) {
+      memcpy(savedClip->clip_span, clip_span, sizeof(unsigned int) * clip_num_span);
+      memcpy(savedClip->clip_index, clip_index, sizeof(unsigned int) * (clip_sy + 1));
+      savedClip->clip_num_span = clip_num_span;
+    } else {
+      /* draw nothing rather than ignore the clip */
+      free(savedClip->clip_span);
+      free(savedClip->clip_index);
+      savedClip->clip_span = NULL;
+      savedClip->clip_index = NULL;
+      savedClip->all_clipped = YES;
     }
   }
-  savedClip->clip_num_span = clip_num_span;
 
   return savedClip;
 }
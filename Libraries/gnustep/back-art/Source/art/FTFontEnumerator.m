@@ -24,6 +24,8 @@
 
 #include <Foundation/NSArray.h>
 #include <Foundation/NSBundle.h>
+#include <Foundation/NSData.h>
+#include <Foundation/NSDate.h>
 #include <Foundation/NSDebug.h>
 #include <Foundation/NSDictionary.h>
 #include <Foundation/NSFileManager.h>
@@ -36,6 +38,13 @@
 #include "FTFontEnumerator.h"
 #include "FTFaceInfo.h"
 
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #if 0
 
 /*
@@ -65,6 +74,11 @@ static NSMutableDictionary *fcfg_allFontFamilies;
 static NSMutableDictionary *fcfg_all_fonts;
 static NSMutableSet *families_seen, *families_pending;
 
+/* The catalogue being built while the font directories are scanned, to be
+   written to the cache (see below). nil if it isn't written. */
+static NSMutableData *catalogue_dirs, *catalogue_faces;
+static uint32_t catalogue_num_dirs, catalogue_num_faces;
+
 static int traits_from_string(NSString *s, unsigned int *traits, unsigned int *weight)
 {
   static struct {
@@ -155,6 +169,406 @@ static NSArray *fix_path(NSString *path, NSArray *files)
   return nfiles;
 }
 
+static void register_face(FTFaceInfo *faceInfo, NSString *fontName, NSString *family,
+                          NSString *faceName)
+{
+  NSArray *a;
+  NSMutableArray *ma;
+
+  [fcfg_all_fonts setObject:faceInfo forKey:fontName];
+  [fcfg_allFontNames addObject:fontName];
+
+  a = [NSArray arrayWithObjects:fontName, faceName, [NSNumber numberWithInt:faceInfo->weight],
+                                [NSNumber numberWithUnsignedInt:faceInfo->traits], nil];
+  ma = [fcfg_allFontFamilies objectForKey:family];
+  if (!ma) {
+    ma = [[NSMutableArray alloc] init];
+    [fcfg_allFontFamilies setObject:ma forKey:family];
+    [ma release];
+  }
+  [ma addObject:a];
+}
+
+/*
+The font catalogue cache.
+
+Scanning the font directories means parsing the FontInfo.plist of every
+.nfont package, on each launch of each application. The result of the scan
+is therefore written to a binary file in the user's caches directory, which
+later launches map and read back without parsing any property list.
+
+The catalogue is only used if the Fonts directories are the same, and if
+they and every FontInfo.plist that was read still have the modification
+times they had when it was built: adding or removing a package changes
+the time of its directory, and editing a FontInfo.plist changes its own.
+The face names must also have been localized for the same languages.
+
+All the numbers are 32 bits in the byte order of the machine, except the
+modification times, which are 64 bits. A string is its length in UTF-8
+bytes (0xffffffff for nil) followed by the bytes; an array of strings is
+its count (0xffffffff for nil) followed by the strings.
+
+  header:  "FTFCAT1\0", 0x01020304, scan time in microseconds (64 bits),
+           Fonts directories and languages (string)
+  dirs:    count, then for each: path (string), seconds, nanoseconds
+           (both -1 if the path doesn't exist)
+  faces:   count, then for each: PostScript name, family, FTFaceInfo
+           family name, face name, FTFaceInfo face name, display name
+           (strings), files (array), weight, traits, number of sizes,
+           then for each size: pixel size, files (array)
+*/
+
+#define CATALOGUE_MAGIC "FTFCAT1"
+#define CATALOGUE_NIL 0xffffffff
+
+static NSString *catalogue_path(void)
+{
+  NSArray *paths = NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES);
+
+  if (![paths count])
+    return nil;
+  return [[paths objectAtIndex:0] stringByAppendingPathComponent:@"FTFontCatalogue"];
+}
+
+/* what the catalogue depends on besides modification times: the font
+   directories and the languages for localizing face names */
+static NSString *catalogue_key(NSArray *font_dirs)
+{
+  NSArray *lang = [[NSUserDefaults standardUserDefaults] stringArrayForKey:@"NSLanguages"];
+
+  return [NSString stringWithFormat:@"%@\n\n%@", [font_dirs componentsJoinedByString:@"\n"],
+                                    lang ? [lang componentsJoinedByString:@"\n"] : @""];
+}
+
+static void catalogue_put_int(NSMutableData *d, uint32_t i)
+{
+  [d appendBytes:&i length:sizeof(i)];
+}
+
+static void catalogue_put_time(NSMutableData *d, int64_t t)
+{
+  [d appendBytes:&t length:sizeof(t)];
+}
+
+static void catalogue_put_string(NSMutableData *d, NSString *s)
+{
+  const char *utf8;
+  uint32_t length;
+
+  if (!s) {
+    catalogue_put_int(d, CATALOGUE_NIL);
+    return;
+  }
+  utf8 = [s UTF8String];
+  length = strlen(utf8);
+  catalogue_put_int(d, length);
+  [d appendBytes:utf8 length:length];
+}
+
+static void catalogue_put_strings(NSMutableData *d, NSArray *a)
+{
+  int i, c = [a count];
+
+  if (!a) {
+    catalogue_put_int(d, CATALOGUE_NIL);
+    return;
+  }
+  catalogue_put_int(d, c);
+  for (i = 0; i < c; i++)
+    catalogue_put_string(d, [a objectAtIndex:i]);
+}
+
+/* records the modification time of 'path', which the catalogue depends on */
+static void catalogue_put_dir(NSString *path)
+{
+  struct stat st;
+
+  if (!catalogue_dirs)
+    return;
+  catalogue_put_string(catalogue_dirs, path);
+  if (stat([path fileSystemRepresentation], &st) == 0) {
+    catalogue_put_time(catalogue_dirs, st.st_mtim.tv_sec);
+    catalogue_put_time(catalogue_dirs, st.st_mtim.tv_nsec);
+  } else {
+    catalogue_put_time(catalogue_dirs, -1);
+    catalogue_put_time(catalogue_dirs, -1);
+  }
+  catalogue_num_dirs++;
+}
+
+static void catalogue_put_face(FTFaceInfo *faceInfo, NSString *fontName, NSString *family,
+                               NSString *faceName)
+{
+  NSMutableData *d = catalogue_faces;
+  int i;
+
+  catalogue_put_string(d, fontName);
+  catalogue_put_string(d, family);
+  catalogue_put_string(d, faceInfo->familyName);
+  catalogue_put_string(d, faceName);
+  catalogue_put_string(d, faceInfo->faceName);
+  catalogue_put_string(d, faceInfo->displayName);
+  catalogue_put_strings(d, faceInfo->files);
+  catalogue_put_int(d, faceInfo->weight);
+  catalogue_put_int(d, faceInfo->traits);
+  catalogue_put_int(d, faceInfo->num_sizes);
+  for (i = 0; i < faceInfo->num_sizes; i++) {
+    catalogue_put_int(d, faceInfo->sizes[i].pixel_size);
+    catalogue_put_strings(d, faceInfo->sizes[i].files);
+  }
+  catalogue_num_faces++;
+}
+
+static void catalogue_write(NSString *path, NSArray *font_dirs, NSTimeInterval scan_time)
+{
+  NSMutableData *d = [NSMutableData data];
+  int64_t usec = scan_time * 1e6;
+
+  [d appendBytes:CATALOGUE_MAGIC length:sizeof(CATALOGUE_MAGIC)];
+  catalogue_put_int(d, 0x01020304);
+  catalogue_put_time(d, usec);
+  catalogue_put_string(d, catalogue_key(font_dirs));
+  catalogue_put_int(d, catalogue_num_dirs);
+  [d appendData:catalogue_dirs];
+  catalogue_put_int(d, catalogue_num_faces);
+  [d appendData:catalogue_faces];
+
+  [[NSFileManager defaultManager] createDirectoryAtPath:[path stringByDeletingLastPathComponent]
+                            withIntermediateDirectories:YES
+                                             attributes:nil
+                                                  error:NULL];
+  if (![d writeToFile:path atomically:YES])
+    NSDebugLLog(@"ftfont-cache", @"couldn't write the font catalogue to %@", path);
+}
+
+/* a bounds checked cursor in the mapped catalogue */
+typedef struct {
+  const unsigned char *p, *end;
+  BOOL bad;
+} catalogue_reader_t;
+
+static const unsigned char *catalogue_get(catalogue_reader_t *r, size_t size)
+{
+  const unsigned char *p = r->p;
+
+  if (r->bad || (size_t)(r->end - r->p) < size) {
+    r->bad = YES;
+    return NULL;
+  }
+  r->p += size;
+  return p;
+}
+
+static uint32_t catalogue_get_int(catalogue_reader_t *r)
+{
+  const unsigned char *p = catalogue_get(r, sizeof(uint32_t));
+  uint32_t i = 0;
+
+  if (p)
+    memcpy(&i, p, sizeof(i));
+  return i;
+}
+
+static int64_t catalogue_get_time(catalogue_reader_t *r)
+{
+  const unsigned char *p = catalogue_get(r, sizeof(int64_t));
+  int64_t t = 0;
+
+  if (p)
+    memcpy(&t, p, sizeof(t));
+  return t;
+}
+
+/* returns a new string if 'build', or nil */
+static NSString *catalogue_get_string(catalogue_reader_t *r, BOOL build)
+{
+  uint32_t length = catalogue_get_int(r);
+  const unsigned char *p;
+
+  if (length == CATALOGUE_NIL)
+    return nil;
+  p = catalogue_get(r, length);
+  if (!p || !build)
+    return nil;
+  return [[NSString alloc] initWithBytes:p length:length encoding:NSUTF8StringEncoding];
+}
+
+static NSArray *catalogue_get_strings(catalogue_reader_t *r, BOOL build)
+{
+  uint32_t i, count = catalogue_get_int(r);
+  NSMutableArray *a;
+  NSString *s;
+
+  if (count == CATALOGUE_NIL)
+    return nil;
+  a = build ? [[NSMutableArray alloc] initWithCapacity:count] : nil;
+  for (i = 0; i < count && !r->bad; i++) {
+    s = catalogue_get_string(r, build);
+    if (s) {
+      [a addObject:s];
+      [s release];
+    }
+  }
+  return a;
+}
+
+/*
+Reads the faces of the catalogue. With 'build' NO it only checks that they
+are all there, so that no FTFaceInfo (which are never deallocated) is
+created from a damaged file.
+*/
+static BOOL catalogue_read_faces(catalogue_reader_t *r, BOOL build)
+{
+  uint32_t n, i, j, num_sizes;
+  FTFaceInfo *faceInfo = nil;
+  NSString *fontName, *family, *faceName;
+
+  n = catalogue_get_int(r);
+  for (i = 0; i < n && !r->bad; i++) {
+    NSString *familyName, *infoFaceName, *displayName;
+    NSArray *files;
+    int weight;
+    unsigned int traits;
+
+    fontName = catalogue_get_string(r, build);
+    family = catalogue_get_string(r, build);
+    familyName = catalogue_get_string(r, build);
+    faceName = catalogue_get_string(r, build);
+    infoFaceName = catalogue_get_string(r, build);
+    displayName = catalogue_get_string(r, build);
+    files = catalogue_get_strings(r, build);
+    weight = catalogue_get_int(r);
+    traits = catalogue_get_int(r);
+    num_sizes = catalogue_get_int(r);
+
+    /* a size takes 8 bytes at least */
+    if (num_sizes > (size_t)(r->end - r->p) / (2 * sizeof(uint32_t)))
+      r->bad = YES;
+
+    if (build) {
+      faceInfo = [[FTFaceInfo alloc] init];
+      faceInfo->familyName = familyName;
+      faceInfo->faceName = infoFaceName;
+      faceInfo->displayName = displayName;
+      faceInfo->files = files;
+      faceInfo->weight = weight;
+      faceInfo->traits = traits;
+      if (num_sizes && !r->bad) {
+        faceInfo->num_sizes = num_sizes;
+        faceInfo->sizes = malloc(sizeof(faceInfo->sizes[0]) * num_sizes);
+      }
+    }
+
+    for (j = 0; j < num_sizes && !r->bad; j++) {
+      int pixel_size = catalogue_get_int(r);
+      NSArray *size_files = catalogue_get_strings(r, build);
+
+      if (build) {
+        faceInfo->sizes[j].pixel_size = pixel_size;
+        faceInfo->sizes[j].files = size_files;
+      }
+    }
+
+    if (build) {
+      register_face(faceInfo, fontName, family, faceName);
+      [fontName release];
+      [family release];
+      [faceName release];
+      DESTROY(faceInfo);
+    }
+  }
+  return !r->bad && r->p == r->end;
+}
+
+/* loads the catalogue at 'path' if it's up to date, and returns the scan
+   time it saves, or a negative number */
+static NSTimeInterval catalogue_load(NSString *path, NSArray *font_dirs)
+{
+  catalogue_reader_t r;
+  struct stat st;
+  size_t size;
+  void *map;
+  int fd;
+  uint32_t n, i;
+  int64_t usec = -1;
+  NSString *s;
+
+  fd = open([path fileSystemRepresentation], O_RDONLY);
+  if (fd < 0)
+    return -1;
+  if (fstat(fd, &st) || st.st_size < (off_t)sizeof(CATALOGUE_MAGIC)) {
+    close(fd);
+    return -1;
+  }
+  size = st.st_size;
+  map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return -1;
+
+  r.p = map;
+  r.end = r.p + size;
+  r.bad = NO;
+
+  if (memcmp(catalogue_get(&r, sizeof(CATALOGUE_MAGIC)), CATALOGUE_MAGIC,
+             sizeof(CATALOGUE_MAGIC)) ||
+      catalogue_get_int(&r) != 0x01020304) {
+    NSDebugLLog(@"ftfont-cache", @"%@ isn't a font catalogue of this machine", path);
+    goto done;
+  }
+  usec = catalogue_get_time(&r);
+
+  s = catalogue_get_string(&r, YES);
+  if (![s isEqualToString:catalogue_key(font_dirs)]) {
+    NSDebugLLog(@"ftfont-cache",
+                @"the font directories or languages have changed since the font catalogue was built");
+    [s release];
+    usec = -1;
+    goto done;
+  }
+  [s release];
+
+  n = catalogue_get_int(&r);
+  for (i = 0; i < n && !r.bad; i++) {
+    int64_t sec, nsec;
+    BOOL changed;
+
+    s = catalogue_get_string(&r, YES);
+    sec = catalogue_get_time(&r);
+    nsec = catalogue_get_time(&r);
+    if (!s)
+      r.bad = YES;
+    if (r.bad)
+      break;
+    if (stat([s fileSystemRepresentation], &st) == 0)
+      changed = st.st_mtim.tv_sec != sec || st.st_mtim.tv_nsec != nsec;
+    else
+      changed = sec != -1;
+    if (changed) {
+      NSDebugLLog(@"ftfont-cache", @"%@ has changed since the font catalogue was built", s);
+      [s release];
+      usec = -1;
+      goto done;
+    }
+    [s release];
+  }
+
+  {
+    catalogue_reader_t faces = r;
+
+    if (r.bad || !catalogue_read_faces(&faces, NO)) {
+      NSDebugLLog(@"ftfont-cache", @"%@ is damaged", path);
+      usec = -1;
+      goto done;
+    }
+    catalogue_read_faces(&r, YES);
+  }
+
+done:
+  munmap(map, size);
+  return usec < 0 ? -1 : usec / 1e6;
+}
+
 /* TODO: handling of .font packages needs to be reworked */
 static void add_face(NSString *family, int family_weight, unsigned int family_traits,
                      NSDictionary *d, NSString *path, BOOL from_nfont)
@@ -260,22 +674,9 @@ static void add_face(NSString *family, int family_weight, unsigned int family_tr
 
   NSDebugLLog(@"ftfont", @"adding '%@' '%@'", fontName, faceInfo);
 
-  [fcfg_all_fonts setObject:faceInfo forKey:fontName];
-  [fcfg_allFontNames addObject:fontName];
-
-  {
-    NSArray *a;
-    NSMutableArray *ma;
-    a = [NSArray arrayWithObjects:fontName, faceName, [NSNumber numberWithInt:weight],
-                                  [NSNumber numberWithUnsignedInt:traits], nil];
-    ma = [fcfg_allFontFamilies objectForKey:family];
-    if (!ma) {
-      ma = [[NSMutableArray alloc] init];
-      [fcfg_allFontFamilies setObject:ma forKey:family];
-      [ma release];
-    }
-    [ma addObject:a];
-  }
+  register_face(faceInfo, fontName, family, faceName);
+  if (catalogue_faces)
+    catalogue_put_face(faceInfo, fontName, family, faceName);
 
   DESTROY(faceInfo);
 }
@@ -289,18 +690,39 @@ static void load_font_configuration(void)
   NSArray *files;
   NSDictionary *d;
   NSArray *faces;
+  NSMutableArray *font_dirs;
+  NSString *catalogue;
+  NSTimeInterval start = [NSDate timeIntervalSinceReferenceDate], saved;
 
   fcfg_all_fonts = [[NSMutableDictionary alloc] init];
   fcfg_allFontFamilies = [[NSMutableDictionary alloc] init];
   fcfg_allFontNames = [[NSMutableArray alloc] init];
 
+  paths = NSSearchPathForDirectoriesInDomains(NSLibraryDirectory, NSAllDomainsMask, YES);
+  font_dirs = [NSMutableArray arrayWithCapacity:[paths count]];
+  for (i = 0; i < [paths count]; i++)
+    [font_dirs addObject:[[paths objectAtIndex:i] stringByAppendingPathComponent:@"Fonts"]];
+
+  catalogue = catalogue_path();
+  if (catalogue && (saved = catalogue_load(catalogue, font_dirs)) >= 0) {
+    NSDebugLLog(@"ftfont-cache", @"read %lu fonts from %@ in %.1f ms, scanning took %.1f ms",
+                [fcfg_allFontNames count], catalogue,
+                ([NSDate timeIntervalSinceReferenceDate] - start) * 1000, saved * 1000);
+    goto loaded;
+  }
+
+  if (catalogue) {
+    catalogue_dirs = [[NSMutableData alloc] init];
+    catalogue_faces = [[NSMutableData alloc] init];
+    catalogue_num_dirs = catalogue_num_faces = 0;
+  }
+
   families_seen = [[NSMutableSet alloc] init];
   families_pending = [[NSMutableSet alloc] init];
 
-  paths = NSSearchPathForDirectoriesInDomains(NSLibraryDirectory, NSAllDomainsMask, YES);
-  for (i = 0; i < [paths count]; i++) {
-    path = [paths objectAtIndex:i];
-    path = [path stringByAppendingPathComponent:@"Fonts"];
+  for (i = 0; i < [font_dirs count]; i++) {
+    path = [font_dirs objectAtIndex:i];
+    catalogue_put_dir(path);
     files = [fm directoryContentsAtPath:path];
     c = [files count];
 
@@ -329,6 +751,7 @@ static void load_font_configuration(void)
       NSDebugLLog(@"ftfont", @"loading %@", font_path);
 
       font_info_path = [font_path stringByAppendingPathComponent:@"FontInfo.plist"];
+      catalogue_put_dir(font_info_path);
       if (![fm fileExistsAtPath:font_info_path])
         continue;
       d = [NSDictionary dictionaryWithContentsOfFile:font_info_path];
@@ -382,6 +805,19 @@ static void load_font_configuration(void)
     [families_pending removeAllObjects];
   }
 
+  DESTROY(families_seen);
+  DESTROY(families_pending);
+
+  if (catalogue) {
+    saved = [NSDate timeIntervalSinceReferenceDate] - start;
+    catalogue_write(catalogue, font_dirs, saved);
+    NSDebugLLog(@"ftfont-cache", @"scanned the font directories in %.1f ms, wrote %@",
+                saved * 1000, catalogue);
+    DESTROY(catalogue_dirs);
+    DESTROY(catalogue_faces);
+  }
+
+loaded:
   NSDebugLLog(@"ftfont", @"got %lu fonts in %lu families", [fcfg_allFontNames count],
               [fcfg_allFontFamilies count]);
 
@@ -389,9 +825,6 @@ static void load_font_configuration(void)
     NSLog(@"No fonts found!");
     exit(1);
   }
-
-  DESTROY(families_seen);
-  DESTROY(families_pending);
 }
 
 @implementation FTFontEnumerator
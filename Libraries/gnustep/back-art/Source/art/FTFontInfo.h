@@ -97,9 +97,23 @@
 
 - (void)outlineString:(const char *)s at:(CGFloat)x :(CGFloat)y gstate:(void *)func_param;
 
+/* -advancementForGlyph: of 'count' glyphs at once */
+- (void)advancementsForGlyphs:(const NSGlyph *)glyphs
+                        count:(int)count
+                 advancements:(NSSize *)advancements;
+
 @end
 
-#define CACHE_SIZE 257
+/* The metrics tables are split in pages of glyphs (or characters), which
+   are allocated and filled as they are used. */
+#define GLYPH_PAGE_SHIFT 8
+#define GLYPH_PAGE_SIZE (1 << GLYPH_PAGE_SHIFT)
+#define GLYPH_PAGE_MASK (GLYPH_PAGE_SIZE - 1)
+
+typedef struct {
+  unsigned int known[GLYPH_PAGE_SIZE / 32];
+  NSSize advancement[GLYPH_PAGE_SIZE];
+} glyph_metrics_page_t;
 
 @interface FTFontInfo : GSFontInfo <FTFontInfo>
 {
@@ -124,11 +138,14 @@
 
   /*
     Profiling (2003-11-14) shows that calls to -advancementForGlyph: accounted
-    for roughly 20% of layout time. This cache reduces it to (currently)
-    insignificant levels.
+    for roughly 20% of layout time. The advancements of all the glyphs of the
+    face are kept here, and the glyphs of the characters of the BMP (~0 for
+    the ones not looked up yet), so that layout doesn't call FreeType for the
+    glyphs it has already measured.
   */
-  unsigned int cachedGlyph[CACHE_SIZE];
-  NSSize cachedSize[CACHE_SIZE];
+  glyph_metrics_page_t **metricsPages;
+  unsigned int numMetricsPages;
+  unsigned int *characterPages[65536 / GLYPH_PAGE_SIZE];
 
   CGFloat lineHeight;
 }
@@ -22,6 +22,7 @@
    Boston, MA 02110-1301, USA.
 */
 
+#include <limits.h>
 #include <math.h>
 
 #import <Foundation/NSArray.h>
@@ -45,6 +46,7 @@
 
 #import "FTFontEnumerator.h"
 #import "FTFontInfo.h"
+#import "FTGlyphRunCache.h"
 
 #define DI (*di)
 
@@ -110,8 +112,200 @@ static int filters[3][7] = {{0 * 65536 / 9, 1 * 65536 / 9, 2 * 65536 / 9, 3 * 65
 
 + (void)initializeBackend
 {
+  NSUserDefaults *ud = [NSUserDefaults standardUserDefaults];
+
   [GSFontEnumerator setDefaultClass:[FTFontEnumerator class]];
   [GSFontInfo setDefaultClass:[FTFontInfo class]];
+
+  /* in kilobytes, 0 disables it */
+  if ([ud objectForKey:@"back-art-glyph-run-cache"])
+    glyph_run_cache_set_limit([ud integerForKey:@"back-art-glyph-run-cache"] * 1024);
+}
+
+/*
+The glyph run cache (see FTGlyphRunCache.h). Runs are only composed from
+anti-aliased sbits; if a glyph is monochrome or can't be looked up, the run
+is drawn glyph by glyph, which also reports the errors.
+*/
+- (glyph_run_t *)_lookupGlyphRun:(int)kind key:(const void *)key :(int)key_length
+{
+  return glyph_run_cache_lookup(ftc_imagetype.face_id, ftc_imagetype.width, ftc_imagetype.height,
+                                ftc_imagetype.flags, kind, key, key_length);
+}
+
+- (glyph_run_t *)_addGlyphRun:(int)kind
+                          key:(const void *)key
+                             :(int)key_length
+                       glyphs:(const unsigned int *)glyphs
+                             :(int)length
+{
+  FTC_SBit sbit;
+  glyph_run_t *run;
+  int i, x, y, pen;
+  int left = INT_MAX, right = INT_MIN, top = INT_MIN, bottom = INT_MAX;
+
+  /* The sbits may be flushed by the following lookups, so the run is
+     measured first and then composed with a second lookup. */
+  for (i = 0, pen = 0; i < length; i++) {
+    if (FTC_SBitCache_Lookup(ftc_sbitcache, &ftc_imagetype, glyphs[i], &sbit, NULL))
+      return NULL;
+    if (sbit->buffer) {
+      if (sbit->format != ft_pixel_mode_grays)
+        return NULL;
+      left = MIN(left, pen + sbit->left);
+      right = MAX(right, pen + sbit->left + sbit->width);
+      top = MAX(top, sbit->top);
+      bottom = MIN(bottom, sbit->top - sbit->height);
+    }
+    pen += sbit->xadvance;
+  }
+  if (left > right)
+    left = right = top = bottom = 0;
+
+  run = glyph_run_cache_add(ftc_imagetype.face_id, ftc_imagetype.width, ftc_imagetype.height,
+                            ftc_imagetype.flags, kind, key, key_length, left, top, right - left,
+                            top - bottom);
+  if (!run)
+    return NULL;
+
+  /* Overlapping glyphs are combined like drawing them one after the other
+     would: a + b - a * b. */
+  for (i = 0, pen = 0; i < length; i++) {
+    if (FTC_SBitCache_Lookup(ftc_sbitcache, &ftc_imagetype, glyphs[i], &sbit, NULL)) {
+      glyph_run_cache_remove(run);
+      return NULL;
+    }
+    if (sbit->buffer) {
+      const unsigned char *src = sbit->buffer;
+      unsigned char *dst = run->mask + (top - sbit->top) * run->width + pen + sbit->left - left;
+
+      for (y = 0; y < sbit->height; y++, src += sbit->pitch, dst += run->width) {
+        for (x = 0; x < sbit->width; x++) {
+          unsigned int a = dst[x], b = src[x], t;
+
+          if (!a)
+            dst[x] = b;
+          else if (b) {
+            t = a * b + 0x80;
+            dst[x] = a + b - ((t + (t >> 8)) >> 8);
+          }
+        }
+      }
+    }
+    pen += sbit->xadvance;
+  }
+
+  if (GSDebugSet(@"ftfont-runs")) {
+    unsigned long hits, misses, evictions;
+    size_t memory;
+
+    glyph_run_cache_statistics(&hits, &misses, &evictions, &memory);
+    NSDebugLLog(@"ftfont-runs", @"%@: added a %ix%i run of %i glyphs; %lu hits, %lu misses, %lu "
+                @"evictions, %lu bytes",
+                fontName, run->width, run->height, length, hits, misses, evictions,
+                (unsigned long)memory);
+  }
+
+  return run;
+}
+
+/* Decodes the UTF-8 character at *c, and leaves *c at its last byte. */
+static unsigned int utf8_character(const unsigned char **pc)
+{
+  const unsigned char *c = *pc;
+  unsigned char ch;
+  unsigned int uch;
+
+  ch = *c;
+  if (ch < 0x80) {
+    uch = ch;
+  } else if (ch < 0xc0) {
+    uch = 0xfffd;
+  } else if (ch < 0xe0) {
+#define ADD_UTF_BYTE(shift, internal) \
+  ch = *++c;                          \
+  if (ch >= 0x80 && ch < 0xc0) {      \
+    uch |= (ch & 0x3f) << shift;      \
+    internal                          \
+  } else {                            \
+    uch = 0xfffd;                     \
+    c--;                              \
+  }
+
+    uch = (ch & 0x1f) << 6;
+    ADD_UTF_BYTE(0, )
+  } else if (ch < 0xf0) {
+    uch = (ch & 0x0f) << 12;
+    ADD_UTF_BYTE(6, ADD_UTF_BYTE(0, ))
+  } else if (ch < 0xf8) {
+    uch = (ch & 0x07) << 18;
+    ADD_UTF_BYTE(12, ADD_UTF_BYTE(6, ADD_UTF_BYTE(0, )))
+  } else if (ch < 0xfc) {
+    uch = (ch & 0x03) << 24;
+    ADD_UTF_BYTE(18, ADD_UTF_BYTE(12, ADD_UTF_BYTE(6, ADD_UTF_BYTE(0, ))))
+  } else if (ch < 0xfe) {
+    uch = (ch & 0x01) << 30;
+    ADD_UTF_BYTE(24, ADD_UTF_BYTE(18, ADD_UTF_BYTE(12, ADD_UTF_BYTE(6, ADD_UTF_BYTE(0, )))))
+  } else {
+    uch = 0xfffd;
+  }
+#undef ADD_UTF_BYTE
+
+  *pc = c;
+  return uch;
+}
+
+/* Draws the mask of a run with one blit per row, clipped like the glyphs
+   in -drawString:... */
+static void draw_glyph_run(glyph_run_t *run, int x, int y, int x1, int y1, unsigned char *buf,
+                           int bpl, unsigned char *abuf, int abpl, unsigned char r, unsigned char g,
+                           unsigned char b, unsigned char alpha, draw_info_t *di)
+{
+  int gx = x + run->left, gy = y - run->top;
+  int sx = run->width, sy = run->height;
+  const unsigned char *src = run->mask;
+  unsigned char *dst = buf;
+  unsigned char *adst = abuf;
+
+  if (gy < 0) {
+    sy += gy;
+    src -= run->width * gy;
+    gy = 0;
+  } else if (gy > 0) {
+    dst += bpl * gy;
+    adst += abpl * gy;
+  }
+
+  sy += gy;
+  if (sy > y1)
+    sy = y1;
+
+  if (gx < 0) {
+    sx += gx;
+    src -= gx;
+    gx = 0;
+  } else if (gx > 0) {
+    dst += DI.bytes_per_pixel * gx;
+    adst += gx;
+  }
+
+  sx += gx;
+  if (sx > x1)
+    sx = x1;
+  sx -= gx;
+
+  if (sx <= 0)
+    return;
+
+  if (abuf)
+    for (; gy < sy; gy++, src += run->width, dst += bpl, adst += abpl)
+      RENDER_BLIT_ALPHA_A(dst, adst, src, r, g, b, alpha, sx);
+  else if (alpha >= 255)
+    for (; gy < sy; gy++, src += run->width, dst += bpl)
+      RENDER_BLIT_ALPHA_OPAQUE(dst, src, r, g, b, sx);
+  else
+    for (; gy < sy; gy++, src += run->width, dst += bpl)
+      RENDER_BLIT_ALPHA(dst, src, r, g, b, alpha, sx);
 }
 
 - (void)_initFontCaches
@@ -302,18 +496,57 @@ static int filters[3][7] = {{0 * 65536 / 9, 1 * 65536 / 9, 2 * 65536 / 9, 3 * 65
     ftc_imagetype.flags = FT_LOAD_TARGET_LIGHT;
   }
 
-  /*
-    Here, we simply need to make sure that we don't get any false matches
-    the first time a particular cache entry is used. Thus, we only need to
-    initialize the first entry. For all other entries, cachedGlyph[i] will
-    be 0, and that's a glyph that can't possibly hash to any entry except
-    entry #0, so it won't cause any false matches.
-  */
-  cachedGlyph[0] = 1;
+  /* without the table, the metrics are loaded for every glyph */
+  numMetricsPages = 0;
+  if (ft_size->face != nil) {
+    unsigned int n = (ft_size->face->num_glyphs + GLYPH_PAGE_MASK) >> GLYPH_PAGE_SHIFT;
+
+    metricsPages = calloc(n, sizeof(glyph_metrics_page_t *));
+    if (metricsPages)
+      numMetricsPages = n;
+  }
 
   return self;
 }
 
+- (void)dealloc
+{
+  unsigned int i;
+
+  for (i = 0; i < numMetricsPages; i++)
+    free(metricsPages[i]);
+  free(metricsPages);
+  for (i = 0; i < sizeof(characterPages) / sizeof(characterPages[0]); i++)
+    free(characterPages[i]);
+
+  [super dealloc];
+}
+
+/* The glyph index (not NSGlyph) of a character, 0 if it has none. */
+- (unsigned int)_glyphForCharacter:(unsigned int)ch
+{
+  unsigned int *page, glyph;
+
+  if (ch >= 65536)
+    return FTC_CMapCache_Lookup(ftc_cmapcache, ftc_faceid, unicodeCmap, ch);
+
+  page = characterPages[ch >> GLYPH_PAGE_SHIFT];
+  if (!page) {
+    page = malloc(GLYPH_PAGE_SIZE * sizeof(unsigned int));
+    if (!page)
+      return FTC_CMapCache_Lookup(ftc_cmapcache, ftc_faceid, unicodeCmap, ch);
+    memset(page, 0xff, GLYPH_PAGE_SIZE * sizeof(unsigned int));
+    characterPages[ch >> GLYPH_PAGE_SHIFT] = page;
+  }
+
+  glyph = page[ch & GLYPH_PAGE_MASK];
+  if (glyph == ~0U) {
+    glyph = FTC_CMapCache_Lookup(ftc_cmapcache, ftc_faceid, unicodeCmap, ch);
+    page[ch & GLYPH_PAGE_MASK] = glyph;
+  }
+  return glyph;
+}
+
 - (NSString *)displayName
 {
   return faceInfo->displayName;
@@ -420,7 +653,6 @@ static int filters[3][7] = {{0 * 65536 / 9, 1 * 65536 / 9, 2 * 65536 / 9, 3 * 65
           drawinfo:(draw_info_t *)di
 {
   const unsigned char *c;
-  unsigned char ch;
   unsigned int uch;
   int d;
 
@@ -500,47 +732,32 @@ static int filters[3][7] = {{0 * 65536 / 9, 1 * 65536 / 9, 2 * 65536 / 9, 3 * 65
     }
   }
 
+  if (use_sbit && !delta_flags && *s && glyph_run_cache_enabled()) {
+    int key_length = strlen(s);
+    glyph_run_t *run = [self _lookupGlyphRun:GLYPH_RUN_STRING key:s:key_length];
+
+    if (!run && key_length <= GLYPH_RUN_MAX_LENGTH) {
+      unsigned int run_glyphs[key_length];
+      int n = 0;
+
+      for (c = (const unsigned char *)s; *c; c++)
+        run_glyphs[n++] = [self _glyphForCharacter:utf8_character(&c)];
+      run = [self _addGlyphRun:GLYPH_RUN_STRING key:s:key_length glyphs:run_glyphs:n];
+    }
+    if (run) {
+      draw_glyph_run(run, x, y, x1, y1, buf, bpl, NULL, 0, r, g, b, alpha, di);
+      return;
+    }
+  }
+
   /*        NSLog(@"drawString: '%s' at: %i:%i  to: %i:%i:%i:%i:%p",
                   s, x, y, x0, y0, x1, y1, buf);*/
   d = 0;
   for (c = (const unsigned char *)s; *c; c++) {
     /* TODO: do the same thing in outlineString:... */
-    ch = *c;
-    if (ch < 0x80) {
-      uch = ch;
-    } else if (ch < 0xc0) {
-      uch = 0xfffd;
-    } else if (ch < 0xe0) {
-#define ADD_UTF_BYTE(shift, internal) \
-  ch = *++c;                          \
-  if (ch >= 0x80 && ch < 0xc0) {      \
-    uch |= (ch & 0x3f) << shift;      \
-    internal                          \
-  } else {                            \
-    uch = 0xfffd;                     \
-    c--;                              \
-  }
+    uch = utf8_character(&c);
 
-      uch = (ch & 0x1f) << 6;
-      ADD_UTF_BYTE(0, )
-    } else if (ch < 0xf0) {
-      uch = (ch & 0x0f) << 12;
-      ADD_UTF_BYTE(6, ADD_UTF_BYTE(0, ))
-    } else if (ch < 0xf8) {
-      uch = (ch & 0x07) << 18;
-      ADD_UTF_BYTE(12, ADD_UTF_BYTE(6, ADD_UTF_BYTE(0, )))
-    } else if (ch < 0xfc) {
-      uch = (ch & 0x03) << 24;
-      ADD_UTF_BYTE(18, ADD_UTF_BYTE(12, ADD_UTF_BYTE(6, ADD_UTF_BYTE(0, ))))
-    } else if (ch < 0xfe) {
-      uch = (ch & 0x01) << 30;
-      ADD_UTF_BYTE(24, ADD_UTF_BYTE(18, ADD_UTF_BYTE(12, ADD_UTF_BYTE(6, ADD_UTF_BYTE(0, )))))
-    } else {
-      uch = 0xfffd;
-    }
-#undef ADD_UTF_BYTE
-
-    glyph = FTC_CMapCache_Lookup(ftc_cmapcache, ftc_faceid, unicodeCmap, uch);
+    glyph = [self _glyphForCharacter:uch];
 
     if (use_sbit) {
       if ((error = FTC_SBitCache_Lookup(ftc_sbitcache, &ftc_imagetype, glyph, &sbit, NULL))) {
@@ -891,6 +1108,25 @@ static int filters[3][7] = {{0 * 65536 / 9, 1 * 65536 / 9, 2 * 65536 / 9, 3 * 65
     }
   }
 
+  if (use_sbit && length > 0 && glyph_run_cache_enabled()) {
+    glyph_run_t *run = [self _lookupGlyphRun:GLYPH_RUN_GLYPHS key:glyphs:length * sizeof(NSGlyph)];
+
+    if (!run && length <= GLYPH_RUN_MAX_LENGTH) {
+      unsigned int run_glyphs[length];
+      int i;
+
+      for (i = 0; i < length; i++)
+        run_glyphs[i] = glyphs[i] - 1;
+      run = [self _addGlyphRun:GLYPH_RUN_GLYPHS
+                           key:glyphs:length * sizeof(NSGlyph)
+                        glyphs:run_glyphs:length];
+    }
+    if (run) {
+      draw_glyph_run(run, x, y, x1, y1, buf, bpl, NULL, 0, r, g, b, alpha, di);
+      return;
+    }
+  }
+
   /*        NSLog(@"drawGlyphs: '%p' at: %i:%i  to: %i:%i:%i:%i:%p",
                   glyphs, x, y, x0, y0, x1, y1, buf);*/
 
@@ -1172,6 +1408,25 @@ static int filters[3][7] = {{0 * 65536 / 9, 1 * 65536 / 9, 2 * 65536 / 9, 3 * 65
     }
   }
 
+  if (use_sbit && length > 0 && glyph_run_cache_enabled()) {
+    glyph_run_t *run = [self _lookupGlyphRun:GLYPH_RUN_GLYPHS key:glyphs:length * sizeof(NSGlyph)];
+
+    if (!run && length <= GLYPH_RUN_MAX_LENGTH) {
+      unsigned int run_glyphs[length];
+      int i;
+
+      for (i = 0; i < length; i++)
+        run_glyphs[i] = glyphs[i] - 1;
+      run = [self _addGlyphRun:GLYPH_RUN_GLYPHS
+                           key:glyphs:length * sizeof(NSGlyph)
+                        glyphs:run_glyphs:length];
+    }
+    if (run) {
+      draw_glyph_run(run, x, y, x1, y1, buf, bpl, abuf, abpl, r, g, b, alpha, di);
+      return;
+    }
+  }
+
   /*        NSLog(@"drawString: '%s' at: %i:%i  to: %i:%i:%i:%i:%p",
                   s, x, y, x0, y0, x1, y1, buf);*/
 
@@ -1387,32 +1642,25 @@ static int filters[3][7] = {{0 * 65536 / 9, 1 * 65536 / 9, 2 * 65536 / 9, 3 * 65
   return YES;
 }
 
-- (NSSize)advancementForGlyph:(NSGlyph)glyph
+/* Looks up the advancement of a glyph index with FreeType. Returns NO if it
+   failed, and the result shouldn't be remembered. */
+- (BOOL)_loadAdvancementOfGlyph:(unsigned int)glyph :(NSSize *)advancement
 {
   FT_Error error;
 
-  if (glyph == NSControlGlyph || glyph == GSAttachmentGlyph)
-    return NSZeroSize;
-
-  if (glyph != NSNullGlyph)
-    glyph--;
+  *advancement = NSZeroSize;
   if (isScreenFont) {
-    int entry = glyph % CACHE_SIZE;
     FTC_SBit sbit;
 
-    if (cachedGlyph[entry] == glyph)
-      return cachedSize[entry];
-
     if ((error = FTC_SBitCache_Lookup(ftc_sbitcache, &ftc_imagetype, glyph, &sbit, NULL))) {
       NSLog(@"FTC_SBitCache_Lookup() failed with error %08x (%08x, %08lu, %ix%i, %08x)", error,
             glyph, (unsigned long)ftc_imagetype.face_id, ftc_imagetype.width, ftc_imagetype.height,
             ftc_imagetype.flags);
-      return NSZeroSize;
+      return NO;
     }
 
-    cachedGlyph[entry] = glyph;
-    cachedSize[entry] = NSMakeSize(sbit->xadvance, sbit->yadvance);
-    return cachedSize[entry];
+    *advancement = NSMakeSize(sbit->xadvance, sbit->yadvance);
+    return YES;
   } else {
     FT_Face face;
     FT_Size size;
@@ -1420,7 +1668,6 @@ static int filters[3][7] = {{0 * 65536 / 9, 1 * 65536 / 9, 2 * 65536 / 9, 3 * 65
     FT_Matrix ftmatrix;
     FT_Vector ftdelta;
     float f;
-    NSSize s;
 
     f = fabs(matrix[0] * matrix[3] - matrix[1] * matrix[2]);
     if (f > 1)
@@ -1438,23 +1685,93 @@ static int filters[3][7] = {{0 * 65536 / 9, 1 * 65536 / 9, 2 * 65536 / 9, 3 * 65
     ftdelta.x = ftdelta.y = 0;
 
     if (FTC_Manager_LookupSize(ftc_manager, &ftc_scaler, &size))
-      return NSZeroSize;
+      return NO;
     face = size->face;
 
     if (FT_Load_Glyph(face, glyph, FT_LOAD_NO_HINTING | FT_LOAD_NO_BITMAP))
-      return NSZeroSize;
+      return NO;
 
     if (FT_Get_Glyph(face->glyph, &gl))
-      return NSZeroSize;
+      return NO;
 
     if (FT_Glyph_Transform(gl, &ftmatrix, &ftdelta))
-      return NSZeroSize;
+      return NO;
 
-    s = NSMakeSize(gl->advance.x / 65536.0, gl->advance.y / 65536.0);
+    *advancement = NSMakeSize(gl->advance.x / 65536.0, gl->advance.y / 65536.0);
 
     FT_Done_Glyph(gl);
 
-    return s;
+    return YES;
+  }
+}
+
+/* The advancement of a glyph index, from the metrics table. */
+- (NSSize)_advancementOfGlyph:(unsigned int)glyph
+{
+  glyph_metrics_page_t *page;
+  unsigned int i = glyph & GLYPH_PAGE_MASK;
+  NSSize advancement;
+
+  if ((glyph >> GLYPH_PAGE_SHIFT) >= numMetricsPages) {
+    [self _loadAdvancementOfGlyph:glyph:&advancement];
+    return advancement;
+  }
+
+  page = metricsPages[glyph >> GLYPH_PAGE_SHIFT];
+  if (!page) {
+    page = calloc(1, sizeof(glyph_metrics_page_t));
+    if (!page) {
+      [self _loadAdvancementOfGlyph:glyph:&advancement];
+      return advancement;
+    }
+    metricsPages[glyph >> GLYPH_PAGE_SHIFT] = page;
+  }
+
+  if (page->known[i / 32] & (1U << (i % 32)))
+    return page->advancement[i];
+
+  if ([self _loadAdvancementOfGlyph:glyph:&advancement]) {
+    page->advancement[i] = advancement;
+    page->known[i / 32] |= 1U << (i % 32);
+  }
+  return advancement;
+}
+
+- (NSSize)advancementForGlyph:(NSGlyph)glyph
+{
+  if (glyph == NSControlGlyph || glyph == GSAttachmentGlyph)
+    return NSZeroSize;
+
+  if (glyph != NSNullGlyph)
+    glyph--;
+  return [self _advancementOfGlyph:glyph];
+}
+
+- (void)advancementsForGlyphs:(const NSGlyph *)glyphs
+                        count:(int)count
+                 advancements:(NSSize *)advancements
+{
+  NSGlyph glyph;
+  int i;
+
+  for (i = 0; i < count; i++) {
+    glyph = glyphs[i];
+    if (glyph == NSControlGlyph || glyph == GSAttachmentGlyph) {
+      advancements[i] = NSZeroSize;
+      continue;
+    }
+    if (glyph != NSNullGlyph)
+      glyph--;
+    if ((glyph >> GLYPH_PAGE_SHIFT) < numMetricsPages) {
+      glyph_metrics_page_t *page = metricsPages[glyph >> GLYPH_PAGE_SHIFT];
+      unsigned int j = glyph & GLYPH_PAGE_MASK;
+
+      if (page && (page->known[j / 32] & (1U << (j % 32)))) {
+        advancements[i] = page->advancement[j];
+        continue;
+      }
+    }
+    advancements[i] = [self _advancementOfGlyph:glyph];
   }
 }
 
@@ -1524,28 +1841,18 @@ static int filters[3][7] = {{0 * 65536 / 9, 1 * 65536 / 9, 2 * 65536 / 9, 3 * 65
 
 - (CGFloat)widthOfString:(NSString *)string
 {
-  unichar ch;
-  int i, c = [string length];
-  int total;
-
-  unsigned int glyph;
-
-  FTC_SBit sbit;
+  unichar buffer[256];
+  int i, j, n, c = [string length];
+  CGFloat total;
 
+  /* The same advancements as layout, rather than the ones of the sbits
+     whatever the font is. */
   total = 0;
-  for (i = 0; i < c; i++) {
-    ch = [string characterAtIndex:i];
-    glyph = FTC_CMapCache_Lookup(ftc_cmapcache, ftc_faceid, unicodeCmap, ch);
-
-    /* TODO: shouldn't use sbit cache for this */
-    if (1) {
-      if (FTC_SBitCache_Lookup(ftc_sbitcache, &ftc_imagetype, glyph, &sbit, NULL))
-        continue;
-
-      total += sbit->xadvance;
-    } else {
-      NSLog(@"non-sbit code not implemented");
-    }
+  for (i = 0; i < c; i += n) {
+    n = MIN(c - i, 256);
+    [string getCharacters:buffer range:NSMakeRange(i, n)];
+    for (j = 0; j < n; j++)
+      total += [self _advancementOfGlyph:[self _glyphForCharacter:buffer[j]]].width;
   }
   return total;
 }
@@ -1931,7 +2238,7 @@ add code to avoid loading bitmaps for glyphs */
 {
   NSGlyph g;
 
-  g = FTC_CMapCache_Lookup(ftc_cmapcache, ftc_faceid, unicodeCmap, ch);
+  g = [self _glyphForCharacter:ch];
   if (g)
     return g + 1;
   else
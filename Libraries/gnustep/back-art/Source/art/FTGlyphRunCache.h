@@ -0,0 +1,95 @@
+/*
+   Copyright (C) 2026 NEXTSPACE Team
+
+   This file is part of GNUstep.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; see the file COPYING.LIB.
+   If not, see <http://www.gnu.org/licenses/> or write to the
+   Free Software Foundation, 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef FTGlyphRunCache_h
+#define FTGlyphRunCache_h
+
+#include <stddef.h>
+
+/*
+The coverage masks of whole runs of glyphs, as drawn with the sbit cache
+of a font: menus, labels and terminals draw the same short strings over
+and over, and blitting one mask per run is cheaper than looking up and
+blitting every glyph.
+
+A run is identified by the face, the pixel size and the load flags of the
+font (the fields of FTC_ImageTypeRec, which FTFontInfo instances for the
+same font share), by whether the key is a UTF-8 string or an array of
+glyphs, and by the bytes of that key. Runs drawn with the sbit cache are
+always at integer positions, so the mask doesn't depend on the position.
+
+The cache is shared by all fonts, limited in memory, and evicts the runs
+that were least recently drawn.
+*/
+
+#define GLYPH_RUN_STRING 0
+#define GLYPH_RUN_GLYPHS 1
+
+/* longer runs are drawn glyph by glyph */
+#define GLYPH_RUN_MAX_LENGTH 256
+
+typedef struct glyph_run_s {
+  struct glyph_run_s *hash_next;
+  struct glyph_run_s *lru_prev, *lru_next;
+  unsigned int hash;
+  size_t size; /* bytes used by the entry */
+
+  const void *face_id;
+  int pixel_width, pixel_height;
+  unsigned int flags;
+  int kind;
+  int key_length;
+  const unsigned char *key;
+
+  /* the mask, 'width' bytes per row; its top left pixel is 'left' pixels
+     right of and 'top' pixels above the pen position of the run */
+  int left, top;
+  int width, height;
+  unsigned char *mask;
+} glyph_run_t;
+
+/* the default limit, in bytes */
+#define GLYPH_RUN_CACHE_SIZE (1024 * 1024)
+
+/* Sets the memory limit of the cache, 0 to disable it. */
+void glyph_run_cache_set_limit(size_t bytes);
+int glyph_run_cache_enabled(void);
+
+/* Returns the cached run, and makes it the most recently used one, or
+   NULL. */
+glyph_run_t *glyph_run_cache_lookup(const void *face_id, int pixel_width, int pixel_height,
+                                    unsigned int flags, int kind, const void *key,
+                                    int key_length);
+
+/* Adds a run with a cleared mask of the given size, evicting older ones as
+   needed, and returns it; NULL if it is too large to be cached. */
+glyph_run_t *glyph_run_cache_add(const void *face_id, int pixel_width, int pixel_height,
+                                 unsigned int flags, int kind, const void *key, int key_length,
+                                 int left, int top, int width, int height);
+
+void glyph_run_cache_remove(glyph_run_t *run);
+
+/* counters since the start, for the "ftfont-runs" debug log */
+void glyph_run_cache_statistics(unsigned long *hits, unsigned long *misses,
+                                unsigned long *evictions, size_t *memory);
+
+#endif
@@ -0,0 +1,185 @@
+/*
+   Copyright (C) 2026 NEXTSPACE Team
+
+   This file is part of GNUstep.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; see the file COPYING.LIB.
+   If not, see <http://www.gnu.org/licenses/> or write to the
+   Free Software Foundation, 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "FTGlyphRunCache.h"
+
+#define NUM_BUCKETS 1024
+
+static glyph_run_t *buckets[NUM_BUCKETS];
+/* lru_first is the most recently used run */
+static glyph_run_t *lru_first, *lru_last;
+
+static size_t limit = GLYPH_RUN_CACHE_SIZE;
+static size_t memory;
+static unsigned long hits, misses, evictions;
+
+static unsigned int run_hash(const void *face_id, int pixel_width, int pixel_height,
+                             unsigned int flags, int kind, const unsigned char *key, int key_length)
+{
+  /* FNV-1a */
+  unsigned int h = 2166136261u;
+  int i;
+
+  h = (h ^ (unsigned int)(size_t)face_id) * 16777619u;
+  h = (h ^ (unsigned int)(((size_t)face_id) >> 16 >> 16)) * 16777619u;
+  h = (h ^ (unsigned int)pixel_width) * 16777619u;
+  h = (h ^ (unsigned int)pixel_height) * 16777619u;
+  h = (h ^ flags) * 16777619u;
+  h = (h ^ (unsigned int)kind) * 16777619u;
+  for (i = 0; i < key_length; i++)
+    h = (h ^ key[i]) * 16777619u;
+  return h;
+}
+
+static void lru_unlink(glyph_run_t *run)
+{
+  if (run->lru_prev)
+    run->lru_prev->lru_next = run->lru_next;
+  else
+    lru_first = run->lru_next;
+  if (run->lru_next)
+    run->lru_next->lru_prev = run->lru_prev;
+  else
+    lru_last = run->lru_prev;
+}
+
+static void lru_push(glyph_run_t *run)
+{
+  run->lru_prev = NULL;
+  run->lru_next = lru_first;
+  if (lru_first)
+    lru_first->lru_prev = run;
+  else
+    lru_last = run;
+  lru_first = run;
+}
+
+static void run_free(glyph_run_t *run)
+{
+  glyph_run_t **p = &buckets[run->hash % NUM_BUCKETS];
+
+  while (*p != run)
+    p = &(*p)->hash_next;
+  *p = run->hash_next;
+  lru_unlink(run);
+  memory -= run->size;
+  free(run);
+}
+
+static void shrink_to(size_t bytes)
+{
+  while (lru_last && memory > bytes) {
+    run_free(lru_last);
+    evictions++;
+  }
+}
+
+void glyph_run_cache_set_limit(size_t bytes)
+{
+  limit = bytes;
+  shrink_to(limit);
+}
+
+int glyph_run_cache_enabled(void)
+{
+  return limit != 0;
+}
+
+glyph_run_t *glyph_run_cache_lookup(const void *face_id, int pixel_width, int pixel_height,
+                                    unsigned int flags, int kind, const void *key,
+                                    int key_length)
+{
+  unsigned int h = run_hash(face_id, pixel_width, pixel_height, flags, kind, key, key_length);
+  glyph_run_t *run;
+
+  for (run = buckets[h % NUM_BUCKETS]; run; run = run->hash_next) {
+    if (run->hash == h && run->face_id == face_id && run->pixel_width == pixel_width &&
+        run->pixel_height == pixel_height && run->flags == flags && run->kind == kind &&
+        run->key_length == key_length && !memcmp(run->key, key, key_length)) {
+      if (run != lru_first) {
+        lru_unlink(run);
+        lru_push(run);
+      }
+      hits++;
+      return run;
+    }
+  }
+  misses++;
+  return NULL;
+}
+
+glyph_run_t *glyph_run_cache_add(const void *face_id, int pixel_width, int pixel_height,
+                                 unsigned int flags, int kind, const void *key, int key_length,
+                                 int left, int top, int width, int height)
+{
+  size_t size = sizeof(glyph_run_t) + key_length + (size_t)width * height;
+  glyph_run_t *run;
+
+  /* a single run may use an eighth of the cache */
+  if (size > limit / 8)
+    return NULL;
+
+  shrink_to(limit - size);
+
+  run = calloc(1, size);
+  if (!run)
+    return NULL;
+
+  run->hash = run_hash(face_id, pixel_width, pixel_height, flags, kind, key, key_length);
+  run->size = size;
+  run->face_id = face_id;
+  run->pixel_width = pixel_width;
+  run->pixel_height = pixel_height;
+  run->flags = flags;
+  run->kind = kind;
+  run->key_length = key_length;
+  run->mask = (unsigned char *)(run + 1);
+  run->key = run->mask + (size_t)width * height;
+  memcpy((unsigned char *)run->key, key, key_length);
+  run->left = left;
+  run->top = top;
+  run->width = width;
+  run->height = height;
+
+  run->hash_next = buckets[run->hash % NUM_BUCKETS];
+  buckets[run->hash % NUM_BUCKETS] = run;
+  lru_push(run);
+  memory += size;
+
+  return run;
+}
+
+void glyph_run_cache_remove(glyph_run_t *run)
+{
+  run_free(run);
+}
+
+void glyph_run_cache_statistics(unsigned long *h, unsigned long *m, unsigned long *e, size_t *mem)
+{
+  *h = hits;
+  *m = misses;
+  *e = evictions;
+  *mem = memory;
+}
@@ -0,0 +1,62 @@
+/*
+   Copyright (C) 2026 NEXTSPACE Team
+
+   This file is part of GNUstep.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; see the file COPYING.LIB.
+   If not, see <http://www.gnu.org/licenses/> or write to the
+   Free Software Foundation, 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef bands_h
+#define bands_h
+
+/*
+Rendering split in horizontal bands, which are drawn concurrently by a
+small pool of worker threads and the calling thread.
+
+The procedure is called with ranges [first, last) of 0 .. count - 1, and
+must only touch the rows of its range: the bands are the same whatever
+thread draws them, so the result doesn't depend on the threads. It runs
+outside of Objective-C, and mustn't send messages or allocate objects.
+
+When the pool is busy (art_run_bands() called from two threads), or there
+are fewer than two bands of 'grain' rows, everything is drawn by the
+calling thread.
+*/
+
+typedef void (*art_band_proc_t)(void *data, int first, int last);
+
+void art_run_bands(int count, int grain, art_band_proc_t proc, void *data);
+
+/* drawing fewer pixels isn't split in bands */
+#define ART_BANDS_MIN_PIXELS (256 * 256)
+/* the least number of pixels of a band */
+#define ART_BAND_PIXELS 16384
+
+/* art_run_bands() for 'count' rows of 'width' pixels */
+void art_run_band_rows(int count, int width, art_band_proc_t proc, void *data);
+
+/*
+Sets the number of threads drawing bands, the caller included: 0 for one
+per processor (at most 8), 1 to draw everything in the calling thread.
+Only has an effect before bands are first drawn.
+*/
+void art_band_set_threads(int threads);
+
+/* the number of threads drawing bands, the caller included */
+int art_band_threads(void);
+
+#endif
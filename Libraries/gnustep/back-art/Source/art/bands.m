@@ -0,0 +1,165 @@
+/*
+   Copyright (C) 2026 NEXTSPACE Team
+
+   This file is part of GNUstep.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; see the file COPYING.LIB.
+   If not, see <http://www.gnu.org/licenses/> or write to the
+   Free Software Foundation, 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "bands.h"
+
+#define MAX_THREADS 8
+
+/* the pool is started by the first call with more than one band */
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static int num_threads = 1;
+/* 0 for one per processor */
+static int wanted_threads = 0;
+
+/* taken by the thread running bands, the others draw on their own */
+static pthread_mutex_t run_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+
+/* the current job, under 'lock' */
+static struct {
+  unsigned int generation;
+  art_band_proc_t proc;
+  void *data;
+  int count, num_bands;
+  int next, pending;
+} job;
+
+/* Draws the bands of the job nobody has taken yet. Called with 'lock'. */
+static void run_job(void)
+{
+  int band, first, last;
+
+  while (job.next < job.num_bands) {
+    band = job.next++;
+    first = (long long)job.count * band / job.num_bands;
+    last = (long long)job.count * (band + 1) / job.num_bands;
+
+    pthread_mutex_unlock(&lock);
+    job.proc(job.data, first, last);
+    pthread_mutex_lock(&lock);
+
+    if (!--job.pending)
+      pthread_cond_signal(&done_cond);
+  }
+}
+
+static void *worker(void *arg)
+{
+  unsigned int generation = 0;
+
+  pthread_mutex_lock(&lock);
+  while (1) {
+    while (job.generation == generation)
+      pthread_cond_wait(&work_cond, &lock);
+    generation = job.generation;
+    run_job();
+  }
+
+  return NULL;
+}
+
+static void start_pool(void)
+{
+  pthread_attr_t attr;
+  pthread_t thread;
+  long n = wanted_threads ? wanted_threads : sysconf(_SC_NPROCESSORS_ONLN);
+  int i;
+
+  if (n > MAX_THREADS)
+    n = MAX_THREADS;
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  for (i = 1; i < n; i++) {
+    if (pthread_create(&thread, &attr, worker, NULL))
+      break;
+    num_threads++;
+  }
+  pthread_attr_destroy(&attr);
+}
+
+void art_band_set_threads(int threads)
+{
+  if (threads >= 0)
+    wanted_threads = threads;
+}
+
+int art_band_threads(void)
+{
+  pthread_once(&pool_once, start_pool);
+  return num_threads;
+}
+
+void art_run_bands(int count, int grain, art_band_proc_t proc, void *data)
+{
+  int num_bands;
+
+  if (count <= 0)
+    return;
+  if (grain < 1)
+    grain = 1;
+
+  num_bands = count / grain;
+  if (num_bands > 1 && num_bands > art_band_threads())
+    num_bands = art_band_threads();
+
+  if (num_bands <= 1 || pthread_mutex_trylock(&run_lock)) {
+    proc(data, 0, count);
+    return;
+  }
+
+  pthread_mutex_lock(&lock);
+  job.proc = proc;
+  job.data = data;
+  job.count = count;
+  job.num_bands = job.pending = num_bands;
+  job.next = 0;
+  job.generation++;
+  pthread_cond_broadcast(&work_cond);
+
+  run_job();
+  while (job.pending)
+    pthread_cond_wait(&done_cond, &lock);
+  pthread_mutex_unlock(&lock);
+
+  pthread_mutex_unlock(&run_lock);
+}
+
+void art_run_band_rows(int count, int width, art_band_proc_t proc, void *data)
+{
+  if (width < 1)
+    width = 1;
+
+  if ((long long)count * width < ART_BANDS_MIN_PIXELS) {
+    if (count > 0)
+      proc(data, 0, count);
+    return;
+  }
+
+  art_run_bands(count, (ART_BAND_PIXELS + width - 1) / width, proc, data);
+}
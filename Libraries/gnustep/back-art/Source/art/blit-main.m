@@ -322,6 +322,8 @@ static draw_info_t draw_infos[DI_NUM] = {
   \
   NPRE(read_pixels_o,x), \
   NPRE(read_pixels_a,x), \
+  NPRE(write_pixels_o,x), \
+  NPRE(write_pixels_a,x), \
   \
   NPRE(sover_aa,x), \
   NPRE(sover_ao,x), \
@@ -434,6 +436,8 @@ void artcontext_setup_draw_info(draw_info_t *di, unsigned int red_mask,
           @"Better: implement it and send a patch.)");
     exit(1);
   }
+
+  artcontext_setup_simd_draw_info(di);
 }
 
 void artcontext_setup_gamma(float gamma)
@@ -0,0 +1,775 @@
+/*
+   Copyright (C) 2026 NEXTSPACE Team
+
+   This file is part of GNUstep.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; see the file COPYING.LIB.
+   If not, see <http://www.gnu.org/licenses/> or write to the
+   Free Software Foundation, 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+/*
+  Vector versions of the blitters of blit.m, included by blit-simd.m once
+  for each instruction set with the V_* macros defined.
+
+  The 32-bit functions work for DI_32_RGBA and DI_32_BGRA (alpha in the
+  high byte), the _24 ones for DI_24_RGB and DI_24_BGR. They give exactly
+  the bytes of the scalar versions, which stay the reference:
+  - the special cases of the scalar loops (pixels fully transparent or
+    opaque) are computed with the general formula too, and the pixels
+    where both differ are replaced using masks,
+  - results are truncated to 8 bits like the stores to unsigned char,
+  - the last pixels of a run go through a copy in a vector-sized buffer.
+*/
+
+#define LO16(v) V_UNPACKLO8(v, V_ZERO)
+#define HI16(v) V_UNPACKHI8(v, V_ZERO)
+#define PACK8(lo, hi) V_PACKUS16(V_AND(lo, V_SET1_16(0xff)), V_AND(hi, V_SET1_16(0xff)))
+/* the alpha of each pixel in its 4 lanes */
+#define ALPHA16(v) V_SHUFFLEHI16(V_SHUFFLELO16(v, 0xff), 0xff)
+/* (x * y + r) >> 8, exact in 16 bits when x * y + r < 65536 */
+#define MULDIV(x, y, r) V_SRLI16(V_ADD16(V_MULLO16(x, y), V_SET1_16(r)), 8)
+#define SELECT(m, a, b) V_OR(V_AND(m, a), V_ANDNOT(m, b))
+#define AMASK V_SET1_32((int)0xff000000)
+#define ALPHA_IS(v, x) V_CMPEQ32(V_SRLI32(v, 24), V_SET1_32(x))
+#define INVERT(v) V_ANDNOT(v, V_SET1_32(-1))
+#define SUB255(v) V_SUB16(V_SET1_16(0xff), v)
+
+/* 16-bit lane of the low half vector for byte 'l' of the vector */
+#define LO_BYTE(l) ((l) % 8 + ((l) / 8) * 16)
+
+/* (x * wx + y * wy + 0xff) >> 8 in 32 bits, for 8-bit values and weights */
+static inline SIMD_TARGET V SPRE(lerp2)(V x, V wx, V y, V wy)
+{
+  V lo = V_MADD16(V_UNPACKLO16(x, y), V_UNPACKLO16(wx, wy));
+  V hi = V_MADD16(V_UNPACKHI16(x, y), V_UNPACKHI16(wx, wy));
+
+  lo = V_SRLI32(V_ADD32(lo, V_SET1_32(0xff)), 8);
+  hi = V_SRLI32(V_ADD32(hi, V_SET1_32(0xff)), 8);
+  return V_PACKS32(lo, hi);
+}
+
+/* (x * wx + y * wy + 0xff00) >> 16 in 32 bits, for 16-bit weights */
+static inline SIMD_TARGET V SPRE(lerp2_16)(V x, V wx, V y, V wy)
+{
+  V p_lo = V_MULLO16(x, wx), p_hi = V_MULHI16U(x, wx);
+  V q_lo = V_MULLO16(y, wy), q_hi = V_MULHI16U(y, wy);
+  V lo = V_ADD32(V_UNPACKLO16(p_lo, p_hi), V_UNPACKLO16(q_lo, q_hi));
+  V hi = V_ADD32(V_UNPACKHI16(p_lo, p_hi), V_UNPACKHI16(q_lo, q_hi));
+
+  lo = V_SRLI32(V_ADD32(lo, V_SET1_32(0xff00)), 16);
+  hi = V_SRLI32(V_ADD32(hi, V_SET1_32(0xff00)), 16);
+  return V_PACKS32(lo, hi);
+}
+
+/* s + ((d * (255 - sa) + 0xff) >> 8) on the 16-bit lanes */
+static inline SIMD_TARGET V SPRE(over16)(V s, V d)
+{
+  return V_ADD16(s, MULDIV(d, SUB255(ALPHA16(s)), 0xff));
+}
+
+static inline SIMD_TARGET V SPRE(over)(V s, V d)
+{
+  return PACK8(SPRE(over16)(LO16(s), LO16(d)), SPRE(over16)(HI16(s), HI16(d)));
+}
+
+/* the pixels of s scaled by the alpha of w, or its inverse */
+static inline SIMD_TARGET V SPRE(scale)(V s, V w, int invert, int round)
+{
+  V w_lo = ALPHA16(LO16(w)), w_hi = ALPHA16(HI16(w));
+
+  if (invert) {
+    w_lo = SUB255(w_lo);
+    w_hi = SUB255(w_hi);
+  }
+  return PACK8(MULDIV(LO16(s), w_lo, round), MULDIV(HI16(s), w_hi, round));
+}
+
+/* swaps the 1st and 3rd bytes of the pixels, ie. RGBA <-> BGRA */
+static inline SIMD_TARGET V SPRE(swap_rb)(V v)
+{
+  V rb = V_SET1_32(0xff);
+
+  return V_OR(V_AND(v, V_SET1_32((int)0xff00ff00)),
+              V_OR(V_AND(V_SRLI32(v, 16), rb), V_SLLI32(V_AND(v, rb), 16)));
+}
+
+/** 32-bit compositing **/
+
+/* 1 : 1 - srca */
+static inline SIMD_TARGET V SPRE(sover_aa_v)(V s, V d, V k)
+{
+  return SELECT(ALPHA_IS(s, 0), d, SPRE(over)(s, d));
+}
+
+static inline SIMD_TARGET V SPRE(sover_ao_v)(V s, V d, V k)
+{
+  return SELECT(V_OR(ALPHA_IS(s, 0), AMASK), d, SPRE(over)(s, d));
+}
+
+/* dsta : 0 */
+static inline SIMD_TARGET V SPRE(sin_aa_v)(V s, V d, V k)
+{
+  return SPRE(scale)(s, d, 0, 0xff);
+}
+
+static inline SIMD_TARGET V SPRE(sin_oa_v)(V s, V d, V k)
+{
+  return SPRE(scale)(V_OR(s, AMASK), d, 0, 0xff);
+}
+
+/* 1 - dsta : 0 */
+static inline SIMD_TARGET V SPRE(sout_aa_v)(V s, V d, V k)
+{
+  return SPRE(scale)(s, d, 1, 0xff);
+}
+
+static inline SIMD_TARGET V SPRE(sout_oa_v)(V s, V d, V k)
+{
+  V r = SPRE(scale)(s, d, 1, 0x80);
+
+  /* the alpha is 1 - dsta, not rounded */
+  r = V_OR(V_ANDNOT(AMASK, r), V_ANDNOT(d, AMASK));
+  return SELECT(ALPHA_IS(d, 0), V_OR(s, AMASK), r);
+}
+
+/* dsta : 1 - srca */
+static inline SIMD_TARGET V SPRE(satop_aa_v)(V s, V d, V k)
+{
+  V s_lo = LO16(s), s_hi = HI16(s), d_lo = LO16(d), d_hi = HI16(d);
+  V r = PACK8(SPRE(lerp2)(s_lo, ALPHA16(d_lo), d_lo, SUB255(ALPHA16(s_lo))),
+              SPRE(lerp2)(s_hi, ALPHA16(d_hi), d_hi, SUB255(ALPHA16(s_hi))));
+  V skip = V_OR(ALPHA_IS(d, 0), V_AND(ALPHA_IS(d, 255), ALPHA_IS(s, 0)));
+
+  return SELECT(V_OR(skip, AMASK), d, r);
+}
+
+/* 1 - dsta : 1 */
+static inline SIMD_TARGET V SPRE(dover_v)(V s, V d)
+{
+  V d_lo = LO16(d), d_hi = HI16(d);
+
+  d_lo = V_ADD16(d_lo, MULDIV(LO16(s), SUB255(ALPHA16(d_lo)), 0x80));
+  d_hi = V_ADD16(d_hi, MULDIV(HI16(s), SUB255(ALPHA16(d_hi)), 0x80));
+  return PACK8(d_lo, d_hi);
+}
+
+static inline SIMD_TARGET V SPRE(dover_aa_v)(V s, V d, V k)
+{
+  return SELECT(ALPHA_IS(d, 0), s, SPRE(dover_v)(s, d));
+}
+
+static inline SIMD_TARGET V SPRE(dover_oa_v)(V s, V d, V k)
+{
+  s = V_OR(s, AMASK);
+  return SELECT(ALPHA_IS(d, 0), s, V_OR(SPRE(dover_v)(s, d), AMASK));
+}
+
+/* 0 : srca */
+static inline SIMD_TARGET V SPRE(din_aa_v)(V s, V d, V k)
+{
+  return SELECT(ALPHA_IS(s, 255), d, SPRE(scale)(d, s, 0, 0x80));
+}
+
+/* 0 : 1 - srca */
+static inline SIMD_TARGET V SPRE(dout_aa_v)(V s, V d, V k)
+{
+  return SELECT(ALPHA_IS(s, 0), d, SPRE(scale)(d, s, 1, 0x80));
+}
+
+/* 1 - dsta : srca */
+static inline SIMD_TARGET V SPRE(datop_aa_v)(V s, V d, V k)
+{
+  V s_lo = LO16(s), s_hi = HI16(s), d_lo = LO16(d), d_hi = HI16(d);
+  V r = PACK8(SPRE(lerp2)(d_lo, ALPHA16(s_lo), s_lo, SUB255(ALPHA16(d_lo))),
+              SPRE(lerp2)(d_hi, ALPHA16(s_hi), s_hi, SUB255(ALPHA16(d_hi))));
+  V d0 = ALPHA_IS(d, 0);
+
+  r = SELECT(AMASK, s, r);
+  r = SELECT(V_AND(d0, ALPHA_IS(s, 255)), s, r);
+  return SELECT(V_AND(d0, ALPHA_IS(s, 0)), d, r);
+}
+
+/* 1 - dsta : 1 - srca */
+static inline SIMD_TARGET V SPRE(xor_aa_v)(V s, V d, V k)
+{
+  V s_lo = LO16(s), s_hi = HI16(s), d_lo = LO16(d), d_hi = HI16(d);
+  V r = PACK8(SPRE(lerp2)(d_lo, SUB255(ALPHA16(s_lo)), s_lo, SUB255(ALPHA16(d_lo))),
+              SPRE(lerp2)(d_hi, SUB255(ALPHA16(s_hi)), s_hi, SUB255(ALPHA16(d_hi))));
+
+  return SELECT(V_AND(ALPHA_IS(d, 0), ALPHA_IS(s, 0)), d, r);
+}
+
+/* dst + src, clamped to 1 */
+static inline SIMD_TARGET V SPRE(plusl_aa_v)(V s, V d, V k)
+{
+  return V_ADDS8U(d, s);
+}
+
+static inline SIMD_TARGET V SPRE(plusl_oa_v)(V s, V d, V k)
+{
+  return V_OR(V_ADDS8U(d, s), AMASK);
+}
+
+static inline SIMD_TARGET V SPRE(plusl_ao_oo_v)(V s, V d, V k)
+{
+  return SELECT(AMASK, d, V_ADDS8U(d, s));
+}
+
+/* dst + src - 1 clamped to 0, the alpha being added as for plusl */
+static inline SIMD_TARGET V SPRE(plusd_aa_v)(V s, V d, V k)
+{
+  return SELECT(AMASK, V_ADDS8U(d, s), V_SUBS8U(d, INVERT(s)));
+}
+
+static inline SIMD_TARGET V SPRE(plusd_oa_v)(V s, V d, V k)
+{
+  return V_OR(V_SUBS8U(d, INVERT(s)), AMASK);
+}
+
+static inline SIMD_TARGET V SPRE(plusd_ao_oo_v)(V s, V d, V k)
+{
+  return SELECT(AMASK, d, V_SUBS8U(d, INVERT(s)));
+}
+
+/* source over, with the source scaled by the fraction in k */
+static inline SIMD_TARGET V SPRE(dissolve_aa_v)(V s, V d, V k)
+{
+  V s_lo = MULDIV(LO16(s), k, 0xff), s_hi = MULDIV(HI16(s), k, 0xff);
+
+  return PACK8(SPRE(over16)(s_lo, LO16(d)), SPRE(over16)(s_hi, HI16(d)));
+}
+
+static inline SIMD_TARGET V SPRE(dissolve_ao_v)(V s, V d, V k)
+{
+  return SELECT(AMASK, d, SPRE(dissolve_aa_v)(s, d, k));
+}
+
+static inline SIMD_TARGET V SPRE(dissolve_oa_v)(V s, V d, V k)
+{
+  return SPRE(dissolve_aa_v)(V_OR(s, AMASK), d, k);
+}
+
+static inline SIMD_TARGET V SPRE(dissolve_oo_v)(V s, V d, V k)
+{
+  return SELECT(AMASK, d, SPRE(dissolve_aa_v)(V_OR(s, AMASK), d, k));
+}
+
+/* read_pixels_*: dst is a RGBA buffer */
+static inline SIMD_TARGET V SPRE(read_rgba_o_v)(V s, V d, V k)
+{
+  return V_OR(s, AMASK);
+}
+
+static inline SIMD_TARGET V SPRE(read_rgba_a_v)(V s, V d, V k)
+{
+  return s;
+}
+
+static inline SIMD_TARGET V SPRE(read_bgra_o_v)(V s, V d, V k)
+{
+  return V_OR(SPRE(swap_rb)(s), AMASK);
+}
+
+static inline SIMD_TARGET V SPRE(read_bgra_a_v)(V s, V d, V k)
+{
+  return SPRE(swap_rb)(s);
+}
+
+#define NO_SETUP V_ZERO
+#define FRACTION_SETUP V_SET1_16(c->fraction)
+
+#define COMPOSITE_32(name, setup)                                         \
+  static SIMD_TARGET void SPRE(name##_32)(composite_run_t * c, int num)   \
+  {                                                                       \
+    unsigned char *s = c->src, *d = c->dst;                               \
+    V k = setup;                                                          \
+                                                                          \
+    for (; num >= V_PIXELS; num -= V_PIXELS, s += V_BYTES, d += V_BYTES) \
+      V_STORE(d, SPRE(name##_v)(V_LOAD(s), V_LOAD(d), k));               \
+    if (num) {                                                            \
+      unsigned char ts[V_BYTES] = {0}, td[V_BYTES] = {0};                 \
+                                                                          \
+      memcpy(ts, s, num * 4);                                             \
+      memcpy(td, d, num * 4);                                             \
+      V_STORE(td, SPRE(name##_v)(V_LOAD(ts), V_LOAD(td), k));            \
+      memcpy(d, td, num * 4);                                             \
+    }                                                                     \
+  }
+
+COMPOSITE_32(sover_aa, NO_SETUP)
+COMPOSITE_32(sover_ao, NO_SETUP)
+COMPOSITE_32(sin_aa, NO_SETUP)
+COMPOSITE_32(sin_oa, NO_SETUP)
+COMPOSITE_32(sout_aa, NO_SETUP)
+COMPOSITE_32(sout_oa, NO_SETUP)
+COMPOSITE_32(satop_aa, NO_SETUP)
+COMPOSITE_32(dover_aa, NO_SETUP)
+COMPOSITE_32(dover_oa, NO_SETUP)
+COMPOSITE_32(din_aa, NO_SETUP)
+COMPOSITE_32(dout_aa, NO_SETUP)
+COMPOSITE_32(datop_aa, NO_SETUP)
+COMPOSITE_32(xor_aa, NO_SETUP)
+COMPOSITE_32(plusl_aa, NO_SETUP)
+COMPOSITE_32(plusl_oa, NO_SETUP)
+COMPOSITE_32(plusl_ao_oo, NO_SETUP)
+COMPOSITE_32(plusd_aa, NO_SETUP)
+COMPOSITE_32(plusd_oa, NO_SETUP)
+COMPOSITE_32(plusd_ao_oo, NO_SETUP)
+COMPOSITE_32(dissolve_aa, FRACTION_SETUP)
+COMPOSITE_32(dissolve_ao, FRACTION_SETUP)
+COMPOSITE_32(dissolve_oa, FRACTION_SETUP)
+COMPOSITE_32(dissolve_oo, FRACTION_SETUP)
+COMPOSITE_32(read_rgba_o, NO_SETUP)
+COMPOSITE_32(read_rgba_a, NO_SETUP)
+COMPOSITE_32(read_bgra_o, NO_SETUP)
+COMPOSITE_32(read_bgra_a, NO_SETUP)
+
+/** 32-bit runs and glyph blits, the color order given by 'bgr' **/
+
+static inline SIMD_TARGET unsigned int SPRE(pixel)(unsigned char r, unsigned char g,
+                                                   unsigned char b, int bgr)
+{
+  return bgr ? (r << 16) | (g << 8) | b : (b << 16) | (g << 8) | r;
+}
+
+/* the 4 16-bit lanes of a pixel */
+static inline SIMD_TARGET V SPRE(lanes)(unsigned int r, unsigned int g, unsigned int b,
+                                        unsigned int a, int bgr)
+{
+  unsigned long long v = bgr ? b | (g << 16) | ((unsigned long long)r << 32)
+                             : r | (g << 16) | ((unsigned long long)b << 32);
+
+  return V_SET1_64(v | ((unsigned long long)a << 48));
+}
+
+static inline SIMD_TARGET void SPRE(fill_32)(unsigned char *dst, unsigned int v, int num)
+{
+  V p = V_SET1_32(v);
+
+  for (; num >= V_PIXELS; num -= V_PIXELS, dst += V_BYTES)
+    V_STORE(dst, p);
+  for (; num; num--, dst += 4)
+    memcpy(dst, &v, 4);
+}
+
+static inline SIMD_TARGET void SPRE(run_opaque_32)(render_run_t *ri, int num, int bgr)
+{
+  if (ri->r == ri->g && ri->r == ri->b) {
+    memset(ri->dst, ri->r, num * 4);
+    return;
+  }
+  SPRE(fill_32)(ri->dst, SPRE(pixel)(ri->r, ri->g, ri->b, bgr), num);
+}
+
+static inline SIMD_TARGET void SPRE(run_opaque_a_32)(render_run_t *ri, int num, int bgr)
+{
+  SPRE(fill_32)(ri->dst, SPRE(pixel)(ri->r, ri->g, ri->b, bgr) | 0xff000000, num);
+}
+
+/* (c * a + n * (255 - a) + 0xff) >> 8, the alpha being kept or blended */
+static inline SIMD_TARGET void SPRE(run_alpha_32)(render_run_t *ri, int num, int bgr,
+                                                  int blend_alpha)
+{
+  unsigned char *dst = ri->dst;
+  int a = ri->a, ia = 255 - a;
+  V ck = SPRE(lanes)(ri->r * a + 0xff, ri->g * a + 0xff, ri->b * a + 0xff,
+                     0xffff - (ia << 8), bgr);
+  V m = V_SET1_16(ia), keep = blend_alpha ? V_ZERO : AMASK;
+  V d, r;
+
+  while (num > 0) {
+    unsigned char td[V_BYTES] = {0};
+    unsigned char *p = (num >= V_PIXELS) ? dst : td;
+
+    if (p == td)
+      memcpy(td, dst, num * 4);
+    d = V_LOAD(p);
+    r = PACK8(V_SRLI16(V_ADD16(ck, V_MULLO16(LO16(d), m)), 8),
+              V_SRLI16(V_ADD16(ck, V_MULLO16(HI16(d), m)), 8));
+    V_STORE(p, SELECT(keep, d, r));
+    if (p == td)
+      memcpy(dst, td, num * 4);
+    num -= V_PIXELS;
+    dst += V_BYTES;
+  }
+}
+
+/*
+  (c * a + n * (65280 - a) + 0xff00) >> 16, with a the glyph coverage
+  times alpha; ca is the factor of the alpha when it is blended.
+*/
+static inline SIMD_TARGET void SPRE(blit_alpha_32)(unsigned char *dst, const unsigned char *src,
+                                                   unsigned char r, unsigned char g,
+                                                   unsigned char b, int alpha, int num, int bgr,
+                                                   int ca)
+{
+  V c = SPRE(lanes)(r, g, b, ca, bgr), va = V_SET1_16(alpha);
+  V keep = ca ? V_ZERO : AMASK;
+  V d, cov, a_lo, a_hi, res;
+
+  while (num > 0) {
+    unsigned char td[V_BYTES] = {0}, ts[V_PIXELS] = {0};
+    unsigned char *p = (num >= V_PIXELS) ? dst : td;
+    const unsigned char *q = (num >= V_PIXELS) ? src : ts;
+
+    if (p == td) {
+      memcpy(td, dst, num * 4);
+      memcpy(ts, src, num);
+    }
+    d = V_LOAD(p);
+    cov = V_COVERAGE(q);
+    a_lo = V_MULLO16(LO16(cov), va);
+    a_hi = V_MULLO16(HI16(cov), va);
+    res = V_PACKUS16(
+        SPRE(lerp2_16)(c, a_lo, LO16(d), V_SUB16(V_SET1_16(65280), a_lo)),
+        SPRE(lerp2_16)(c, a_hi, HI16(d), V_SUB16(V_SET1_16(65280), a_hi)));
+    V_STORE(p, SELECT(keep, d, res));
+    if (p == td)
+      memcpy(dst, td, num * 4);
+    num -= V_PIXELS;
+    dst += V_BYTES;
+    src += V_PIXELS;
+  }
+}
+
+#define FORMAT_32(fmt, bgr)                                                                   \
+  static SIMD_TARGET void SPRE(run_opaque_##fmt)(render_run_t * ri, int num)                  \
+  {                                                                                           \
+    SPRE(run_opaque_32)(ri, num, bgr);                                                        \
+  }                                                                                           \
+  static SIMD_TARGET void SPRE(run_opaque_a_##fmt)(render_run_t * ri, int num)                \
+  {                                                                                           \
+    SPRE(run_opaque_a_32)(ri, num, bgr);                                                      \
+  }                                                                                           \
+  static SIMD_TARGET void SPRE(run_alpha_##fmt)(render_run_t * ri, int num)                   \
+  {                                                                                           \
+    SPRE(run_alpha_32)(ri, num, bgr, 0);                                                      \
+  }                                                                                           \
+  static SIMD_TARGET void SPRE(run_alpha_a_##fmt)(render_run_t * ri, int num)                 \
+  {                                                                                           \
+    SPRE(run_alpha_32)(ri, num, bgr, 1);                                                      \
+  }                                                                                           \
+  static SIMD_TARGET void SPRE(blit_alpha_##fmt)(unsigned char *dst, const unsigned char *src, \
+                                                 unsigned char r, unsigned char g,            \
+                                                 unsigned char b, unsigned char alpha, int num) \
+  {                                                                                           \
+    /* as the scalar version, which wraps 255 to 0 */                                         \
+    if (alpha > 127)                                                                          \
+      alpha++;                                                                                \
+    SPRE(blit_alpha_32)(dst, src, r, g, b, alpha, num, bgr, 0);                               \
+  }                                                                                           \
+  static SIMD_TARGET void SPRE(blit_alpha_a_##fmt)(                                           \
+      unsigned char *dst, unsigned char *dsta, const unsigned char *src, unsigned char r,     \
+      unsigned char g, unsigned char b, unsigned char a_alpha, int num)                       \
+  {                                                                                           \
+    int alpha = a_alpha;                                                                      \
+                                                                                              \
+    if (alpha > 127)                                                                          \
+      alpha++;                                                                                \
+    SPRE(blit_alpha_32)(dst, src, r, g, b, alpha, num, bgr, 256);                             \
+  }
+
+FORMAT_32(rgba, 0)
+FORMAT_32(bgra, 1)
+
+/** 24-bit formats, the alpha being in a separate buffer **/
+
+static inline SIMD_TARGET void SPRE(adds_8)(unsigned char *d, const unsigned char *s, int n)
+{
+  for (; n >= V_BYTES; n -= V_BYTES, s += V_BYTES, d += V_BYTES)
+    V_STORE(d, V_ADDS8U(V_LOAD(d), V_LOAD(s)));
+  for (; n; n--, s++, d++)
+    *d = (*d + *s > 255) ? 255 : *d + *s;
+}
+
+static inline SIMD_TARGET void SPRE(subs_8)(unsigned char *d, const unsigned char *s, int n)
+{
+  for (; n >= V_BYTES; n -= V_BYTES, s += V_BYTES, d += V_BYTES)
+    V_STORE(d, V_SUBS8U(V_LOAD(d), INVERT(V_LOAD(s))));
+  for (; n; n--, s++, d++)
+    *d = (*d + *s < 255) ? 0 : *d + *s - 255;
+}
+
+static SIMD_TARGET void SPRE(plusl_aa_24)(composite_run_t *c, int num)
+{
+  SPRE(adds_8)(c->dst, c->src, num * 3);
+  SPRE(adds_8)(c->dsta, c->srca, num);
+}
+
+static SIMD_TARGET void SPRE(plusl_oa_24)(composite_run_t *c, int num)
+{
+  SPRE(adds_8)(c->dst, c->src, num * 3);
+  memset(c->dsta, 0xff, num);
+}
+
+static SIMD_TARGET void SPRE(plusl_ao_oo_24)(composite_run_t *c, int num)
+{
+  SPRE(adds_8)(c->dst, c->src, num * 3);
+}
+
+static SIMD_TARGET void SPRE(plusd_aa_24)(composite_run_t *c, int num)
+{
+  SPRE(subs_8)(c->dst, c->src, num * 3);
+  SPRE(adds_8)(c->dsta, c->srca, num);
+}
+
+static SIMD_TARGET void SPRE(plusd_oa_24)(composite_run_t *c, int num)
+{
+  SPRE(subs_8)(c->dst, c->src, num * 3);
+  memset(c->dsta, 0xff, num);
+}
+
+static SIMD_TARGET void SPRE(plusd_ao_oo_24)(composite_run_t *c, int num)
+{
+  SPRE(subs_8)(c->dst, c->src, num * 3);
+}
+
+/* the source scaled by the fraction, over the destination */
+static SIMD_TARGET void SPRE(dissolve_oo_24)(composite_run_t *c, int num)
+{
+  unsigned char *s = c->src, *d = c->dst;
+  int f = c->fraction, n = num * 3;
+  V k = V_SET1_16(f), ik = V_SET1_16(255 - f);
+  V vs, vd;
+
+  while (n > 0) {
+    unsigned char ts[V_BYTES] = {0}, td[V_BYTES] = {0};
+    unsigned char *p = (n >= V_BYTES) ? d : td;
+
+    if (p == td) {
+      memcpy(ts, s, n);
+      memcpy(td, d, n);
+    }
+    vs = V_LOAD(p == td ? ts : s);
+    vd = V_LOAD(p);
+    V_STORE(p, PACK8(V_ADD16(MULDIV(LO16(vs), k, 0xff), MULDIV(LO16(vd), ik, 0xff)),
+                     V_ADD16(MULDIV(HI16(vs), k, 0xff), MULDIV(HI16(vd), ik, 0xff))));
+    if (p == td)
+      memcpy(d, td, n);
+    n -= V_BYTES;
+    s += V_BYTES;
+    d += V_BYTES;
+  }
+}
+
+/* 3 vectors hold a whole number of pixels */
+static inline SIMD_TARGET void SPRE(run_opaque_24)(render_run_t *ri, int num, int bgr)
+{
+  unsigned char *dst = ri->dst;
+  unsigned char c[3] = {ri->r, ri->g, ri->b};
+  unsigned char pat[3 * V_BYTES];
+  int i, n = num * 3;
+  V p0, p1, p2;
+
+  if (bgr) {
+    c[0] = ri->b;
+    c[2] = ri->r;
+  }
+  if (n < 3 * V_BYTES) {
+    for (i = 0; i < n; i++)
+      dst[i] = c[i % 3];
+    return;
+  }
+
+  for (i = 0; i < 3 * V_BYTES; i++)
+    pat[i] = c[i % 3];
+  p0 = V_LOAD(pat);
+  p1 = V_LOAD(pat + V_BYTES);
+  p2 = V_LOAD(pat + 2 * V_BYTES);
+  for (; n >= 3 * V_BYTES; n -= 3 * V_BYTES, dst += 3 * V_BYTES) {
+    V_STORE(dst, p0);
+    V_STORE(dst + V_BYTES, p1);
+    V_STORE(dst + 2 * V_BYTES, p2);
+  }
+  memcpy(dst, pat, n);
+}
+
+static inline SIMD_TARGET void SPRE(run_alpha_24)(render_run_t *ri, int num, int bgr)
+{
+  unsigned char *dst = ri->dst;
+  int a = ri->a, c[3] = {ri->r * a, ri->g * a, ri->b * a};
+  int i, j, l, n = num * 3, t;
+  /* c * a + 0xff for each byte of 3 vectors, as low and high lanes */
+  unsigned short ck[3][2][V_BYTES / 2];
+  V m = V_SET1_16(255 - a), d;
+
+  if (bgr) {
+    t = c[0];
+    c[0] = c[2];
+    c[2] = t;
+  }
+  if (n < 3 * V_BYTES) {
+    for (i = 0; i < n; i++)
+      dst[i] = (c[i % 3] + dst[i] * (255 - a) + 0xff) >> 8;
+    return;
+  }
+
+  for (j = 0; j < 3; j++) {
+    for (l = 0; l < V_BYTES / 2; l++) {
+      ck[j][0][l] = c[(j * V_BYTES + LO_BYTE(l)) % 3] + 0xff;
+      ck[j][1][l] = c[(j * V_BYTES + LO_BYTE(l) + 8) % 3] + 0xff;
+    }
+  }
+
+  for (j = 0; n > 0; j = (j + 1) % 3) {
+    unsigned char td[V_BYTES] = {0};
+    unsigned char *p = (n >= V_BYTES) ? dst : td;
+
+    if (p == td)
+      memcpy(td, dst, n);
+    d = V_LOAD(p);
+    V_STORE(p, PACK8(V_SRLI16(V_ADD16(V_LOAD(ck[j][0]), V_MULLO16(LO16(d), m)), 8),
+                     V_SRLI16(V_ADD16(V_LOAD(ck[j][1]), V_MULLO16(HI16(d), m)), 8)));
+    if (p == td)
+      memcpy(dst, td, n);
+    n -= V_BYTES;
+    dst += V_BYTES;
+  }
+}
+
+/* na = (na * a + 0xffff - (a << 8)) >> 8, with a = 255 - alpha */
+static inline SIMD_TARGET void SPRE(run_alpha_8)(unsigned char *dsta, int alpha, int num)
+{
+  int a = 255 - alpha, k = 0xffff - (a << 8);
+  V m = V_SET1_16(a), vk = V_SET1_16(k), d;
+
+  for (; num >= V_BYTES; num -= V_BYTES, dsta += V_BYTES) {
+    d = V_LOAD(dsta);
+    V_STORE(dsta, V_PACKUS16(V_SRLI16(V_ADD16(V_MULLO16(LO16(d), m), vk), 8),
+                             V_SRLI16(V_ADD16(V_MULLO16(HI16(d), m), vk), 8)));
+  }
+  for (; num; num--, dsta++)
+    *dsta = (*dsta * a + k) >> 8;
+}
+
+#define FORMAT_24(fmt, bgr)                                                  \
+  static SIMD_TARGET void SPRE(run_opaque_##fmt)(render_run_t * ri, int num) \
+  {                                                                          \
+    SPRE(run_opaque_24)(ri, num, bgr);                                       \
+  }                                                                          \
+  static SIMD_TARGET void SPRE(run_opaque_a_##fmt)(render_run_t * ri, int num) \
+  {                                                                          \
+    SPRE(run_opaque_24)(ri, num, bgr);                                       \
+    memset(ri->dsta, 0xff, num);                                             \
+  }                                                                          \
+  static SIMD_TARGET void SPRE(run_alpha_##fmt)(render_run_t * ri, int num)  \
+  {                                                                          \
+    SPRE(run_alpha_24)(ri, num, bgr);                                        \
+  }                                                                          \
+  static SIMD_TARGET void SPRE(run_alpha_a_##fmt)(render_run_t * ri, int num) \
+  {                                                                          \
+    SPRE(run_alpha_24)(ri, num, bgr);                                        \
+    SPRE(run_alpha_8)(ri->dsta, ri->a, num);                                 \
+  }
+
+FORMAT_24(rgb, 0)
+FORMAT_24(bgr, 1)
+
+/** the table **/
+
+static void SPRE(setup_draw_info)(draw_info_t *di)
+{
+  switch (di->how) {
+    case DI_32_RGBA:
+    case DI_32_BGRA:
+      if (di->how == DI_32_RGBA) {
+        di->render_run_opaque = SPRE(run_opaque_rgba);
+        di->render_run_opaque_a = SPRE(run_opaque_a_rgba);
+        di->render_run_alpha = SPRE(run_alpha_rgba);
+        di->render_run_alpha_a = SPRE(run_alpha_a_rgba);
+        di->render_blit_alpha = SPRE(blit_alpha_rgba);
+        di->render_blit_alpha_a = SPRE(blit_alpha_a_rgba);
+        di->read_pixels_o = SPRE(read_rgba_o_32);
+        di->read_pixels_a = SPRE(read_rgba_a_32);
+      } else {
+        di->render_run_opaque = SPRE(run_opaque_bgra);
+        di->render_run_opaque_a = SPRE(run_opaque_a_bgra);
+        di->render_run_alpha = SPRE(run_alpha_bgra);
+        di->render_run_alpha_a = SPRE(run_alpha_a_bgra);
+        di->render_blit_alpha = SPRE(blit_alpha_bgra);
+        di->render_blit_alpha_a = SPRE(blit_alpha_a_bgra);
+        di->read_pixels_o = SPRE(read_bgra_o_32);
+        di->read_pixels_a = SPRE(read_bgra_a_32);
+      }
+      di->composite_sover_aa = SPRE(sover_aa_32);
+      di->composite_sover_ao = SPRE(sover_ao_32);
+      di->composite_sin_aa = SPRE(sin_aa_32);
+      di->composite_sin_oa = SPRE(sin_oa_32);
+      di->composite_sout_aa = SPRE(sout_aa_32);
+      di->composite_sout_oa = SPRE(sout_oa_32);
+      di->composite_satop_aa = SPRE(satop_aa_32);
+      di->composite_dover_aa = SPRE(dover_aa_32);
+      di->composite_dover_oa = SPRE(dover_oa_32);
+      di->composite_din_aa = SPRE(din_aa_32);
+      di->composite_dout_aa = SPRE(dout_aa_32);
+      di->composite_datop_aa = SPRE(datop_aa_32);
+      di->composite_xor_aa = SPRE(xor_aa_32);
+      di->composite_plusl_aa = SPRE(plusl_aa_32);
+      di->composite_plusl_oa = SPRE(plusl_oa_32);
+      di->composite_plusl_ao = SPRE(plusl_ao_oo_32);
+      di->composite_plusl_oo = SPRE(plusl_ao_oo_32);
+      di->composite_plusd_aa = SPRE(plusd_aa_32);
+      di->composite_plusd_oa = SPRE(plusd_oa_32);
+      di->composite_plusd_ao = SPRE(plusd_ao_oo_32);
+      di->composite_plusd_oo = SPRE(plusd_ao_oo_32);
+      di->dissolve_aa = SPRE(dissolve_aa_32);
+      di->dissolve_ao = SPRE(dissolve_ao_32);
+      di->dissolve_oa = SPRE(dissolve_oa_32);
+      di->dissolve_oo = SPRE(dissolve_oo_32);
+      break;
+
+    case DI_24_RGB:
+    case DI_24_BGR:
+      if (di->how == DI_24_RGB) {
+        di->render_run_opaque = SPRE(run_opaque_rgb);
+        di->render_run_opaque_a = SPRE(run_opaque_a_rgb);
+        di->render_run_alpha = SPRE(run_alpha_rgb);
+        di->render_run_alpha_a = SPRE(run_alpha_a_rgb);
+      } else {
+        di->render_run_opaque = SPRE(run_opaque_bgr);
+        di->render_run_opaque_a = SPRE(run_opaque_a_bgr);
+        di->render_run_alpha = SPRE(run_alpha_bgr);
+        di->render_run_alpha_a = SPRE(run_alpha_a_bgr);
+      }
+      di->composite_plusl_aa = SPRE(plusl_aa_24);
+      di->composite_plusl_oa = SPRE(plusl_oa_24);
+      di->composite_plusl_ao = SPRE(plusl_ao_oo_24);
+      di->composite_plusl_oo = SPRE(plusl_ao_oo_24);
+      di->composite_plusd_aa = SPRE(plusd_aa_24);
+      di->composite_plusd_oa = SPRE(plusd_oa_24);
+      di->composite_plusd_ao = SPRE(plusd_ao_oo_24);
+      di->composite_plusd_oo = SPRE(plusd_ao_oo_24);
+      di->dissolve_oo = SPRE(dissolve_oo_24);
+      break;
+  }
+}
+
+#undef LO16
+#undef HI16
+#undef PACK8
+#undef ALPHA16
+#undef MULDIV
+#undef SELECT
+#undef AMASK
+#undef ALPHA_IS
+#undef INVERT
+#undef SUB255
+#undef LO_BYTE
+#undef NO_SETUP
+#undef FRACTION_SETUP
+#undef COMPOSITE_32
+#undef FORMAT_32
+#undef FORMAT_24
@@ -0,0 +1,232 @@
+/*
+   Copyright (C) 2026 NEXTSPACE Team
+
+   This file is part of GNUstep.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; see the file COPYING.LIB.
+   If not, see <http://www.gnu.org/licenses/> or write to the
+   Free Software Foundation, 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include <string.h>
+#include <strings.h>
+
+#include <Foundation/NSDebug.h>
+
+#include "blit.h"
+
+/*
+The vector blitters are compiled with per-function target attributes, so
+the backend itself still runs on any x86 CPU. The instruction set is
+picked when the draw info is set up.
+*/
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BLIT_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+static int simd_level = -1;
+
+#ifdef BLIT_X86_SIMD
+
+#define NPRE(r, pre) pre##_##r
+#define M2PRE(a, b) NPRE(a, b)
+#define SPRE(r) M2PRE(r, SIMD_INSTANCE)
+
+/* SSE2, 4 pixels per vector */
+#define SIMD_INSTANCE sse2
+#define SIMD_TARGET __attribute__((target("sse2")))
+
+#define V __m128i
+#define V_BYTES 16
+#define V_PIXELS 4
+#define V_LOAD(p) _mm_loadu_si128((const __m128i *)(p))
+#define V_STORE(p, v) _mm_storeu_si128((__m128i *)(p), v)
+#define V_ZERO _mm_setzero_si128()
+#define V_SET1_16(x) _mm_set1_epi16(x)
+#define V_SET1_32(x) _mm_set1_epi32(x)
+#define V_SET1_64(x) _mm_set1_epi64x(x)
+#define V_AND(a, b) _mm_and_si128(a, b)
+#define V_ANDNOT(a, b) _mm_andnot_si128(a, b)
+#define V_OR(a, b) _mm_or_si128(a, b)
+#define V_ADD16(a, b) _mm_add_epi16(a, b)
+#define V_SUB16(a, b) _mm_sub_epi16(a, b)
+#define V_ADD32(a, b) _mm_add_epi32(a, b)
+#define V_MULLO16(a, b) _mm_mullo_epi16(a, b)
+#define V_MULHI16U(a, b) _mm_mulhi_epu16(a, b)
+#define V_MADD16(a, b) _mm_madd_epi16(a, b)
+#define V_SRLI16(v, n) _mm_srli_epi16(v, n)
+#define V_SRLI32(v, n) _mm_srli_epi32(v, n)
+#define V_SLLI32(v, n) _mm_slli_epi32(v, n)
+#define V_CMPEQ32(a, b) _mm_cmpeq_epi32(a, b)
+#define V_ADDS8U(a, b) _mm_adds_epu8(a, b)
+#define V_SUBS8U(a, b) _mm_subs_epu8(a, b)
+#define V_UNPACKLO8(a, b) _mm_unpacklo_epi8(a, b)
+#define V_UNPACKHI8(a, b) _mm_unpackhi_epi8(a, b)
+#define V_UNPACKLO16(a, b) _mm_unpacklo_epi16(a, b)
+#define V_UNPACKHI16(a, b) _mm_unpackhi_epi16(a, b)
+#define V_PACKUS16(a, b) _mm_packus_epi16(a, b)
+#define V_PACKS32(a, b) _mm_packs_epi32(a, b)
+#define V_SHUFFLELO16(v, i) _mm_shufflelo_epi16(v, i)
+#define V_SHUFFLEHI16(v, i) _mm_shufflehi_epi16(v, i)
+
+/* the coverage byte of each pixel in its 4 bytes */
+static inline SIMD_TARGET __m128i sse2_coverage(const unsigned char *src)
+{
+  int c;
+  __m128i v;
+
+  memcpy(&c, src, 4);
+  v = _mm_cvtsi32_si128(c);
+  v = _mm_unpacklo_epi8(v, v);
+  return _mm_unpacklo_epi16(v, v);
+}
+#define V_COVERAGE(p) sse2_coverage(p)
+
+#include "blit-simd-template.h"
+
+#undef SIMD_INSTANCE
+#undef SIMD_TARGET
+#undef V
+#undef V_BYTES
+#undef V_PIXELS
+#undef V_LOAD
+#undef V_STORE
+#undef V_ZERO
+#undef V_SET1_16
+#undef V_SET1_32
+#undef V_SET1_64
+#undef V_AND
+#undef V_ANDNOT
+#undef V_OR
+#undef V_ADD16
+#undef V_SUB16
+#undef V_ADD32
+#undef V_MULLO16
+#undef V_MULHI16U
+#undef V_MADD16
+#undef V_SRLI16
+#undef V_SRLI32
+#undef V_SLLI32
+#undef V_CMPEQ32
+#undef V_ADDS8U
+#undef V_SUBS8U
+#undef V_UNPACKLO8
+#undef V_UNPACKHI8
+#undef V_UNPACKLO16
+#undef V_UNPACKHI16
+#undef V_PACKUS16
+#undef V_PACKS32
+#undef V_SHUFFLELO16
+#undef V_SHUFFLEHI16
+#undef V_COVERAGE
+
+/*
+AVX2, 8 pixels per vector. The unpack and pack instructions work on each
+128-bit half, which keeps the pixels in order as long as both are used in
+pairs, as they are in blit-simd-template.h.
+*/
+#define SIMD_INSTANCE avx2
+#define SIMD_TARGET __attribute__((target("avx2")))
+
+#define V __m256i
+#define V_BYTES 32
+#define V_PIXELS 8
+#define V_LOAD(p) _mm256_loadu_si256((const __m256i *)(p))
+#define V_STORE(p, v) _mm256_storeu_si256((__m256i *)(p), v)
+#define V_ZERO _mm256_setzero_si256()
+#define V_SET1_16(x) _mm256_set1_epi16(x)
+#define V_SET1_32(x) _mm256_set1_epi32(x)
+#define V_SET1_64(x) _mm256_set1_epi64x(x)
+#define V_AND(a, b) _mm256_and_si256(a, b)
+#define V_ANDNOT(a, b) _mm256_andnot_si256(a, b)
+#define V_OR(a, b) _mm256_or_si256(a, b)
+#define V_ADD16(a, b) _mm256_add_epi16(a, b)
+#define V_SUB16(a, b) _mm256_sub_epi16(a, b)
+#define V_ADD32(a, b) _mm256_add_epi32(a, b)
+#define V_MULLO16(a, b) _mm256_mullo_epi16(a, b)
+#define V_MULHI16U(a, b) _mm256_mulhi_epu16(a, b)
+#define V_MADD16(a, b) _mm256_madd_epi16(a, b)
+#define V_SRLI16(v, n) _mm256_srli_epi16(v, n)
+#define V_SRLI32(v, n) _mm256_srli_epi32(v, n)
+#define V_SLLI32(v, n) _mm256_slli_epi32(v, n)
+#define V_CMPEQ32(a, b) _mm256_cmpeq_epi32(a, b)
+#define V_ADDS8U(a, b) _mm256_adds_epu8(a, b)
+#define V_SUBS8U(a, b) _mm256_subs_epu8(a, b)
+#define V_UNPACKLO8(a, b) _mm256_unpacklo_epi8(a, b)
+#define V_UNPACKHI8(a, b) _mm256_unpackhi_epi8(a, b)
+#define V_UNPACKLO16(a, b) _mm256_unpacklo_epi16(a, b)
+#define V_UNPACKHI16(a, b) _mm256_unpackhi_epi16(a, b)
+#define V_PACKUS16(a, b) _mm256_packus_epi16(a, b)
+#define V_PACKS32(a, b) _mm256_packs_epi32(a, b)
+#define V_SHUFFLELO16(v, i) _mm256_shufflelo_epi16(v, i)
+#define V_SHUFFLEHI16(v, i) _mm256_shufflehi_epi16(v, i)
+
+static inline SIMD_TARGET __m256i avx2_coverage(const unsigned char *src)
+{
+  __m128i v = _mm_loadl_epi64((const __m128i *)src);
+
+  return _mm256_mullo_epi32(_mm256_cvtepu8_epi32(v), _mm256_set1_epi32(0x01010101));
+}
+#define V_COVERAGE(p) avx2_coverage(p)
+
+#include "blit-simd-template.h"
+
+static int cpu_simd_level(void)
+{
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return DI_SIMD_AVX2;
+  if (__builtin_cpu_supports("sse2"))
+    return DI_SIMD_SSE2;
+  return DI_SIMD_NONE;
+}
+
+#else
+
+static int cpu_simd_level(void)
+{
+  return DI_SIMD_NONE;
+}
+
+#endif /* BLIT_X86_SIMD */
+
+int artcontext_setup_simd(const char *isa)
+{
+  simd_level = cpu_simd_level();
+
+  if (isa && !strcasecmp(isa, "none") && simd_level > DI_SIMD_NONE)
+    simd_level = DI_SIMD_NONE;
+  else if (isa && !strcasecmp(isa, "sse2") && simd_level > DI_SIMD_SSE2)
+    simd_level = DI_SIMD_SSE2;
+
+  NSDebugLLog(@"back-art", @"vector blitters: %s",
+              simd_level == DI_SIMD_AVX2 ? "avx2" : simd_level == DI_SIMD_SSE2 ? "sse2" : "none");
+
+  return simd_level;
+}
+
+void artcontext_setup_simd_draw_info(draw_info_t *di)
+{
+  if (simd_level < 0)
+    artcontext_setup_simd(NULL);
+
+#ifdef BLIT_X86_SIMD
+  if (simd_level == DI_SIMD_AVX2)
+    avx2_setup_draw_info(di);
+  else if (simd_level == DI_SIMD_SSE2)
+    sse2_setup_draw_info(di);
+#endif
+}
@@ -92,6 +92,9 @@ typedef struct draw_info_s {
   /* dst should be a 32bpp RGBA buffer. */
   void (*read_pixels_o)(composite_run_t *c, int num);
   void (*read_pixels_a)(composite_run_t *c, int num);
+  /* src should be a 32bpp RGBA buffer, premultiplied. */
+  void (*write_pixels_o)(composite_run_t *c, int num);
+  void (*write_pixels_a)(composite_run_t *c, int num);
 
   void (*composite_sover_aa)(composite_run_t *c, int num);
   void (*composite_sover_ao)(composite_run_t *c, int num);
@@ -148,4 +151,18 @@ void artcontext_setup_draw_info(draw_info_t *di, unsigned int red_mask,
                                 int bpp);
 void artcontext_setup_gamma(float gamma);
 
+/* instruction sets of the vector blitters (blit-simd.m) */
+#define DI_SIMD_NONE 0
+#define DI_SIMD_SSE2 1
+#define DI_SIMD_AVX2 2
+
+/*
+Limits the vector blitters used by artcontext_setup_draw_info() to 'isa'
+("none", "sse2" or "avx2"; NULL for the best one the CPU supports) and
+returns the DI_SIMD_* level in use.
+*/
+int artcontext_setup_simd(const char *isa);
+/* replaces the scalar blitters of 'di' with the vector ones, if any */
+void artcontext_setup_simd_draw_info(draw_info_t *di);
+
 #endif
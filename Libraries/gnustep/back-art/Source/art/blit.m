@@ -425,6 +425,31 @@ static void MPRE(read_pixels_a)(composite_run_t *c, int num)
   }
 }
 
+static void MPRE(write_pixels_o)(composite_run_t *c, int num)
+{
+  const unsigned char *s = c->src;
+  BLEND_TYPE *dst = (BLEND_TYPE *)c->dst;
+
+  for (; num; num--, s += 4) {
+    BLEND_WRITE(dst, s[0], s[1], s[2])
+    BLEND_INC(dst)
+  }
+}
+
+static void MPRE(write_pixels_a)(composite_run_t *c, int num)
+{
+  const unsigned char *s = c->src;
+  BLEND_TYPE *dst = (BLEND_TYPE *)c->dst;
+#ifndef INLINE_ALPHA
+  unsigned char *dst_alpha = c->dsta;
+#endif
+
+  for (; num; num--, s += 4) {
+    BLEND_WRITE_ALPHA(dst, dst_alpha, s[0], s[1], s[2], s[3])
+    ALPHA_INC(dst, dst_alpha)
+  }
+}
+
 /* 1 : 1 - srca */
 static void MPRE(sover_aa)(composite_run_t *c, int num)
 {
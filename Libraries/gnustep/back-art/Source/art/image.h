@@ -0,0 +1,94 @@
+/*
+   Copyright (C) 2026 NEXTSPACE Team
+
+   This file is part of GNUstep.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; see the file COPYING.LIB.
+   If not, see <http://www.gnu.org/licenses/> or write to the
+   Free Software Foundation, 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef image_h
+#define image_h
+
+#include "blit.h"
+
+/*
+Drawing of images which aren't rotated, flipped or sheared, for DPSimage:
+the most common case by far (icons, and images drawn at their size or
+scaled to fit). The image is 8 bit RGB or premultiplied RGBA, not planar.
+
+Rows are converted to RGBA, then written to the window with
+write_pixels_*, or composited with composite_sover_* where the image is
+partly transparent.
+*/
+
+/* each pixel of the image is one pixel of the window */
+#define IMAGE_TRANSLATE 1
+/* each pixel of the image is scale_x * scale_y pixels of the window */
+#define IMAGE_UPSCALE 2
+/* each pixel of the window is the average of a box of pixels of the
+   image */
+#define IMAGE_DOWNSCALE 3
+/* each pixel of the image is one pixel of the window, and the image is
+   already in the format of the window (see image_cache.h) */
+#define IMAGE_DEVICE 4
+
+typedef struct {
+  int kind;
+
+  const unsigned char *src;
+  int width, height, bytes_per_row;
+  int has_alpha; /* RGBA, otherwise RGB */
+
+  /* IMAGE_DEVICE: the alpha of the image, width bytes per row, if the
+     format has no alpha in the pixels; and whether it is opaque */
+  const unsigned char *src_alpha;
+  int opaque;
+
+  /* the window pixel of the top left corner of the image, and its size */
+  int x, y, sx, sy;
+
+  int scale_x, scale_y;
+  /* IMAGE_DOWNSCALE: the first image column (row) of each window column
+     (row) of the image, sx + 1 (sy + 1) entries */
+  int *columns, *rows;
+
+  /* the window */
+  draw_info_t *di;
+  unsigned char *data, *alpha;
+  int bytes_per_line, alpha_per_line;
+  int window_alpha;
+
+  /* the part of the image that is drawn: columns x0 .. x1 - 1 of the
+     window, and rows y0 .. y0 + (number of rows) - 1 */
+  int x0, x1, y0;
+
+  /* the clip spans (see ARTGState.h), or NULL */
+  int clip_x0, clip_y0;
+  unsigned int *clip_span, *clip_index;
+} image_draw_t;
+
+/*
+Sets up the tables of IMAGE_DOWNSCALE for an image drawn at sx * sy
+pixels. Returns 0 if they couldn't be allocated.
+*/
+int image_setup_downscale(image_draw_t *d);
+void image_free(image_draw_t *d);
+
+/* Draws rows y0 + first .. y0 + last - 1. Suits art_run_bands(). */
+void image_draw_rows(void *data, int first, int last);
+
+#endif
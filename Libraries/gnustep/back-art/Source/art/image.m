@@ -0,0 +1,251 @@
+/*
+   Copyright (C) 2026 NEXTSPACE Team
+
+   This file is part of GNUstep.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; see the file COPYING.LIB.
+   If not, see <http://www.gnu.org/licenses/> or write to the
+   Free Software Foundation, 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "image.h"
+
+/* pixels converted at a time */
+#define CHUNK 256
+
+int image_setup_downscale(image_draw_t *d)
+{
+  int i;
+
+  d->columns = malloc(sizeof(int) * (d->sx + d->sy + 2));
+  if (!d->columns)
+    return 0;
+  d->rows = d->columns + d->sx + 1;
+
+  /* sx <= width, so every column has at least one image column */
+  for (i = 0; i <= d->sx; i++)
+    d->columns[i] = (long long)i * d->width / d->sx;
+  for (i = 0; i <= d->sy; i++)
+    d->rows[i] = (long long)i * d->height / d->sy;
+
+  return 1;
+}
+
+void image_free(image_draw_t *d)
+{
+  free(d->columns);
+  d->columns = d->rows = NULL;
+}
+
+/* the RGBA pixels of window columns a .. a + num - 1 of window row y */
+static void image_fetch(image_draw_t *d, int y, int a, int num, unsigned char *rgba)
+{
+  int bpp = d->has_alpha ? 4 : 3;
+  const unsigned char *s;
+  int i;
+
+  switch (d->kind) {
+    case IMAGE_TRANSLATE:
+      s = d->src + (y - d->y) * d->bytes_per_row + (a - d->x) * bpp;
+      if (d->has_alpha) {
+        memcpy(rgba, s, num * 4);
+      } else {
+        for (i = 0; i < num; i++, s += 3, rgba += 4) {
+          rgba[0] = s[0];
+          rgba[1] = s[1];
+          rgba[2] = s[2];
+          rgba[3] = 255;
+        }
+      }
+      break;
+
+    case IMAGE_UPSCALE: {
+      int column = (a - d->x) / d->scale_x, phase = (a - d->x) % d->scale_x;
+
+      s = d->src + ((y - d->y) / d->scale_y) * d->bytes_per_row + column * bpp;
+      for (i = 0; i < num; i++, rgba += 4) {
+        rgba[0] = s[0];
+        rgba[1] = s[1];
+        rgba[2] = s[2];
+        rgba[3] = d->has_alpha ? s[3] : 255;
+        if (++phase == d->scale_x) {
+          phase = 0;
+          s += bpp;
+        }
+      }
+      break;
+    }
+
+    case IMAGE_DOWNSCALE: {
+      int r0 = d->rows[y - d->y], r1 = d->rows[y - d->y + 1];
+      int c, c0, c1, x, n, r, g, b, al;
+      const unsigned char *row;
+
+      for (i = 0; i < num; i++, rgba += 4) {
+        c = a - d->x + i;
+        c0 = d->columns[c];
+        c1 = d->columns[c + 1];
+        n = (r1 - r0) * (c1 - c0);
+
+        r = g = b = al = 0;
+        for (row = d->src + r0 * d->bytes_per_row; row < d->src + r1 * d->bytes_per_row;
+             row += d->bytes_per_row) {
+          for (x = c0, s = row + c0 * bpp; x < c1; x++, s += bpp) {
+            r += s[0];
+            g += s[1];
+            b += s[2];
+            if (d->has_alpha)
+              al += s[3];
+          }
+        }
+        rgba[0] = (r + n / 2) / n;
+        rgba[1] = (g + n / 2) / n;
+        rgba[2] = (b + n / 2) / n;
+        rgba[3] = d->has_alpha ? (al + n / 2) / n : 255;
+      }
+      break;
+    }
+  }
+}
+
+/* IMAGE_DEVICE: copies or composites the pixels of the image */
+static void image_draw_device_span(image_draw_t *d, int y, int a, int b)
+{
+  draw_info_t *di = d->di;
+  int bpp = di->bytes_per_pixel;
+  composite_run_t c;
+
+  c.dst = d->data + y * d->bytes_per_line + a * bpp;
+  c.dsta = d->alpha + y * d->alpha_per_line + a;
+  c.src = (unsigned char *)d->src + (y - d->y) * d->bytes_per_row + (a - d->x) * bpp;
+  if (di->inline_alpha)
+    c.srca = c.src;
+  else if (d->src_alpha)
+    c.srca = (unsigned char *)d->src_alpha + (y - d->y) * d->width + (a - d->x);
+  else
+    c.srca = NULL;
+  c.fraction = 255;
+
+  if (d->opaque) {
+    /* pixels with alpha in them are opaque already */
+    memcpy(c.dst, c.src, (b - a) * bpp);
+    if (d->window_alpha && !di->inline_alpha)
+      memset(c.dsta, 0xff, b - a);
+  } else if (d->window_alpha) {
+    di->composite_sover_aa(&c, b - a);
+  } else {
+    di->composite_sover_ao(&c, b - a);
+  }
+}
+
+/* draws window columns a .. b - 1 of window row y */
+static void image_draw_span(image_draw_t *d, int y, int a, int b)
+{
+  unsigned char rgba[CHUNK * 4], tmp[CHUNK * 4], tmpa[CHUNK];
+  draw_info_t *di = d->di;
+  int bpp = di->bytes_per_pixel;
+  unsigned char *dst, *dsta;
+  composite_run_t c;
+  int num, i, j, kind;
+
+  if (d->kind == IMAGE_DEVICE) {
+    image_draw_device_span(d, y, a, b);
+    return;
+  }
+
+  while (a < b) {
+    num = b - a < CHUNK ? b - a : CHUNK;
+    image_fetch(d, y, a, num, rgba);
+    dst = d->data + y * d->bytes_per_line + a * bpp;
+    dsta = d->alpha + y * d->alpha_per_line + a;
+
+    /* runs of transparent pixels are skipped, opaque ones written, and
+       the others composited */
+    for (i = 0; i < num; i = j) {
+      kind = rgba[i * 4 + 3] == 255 ? 2 : rgba[i * 4 + 3] ? 1 : 0;
+      for (j = i + 1; j < num; j++) {
+        if ((rgba[j * 4 + 3] == 255 ? 2 : rgba[j * 4 + 3] ? 1 : 0) != kind)
+          break;
+      }
+
+      c.dst = dst + i * bpp;
+      c.dsta = dsta + i;
+      c.src = rgba + i * 4;
+      c.srca = NULL;
+      c.fraction = 255;
+      if (kind == 2) {
+        if (d->window_alpha)
+          di->write_pixels_a(&c, j - i);
+        else
+          di->write_pixels_o(&c, j - i);
+      } else if (kind == 1) {
+        c.dst = tmp;
+        c.dsta = tmpa;
+        di->write_pixels_a(&c, j - i);
+
+        c.dst = dst + i * bpp;
+        c.dsta = dsta + i;
+        c.src = tmp;
+        c.srca = tmpa;
+        if (d->window_alpha)
+          di->composite_sover_aa(&c, j - i);
+        else
+          di->composite_sover_ao(&c, j - i);
+      }
+    }
+
+    a += num;
+  }
+}
+
+void image_draw_rows(void *data, int first, int last)
+{
+  image_draw_t *d = data;
+  unsigned int *span, *end;
+  int i, y, x, x_end, next;
+  int state;
+
+  for (i = first; i < last; i++) {
+    y = d->y0 + i;
+    if (!d->clip_span) {
+      image_draw_span(d, y, d->x0, d->x1);
+      continue;
+    }
+
+    /* the spans are relative to clip_x0, and toggle between clipped and
+       drawn from clipped */
+    span = &d->clip_span[d->clip_index[y - d->clip_y0]];
+    end = &d->clip_span[d->clip_index[y - d->clip_y0 + 1]];
+    x = d->x0 - d->clip_x0;
+    x_end = d->x1 - d->clip_x0;
+
+    state = 0;
+    while (span != end && *span <= x) {
+      state = !state;
+      span++;
+    }
+    while (x < x_end) {
+      next = (span != end && *span < x_end) ? *span : x_end;
+      if (state && next > x)
+        image_draw_span(d, y, x + d->clip_x0, next + d->clip_x0);
+      x = next;
+      state = !state;
+      span++;
+    }
+  }
+}
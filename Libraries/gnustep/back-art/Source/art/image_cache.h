@@ -0,0 +1,91 @@
+/*
+   Copyright (C) 2026 NEXTSPACE Team
+
+   This file is part of GNUstep.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; see the file COPYING.LIB.
+   If not, see <http://www.gnu.org/licenses/> or write to the
+   Free Software Foundation, 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef image_cache_h
+#define image_cache_h
+
+#include <stddef.h>
+
+#include "blit.h"
+
+/*
+The pixels of bitmap images converted to the format of the windows, for
+images drawn over and over at their size (icons, mostly). Drawing such an
+image is then a copy, or a composite run, per row.
+
+An entry is identified by the image (the NSBitmapImageRep, which isn't
+retained) and the draw_info_t it was converted for. Bitmaps don't tell
+when their samples change, so every lookup checks the samples against a
+checksum taken when the entry was made, which also catches an image freed
+and another one allocated at the same address. Stale entries are
+converted again.
+
+The image is 8 bit RGB or premultiplied RGBA, not planar. The cache is
+limited in memory, and evicts the images that were least recently drawn.
+*/
+
+typedef struct image_cache_s {
+  struct image_cache_s *hash_next;
+  struct image_cache_s *lru_prev, *lru_next;
+  size_t size; /* bytes used by the entry */
+
+  const void *image;
+  const draw_info_t *di;
+
+  /* what the pixels were converted from */
+  const unsigned char *src;
+  int width, height, bytes_per_row;
+  int has_alpha;
+  unsigned long long checksum;
+
+  /* no pixel is transparent, the rows can be copied */
+  int opaque;
+  /* width * di->bytes_per_pixel bytes per row, and width bytes per row of
+     alpha if the format has no alpha in the pixels and the image isn't
+     opaque (otherwise NULL) */
+  unsigned char *data, *alpha;
+} image_cache_t;
+
+/* the default limit, in bytes */
+#define IMAGE_CACHE_SIZE (4 * 1024 * 1024)
+
+/* Sets the memory limit of the cache, 0 to disable it. */
+void image_cache_set_limit(size_t bytes);
+int image_cache_enabled(void);
+
+/*
+Returns the pixels of the image in the format of 'di', converting them if
+they aren't cached or have changed since, or NULL if the image is too
+large to be cached or memory is short.
+*/
+image_cache_t *image_cache_get(const void *image, const draw_info_t *di, const unsigned char *src,
+                               int width, int height, int bytes_per_row, int has_alpha);
+
+/* the number of lookups which had to convert the image (or failed) */
+unsigned long image_cache_misses(void);
+
+/* counters since the start, for the "back-art-image-cache" debug log */
+void image_cache_statistics(unsigned long *hits, unsigned long *misses,
+                            unsigned long *invalidations, unsigned long *evictions,
+                            size_t *memory);
+
+#endif
@@ -0,0 +1,257 @@
+/*
+   Copyright (C) 2026 NEXTSPACE Team
+
+   This file is part of GNUstep.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; see the file COPYING.LIB.
+   If not, see <http://www.gnu.org/licenses/> or write to the
+   Free Software Foundation, 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "image_cache.h"
+
+#define NUM_BUCKETS 256
+
+/* pixels converted at a time */
+#define CHUNK 256
+
+static image_cache_t *buckets[NUM_BUCKETS];
+/* lru_first is the most recently used image */
+static image_cache_t *lru_first, *lru_last;
+
+static size_t limit = IMAGE_CACHE_SIZE;
+static size_t memory;
+static unsigned long hits, misses, invalidations, evictions;
+
+static unsigned int image_hash(const void *image, const draw_info_t *di)
+{
+  size_t h = (size_t)image ^ ((size_t)di >> 4);
+
+  return (unsigned int)(h >> 4 ^ h >> 12);
+}
+
+/* FNV-1a over 8 byte words, it only has to notice changes */
+static unsigned long long image_checksum(const unsigned char *src, int row_bytes, int height,
+                                         int bytes_per_row)
+{
+  unsigned long long h = 14695981039346656037ull, w;
+  const unsigned char *s, *end;
+  int y;
+
+  for (y = 0; y < height; y++, src += bytes_per_row) {
+    s = src;
+    end = src + row_bytes;
+    for (; s + 8 <= end; s += 8) {
+      memcpy(&w, s, 8);
+      h = (h ^ w) * 1099511628211ull;
+    }
+    for (; s < end; s++)
+      h = (h ^ *s) * 1099511628211ull;
+  }
+  return h;
+}
+
+static void lru_unlink(image_cache_t *e)
+{
+  if (e->lru_prev)
+    e->lru_prev->lru_next = e->lru_next;
+  else
+    lru_first = e->lru_next;
+  if (e->lru_next)
+    e->lru_next->lru_prev = e->lru_prev;
+  else
+    lru_last = e->lru_prev;
+}
+
+static void lru_push(image_cache_t *e)
+{
+  e->lru_prev = NULL;
+  e->lru_next = lru_first;
+  if (lru_first)
+    lru_first->lru_prev = e;
+  else
+    lru_last = e;
+  lru_first = e;
+}
+
+static void entry_free(image_cache_t *e)
+{
+  image_cache_t **p = &buckets[image_hash(e->image, e->di) % NUM_BUCKETS];
+
+  while (*p != e)
+    p = &(*p)->hash_next;
+  *p = e->hash_next;
+  lru_unlink(e);
+  memory -= e->size;
+  free(e);
+}
+
+static void shrink_to(size_t bytes)
+{
+  while (lru_last && memory > bytes) {
+    entry_free(lru_last);
+    evictions++;
+  }
+}
+
+void image_cache_set_limit(size_t bytes)
+{
+  limit = bytes;
+  shrink_to(limit);
+}
+
+int image_cache_enabled(void)
+{
+  return limit != 0;
+}
+
+/* converts the image to the entry's pixels */
+static void entry_convert(image_cache_t *e)
+{
+  const draw_info_t *di = e->di;
+  unsigned char rgba[CHUNK * 4];
+  const unsigned char *s;
+  composite_run_t c;
+  int x, y, i, num;
+
+  e->opaque = 1;
+  for (y = 0; y < e->height; y++) {
+    s = e->src + y * e->bytes_per_row;
+    c.dst = e->data + y * e->width * di->bytes_per_pixel;
+    c.dsta = e->alpha ? e->alpha + y * e->width : NULL;
+    c.srca = NULL;
+    c.fraction = 255;
+
+    for (x = 0; x < e->width; x += num) {
+      num = e->width - x < CHUNK ? e->width - x : CHUNK;
+      if (e->has_alpha) {
+        c.src = (unsigned char *)s;
+        for (i = 0; i < num; i++) {
+          if (s[i * 4 + 3] != 255)
+            e->opaque = 0;
+        }
+        s += num * 4;
+      } else {
+        for (i = 0; i < num; i++, s += 3) {
+          rgba[i * 4 + 0] = s[0];
+          rgba[i * 4 + 1] = s[1];
+          rgba[i * 4 + 2] = s[2];
+          rgba[i * 4 + 3] = 255;
+        }
+        c.src = rgba;
+      }
+
+      /* formats with alpha in the pixels get it even for RGB images, so
+         opaque rows can be copied to windows with alpha */
+      if (e->has_alpha || di->inline_alpha)
+        di->write_pixels_a(&c, num);
+      else
+        di->write_pixels_o(&c, num);
+      c.dst += num * di->bytes_per_pixel;
+      if (c.dsta)
+        c.dsta += num;
+    }
+  }
+}
+
+image_cache_t *image_cache_get(const void *image, const draw_info_t *di, const unsigned char *src,
+                               int width, int height, int bytes_per_row, int has_alpha)
+{
+  int row_bytes = width * (has_alpha ? 4 : 3);
+  unsigned int h = image_hash(image, di) % NUM_BUCKETS;
+  unsigned long long checksum;
+  image_cache_t *e;
+  size_t size, pixels;
+
+  if (!limit || width < 1 || height < 1)
+    return NULL;
+
+  checksum = image_checksum(src, row_bytes, height, bytes_per_row);
+
+  for (e = buckets[h]; e; e = e->hash_next) {
+    if (e->image == image && e->di == di)
+      break;
+  }
+  if (e) {
+    if (e->src == src && e->width == width && e->height == height &&
+        e->bytes_per_row == bytes_per_row && e->has_alpha == has_alpha &&
+        e->checksum == checksum) {
+      if (e != lru_first) {
+        lru_unlink(e);
+        lru_push(e);
+      }
+      hits++;
+      return e;
+    }
+    entry_free(e);
+    invalidations++;
+  }
+  misses++;
+
+  pixels = (size_t)width * height;
+  size = sizeof(image_cache_t) + pixels * di->bytes_per_pixel;
+  if (has_alpha && !di->inline_alpha)
+    size += pixels;
+
+  /* a single image may use an eighth of the cache */
+  if (size > limit / 8)
+    return NULL;
+
+  shrink_to(limit - size);
+
+  e = malloc(size);
+  if (!e)
+    return NULL;
+
+  e->size = size;
+  e->image = image;
+  e->di = di;
+  e->src = src;
+  e->width = width;
+  e->height = height;
+  e->bytes_per_row = bytes_per_row;
+  e->has_alpha = has_alpha;
+  e->checksum = checksum;
+  e->data = (unsigned char *)(e + 1);
+  e->alpha = (has_alpha && !di->inline_alpha) ? e->data + pixels * di->bytes_per_pixel : NULL;
+  entry_convert(e);
+  if (e->opaque)
+    e->alpha = NULL;
+
+  e->hash_next = buckets[h];
+  buckets[h] = e;
+  lru_push(e);
+  memory += size;
+
+  return e;
+}
+
+unsigned long image_cache_misses(void)
+{
+  return misses;
+}
+
+void image_cache_statistics(unsigned long *h, unsigned long *m, unsigned long *i,
+                            unsigned long *e, size_t *mem)
+{
+  *h = hits;
+  *m = misses;
+  *i = invalidations;
+  *e = evictions;
+  *mem = memory;
+}
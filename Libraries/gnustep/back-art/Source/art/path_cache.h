@@ -0,0 +1,95 @@
+/*
+   Copyright (C) 2026 NEXTSPACE Team
+
+   This file is part of GNUstep.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; see the file COPYING.LIB.
+   If not, see <http://www.gnu.org/licenses/> or write to the
+   Free Software Foundation, 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef path_cache_h
+#define path_cache_h
+
+#include <stddef.h>
+
+#include <libart_lgpl/art_svp.h>
+#include <libart_lgpl/art_vpath.h>
+
+/*
+The sorted vector paths (SVPs) of filled and stroked paths: bezels,
+buttons and scroller knobs are the same paths on every redraw, and
+building an SVP (intersecting the segments, or stroking them) costs much
+more than rendering it.
+
+A path is identified by its vector path in device space, moved by whole
+pixels so its first point is in [0, 1) (see path_cache_translate()), and
+by everything else the SVP depends on: the winding rule of a fill; the
+width, joins, caps, miter limit, stroke adjustment and dash of a stroke.
+A path drawn elsewhere on the window then finds the same SVP, which is
+rendered moved back.
+
+The cache is limited in memory, and evicts the SVPs that were least
+recently drawn.
+*/
+
+#define PATH_CACHE_FILL 0
+#define PATH_CACHE_STROKE 1
+
+/* paths with more points are never cached */
+#define PATH_CACHE_MAX_POINTS 1024
+
+/* the default limit, in bytes */
+#define PATH_CACHE_SIZE (1024 * 1024)
+
+/* what the SVP depends on besides the vector path; compared as bytes, so
+   it must be cleared with memset() before it's set */
+typedef struct {
+  int kind;
+  int rule;
+  double width, scale, miter_limit; /* scale: see -_stroke: */
+  int join, cap;
+  int stroke_adjust;
+  double dash_offset;
+  int num_dash;
+  double dash[8];
+} path_cache_params_t;
+
+/* Sets the memory limit of the cache, 0 to disable it. */
+void path_cache_set_limit(size_t bytes);
+int path_cache_enabled(void);
+
+/*
+Moves the vector path by whole pixels so its first point is in [0, 1), and
+stores the offset in *dx, *dy: the path was at its coordinates plus the
+offset.
+*/
+void path_cache_translate(ArtVpath *vp, int *dx, int *dy);
+
+/* Returns the cached SVP of the (translated) path, or NULL. */
+const ArtSVP *path_cache_lookup(const path_cache_params_t *params, const ArtVpath *vp);
+
+/*
+Adds the SVP of the path, which then belongs to the cache. Returns 0 if it
+isn't cached (too large, or the cache is disabled), and the caller keeps
+it.
+*/
+int path_cache_add(const path_cache_params_t *params, const ArtVpath *vp, ArtSVP *svp);
+
+/* counters since the start, for the "back-art-path-cache" debug log */
+void path_cache_statistics(unsigned long *hits, unsigned long *misses, unsigned long *evictions,
+                           size_t *memory);
+
+#endif
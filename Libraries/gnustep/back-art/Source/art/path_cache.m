@@ -0,0 +1,239 @@
+/*
+   Copyright (C) 2026 NEXTSPACE Team
+
+   This file is part of GNUstep.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; see the file COPYING.LIB.
+   If not, see <http://www.gnu.org/licenses/> or write to the
+   Free Software Foundation, 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "path_cache.h"
+
+#define NUM_BUCKETS 1024
+
+typedef struct path_entry_s {
+  struct path_entry_s *hash_next;
+  struct path_entry_s *lru_prev, *lru_next;
+  unsigned int hash;
+  size_t size; /* bytes used by the entry */
+
+  ArtSVP *svp;
+  int key_length;
+  unsigned char key[1];
+} path_entry_t;
+
+static path_entry_t *buckets[NUM_BUCKETS];
+/* lru_first is the most recently used path */
+static path_entry_t *lru_first, *lru_last;
+
+static size_t limit = PATH_CACHE_SIZE;
+static size_t memory;
+static unsigned long hits, misses, evictions;
+
+/* the key of the last path looked up, or being added */
+static unsigned char key_buffer[sizeof(path_cache_params_t) +
+                                PATH_CACHE_MAX_POINTS * (2 * sizeof(double) + 1)];
+
+/* Stores the key of the path in key_buffer, and returns its length, or 0
+   if the path isn't cached. */
+static int make_key(const path_cache_params_t *params, const ArtVpath *vp)
+{
+  unsigned char *k = key_buffer;
+  int i;
+
+  if (params->num_dash > 8)
+    return 0;
+  for (i = 0; vp[i].code != ART_END; i++) {
+    if (i == PATH_CACHE_MAX_POINTS)
+      return 0;
+  }
+
+  memcpy(k, params, sizeof(*params));
+  k += sizeof(*params);
+  for (i = 0; vp[i].code != ART_END; i++) {
+    *k++ = vp[i].code;
+    memcpy(k, &vp[i].x, sizeof(double));
+    k += sizeof(double);
+    memcpy(k, &vp[i].y, sizeof(double));
+    k += sizeof(double);
+  }
+  return k - key_buffer;
+}
+
+static unsigned int key_hash(int length)
+{
+  /* FNV-1a */
+  unsigned int h = 2166136261u;
+  int i;
+
+  for (i = 0; i < length; i++)
+    h = (h ^ key_buffer[i]) * 16777619u;
+  return h;
+}
+
+static size_t svp_size(const ArtSVP *svp)
+{
+  size_t size = sizeof(ArtSVP) + svp->n_segs * sizeof(ArtSVPSeg);
+  int i;
+
+  for (i = 0; i < svp->n_segs; i++)
+    size += svp->segs[i].n_points * sizeof(ArtPoint);
+  return size;
+}
+
+static void lru_unlink(path_entry_t *e)
+{
+  if (e->lru_prev)
+    e->lru_prev->lru_next = e->lru_next;
+  else
+    lru_first = e->lru_next;
+  if (e->lru_next)
+    e->lru_next->lru_prev = e->lru_prev;
+  else
+    lru_last = e->lru_prev;
+}
+
+static void lru_push(path_entry_t *e)
+{
+  e->lru_prev = NULL;
+  e->lru_next = lru_first;
+  if (lru_first)
+    lru_first->lru_prev = e;
+  else
+    lru_last = e;
+  lru_first = e;
+}
+
+static void entry_free(path_entry_t *e)
+{
+  path_entry_t **p = &buckets[e->hash % NUM_BUCKETS];
+
+  while (*p != e)
+    p = &(*p)->hash_next;
+  *p = e->hash_next;
+  lru_unlink(e);
+  memory -= e->size;
+  art_svp_free(e->svp);
+  free(e);
+}
+
+static void shrink_to(size_t bytes)
+{
+  while (lru_last && memory > bytes) {
+    entry_free(lru_last);
+    evictions++;
+  }
+}
+
+void path_cache_set_limit(size_t bytes)
+{
+  limit = bytes;
+  shrink_to(limit);
+}
+
+int path_cache_enabled(void)
+{
+  return limit != 0;
+}
+
+void path_cache_translate(ArtVpath *vp, int *dx, int *dy)
+{
+  int i;
+
+  *dx = *dy = 0;
+  if (vp[0].code == ART_END)
+    return;
+
+  *dx = floor(vp[0].x);
+  *dy = floor(vp[0].y);
+  for (i = 0; vp[i].code != ART_END; i++) {
+    vp[i].x -= *dx;
+    vp[i].y -= *dy;
+  }
+}
+
+const ArtSVP *path_cache_lookup(const path_cache_params_t *params, const ArtVpath *vp)
+{
+  int length = make_key(params, vp);
+  unsigned int h;
+  path_entry_t *e;
+
+  if (!length)
+    return NULL;
+
+  h = key_hash(length);
+  for (e = buckets[h % NUM_BUCKETS]; e; e = e->hash_next) {
+    if (e->hash == h && e->key_length == length && !memcmp(e->key, key_buffer, length)) {
+      if (e != lru_first) {
+        lru_unlink(e);
+        lru_push(e);
+      }
+      hits++;
+      return e->svp;
+    }
+  }
+  misses++;
+  return NULL;
+}
+
+int path_cache_add(const path_cache_params_t *params, const ArtVpath *vp, ArtSVP *svp)
+{
+  int length;
+  size_t size;
+  path_entry_t *e;
+
+  if (!limit)
+    return 0;
+  length = make_key(params, vp);
+  if (!length)
+    return 0;
+
+  size = sizeof(path_entry_t) + length + svp_size(svp);
+  /* a single path may use an eighth of the cache */
+  if (size > limit / 8)
+    return 0;
+
+  shrink_to(limit - size);
+
+  e = malloc(sizeof(path_entry_t) + length);
+  if (!e)
+    return 0;
+
+  e->hash = key_hash(length);
+  e->size = size;
+  e->svp = svp;
+  e->key_length = length;
+  memcpy(e->key, key_buffer, length);
+
+  e->hash_next = buckets[e->hash % NUM_BUCKETS];
+  buckets[e->hash % NUM_BUCKETS] = e;
+  lru_push(e);
+  memory += size;
+
+  return 1;
+}
+
+void path_cache_statistics(unsigned long *h, unsigned long *m, unsigned long *e, size_t *mem)
+{
+  *h = hits;
+  *m = misses;
+  *e = evictions;
+  *mem = memory;
+}
@@ -33,6 +33,7 @@
 @interface GSStreamContext : GSContext
 {
   FILE *gstream;
+  int imageFilter;
 }
 
 @end
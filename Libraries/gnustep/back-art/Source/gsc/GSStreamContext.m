@@ -42,13 +42,26 @@
 #include <Foundation/NSString.h>
 #include <Foundation/NSUserDefaults.h>
 #include <Foundation/NSValue.h>
+#include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 @interface GSFontInfo (experimental_glyph_printing_extension)
 // This method is currently only present in the libart backend
 -(const char *) nameOfGlyph: (NSGlyph)g;
 @end
 
+/* How the samples of images are written (the "back-art-ps-image-filter"
+   default, ASCII85 if unset). All but ASCIIHex need PostScript Level 2,
+   Flate Level 3. */
+#define IMAGE_FILTER_HEX	0
+#define IMAGE_FILTER_ASCII85	1
+#define IMAGE_FILTER_RUNLENGTH	2
+#define IMAGE_FILTER_FLATE	3
+
 /* Print a floating point number regardless of localization */
 static void
 fpfloat(FILE *stream, float f)
@@ -93,6 +106,8 @@ fpfloat(FILE *stream, float f)
 
 - initWithContextInfo: (NSDictionary *)info
 {
+  NSString *filter;
+
   self = [super initWithContextInfo: info];
   if (!self)
     return nil;
@@ -112,6 +127,8 @@ fpfloat(FILE *stream, float f)
                       DPSinvalidfileaccess, path);
           return nil;
         }
+      /* pages with images are megabytes */
+      setvbuf(gstream, NULL, _IOFBF, 64 * 1024);
     }
   else
     {
@@ -121,6 +138,21 @@ fpfloat(FILE *stream, float f)
       return nil;
     }
 
+  filter = [[NSUserDefaults standardUserDefaults]
+	     stringForKey: @"back-art-ps-image-filter"];
+  /* ASCII85 is the fastest to write and any Level 2 printer reads it;
+     Flate makes smaller files but is slower and needs Level 3 */
+  if ([filter isEqualToString: @"ASCIIHex"])
+    imageFilter = IMAGE_FILTER_HEX;
+  else if ([filter isEqualToString: @"RunLength"])
+    imageFilter = IMAGE_FILTER_RUNLENGTH;
+#ifdef HAVE_ZLIB
+  else if ([filter isEqualToString: @"Flate"])
+    imageFilter = IMAGE_FILTER_FLATE;
+#endif
+  else
+    imageFilter = IMAGE_FILTER_ASCII85;
+
   return self;
 }
 
@@ -879,18 +911,312 @@ fpfloat(FILE *stream, float f)
 @end
 
 
+/* ----------------------------------------------------------------------- */
+/* Image data */
+/* ----------------------------------------------------------------------- */
+
+/* The samples of an image go through the compression filter, if any, and
+   are encoded in ASCII85 (or hex) into a block, which is written to the
+   stream when it's full. */
+
+#define IMAGE_BLOCK_SIZE	(64 * 1024)
+/* lines end once they have this many encoded characters */
+#define IMAGE_LINE_LENGTH	76
+
+typedef struct {
+  FILE *stream;
+  int filter;
+  /* PNG Up predictor before Flate: the previous row, and the current row
+     as differences */
+  int predictor;
+  unsigned char *prev, *diff;
+#ifdef HAVE_ZLIB
+  z_stream z;
+#endif
+  /* ASCII85 bytes waiting for a group of 4 */
+  unsigned char tuple[4];
+  int tuple_len;
+  int column;
+  size_t len;
+  unsigned char block[IMAGE_BLOCK_SIZE];
+} image_writer_t;
+
+static void
+writer_flush(image_writer_t *w)
+{
+  if (w->len)
+    fwrite(w->block, 1, w->len, w->stream);
+  w->len = 0;
+}
+
+/* makes room for n characters and a newline */
+static inline void
+writer_reserve(image_writer_t *w, size_t n)
+{
+  if (w->len + n + 1 > IMAGE_BLOCK_SIZE)
+    writer_flush(w);
+}
+
+static inline void
+writer_end_line(image_writer_t *w)
+{
+  if (w->column >= IMAGE_LINE_LENGTH)
+    {
+      w->block[w->len++] = '\n';
+      w->column = 0;
+    }
+}
+
+static void
+encode_hex(image_writer_t *w, const unsigned char *s, size_t n)
+{
+  static const char *hexdigits = "0123456789abcdef";
+
+  for (; n; n--, s++)
+    {
+      writer_reserve(w, 2);
+      w->block[w->len++] = hexdigits[*s >> 4];
+      w->block[w->len++] = hexdigits[*s & 15];
+      w->column += 2;
+      writer_end_line(w);
+    }
+}
+
+/* encodes the first n (1 to 4) bytes of t, which is padded with zeros */
 static void
-writeHex(FILE *gstream, const unsigned char *data, int count)
+encode_ascii85_tuple(image_writer_t *w, const unsigned char *t, int n)
 {
-static const char *hexdigits = "0123456789abcdef";
+  unsigned long v;
+  char c[5];
   int i;
-  for (i = 0; i < count; i++)
+
+  v = ((unsigned long)t[0] << 24) | (t[1] << 16) | (t[2] << 8) | t[3];
+  writer_reserve(w, 5);
+  if (v == 0 && n == 4)
+    {
+      w->block[w->len++] = 'z';
+      w->column++;
+    }
+  else
+    {
+      for (i = 4; i >= 0; i--)
+	{
+	  c[i] = v % 85 + '!';
+	  v /= 85;
+	}
+      memcpy(w->block + w->len, c, n + 1);
+      w->len += n + 1;
+      w->column += n + 1;
+    }
+  writer_end_line(w);
+}
+
+static void
+encode_ascii85(image_writer_t *w, const unsigned char *s, size_t n)
+{
+  while (n)
+    {
+      if (w->tuple_len == 0 && n >= 4)
+	{
+	  encode_ascii85_tuple(w, s, 4);
+	  s += 4;
+	  n -= 4;
+	  continue;
+	}
+      w->tuple[w->tuple_len++] = *s++;
+      n--;
+      if (w->tuple_len == 4)
+	{
+	  encode_ascii85_tuple(w, w->tuple, 4);
+	  w->tuple_len = 0;
+	}
+    }
+}
+
+static void
+encode(image_writer_t *w, const unsigned char *s, size_t n)
+{
+  if (w->filter == IMAGE_FILTER_HEX)
+    encode_hex(w, s, n);
+  else
+    encode_ascii85(w, s, n);
+}
+
+/* RunLengthDecode data: runs of 2 to 128 equal bytes, and up to 128 bytes
+   between them copied */
+static void
+write_runlength(image_writer_t *w, const unsigned char *s, size_t n)
+{
+  unsigned char run[2];
+  size_t i = 0, j;
+
+  while (i < n)
+    {
+      for (j = i + 1; j < n && j - i < 128 && s[j] == s[i]; j++)
+	;
+      if (j - i >= 2)
+	{
+	  run[0] = 257 - (j - i);
+	  run[1] = s[i];
+	  encode(w, run, 2);
+	  i = j;
+	  continue;
+	}
+
+      /* copy up to the next run of 3 */
+      for (j = i + 1; j < n && j - i < 128; j++)
+	{
+	  if (j + 2 < n && s[j] == s[j + 1] && s[j] == s[j + 2])
+	    break;
+	}
+      run[0] = j - i - 1;
+      encode(w, run, 1);
+      encode(w, s + i, j - i);
+      i = j;
+    }
+}
+
+#ifdef HAVE_ZLIB
+static void
+write_flate(image_writer_t *w, const unsigned char *s, size_t n, int flush)
+{
+  unsigned char out[16 * 1024];
+  int ret;
+
+  w->z.next_in = (Bytef *)s;
+  w->z.avail_in = n;
+  do
+    {
+      w->z.next_out = out;
+      w->z.avail_out = sizeof(out);
+      ret = deflate(&w->z, flush);
+      encode(w, out, sizeof(out) - w->z.avail_out);
+    }
+  while (ret == Z_OK && (w->z.avail_out == 0 || flush == Z_FINISH));
+}
+#endif
+
+/* Returns a writer for rows of row_bytes bytes, or NULL if memory is
+   short. The predictor is used for 8 bit samples only. */
+static image_writer_t *
+writer_create(FILE *stream, int filter, size_t row_bytes, BOOL predictor)
+{
+  image_writer_t *w;
+
+  w = malloc(sizeof(image_writer_t));
+  if (!w)
+    return NULL;
+  memset(w, 0, offsetof(image_writer_t, block));
+  w->stream = stream;
+  w->filter = filter;
+
+#ifdef HAVE_ZLIB
+  if (filter == IMAGE_FILTER_FLATE)
     {
-      fputc(hexdigits[(int)(data[i] / 16)], gstream);
-      fputc(hexdigits[(int)(data[i] % 16)], gstream);
-      if (i && i % 40 == 0)
-	fprintf(gstream, "\n");
+      /* photos compress about as well, twice as fast, as by default */
+      if (deflateInit(&w->z, Z_BEST_SPEED) != Z_OK)
+	{
+	  free(w);
+	  return NULL;
+	}
+      if (predictor)
+	{
+	  w->prev = calloc(2, row_bytes + 1);
+	  if (!w->prev)
+	    {
+	      deflateEnd(&w->z);
+	      free(w);
+	      return NULL;
+	    }
+	  w->diff = w->prev + row_bytes + 1;
+	  w->predictor = 1;
+	}
+    }
+#endif
+
+  return w;
+}
+
+static void
+writer_free(image_writer_t *w)
+{
+  if (!w)
+    return;
+#ifdef HAVE_ZLIB
+  if (w->filter == IMAGE_FILTER_FLATE)
+    deflateEnd(&w->z);
+#endif
+  free(w->prev);
+  free(w);
+}
+
+static void
+writer_write_row(image_writer_t *w, const unsigned char *row, size_t n)
+{
+  switch (w->filter)
+    {
+      case IMAGE_FILTER_HEX:
+      case IMAGE_FILTER_ASCII85:
+	encode(w, row, n);
+	break;
+      case IMAGE_FILTER_RUNLENGTH:
+	write_runlength(w, row, n);
+	break;
+#ifdef HAVE_ZLIB
+      case IMAGE_FILTER_FLATE:
+	if (w->predictor)
+	  {
+	    size_t i;
+
+	    /* each row starts with its PNG filter type, 2 for Up */
+	    w->diff[0] = 2;
+	    for (i = 0; i < n; i++)
+	      w->diff[i + 1] = row[i] - w->prev[i];
+	    memcpy(w->prev, row, n);
+	    write_flate(w, w->diff, n + 1, Z_NO_FLUSH);
+	  }
+	else
+	  {
+	    write_flate(w, row, n, Z_NO_FLUSH);
+	  }
+	break;
+#endif
+    }
+}
+
+/* ends the data, and frees the writer */
+static void
+writer_finish(image_writer_t *w)
+{
+  unsigned char eod = 128;
+
+  switch (w->filter)
+    {
+      case IMAGE_FILTER_RUNLENGTH:
+	encode(w, &eod, 1);
+	break;
+#ifdef HAVE_ZLIB
+      case IMAGE_FILTER_FLATE:
+	write_flate(w, NULL, 0, Z_FINISH);
+	break;
+#endif
+    }
+
+  writer_reserve(w, 3);
+  if (w->filter != IMAGE_FILTER_HEX)
+    {
+      if (w->tuple_len)
+	{
+	  memset(w->tuple + w->tuple_len, 0, 4 - w->tuple_len);
+	  encode_ascii85_tuple(w, w->tuple, w->tuple_len);
+	  writer_reserve(w, 3);
+	}
+      w->block[w->len++] = '~';
+      w->block[w->len++] = '>';
     }
+  w->block[w->len++] = '\n';
+  writer_flush(w);
+  writer_free(w);
 }
 
 @implementation GSStreamContext (Graphics)
@@ -901,27 +1227,21 @@ static const char *hexdigits = "0123456789abcdef";
 		     : (BOOL)hasAlpha : (NSString *)colorSpaceName
 		     : (const unsigned char *const [5])data
 {
-  NSInteger bytes, spp;
+  NSInteger bytes, spp, row_bytes;
   CGFloat y;
   BOOL flipped = NO;
+  BOOL convert;
+  image_writer_t *w;
+  unsigned char *row = NULL;
+  const char *space;
+  int filter = imageFilter;
+  int i, j;
 
   /* In a flipped view, we don't want to flip the image again, which would
      make it come out upsidedown. FIXME: This can't be right, can it? */
   if ([[NSView focusView] isFlipped])
     flipped = YES;
 
-  /* Save scaling */
-  fprintf(gstream, "matrix\ncurrentmatrix\n");
-  y = NSMinY(rect);
-  if (flipped)
-    y += NSHeight(rect);
-  fpfloat(gstream, NSMinX(rect));
-  fpfloat(gstream, y);
-  fprintf(gstream, "translate ");
-  fpfloat(gstream, NSWidth(rect));
-  fpfloat(gstream, NSHeight(rect));
-  fprintf(gstream, "scale\n");
-
   if (bitsPerSample == 0)
     bitsPerSample = 8;
   bytes = 
@@ -938,74 +1258,145 @@ static const char *hexdigits = "0123456789abcdef";
   else
     spp = samplesPerPixel;
 
-  if (samplesPerPixel > 1) 
+  // We need to do a format conversion, a row at a time. A single plane
+  // is already in the packed layout.
+  convert = samplesPerPixel > 1 && (isPlanar || hasAlpha);
+  if (convert && bitsPerSample != 8)
+    {
+      NSLog(@"Image format conversion not supported for bps!=8");
+      return;
+    }
+  if (spp == 1)
+    space = "DeviceGray";
+  else if (spp == 3)
+    space = "DeviceRGB";
+  else if (spp == 4)
+    space = "DeviceCMYK";
+  else
+    {
+      NSLog(@"Image Rendering Error: %d color components", (int)spp);
+      return;
+    }
+
+  row_bytes = convert ? pixelsWide * spp : bytesPerRow;
+  if (convert)
+    row = malloc(row_bytes);
+  w = writer_create(gstream, filter, row_bytes, bitsPerSample == 8);
+  if (!w || (convert && !row))
+    {
+      NSLog(@"Image Rendering Error: out of memory");
+      writer_free(w);
+      free(row);
+      return;
+    }
+
+  /* Save scaling, and the color space */
+  fprintf(gstream, "gsave\n");
+  y = NSMinY(rect);
+  if (flipped)
+    y += NSHeight(rect);
+  fpfloat(gstream, NSMinX(rect));
+  fpfloat(gstream, y);
+  fprintf(gstream, "translate ");
+  fpfloat(gstream, NSWidth(rect));
+  fpfloat(gstream, NSHeight(rect));
+  fprintf(gstream, "scale\n");
+
+  if (filter == IMAGE_FILTER_HEX)
     {
-      if (isPlanar || hasAlpha) 
+      /* PostScript Level 1 */
+      if (samplesPerPixel > 1) 
 	{
-	  if (bitsPerSample != 8) 
-	    {
-	      NSLog(@"Image format conversion not supported for bps!=8");
-	      return;
-	    }
+	  fprintf(gstream, "%d %d %d [%d 0 0 %d 0 %d]\n",
+		  (int)pixelsWide, (int)pixelsHigh, (int)bitsPerSample,
+		  (int)pixelsWide,
+		  (flipped) ? (int)pixelsHigh : (int)-pixelsHigh,
+		  (int)pixelsHigh);
+	  fprintf(gstream, "{currentfile %d string readhexstring pop}\n",
+		  (int)(pixelsWide * spp));
+	  fprintf(gstream, "false %d colorimage\n", (int)spp);
+	} 
+      else
+	{
+	  fprintf(gstream, "%d %d %d [%d 0 0 %d 0 %d]\n",
+		  (int)pixelsWide, (int)pixelsHigh, (int)bitsPerSample,
+		  (int)pixelsWide,
+		  (flipped) ? (int)pixelsHigh : (int)-pixelsHigh,
+		  (int)pixelsHigh);
+	  fprintf(gstream, "currentfile image\n");
 	}
-      fprintf(gstream, "%d %d %d [%d 0 0 %d 0 %d]\n",
-	      (int)pixelsWide, (int)pixelsHigh, (int)bitsPerSample, (int)pixelsWide,
-	      (flipped) ? (int)pixelsHigh : (int)-pixelsHigh, (int)pixelsHigh);
-      fprintf(gstream, "{currentfile %d string readhexstring pop}\n",
-	      (int)(pixelsWide * spp));
-      fprintf(gstream, "false %d colorimage\n", (int)spp);
-    } 
+    }
   else
     {
-      fprintf(gstream, "%d %d %d [%d 0 0 %d 0 %d]\n",
-	      (int)pixelsWide, (int)pixelsHigh, (int)bitsPerSample, (int)pixelsWide,
-	      (flipped) ? (int)pixelsHigh : (int)-pixelsHigh, (int)pixelsHigh);
-      fprintf(gstream, "currentfile image\n");
+      /* The ASCII85 filter is kept to read its end of data after the
+	 image, which stops reading once it has its samples. */
+      fprintf(gstream, "/%s setcolorspace\n", space);
+      fprintf(gstream, "/GSImageSource currentfile /ASCII85Decode filter def\n");
+      fprintf(gstream, "<<\n/ImageType 1 /Width %d /Height %d /BitsPerComponent %d\n",
+	      (int)pixelsWide, (int)pixelsHigh, (int)bitsPerSample);
+      fprintf(gstream, "/Decode [");
+      for (i = 0; i < spp; i++)
+	fprintf(gstream, "0 1 ");
+      fprintf(gstream, "]\n/ImageMatrix [%d 0 0 %d 0 %d]\n",
+	      (int)pixelsWide,
+	      (flipped) ? (int)pixelsHigh : (int)-pixelsHigh,
+	      (int)pixelsHigh);
+      fprintf(gstream, "/DataSource GSImageSource");
+      if (filter == IMAGE_FILTER_RUNLENGTH)
+	fprintf(gstream, " /RunLengthDecode filter");
+      else if (filter == IMAGE_FILTER_FLATE && w->predictor)
+	fprintf(gstream, " << /Predictor 15 /Colors %d /BitsPerComponent 8"
+		" /Columns %d >> /FlateDecode filter",
+		(int)spp, (int)pixelsWide);
+      else if (filter == IMAGE_FILTER_FLATE)
+	fprintf(gstream, " /FlateDecode filter");
+      fprintf(gstream, "\n>>\n{image GSImageSource flushfile} exec\n");
     }
   
   // The context is now waiting for data on its standard input
-  if (isPlanar || hasAlpha) 
+  for (j = 0; j < pixelsHigh; j++)
     {
-      // We need to do a format conversion.
-      // We do this on the fly, sending data to the context as soon as
-      // it is computed.
-      int i, j;
-      // Preset this variable to keep compiler happy.
-      int alpha = 0;
-      unsigned char val;
-
-      for (j = 0; j < bytes; j++)
+      if (convert) 
 	{
-	  if (hasAlpha)
-	    {
-	      if (isPlanar)
-		alpha = data[spp][j];
-	      else
-		alpha = data[0][spp + j * samplesPerPixel];
-	    }
-	  for (i = 0; i < spp; i++) 
+	  // Preset this variable to keep compiler happy.
+	  int alpha = 0;
+	  NSInteger p, x;
+	  unsigned char val;
+
+	  for (x = 0; x < pixelsWide; x++)
 	    {
-	      if (isPlanar)
-		val = data[i][j];
-	      else
-		val = data[0][i + j * samplesPerPixel];
+	      p = j * pixelsWide + x;
 	      if (hasAlpha)
-		val = 255 - ((255 - val) * (long)alpha) / 255;
-	      writeHex(gstream, &val, 1);
+		{
+		  if (isPlanar)
+		    alpha = data[spp][p];
+		  else
+		    alpha = data[0][spp + p * samplesPerPixel];
+		}
+	      for (i = 0; i < spp; i++) 
+		{
+		  if (isPlanar)
+		    val = data[i][p];
+		  else
+		    val = data[0][i + p * samplesPerPixel];
+		  if (hasAlpha)
+		    val = 255 - ((255 - val) * (long)alpha) / 255;
+		  row[x * spp + i] = val;
+		}
 	    }
-	  if (j && j % 40 == 0)
-	    fprintf(gstream, "\n");
+	  writer_write_row(w, row, row_bytes);
+	} 
+      else 
+	{
+	  // The data is already in the format the context expects it in
+	  writer_write_row(w, data[0] + j * bytesPerRow, row_bytes);
 	}
-      fprintf(gstream, "\n");
-    } 
-  else 
-    {
-      // The data is already in the format the context expects it in
-      writeHex(gstream, data[0], bytes * samplesPerPixel);
     }
+  writer_finish(w);
+  free(row);
 
-  /* Restore original scaling */
-  fprintf(gstream, "setmatrix\n");
+  /* Restore original scaling and color space */
+  fprintf(gstream, "grestore\n");
 }
 
 @end
@@ -129,6 +129,14 @@ typedef struct MonitorDevice {
 - (BOOL)setPreeditSpot:(NSPoint *)p;
 @end
 
+/*
+ * Counters of the events dropped by -receivedEvent:type:extra:forMode:,
+ * because a later one in the queue replaced them.
+ */
+@interface XGServer (EventCoalescing)
+- (void)getDroppedMotionEvents:(unsigned long *)motion configureEvents:(unsigned long *)configure;
+@end
+
 @interface XGServer (TimeKeeping)
 - (void)setLastTime:(Time)last;
 - (Time)lastTime;
@@ -99,6 +99,15 @@ static NSEventType menuMouseButton;      // "GSMenuButtonEvent" - (NSRightMouseB
 static BOOL menuButtonEnabled;           // "GSMenuButtonEnabled" - BOOL
 static BOOL swapMouseButtons;            // YES if "GSMenuButtonEvent" == NSLeftMouseButton
 
+/*
+  Event coalescing in -receivedEvent:type:extra:forMode:. Tablets and other
+  precise pointing devices may want every motion event.
+*/
+static BOOL coalesceMotion;              // "GSCoalesceMotionEvents" - BOOL (YES)
+static BOOL coalesceConfigure;           // "GSCoalesceConfigureEvents" - BOOL (YES)
+static unsigned long droppedMotion;      // events replaced by a later one
+static unsigned long droppedConfigure;
+
 void __objc_xgcontextevent_linking(void) {}
 
 static SEL procSel = 0;
@@ -122,6 +131,83 @@ static void (*procEvent)(id, SEL, XEvent *) = 0;
 - (NSEvent *)_handleTakeFocusAtom:(XEvent)xEvent forContext:(NSGraphicsContext *)gcontext;
 @end
 
+static void read_coalescing_defaults(void)
+{
+  NSUserDefaults *defs = [NSUserDefaults standardUserDefaults];
+
+  coalesceMotion = YES;
+  if ([defs objectForKey:@"GSCoalesceMotionEvents"])
+    coalesceMotion = [defs boolForKey:@"GSCoalesceMotionEvents"];
+
+  coalesceConfigure = YES;
+  if ([defs objectForKey:@"GSCoalesceConfigureEvents"])
+    coalesceConfigure = [defs boolForKey:@"GSCoalesceConfigureEvents"];
+}
+
+/*
+  Replaces a MotionNotify with the ones right after it in the queue, while
+  they are for the same window with the same buttons and modifiers down.
+*/
+static void coalesce_motion(Display *dpy, XEvent *xEvent)
+{
+  XEvent peek;
+
+  while (XPending(dpy)) {
+    XPeekEvent(dpy, &peek);
+    if (peek.type != MotionNotify || peek.xmotion.window != xEvent->xmotion.window ||
+        peek.xmotion.subwindow != xEvent->xmotion.subwindow ||
+        peek.xmotion.state != xEvent->xmotion.state)
+      break;
+
+    XNextEvent(dpy, xEvent);
+    droppedMotion++;
+    NSDebugLLog(@"NSMotionEvent", @"%lu MotionNotify coalesced (%lu dropped)\n",
+                xEvent->xmotion.window, droppedMotion);
+  }
+}
+
+typedef struct {
+  Window window;
+  BOOL blocked;
+} configure_scan_t;
+
+static Bool is_later_configure(Display *dpy, XEvent *event, XPointer arg)
+{
+  configure_scan_t *scan = (configure_scan_t *)arg;
+
+  if (scan->blocked)
+    return False;
+  if (event->type == ConfigureNotify && event->xconfigure.window == scan->window)
+    return True;
+  /* the other events of the window are handled with the geometry they
+     came with: no ConfigureNotify is taken from beyond them */
+  if (event->xany.window == scan->window)
+    scan->blocked = YES;
+  return False;
+}
+
+/*
+  Replaces a ConfigureNotify with the latest one of the window in the queue,
+  up to the next event of another type for the window.
+*/
+static void coalesce_configure(Display *dpy, XEvent *xEvent)
+{
+  configure_scan_t scan;
+  XEvent later;
+
+  for (;;) {
+    scan.window = xEvent->xconfigure.window;
+    scan.blocked = NO;
+    if (!XCheckIfEvent(dpy, &later, is_later_configure, (XPointer)&scan))
+      break;
+
+    *xEvent = later;
+    droppedConfigure++;
+    NSDebugLLog(@"NSEvent", @"%lu ConfigureNotify coalesced (%lu dropped)\n",
+                xEvent->xconfigure.window, droppedConfigure);
+  }
+}
+
 int XGErrorHandler(Display *display, XErrorEvent *err)
 {
   XGServer *ctxt = (XGServer *)GSCurrentServer();
@@ -213,6 +299,7 @@ static int check_modifier(XEvent *xEvent, KeySym key_sym)
   if (procSel == 0) {
     procSel = @selector(processEvent:);
     procEvent = (void (*)(id, SEL, XEvent *))[self methodForSelector:procSel];
+    read_coalescing_defaults();
   }
 }
 
@@ -243,6 +330,12 @@ static int check_modifier(XEvent *xEvent, KeySym key_sym)
     }
 #endif
 
+    // drop the events a later one in the queue makes stale
+    if (xEvent.type == MotionNotify && coalesceMotion)
+      coalesce_motion(dpy, &xEvent);
+    else if (xEvent.type == ConfigureNotify && coalesceConfigure)
+      coalesce_configure(dpy, &xEvent);
+
     (*procEvent)(self, procSel, &xEvent);
   }
 }
@@ -299,6 +392,8 @@ static int check_modifier(XEvent *xEvent, KeySym key_sym)
       swapMouseButtons = NO;
       break;
   }
+
+  read_coalescing_defaults();
 }
 
 - (void)initializeMouse
@@ -1216,21 +1311,6 @@ static int check_modifier(XEvent *xEvent, KeySym key_sym)
       {
         unsigned int state;
 
-        /*
-         * Compress motion events to avoid flooding.
-         */
-        while (XPending(xEvent.xmotion.display)) {
-          XEvent peek;
-
-          XPeekEvent(xEvent.xmotion.display, &peek);
-          if (peek.type == MotionNotify && xEvent.xmotion.window == peek.xmotion.window &&
-              xEvent.xmotion.subwindow == peek.xmotion.subwindow) {
-            XNextEvent(xEvent.xmotion.display, &xEvent);
-          } else {
-            break;
-          }
-        }
-
         generic.lastMotion = xEvent.xmotion.time;
         [self setLastTime:generic.lastMotion];
         state = xEvent.xmotion.state;
@@ -2282,6 +2362,14 @@ static unsigned int process_modifier_flags(unsigned int state)
 
 @end
 
+@implementation XGServer (EventCoalescing)
+- (void)getDroppedMotionEvents:(unsigned long *)motion configureEvents:(unsigned long *)configure
+{
+  *motion = droppedMotion;
+  *configure = droppedConfigure;
+}
+@end
+
 @implementation XGServer (XSync)
 - (BOOL)xSyncMap:(void *)windowHandle
 {
@@ -65,6 +65,25 @@ struct XWindowBuffer_depth_info_s {
   int byte_order;
 };
 
+struct XWindowBuffer_rect_s {
+  int x, y, w, h;
+};
+
+#define XWINDOWBUFFER_MAX_PENDING_RECTS 8
+
+/* Totals over all the XWindowBuffers, for tuning. */
+struct XWindowBuffer_statistics_s {
+  /* Bytes of the rectangles passed to -_exposeRect:, clipped to the
+     buffer. A rectangle exposed twice before it was put counts twice. */
+  unsigned long long damaged_bytes;
+  /* Bytes sent by XShmPutImage and XPutImage. Less than damaged_bytes
+     when pending updates overlap, more when merging rectangles covered
+     pixels that weren't damaged. */
+  unsigned long long uploaded_bytes;
+  unsigned long puts; /* Number of XShmPutImage and XPutImage calls */
+  unsigned long merges; /* Pending rectangles merged into another */
+};
+
 /*
   XWindowBuffer maintains an XImage for a window. Each ARTGState that
   renders to that window uses the same XWindowBuffer (and thus the same
@@ -92,9 +111,10 @@ struct XWindowBuffer_depth_info_s {
      again. The pending updates are stored here, and when we get the
      ShmCompletion event, we handle them. */
   int pending_put; /* There are pending updates */
-  struct {
-    int x, y, w, h;
-  } pending_rect; /* in this rectangle. */
+  /* in these disjoint rectangles. Close ones are merged, and when there
+     are too many, the ones that waste the fewest pixels. */
+  struct XWindowBuffer_rect_s pending_rects[XWINDOWBUFFER_MAX_PENDING_RECTS + 1];
+  int num_pending_rects;
 
   int pending_event; /* We're waiting for the ShmCompletion event. */
 
@@ -139,6 +159,8 @@ struct XWindowBuffer_depth_info_s {
 */
 - (void)needsAlpha;
 
++ (void)getStatistics:(struct XWindowBuffer_statistics_s *)stats;
+
 - (void)_gotShmCompletion;
 - (void)_exposeRect:(NSRect)r;
 + (void)_gotShmCompletion:(Drawable)d;
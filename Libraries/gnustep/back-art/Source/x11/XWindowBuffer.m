@@ -30,6 +30,7 @@
 #include "x11/XGServerWindow.h"
 #include "x11/XWindowBuffer.h"
 
+#include <limits.h>
 #include <math.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
@@ -166,10 +167,63 @@ no_xshm:
     XSetErrorHandler(old_error_handler);
   }
 }
+
+
+/* Merging two pending rectangles costs at most this many pixels that
+weren't damaged for free: each XShmPutImage is a round of request
+processing in the server, worth about as much as copying a few thousand
+pixels. Overlapping rectangles are always merged so that no pixel is put
+twice. */
+#define MERGE_SLACK 1024
+
+static int rect_area(struct XWindowBuffer_rect_s *r)
+{
+  return r->w * r->h;
+}
+
+static void rect_union(struct XWindowBuffer_rect_s *a,
+                       struct XWindowBuffer_rect_s *b,
+                       struct XWindowBuffer_rect_s *u)
+{
+  int x0 = a->x < b->x ? a->x : b->x;
+  int y0 = a->y < b->y ? a->y : b->y;
+  int x1 = a->x + a->w > b->x + b->w ? a->x + a->w : b->x + b->w;
+  int y1 = a->y + a->h > b->y + b->h ? a->y + a->h : b->y + b->h;
+
+  u->x = x0;
+  u->y = y0;
+  u->w = x1 - x0;
+  u->h = y1 - y0;
+}
+
+/* Pixels the union of 'a' and 'b' covers that neither of them does.
+Negative if they overlap. */
+static int rect_waste(struct XWindowBuffer_rect_s *a,
+                      struct XWindowBuffer_rect_s *b)
+{
+  struct XWindowBuffer_rect_s u;
+
+  rect_union(a, b, &u);
+  return rect_area(&u) - rect_area(a) - rect_area(b);
+}
+
+static BOOL rect_overlaps(struct XWindowBuffer_rect_s *a,
+                          struct XWindowBuffer_rect_s *b)
+{
+  return a->x < b->x + b->w && b->x < a->x + a->w &&
+         a->y < b->y + b->h && b->y < a->y + a->h;
+}
 #endif
 
+static struct XWindowBuffer_statistics_s statistics;
+
 @implementation XWindowBuffer
 
++ (void) getStatistics: (struct XWindowBuffer_statistics_s *)stats
+{
+  *stats = statistics;
+}
+
 + (void) initialize
 {
   NSUserDefaults *ud = [NSUserDefaults standardUserDefaults];
@@ -276,6 +330,7 @@ no_xshm:
         }
 
       wi->pending_put = wi->pending_event = 0;
+      wi->num_pending_rects = 0;
 
       wi->ximage = NULL;
 
@@ -425,9 +480,66 @@ no_xshm:
 
 extern int XShmGetEventBase(Display *d);
 
+#ifdef XSHM
+/* Adds r to the pending rectangles, keeping them disjoint and no more than
+XWINDOWBUFFER_MAX_PENDING_RECTS. */
+- (void) _addPendingRect: (struct XWindowBuffer_rect_s)r
+{
+  struct XWindowBuffer_rect_s *rects = pending_rects;
+  int i, j, best_i, best_j, waste, best_waste;
+
+  while (1)
+    {
+      /* Take in the rectangles that are cheap to merge with r, and the
+         ones r grew over while doing it. */
+      for (i = 0; i < num_pending_rects; i++)
+        {
+          if (rect_overlaps(&rects[i], &r) ||
+              rect_waste(&rects[i], &r) <= MERGE_SLACK)
+            {
+              rect_union(&rects[i], &r, &r);
+              rects[i] = rects[--num_pending_rects];
+              statistics.merges++;
+              i = -1;
+            }
+        }
+
+      rects[num_pending_rects++] = r;
+      if (num_pending_rects <= XWINDOWBUFFER_MAX_PENDING_RECTS)
+        return;
+
+      /* Too many of them: merge the pair wasting the fewest pixels, and
+         add the result again since it may overlap others now. */
+      best_i = 0;
+      best_j = 1;
+      best_waste = INT_MAX;
+      for (i = 0; i < num_pending_rects; i++)
+        {
+          for (j = i + 1; j < num_pending_rects; j++)
+            {
+              waste = rect_waste(&rects[i], &rects[j]);
+              if (waste < best_waste)
+                {
+                  best_waste = waste;
+                  best_i = i;
+                  best_j = j;
+                }
+            }
+        }
+      rect_union(&rects[best_i], &rects[best_j], &r);
+      rects[best_j] = rects[--num_pending_rects];
+      rects[best_i] = rects[--num_pending_rects];
+      statistics.merges++;
+    }
+}
+#endif
+
 - (void) _gotShmCompletion
 {
 #ifdef XSHM
+  struct XWindowBuffer_rect_s *r;
+  int i, last;
+
   if (!use_shm)
     return;
 
@@ -435,30 +547,42 @@ extern int XShmGetEventBase(Display *d);
   if (pending_put)
     {
       pending_put = 0;
-      if (pending_rect.x + pending_rect.w > window->xframe.size.width)
-        {
-          pending_rect.w = window->xframe.size.width - pending_rect.x;
-          if (pending_rect.w <= 0)
-            return;
-        }
-      if (pending_rect.y + pending_rect.h > window->xframe.size.height)
-        {
-          pending_rect.h = window->xframe.size.height - pending_rect.y;
-          if (pending_rect.h <= 0)
-            return;
-        }
-      if (!XShmPutImage(display, drawable, gc, ximage,
-                        pending_rect.x, pending_rect.y,
-                        pending_rect.x, pending_rect.y,
-                        pending_rect.w, pending_rect.h,
-                        1))
+
+      /* The window may have shrunk since the rectangles were added. */
+      for (i = 0, last = -1; i < num_pending_rects; i++)
         {
-          NSLog(@"XShmPutImage failed?");
+          r = &pending_rects[i];
+          if (r->x + r->w > window->xframe.size.width)
+            r->w = window->xframe.size.width - r->x;
+          if (r->y + r->h > window->xframe.size.height)
+            r->h = window->xframe.size.height - r->y;
+          if (r->w > 0 && r->h > 0)
+            last = i;
         }
-      else
+
+      /* Put all of them at once, and only ask for a ShmCompletion event
+         for the last one: the server handles them in order. */
+      for (i = 0; i <= last; i++)
         {
-          pending_event = 1;
+          r = &pending_rects[i];
+          if (r->w <= 0 || r->h <= 0)
+            continue;
+          if (!XShmPutImage(display, drawable, gc, ximage,
+                            r->x, r->y, r->x, r->y, r->w, r->h,
+                            i == last))
+            {
+              NSLog(@"XShmPutImage failed?");
+            }
+          else
+            {
+              statistics.puts++;
+              statistics.uploaded_bytes +=
+                (unsigned long long)r->w * r->h * bytes_per_pixel;
+              if (i == last)
+                pending_event = 1;
+            }
         }
+      num_pending_rects = 0;
     }
 //        XFlush(window->display);
 #endif
@@ -509,6 +633,8 @@ accuracy, we do the test using int: s.
   if (w <= 0 || h <= 0)
     return;
 
+  statistics.damaged_bytes += (unsigned long long)w * h * bytes_per_pixel;
+
 #ifdef XSHM
   if (use_shm)
     {
@@ -593,35 +719,14 @@ static int warn = 0;
 
       if (pending_event)
         {
+          struct XWindowBuffer_rect_s r = {x, y, w, h};
+
           if (!pending_put)
             {
               pending_put = 1;
-              pending_rect.x = x;
-              pending_rect.y = y;
-              pending_rect.w = w;
-              pending_rect.h = h;
-            }
-          else
-            {
-              if (x < pending_rect.x)
-                {
-                  pending_rect.w += pending_rect.x - x;
-                  pending_rect.x = x;
-                }
-              if (x + w > pending_rect.x + pending_rect.w)
-                {
-                  pending_rect.w = x + w - pending_rect.x;
-                }
-              if (y < pending_rect.y)
-                {
-                  pending_rect.h += pending_rect.y - y;
-                  pending_rect.y = y;
-                }
-              if (y + h > pending_rect.y + pending_rect.h)
-                {
-                  pending_rect.h = y + h - pending_rect.y;
-                }
+              num_pending_rects = 0;
             }
+          [self _addPendingRect: r];
         }
       else
         {
@@ -633,6 +738,8 @@ static int warn = 0;
             }
           else
             {
+              statistics.puts++;
+              statistics.uploaded_bytes += (unsigned long long)w * h * bytes_per_pixel;
               pending_event = 1;
             }
         }
@@ -654,6 +761,8 @@ static int warn = 0;
     if (ximage)
     {
       XPutImage(display, drawable, gc, ximage, x, y, x, y, w, h);
+      statistics.puts++;
+      statistics.uploaded_bytes += (unsigned long long)w * h * bytes_per_pixel;
     }
 }
 
@@ -0,0 +1,125 @@
+/*
+ * Micro-benchmark of the blitters of the draw info.
+ *
+ * Runs headless: every function of the formats having vector versions is
+ * timed on runs of pixels in memory buffers, with the scalar reference and
+ * with each instruction set the CPU supports.
+ *
+ * usage: benchblit [pixels [seconds]]
+ */
+
+#include "../Source/art/blit-main.m"
+#include "../Source/art/blit-simd.m"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "blitfunctions.h"
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Mpixel/s */
+static double bench(const draw_info_t *di, const blit_function_t *f, blit_args_t *args, int num,
+                    double seconds)
+{
+  double start = now(), elapsed;
+  long count = 0;
+  int i;
+
+  do {
+    for (i = 0; i < 16; i++)
+      blit_call(di, f, args, num);
+    count += 16;
+    elapsed = now() - start;
+  } while (elapsed < seconds);
+
+  return count * num / elapsed / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+  draw_info_t di[DI_SIMD_AVX2 + 1];
+  unsigned char *src, *srca, *dst, *dsta;
+  blit_args_t args;
+  double seconds = 0.1, rate[DI_SIMD_AVX2 + 1];
+  int num = 1024, max_level, level, format, i;
+
+  if (argc > 1)
+    num = atoi(argv[1]);
+  if (argc > 2)
+    seconds = atof(argv[2]);
+  if (num < 1 || seconds <= 0) {
+    fprintf(stderr, "usage: %s [pixels [seconds]]\n", argv[0]);
+    exit(1);
+  }
+
+  src = malloc(num * 4);
+  srca = malloc(num);
+  dst = malloc(num * 4);
+  dsta = malloc(num);
+  if (!src || !srca || !dst || !dsta) {
+    fprintf(stderr, "Cannot allocate memory!\n");
+    exit(1);
+  }
+  srand(1);
+  for (i = 0; i < num * 4; i++) {
+    src[i] = rand();
+    dst[i] = rand();
+  }
+  for (i = 0; i < num; i++) {
+    srca[i] = rand();
+    dsta[i] = rand();
+  }
+  args.src = src;
+  args.srca = srca;
+  args.dst = dst;
+  args.dsta = dsta;
+  args.r = 200;
+  args.g = 100;
+  args.b = 50;
+  args.a = 160;
+  args.fraction = 128;
+  args.src_ofs = 0;
+
+  artcontext_setup_gamma(0);
+  max_level = artcontext_setup_simd(NULL);
+  printf("%d pixels per run, vector blitters: %s\n", num, simd_names[max_level]);
+  printf("%-6s %-30s", "format", "function (Mpixel/s)");
+  for (level = DI_SIMD_NONE; level <= max_level; level++)
+    printf(" %9s", simd_names[level]);
+  printf("\n");
+
+  for (format = 0; format < NUM_BLIT_FORMATS; format++) {
+    for (level = DI_SIMD_NONE; level <= max_level; level++) {
+      artcontext_setup_simd(simd_names[level]);
+      artcontext_setup_draw_info(&di[level], blit_formats[format].red_mask,
+                                 blit_formats[format].green_mask, blit_formats[format].blue_mask,
+                                 blit_formats[format].bpp);
+    }
+
+    for (i = 0; i < NUM_BLIT_FUNCTIONS; i++) {
+      printf("%-6s %-30s", blit_formats[format].name, blit_functions[i].name);
+      for (level = DI_SIMD_NONE; level <= max_level; level++) {
+        rate[level] = bench(&di[level], &blit_functions[i], &args, num, seconds);
+        printf(" %9.1f", rate[level]);
+      }
+      if (max_level > DI_SIMD_NONE)
+        printf("  x%.1f", rate[max_level] / rate[DI_SIMD_NONE]);
+      printf("\n");
+    }
+  }
+
+  free(src);
+  free(srca);
+  free(dst);
+  free(dsta);
+
+  return 0;
+}
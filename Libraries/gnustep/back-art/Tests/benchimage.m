@@ -0,0 +1,208 @@
+/*
+ * Micro-benchmark of the image kernels of DPSimage (image.m).
+ *
+ * Runs headless: an image is drawn into a window buffer in memory at its
+ * size, at twice its size, at half its size and at its size from the image
+ * cache (image_cache.m), with the kernels and with a reference which draws
+ * every pixel like the general affine code does (sampling, undoing the
+ * premultiplication and a render run per pixel).
+ * For the cases both sample the same pixels, the largest difference
+ * between the two is printed too.
+ *
+ * usage: benchimage [size [seconds]]
+ */
+
+#include "../Source/art/blit-main.m"
+#include "../Source/art/blit-simd.m"
+#include "../Source/art/image.m"
+#include "../Source/art/image_cache.m"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* like _image_do_rgb_transform::: with _image_get_color_rgb_8 */
+static void reference_draw(image_draw_t *d)
+{
+  draw_info_t *di = d->di;
+  void (*render_run)(render_run_t *ri, int num) =
+      d->window_alpha ? di->render_run_alpha_a : di->render_run_alpha;
+  int bpp = d->has_alpha ? 4 : 3;
+  const unsigned char *s;
+  render_run_t ri;
+  int x, y;
+
+  for (y = 0; y < d->sy; y++) {
+    ri.dst = d->data + (d->y + y) * d->bytes_per_line + d->x * di->bytes_per_pixel;
+    ri.dsta = d->alpha + (d->y + y) * d->alpha_per_line + d->x;
+    for (x = 0; x < d->sx; x++, ri.dst += di->bytes_per_pixel, ri.dsta++) {
+      s = d->src + (y * d->height / d->sy) * d->bytes_per_row + (x * d->width / d->sx) * bpp;
+      ri.r = s[0];
+      ri.g = s[1];
+      ri.b = s[2];
+      ri.a = d->has_alpha ? s[3] : 255;
+      if (ri.a && ri.a != 255) {
+        ri.r = (255 * ri.r) / ri.a;
+        ri.g = (255 * ri.g) / ri.a;
+        ri.b = (255 * ri.b) / ri.a;
+      }
+      render_run(&ri, 1);
+    }
+  }
+}
+
+static void kernel_draw(image_draw_t *d)
+{
+  image_draw_rows(d, 0, d->sy);
+}
+
+/* like -_image_draw_cached:: */
+static void cached_draw(image_draw_t *d)
+{
+  image_cache_t *e;
+  image_draw_t c = *d;
+
+  e = image_cache_get(d->src, d->di, d->src, d->width, d->height, d->bytes_per_row, d->has_alpha);
+  c.kind = IMAGE_DEVICE;
+  c.src = e->data;
+  c.bytes_per_row = d->width * d->di->bytes_per_pixel;
+  c.src_alpha = e->alpha;
+  c.opaque = e->opaque;
+  image_draw_rows(&c, 0, c.sy);
+}
+
+/* Mpixel/s of the window */
+static double bench(void (*draw)(image_draw_t *d), image_draw_t *d, double seconds)
+{
+  double start = now(), elapsed;
+  long count = 0;
+
+  do {
+    draw(d);
+    count++;
+    elapsed = now() - start;
+  } while (elapsed < seconds);
+
+  return (double)count * d->sx * d->sy / elapsed / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+  static const struct {
+    const char *name;
+    int kind, has_alpha, scale; /* scale: window size is size * scale / 2 */
+  } cases[] = {
+      {"translate RGB", IMAGE_TRANSLATE, 0, 2},   {"translate RGBA", IMAGE_TRANSLATE, 1, 2},
+      {"upscale x2 RGB", IMAGE_UPSCALE, 0, 4},    {"upscale x2 RGBA", IMAGE_UPSCALE, 1, 4},
+      {"downscale /2 RGB", IMAGE_DOWNSCALE, 0, 1}, {"downscale /2 RGBA", IMAGE_DOWNSCALE, 1, 1},
+      {"cached RGB", IMAGE_DEVICE, 0, 2},         {"cached RGBA", IMAGE_DEVICE, 1, 2},
+  };
+  void (*draw)(image_draw_t *d);
+  draw_info_t di;
+  image_draw_t d;
+  unsigned char *src, *data, *alpha, *copy;
+  double seconds = 0.2, ref, fast;
+  int size = 256, i, j, a, diff, max_diff;
+
+  if (argc > 1)
+    size = atoi(argv[1]);
+  if (argc > 2)
+    seconds = atof(argv[2]);
+  if (size < 2 || seconds <= 0) {
+    fprintf(stderr, "usage: %s [size [seconds]]\n", argv[0]);
+    exit(1);
+  }
+
+  src = malloc(size * size * 4);
+  data = malloc(size * size * 4 * 4);
+  copy = malloc(size * size * 4 * 4);
+  alpha = malloc(size * size * 4);
+  if (!src || !data || !copy || !alpha) {
+    fprintf(stderr, "Cannot allocate memory!\n");
+    exit(1);
+  }
+
+  artcontext_setup_gamma(0);
+  artcontext_setup_simd(NULL);
+  /* the usual 32 bit X visual, a window with alpha */
+  artcontext_setup_draw_info(&di, 0xff0000, 0xff00, 0xff, 32);
+  /* room for the image */
+  image_cache_set_limit((size_t)size * size * 4 * 16);
+
+  printf("%ix%i image, %-18s %12s %12s\n", size, size, "(Mpixel/s)", "reference", "kernel");
+  for (i = 0; i < (int)(sizeof(cases) / sizeof(cases[0])); i++) {
+    /* an icon: transparent, opaque and antialiased edges, premultiplied */
+    srand(1);
+    for (j = 0; j < size * size; j++) {
+      a = (j % size < size / 4) ? 0 : (j % size > size / 2) ? 255 : rand() & 255;
+      if (!cases[i].has_alpha)
+        a = 255;
+      src[j * 4 + 0] = (rand() & 255) * a / 255;
+      src[j * 4 + 1] = (rand() & 255) * a / 255;
+      src[j * 4 + 2] = (rand() & 255) * a / 255;
+      src[j * 4 + 3] = a;
+    }
+    if (!cases[i].has_alpha) {
+      for (j = 0; j < size * size; j++)
+        memmove(src + j * 3, src + j * 4, 3);
+    }
+
+    memset(&d, 0, sizeof(d));
+    d.kind = cases[i].kind == IMAGE_DEVICE ? IMAGE_TRANSLATE : cases[i].kind;
+    draw = cases[i].kind == IMAGE_DEVICE ? cached_draw : kernel_draw;
+    d.src = src;
+    d.width = d.height = size;
+    d.bytes_per_row = size * (cases[i].has_alpha ? 4 : 3);
+    d.has_alpha = cases[i].has_alpha;
+    d.sx = d.sy = size * cases[i].scale / 2;
+    d.scale_x = d.scale_y = 2;
+    d.di = &di;
+    d.data = data;
+    d.alpha = alpha;
+    d.bytes_per_line = d.sx * 4;
+    d.alpha_per_line = d.sx;
+    d.window_alpha = 1;
+    d.x0 = 0;
+    d.x1 = d.sx;
+    if (d.kind == IMAGE_DOWNSCALE && !image_setup_downscale(&d)) {
+      fprintf(stderr, "Cannot allocate memory!\n");
+      exit(1);
+    }
+
+    memset(data, 0x80, d.sx * d.sy * 4);
+    reference_draw(&d);
+    memcpy(copy, data, d.sx * d.sy * 4);
+    memset(data, 0x80, d.sx * d.sy * 4);
+    draw(&d);
+    max_diff = 0;
+    for (j = 0; j < d.sx * d.sy * 4; j++) {
+      diff = abs(data[j] - copy[j]);
+      if (diff > max_diff)
+        max_diff = diff;
+    }
+
+    ref = bench(reference_draw, &d, seconds);
+    fast = bench(draw, &d, seconds);
+    printf("%-36s %12.1f %12.1f  x%.1f", cases[i].name, ref, fast, fast / ref);
+    if (d.kind != IMAGE_DOWNSCALE)
+      printf("  (largest difference %i)", max_diff);
+    printf("\n");
+
+    image_free(&d);
+  }
+
+  free(src);
+  free(data);
+  free(copy);
+  free(alpha);
+
+  return 0;
+}
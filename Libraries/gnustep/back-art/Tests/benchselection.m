@@ -0,0 +1,326 @@
+/*
+ * Throughput benchmark of X selection transfers between two clients.
+ *
+ * Runs on the X server of $DISPLAY, Xvfb will do:
+ *   Xvfb :9 & DISPLAY=:9 ./obj/benchselection
+ *
+ * A child process owns the CLIPBOARD with data of the given size, and the
+ * parent converts it the given number of times. The child sends it like
+ * xpbs (Tools/xpbs.m) did, in 4 kB properties with a round trip after
+ * each, and like it does now, in properties as large as the server
+ * accepts (up to 1 MB) or with INCR when the data is larger.
+ *
+ * With -paste, the CLIPBOARD of the running owner is converted instead,
+ * to the given target: copy an image in a GNUstep application and run
+ * 'benchselection -paste image/tiff' to time gpbs.
+ *
+ * usage: benchselection [megabytes [count]]
+ *        benchselection -paste [target [count]]
+ */
+
+#include <X11/Xatom.h>
+#include <X11/Xlib.h>
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SEND_SYNC 0
+#define SEND_INCR 1
+
+/* like XPB_MAX_CHUNK of xpbs */
+#define MAX_CHUNK (1024 * 1024)
+
+static Atom clipboard, incr, target, property;
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static Display *open_display(void)
+{
+  Display *d = XOpenDisplay(NULL);
+
+  if (!d) {
+    fprintf(stderr, "Cannot open display %s\n", XDisplayName(NULL));
+    exit(1);
+  }
+  clipboard = XInternAtom(d, "CLIPBOARD", False);
+  incr = XInternAtom(d, "INCR", False);
+  property = XInternAtom(d, "BENCH_SELECTION", False);
+  return d;
+}
+
+static unsigned char *make_data(size_t size)
+{
+  unsigned char *data = malloc(size);
+  size_t i;
+
+  if (!data) {
+    fprintf(stderr, "Cannot allocate memory!\n");
+    exit(1);
+  }
+  for (i = 0; i < size; i++)
+    data[i] = (i * 31) ^ (i >> 12);
+  return data;
+}
+
+static unsigned long max_chunk(Display *d)
+{
+  long max = XExtendedMaxRequestSize(d);
+
+  if (max == 0)
+    max = XMaxRequestSize(d);
+  max = max * 4 - 100;
+  return max < MAX_CHUNK ? max : MAX_CHUNK;
+}
+
+static void notify(Display *d, XSelectionRequestEvent *r, Atom prop)
+{
+  XSelectionEvent n;
+
+  memset(&n, 0, sizeof(n));
+  n.type = SelectionNotify;
+  n.requestor = r->requestor;
+  n.selection = r->selection;
+  n.target = r->target;
+  n.property = prop;
+  n.time = r->time;
+  XSendEvent(d, r->requestor, False, 0, (XEvent *)&n);
+  XFlush(d);
+}
+
+/* the child: owns the CLIPBOARD until it's killed */
+static void owner(int mode, size_t size, int fd)
+{
+  Display *d = open_display();
+  Window w = XCreateSimpleWindow(d, DefaultRootWindow(d), 0, 0, 1, 1, 0, 0, 0);
+  unsigned char *data = make_data(size);
+  unsigned long chunk = mode == SEND_SYNC ? 4096 : max_chunk(d);
+  /* the INCR transfer in progress */
+  Window incr_window = None;
+  Atom incr_property = None;
+  size_t pos = 0, n;
+  XEvent e;
+
+  XSetSelectionOwner(d, clipboard, w, CurrentTime);
+  XSync(d, False);
+  if (write(fd, &w, sizeof(w)) != sizeof(w))
+    exit(1);
+
+  for (;;) {
+    XNextEvent(d, &e);
+
+    if (e.type == SelectionRequest) {
+      XSelectionRequestEvent *r = &e.xselectionrequest;
+
+      if (mode == SEND_INCR && size > chunk) {
+        long length = size;
+
+        XSelectInput(d, r->requestor, PropertyChangeMask);
+        XChangeProperty(d, r->requestor, r->property, incr, 32, PropModeReplace,
+                        (unsigned char *)&length, 1);
+        XSync(d, False);
+        incr_window = r->requestor;
+        incr_property = r->property;
+        pos = 0;
+      } else {
+        int prop_mode = PropModeReplace;
+
+        for (pos = 0; pos < size; pos += n) {
+          n = size - pos < chunk ? size - pos : chunk;
+          XChangeProperty(d, r->requestor, r->property, XA_STRING, 8, prop_mode, data + pos, n);
+          prop_mode = PropModeAppend;
+          if (chunk == 4096)
+            XSync(d, False);
+        }
+        XSync(d, False);
+      }
+      notify(d, r, r->property);
+    } else if (e.type == PropertyNotify && e.xproperty.window == incr_window &&
+               e.xproperty.atom == incr_property && e.xproperty.state == PropertyDelete) {
+      n = size - pos < chunk ? size - pos : chunk;
+      XChangeProperty(d, incr_window, incr_property, XA_STRING, 8, PropModeReplace, data + pos,
+                      n);
+      XSync(d, False);
+      pos += n;
+      if (n == 0) {
+        XSelectInput(d, incr_window, NoEventMask);
+        incr_window = None;
+      }
+    }
+  }
+}
+
+static Bool is_selection_notify(Display *d, XEvent *e, XPointer arg)
+{
+  return e->type == SelectionNotify;
+}
+
+static Bool is_new_value(Display *d, XEvent *e, XPointer arg)
+{
+  return e->type == PropertyNotify && e->xproperty.atom == property &&
+         e->xproperty.state == PropertyNewValue;
+}
+
+/* reads and deletes the property, returns the number of bytes (0 and type
+   None if there is no property) */
+static long read_property(Display *d, Window w, unsigned char **buffer, size_t *length,
+                          Atom *type)
+{
+  unsigned long items, remaining;
+  unsigned char *value;
+  int format;
+  long bytes;
+
+  if (XGetWindowProperty(d, w, property, 0, 0x1fffffff, True, AnyPropertyType, type, &format,
+                         &items, &remaining, &value) != Success)
+    return -1;
+  bytes = items * (format == 32 ? sizeof(long) : format / 8);
+  *buffer = realloc(*buffer, *length + bytes + 1);
+  if (bytes)
+    memcpy(*buffer + *length, value, bytes);
+  *length += bytes;
+  if (value)
+    XFree(value);
+  return bytes;
+}
+
+/* converts the CLIPBOARD, returns the number of bytes, -1 on failure */
+static long convert(Display *d, Window w, unsigned char **buffer)
+{
+  size_t length = 0;
+  long bytes;
+  Atom type;
+  XEvent e;
+
+  /* the events of earlier transfers */
+  while (XCheckIfEvent(d, &e, is_new_value, NULL))
+    ;
+
+  XConvertSelection(d, clipboard, target, property, w, CurrentTime);
+  XIfEvent(d, &e, is_selection_notify, NULL);
+  if (e.xselection.property == None)
+    return -1;
+
+  if (read_property(d, w, buffer, &length, &type) < 0)
+    return -1;
+  if (type == incr) {
+    /* deleting the property started the transfer, which ends with an
+       empty property; the event of the INCR property may come first */
+    length = 0;
+    do {
+      XIfEvent(d, &e, is_new_value, NULL);
+      bytes = read_property(d, w, buffer, &length, &type);
+      if (bytes < 0)
+        return -1;
+    } while (bytes > 0 || type == None);
+  }
+  return length;
+}
+
+/* MB/s, or 0 if a transfer failed */
+static double bench(Display *d, Window w, int count, const unsigned char *expected, size_t size,
+                    long *length)
+{
+  unsigned char *buffer = NULL;
+  double start = now();
+  int i;
+
+  for (i = 0; i < count; i++) {
+    *length = convert(d, w, &buffer);
+    if (*length < 0 || (expected && ((size_t)*length != size || memcmp(buffer, expected, size))))
+      return 0;
+  }
+  free(buffer);
+  return (double)*length * count / (now() - start) / (1024 * 1024);
+}
+
+int main(int argc, char **argv)
+{
+  static const char *names[] = {"4 kB properties, round trip each", "large properties, INCR"};
+  const char *target_name = "STRING";
+  unsigned char *expected;
+  size_t size = 16 * 1024 * 1024;
+  int count = 4, paste = 0, mode, fds[2];
+  double rate;
+  Display *d;
+  Window w, child_window;
+  long length;
+  pid_t pid;
+
+  if (argc > 1 && !strcmp(argv[1], "-paste")) {
+    paste = 1;
+    if (argc > 2)
+      target_name = argv[2];
+    if (argc > 3)
+      count = atoi(argv[3]);
+  } else {
+    if (argc > 1)
+      size = (size_t)(atof(argv[1]) * 1024 * 1024);
+    if (argc > 2)
+      count = atoi(argv[2]);
+  }
+  if (size < 1 || count < 1) {
+    fprintf(stderr, "usage: %s [megabytes [count]]\n       %s -paste [target [count]]\n",
+            argv[0], argv[0]);
+    exit(1);
+  }
+
+  d = open_display();
+  target = XInternAtom(d, target_name, False);
+  w = XCreateSimpleWindow(d, DefaultRootWindow(d), 0, 0, 1, 1, 0, 0, 0);
+  XSelectInput(d, w, PropertyChangeMask);
+
+  if (paste) {
+    rate = bench(d, w, count, NULL, 0, &length);
+    if (rate == 0) {
+      fprintf(stderr, "The CLIPBOARD could not be converted to %s\n", target_name);
+      exit(1);
+    }
+    printf("%s, %ld bytes: %.1f MB/s\n", target_name, length, rate);
+    return 0;
+  }
+
+  expected = make_data(size);
+  printf("%.1f MB selection, largest request %lu kB\n", size / (1024.0 * 1024),
+         (XExtendedMaxRequestSize(d) ? XExtendedMaxRequestSize(d) : XMaxRequestSize(d)) * 4 /
+             1024);
+  for (mode = SEND_SYNC; mode <= SEND_INCR; mode++) {
+    if (pipe(fds) < 0)
+      exit(1);
+    pid = fork();
+    if (pid == 0) {
+      close(fds[0]);
+      owner(mode, size, fds[1]);
+    }
+    close(fds[1]);
+    if (pid < 0 || read(fds[0], &child_window, sizeof(child_window)) != sizeof(child_window)) {
+      fprintf(stderr, "Cannot start the selection owner\n");
+      exit(1);
+    }
+    close(fds[0]);
+
+    rate = bench(d, w, count, expected, size, &length);
+    if (rate == 0)
+      printf("%-36s failed\n", names[mode]);
+    else
+      printf("%-36s %8.1f MB/s\n", names[mode], rate);
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+  }
+
+  free(expected);
+  XCloseDisplay(d);
+
+  return 0;
+}
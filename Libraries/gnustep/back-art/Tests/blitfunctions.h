@@ -0,0 +1,159 @@
+/*
+ * The functions of draw_info_t and how to call them, for testblit and
+ * benchblit. Both include the blitters themselves (blit-main.m and
+ * blit-simd.m) and run headless.
+ */
+
+#ifndef blitfunctions_h
+#define blitfunctions_h
+
+#include <stddef.h>
+
+typedef enum {
+  RUN,
+  BLIT_ALPHA_OPAQUE,
+  BLIT_MONO_OPAQUE,
+  BLIT_ALPHA,
+  BLIT_MONO,
+  BLIT_ALPHA_A,
+  BLIT_MONO_A,
+  BLIT_SUBPIXEL,
+  COMPOSITE
+} blit_kind_t;
+
+typedef struct {
+  const char *name;
+  size_t offset;
+  blit_kind_t kind;
+} blit_function_t;
+
+#define F(field, name, kind) {name, offsetof(draw_info_t, field), kind}
+
+/* the compositing ones by operation, aa: source and destination with alpha,
+   oa: opaque source, ao: opaque destination, oo: both opaque */
+static const blit_function_t blit_functions[] = {
+    F(render_run_alpha, "render_run_alpha", RUN),
+    F(render_run_opaque, "render_run_opaque", RUN),
+    F(render_run_alpha_a, "render_run_alpha_a", RUN),
+    F(render_run_opaque_a, "render_run_opaque_a", RUN),
+    F(render_blit_alpha_opaque, "render_blit_alpha_opaque", BLIT_ALPHA_OPAQUE),
+    F(render_blit_mono_opaque, "render_blit_mono_opaque", BLIT_MONO_OPAQUE),
+    F(render_blit_alpha, "render_blit_alpha", BLIT_ALPHA),
+    F(render_blit_mono, "render_blit_mono", BLIT_MONO),
+    F(render_blit_alpha_a, "render_blit_alpha_a", BLIT_ALPHA_A),
+    F(render_blit_mono_a, "render_blit_mono_a", BLIT_MONO_A),
+    F(render_blit_subpixel, "render_blit_subpixel", BLIT_SUBPIXEL),
+    F(read_pixels_o, "read_pixels_o", COMPOSITE),
+    F(read_pixels_a, "read_pixels_a", COMPOSITE),
+    F(write_pixels_o, "write_pixels_o", COMPOSITE),
+    F(write_pixels_a, "write_pixels_a", COMPOSITE),
+    F(composite_sover_aa, "NSCompositeSourceOver aa", COMPOSITE),
+    F(composite_sover_ao, "NSCompositeSourceOver ao", COMPOSITE),
+    F(composite_sin_aa, "NSCompositeSourceIn aa", COMPOSITE),
+    F(composite_sin_oa, "NSCompositeSourceIn oa", COMPOSITE),
+    F(composite_sout_aa, "NSCompositeSourceOut aa", COMPOSITE),
+    F(composite_sout_oa, "NSCompositeSourceOut oa", COMPOSITE),
+    F(composite_satop_aa, "NSCompositeSourceAtop aa", COMPOSITE),
+    F(composite_dover_aa, "NSCompositeDestinationOver aa", COMPOSITE),
+    F(composite_dover_oa, "NSCompositeDestinationOver oa", COMPOSITE),
+    F(composite_din_aa, "NSCompositeDestinationIn aa", COMPOSITE),
+    F(composite_dout_aa, "NSCompositeDestinationOut aa", COMPOSITE),
+    F(composite_datop_aa, "NSCompositeDestinationAtop aa", COMPOSITE),
+    F(composite_xor_aa, "NSCompositeXOR aa", COMPOSITE),
+    F(composite_plusl_aa, "NSCompositePlusLighter aa", COMPOSITE),
+    F(composite_plusl_oa, "NSCompositePlusLighter oa", COMPOSITE),
+    F(composite_plusl_ao, "NSCompositePlusLighter ao", COMPOSITE),
+    F(composite_plusl_oo, "NSCompositePlusLighter oo", COMPOSITE),
+    F(composite_plusd_aa, "NSCompositePlusDarker aa", COMPOSITE),
+    F(composite_plusd_oa, "NSCompositePlusDarker oa", COMPOSITE),
+    F(composite_plusd_ao, "NSCompositePlusDarker ao", COMPOSITE),
+    F(composite_plusd_oo, "NSCompositePlusDarker oo", COMPOSITE),
+    F(dissolve_aa, "dissolve aa", COMPOSITE),
+    F(dissolve_oa, "dissolve oa", COMPOSITE),
+    F(dissolve_ao, "dissolve ao", COMPOSITE),
+    F(dissolve_oo, "dissolve oo", COMPOSITE),
+};
+
+#undef F
+
+#define NUM_BLIT_FUNCTIONS ((int)(sizeof(blit_functions) / sizeof(blit_functions[0])))
+
+static const struct {
+  const char *name;
+  int how, bpp;
+  unsigned int red_mask, green_mask, blue_mask;
+} blit_formats[] = {
+    {"RGBA", DI_32_RGBA, 32, 0xff, 0xff00, 0xff0000},
+    {"BGRA", DI_32_BGRA, 32, 0xff0000, 0xff00, 0xff},
+    {"RGB", DI_24_RGB, 24, 0xff, 0xff00, 0xff0000},
+    {"BGR", DI_24_BGR, 24, 0xff0000, 0xff00, 0xff},
+};
+
+#define NUM_BLIT_FORMATS ((int)(sizeof(blit_formats) / sizeof(blit_formats[0])))
+
+static const char *simd_names[] = {"none", "sse2", "avx2"};
+
+/* buffers and parameters of a call */
+typedef struct {
+  unsigned char *dst, *dsta, *src, *srca;
+  unsigned char r, g, b, a, fraction;
+  int src_ofs;
+} blit_args_t;
+
+typedef void (*run_f)(render_run_t *, int);
+typedef void (*blit_alpha_opaque_f)(unsigned char *, const unsigned char *, unsigned char,
+                                    unsigned char, unsigned char, int);
+typedef void (*blit_mono_opaque_f)(unsigned char *, const unsigned char *, int, unsigned char,
+                                   unsigned char, unsigned char, int);
+typedef void (*blit_alpha_f)(unsigned char *, const unsigned char *, unsigned char, unsigned char,
+                             unsigned char, unsigned char, int);
+typedef void (*blit_mono_f)(unsigned char *, const unsigned char *, int, unsigned char,
+                            unsigned char, unsigned char, unsigned char, int);
+typedef void (*blit_alpha_a_f)(unsigned char *, unsigned char *, const unsigned char *,
+                               unsigned char, unsigned char, unsigned char, unsigned char, int);
+typedef void (*blit_mono_a_f)(unsigned char *, unsigned char *, const unsigned char *, int,
+                              unsigned char, unsigned char, unsigned char, unsigned char, int);
+typedef void (*composite_f)(composite_run_t *, int);
+
+#define FUNC(type) (*(type *)((const char *)di + f->offset))
+
+static void blit_call(const draw_info_t *di, const blit_function_t *f, blit_args_t *p, int num)
+{
+  switch (f->kind) {
+    case RUN: {
+      render_run_t ri = {p->r, p->g, p->b, p->a, p->dst, p->dsta};
+
+      FUNC(run_f)(&ri, num);
+      break;
+    }
+    case BLIT_ALPHA_OPAQUE:
+      FUNC(blit_alpha_opaque_f)(p->dst, p->src, p->r, p->g, p->b, num);
+      break;
+    case BLIT_MONO_OPAQUE:
+      FUNC(blit_mono_opaque_f)(p->dst, p->src, p->src_ofs, p->r, p->g, p->b, num);
+      break;
+    case BLIT_ALPHA:
+    case BLIT_SUBPIXEL:
+      FUNC(blit_alpha_f)(p->dst, p->src, p->r, p->g, p->b, p->a, num);
+      break;
+    case BLIT_MONO:
+      FUNC(blit_mono_f)(p->dst, p->src, p->src_ofs, p->r, p->g, p->b, p->a, num);
+      break;
+    case BLIT_ALPHA_A:
+      FUNC(blit_alpha_a_f)(p->dst, p->dsta, p->src, p->r, p->g, p->b, p->a, num);
+      break;
+    case BLIT_MONO_A:
+      FUNC(blit_mono_a_f)(p->dst, p->dsta, p->src, p->src_ofs, p->r, p->g, p->b, p->a, num);
+      break;
+    case COMPOSITE: {
+      composite_run_t c = {p->dst, p->dsta, p->src, p->srca, p->fraction};
+
+      FUNC(composite_f)(&c, num);
+      break;
+    }
+  }
+}
+
+#undef FUNC
+
+#endif
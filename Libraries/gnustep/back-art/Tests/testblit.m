@@ -0,0 +1,140 @@
+/*
+ * Regression test of the vector blitters.
+ *
+ * Every function of the draw info of the formats having vector versions
+ * is run on random pixels, with runs of transparent and opaque ones, with
+ * the scalar reference and with each instruction set the CPU supports:
+ * the results must be the same bytes. The compositing functions are named
+ * after the NSCompositingOperation they implement.
+ *
+ * usage: testblit [iterations]
+ */
+
+#include "../Source/art/blit-main.m"
+#include "../Source/art/blit-simd.m"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "blitfunctions.h"
+
+#define MAX_PIXELS 80
+/* room for a misaligned start and bytes after the run, which must not change */
+#define BUFFER_SIZE ((MAX_PIXELS + 16) * 4)
+
+static int failures = 0;
+
+/* random bytes, with runs of 0 and 255 every 'step' bytes from 'ofs' */
+static void fill(unsigned char *p, int size, int ofs, int step)
+{
+  int i, run = 0, kind = 0;
+
+  for (i = 0; i < size; i++)
+    p[i] = rand();
+
+  for (i = ofs; i < size; i += step) {
+    if (run-- <= 0) {
+      run = rand() % 12;
+      kind = rand() % 4;
+    }
+    if (kind == 0)
+      p[i] = 0;
+    else if (kind == 1)
+      p[i] = 255;
+  }
+}
+
+static unsigned char random_value(void)
+{
+  switch (rand() % 4) {
+    case 0:
+      return 0;
+    case 1:
+      return 255;
+    default:
+      return rand();
+  }
+}
+
+static void test_function(const char *format, int level, const draw_info_t *ref,
+                          const draw_info_t *vec, const blit_function_t *f, int inline_alpha)
+{
+  unsigned char src[BUFFER_SIZE], srca[BUFFER_SIZE];
+  unsigned char dst[2][BUFFER_SIZE], dsta[2][BUFFER_SIZE];
+  blit_args_t args[2];
+  int num = rand() % MAX_PIXELS, ofs = rand() % 16, i;
+
+  fill(src, BUFFER_SIZE, 3, inline_alpha ? 4 : 1);
+  fill(srca, BUFFER_SIZE, 0, 1);
+  fill(dst[0], BUFFER_SIZE, 3, inline_alpha ? 4 : 1);
+  fill(dsta[0], BUFFER_SIZE, 0, 1);
+  memcpy(dst[1], dst[0], BUFFER_SIZE);
+  memcpy(dsta[1], dsta[0], BUFFER_SIZE);
+
+  args[0].src = src + ofs;
+  args[0].srca = srca + ofs;
+  args[0].r = random_value();
+  args[0].g = (rand() % 3) ? random_value() : args[0].r;
+  args[0].b = (rand() % 3) ? random_value() : args[0].r;
+  args[0].a = random_value();
+  args[0].fraction = random_value();
+  args[0].src_ofs = rand() % 8;
+  args[1] = args[0];
+
+  for (i = 0; i < 2; i++) {
+    args[i].dst = dst[i] + ofs;
+    args[i].dsta = dsta[i] + ofs;
+    blit_call(i ? vec : ref, f, &args[i], num);
+  }
+
+  if (memcmp(dst[0], dst[1], BUFFER_SIZE) || memcmp(dsta[0], dsta[1], BUFFER_SIZE)) {
+    for (i = 0; i < BUFFER_SIZE; i++) {
+      if (dst[0][i] != dst[1][i] || dsta[0][i] != dsta[1][i])
+        break;
+    }
+    printf("FAIL %s %s %s: %i pixels, first difference at byte %i\n", format, simd_names[level],
+           f->name, num, i - ofs);
+    failures++;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  draw_info_t ref, vec;
+  int iterations = 200, max_level, level, format, i, j;
+
+  if (argc > 1)
+    iterations = atoi(argv[1]);
+
+  srand(1);
+  artcontext_setup_gamma(0);
+  max_level = artcontext_setup_simd(NULL);
+  printf("vector blitters: %s\n", simd_names[max_level]);
+
+  for (format = 0; format < NUM_BLIT_FORMATS; format++) {
+    artcontext_setup_simd("none");
+    artcontext_setup_draw_info(&ref, blit_formats[format].red_mask,
+                               blit_formats[format].green_mask, blit_formats[format].blue_mask,
+                               blit_formats[format].bpp);
+
+    for (level = DI_SIMD_SSE2; level <= max_level; level++) {
+      artcontext_setup_simd(simd_names[level]);
+      artcontext_setup_draw_info(&vec, blit_formats[format].red_mask,
+                                 blit_formats[format].green_mask, blit_formats[format].blue_mask,
+                                 blit_formats[format].bpp);
+
+      for (i = 0; i < NUM_BLIT_FUNCTIONS; i++) {
+        for (j = 0; j < iterations; j++)
+          test_function(blit_formats[format].name, level, &ref, &vec, &blit_functions[i],
+                        ref.inline_alpha);
+      }
+    }
+  }
+
+  if (failures)
+    printf("%d failures\n", failures);
+  else
+    printf("all the vector blitters give the same bytes as the scalar ones\n");
+
+  return failures ? 1 : 0;
+}
@@ -33,6 +33,8 @@
 #include <Foundation/NSUserDefaults.h>
 #include <AppKit/NSPasteboard.h>
 
+#include <poll.h>
+
 #include <X11/Xatom.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
@@ -190,6 +192,40 @@ static Atom atoms[sizeof(atom_names)/sizeof(char*)];
 }
 @end
 
+
+
+
+/*
+ * A selection too large for one property is sent with the INCR protocol
+ * of the ICCCM: the requestor is given the size, and deletes the property
+ * every time it has read it, which makes us write the next chunk.  A zero
+ * length chunk ends the transfer.  The PropertyNotify events of the
+ * requestor's window come with the others, so gpbs goes on serving
+ * requests during the transfer.
+ */
+@interface	XPbIncrSender : NSObject
+{
+  NSData	*_data;
+  Window	_window;
+  Atom		_property;
+  Atom		_type;
+  unsigned long	_pos;
+  unsigned long	_chunk;
+  NSTimer	*_timer;
+  NSTimeInterval _lastActivity;
+}
+
++ (XPbIncrSender*) senderTo: (Window)window property: (Atom)property;
++ (BOOL) sendData: (NSData*)data type: (Atom)xType
+	       to: (Window)window property: (Atom)property
+	    chunk: (unsigned long)chunk;
++ (BOOL) xPropertyNotify: (XPropertyEvent*)xEvent;
+
+- (void) checkTimeout: (NSTimer*)timer;
+- (void) finish;
+- (void) sendChunk;
+@end
+
 
 
 /*
@@ -457,6 +493,9 @@ static int              xFixesEventBase;
 {
   XPbOwner	*o;
 
+  if ([XPbIncrSender xPropertyNotify: xEvent])
+    return;
+
   o = [self ownerByXPb: xEvent->atom];
   if (o == nil)
     {
@@ -783,6 +822,32 @@ xErrorHandler(Display *d, XErrorEvent *e)
   return 0;
 }
 
+/*
+ * The largest chunk of data written to a property at once: what fits in
+ * the largest request the server accepts, up to XPB_MAX_CHUNK so the
+ * server doesn't keep a copy of a large selection.  Larger data is sent
+ * with INCR.
+ */
+#define XPB_MAX_CHUNK	(1024 * 1024)
+
+/*
+ * How long either side of an INCR transfer waits for the other before
+ * the transfer is given up.
+ */
+#define XPB_INCR_TIMEOUT	30.0
+
+static unsigned long
+xMaxChunk(void)
+{
+  long	max = XExtendedMaxRequestSize(xDisplay);
+
+  if (max == 0)
+    max = XMaxRequestSize(xDisplay);
+  /* room for the header of ChangeProperty */
+  max = max * 4 - 100;
+  return max < XPB_MAX_CHUNK ? max : XPB_MAX_CHUNK;
+}
+
 /*
  * Check to see what types of data the selection owner is
  * making available, and declare them all.
@@ -966,6 +1031,27 @@ xErrorHandler(Display *d, XErrorEvent *e)
     }
 }
 
+/*
+ * Matches the PropertyNotify of the next chunk of the INCR transfer to
+ * the window and property of the SelectionNotify event in 'arg'.
+ */
+static Bool
+isIncrChunk(Display *d, XEvent *event, XPointer arg)
+{
+  XSelectionEvent	*xEvent = (XSelectionEvent*)arg;
+
+  return event->type == PropertyNotify
+    && event->xproperty.window == xEvent->requestor
+    && event->xproperty.atom == xEvent->property
+    && event->xproperty.state == PropertyNewValue;
+}
+
+static Bool
+isNotIncrChunk(Display *d, XEvent *event, XPointer arg)
+{
+  return !isIncrChunk(d, event, arg);
+}
+
 - (void) xSelectionNotify: (XSelectionEvent*)xEvent
 {
   Atom actual_type;
@@ -993,34 +1079,77 @@ xErrorHandler(Display *d, XErrorEvent *e)
         {
           XEvent event;
           NSMutableData	*imd = nil;
+          NSDate *limit;
+          struct pollfd pfd;
           BOOL wait = YES;
           
           md = nil;
+          /*
+           * Deleting the INCR property starts the transfer.  The owner
+           * then writes each chunk after we delete the previous one, and
+           * ends with an empty chunk.  The event of the INCR property
+           * itself is queued before the SelectionNotify, drop it.
+           */
+          while (XCheckIfEvent(xDisplay, &event, isIncrChunk,
+                               (XPointer)xEvent))
+            ;
+          XDeleteProperty(xDisplay, xEvent->requestor, xEvent->property);
+          XFlush(xDisplay);
+          limit = [NSDate dateWithTimeIntervalSinceNow: XPB_INCR_TIMEOUT];
+          pfd.fd = ConnectionNumber(xDisplay);
+          pfd.events = POLLIN;
           while (wait)
             {
-              XNextEvent(xDisplay, &event);
-              
-              if (event.type == PropertyNotify)
+              /*
+               * Other events are handled as usual meanwhile, so that the
+               * INCR transfers we send ourselves go on.  They are taken
+               * with the negated predicate too: a chunk that arrives
+               * between the two checks must stay in the queue.
+               */
+              if (!XCheckIfEvent(xDisplay, &event, isIncrChunk,
+                                 (XPointer)xEvent))
                 {
-                  if (event.xproperty.state != PropertyNewValue) continue;
-                  
-                  imd = [self getSelectionData: xEvent type: &actual_type];
-                  if (imd != nil)
+                  if (XCheckIfEvent(xDisplay, &event, isNotIncrChunk,
+                                    (XPointer)xEvent))
                     {
-                      if (md == nil)
-                        {
-                          md = imd;
-                        }
-                      else
-                        {
-                          [md appendData: imd];
-                        }
+                      [[self class] xEvent: &event];
                     }
-                  else
+                  else if (XQLength(xDisplay) > 0)
+                    {
+                      /* the chunk came in meanwhile, don't poll */
+                    }
+                  else if ([limit timeIntervalSinceNow] <= 0.0)
                     {
+                      NSLog(@"Timed out waiting for INCR data for %@", _name);
+                      md = nil;
                       wait = NO;
                     }
+                  else
+                    {
+                      poll(&pfd, 1, 1000);
+                    }
+                  continue;
                 }
+
+              imd = [self getSelectionData: xEvent type: &actual_type];
+              XDeleteProperty(xDisplay, xEvent->requestor, xEvent->property);
+              XFlush(xDisplay);
+              if (imd != nil)
+                {
+                  if (md == nil)
+                    {
+                      md = imd;
+                    }
+                  else
+                    {
+                      [md appendData: imd];
+                    }
+                }
+              else
+                {
+                  wait = NO;
+                }
+              limit = [NSDate dateWithTimeIntervalSinceNow: XPB_INCR_TIMEOUT];
             }
         }
     }
@@ -1470,8 +1599,9 @@ xErrorHandler(Display *d, XErrorEvent *e)
   /*
    * If we have managed to convert data of the appropritate type, we must now
    * append the data to the property on the requesting window.
-   * We do this in small chunks, checking for errors, in case the window
-   * manager puts a limit on the data size we can use.
+   * We do this in chunks as large as the server accepts, and check for
+   * errors once they are all written.  Data larger than a chunk is sent
+   * with INCR.
    * This is not thread-safe - but I think that's a general problem with X.
    */
   if (data != 0 && numItems != 0 && format != 0)
@@ -1479,12 +1609,22 @@ xErrorHandler(Display *d, XErrorEvent *e)
       int	(*oldHandler)(Display*, XErrorEvent*);
       int	mode = PropModeReplace;
       int	pos = 0;
-      int	maxItems = 4096 * 8 / format;
+      unsigned long chunk = xMaxChunk();
+      int	maxItems = chunk * 8 / format;
+
+      if (format == 8 && numItems > chunk)
+        {
+          NSData *d = [NSData dataWithBytesNoCopy: data length: numItems];
+
+          return [XPbIncrSender sendData: d type: xType
+                                      to: window property: property
+                                   chunk: chunk];
+        }
 
       appendFailure = NO;
       oldHandler = XSetErrorHandler(xErrorHandler);
 
-      while (appendFailure == NO && pos < numItems)
+      while (pos < numItems)
         {
           if (pos + maxItems > numItems)
             {
@@ -1494,8 +1634,8 @@ xErrorHandler(Display *d, XErrorEvent *e)
                           xType, format, mode, &data[pos*format/8], maxItems);
           mode = PropModeAppend;
           pos += maxItems;
-          XSync(xDisplay, False);
         }
+      XSync(xDisplay, False);
       free(data);
       XSetErrorHandler(oldHandler);
       if (appendFailure == NO)
@@ -1574,6 +1714,157 @@ xErrorHandler(Display *d, XErrorEvent *e)
 
 
 
+/* Transfers in progress. */
+static NSMutableArray	*incrSenders;
+
+@implementation	XPbIncrSender
+
++ (XPbIncrSender*) senderTo: (Window)window property: (Atom)property
+{
+  NSEnumerator	*e = [incrSenders objectEnumerator];
+  XPbIncrSender	*s;
+
+  while ((s = [e nextObject]) != nil)
+    {
+      if (s->_window == window
+	&& (property == None || s->_property == property))
+        return s;
+    }
+  return nil;
+}
+
++ (BOOL) sendData: (NSData*)data type: (Atom)xType
+	       to: (Window)window property: (Atom)property
+	    chunk: (unsigned long)chunk
+{
+  int		(*oldHandler)(Display*, XErrorEvent*);
+  XPbIncrSender	*s;
+  long		size = [data length];
+
+  /* the requestor wants the property for something else now */
+  [[self senderTo: window property: property] finish];
+
+  /*
+   * Property changes on the requestor's window are watched from before
+   * the INCR property is written, so its deletion isn't missed.
+   */
+  appendFailure = NO;
+  oldHandler = XSetErrorHandler(xErrorHandler);
+  XSelectInput(xDisplay, window, PropertyChangeMask);
+  XChangeProperty(xDisplay, window, property, XG_INCR, 32,
+		  PropModeReplace, (unsigned char*)&size, 1);
+  XSync(xDisplay, False);
+  XSetErrorHandler(oldHandler);
+  if (appendFailure)
+    {
+      NSDebugLLog(@"Pbs", @"Could not start INCR transfer.");
+      return NO;
+    }
+
+  s = [self new];
+  ASSIGN(s->_data, data);
+  s->_window = window;
+  s->_property = property;
+  s->_type = xType;
+  s->_chunk = chunk;
+  s->_lastActivity = [NSDate timeIntervalSinceReferenceDate];
+  /* retains the sender until -finish */
+  s->_timer = [NSTimer scheduledTimerWithTimeInterval: XPB_INCR_TIMEOUT / 2
+					       target: s
+					     selector: @selector(checkTimeout:)
+					     userInfo: nil
+					      repeats: YES];
+  if (incrSenders == nil)
+    incrSenders = [NSMutableArray new];
+  [incrSenders addObject: s];
+  RELEASE(s);
+  NSDebugLLog(@"Pbs", @"INCR transfer of %ld bytes to window 0x%lx.",
+	      size, (unsigned long)window);
+  return YES;
+}
+
++ (BOOL) xPropertyNotify: (XPropertyEvent*)xEvent
+{
+  XPbIncrSender	*s;
+
+  s = [self senderTo: xEvent->window property: xEvent->atom];
+  if (s == nil)
+    return NO;
+  if (xEvent->state == PropertyDelete)
+    [s sendChunk];
+  return YES;
+}
+
+- (void) dealloc
+{
+  RELEASE(_data);
+  [super dealloc];
+}
+
+- (void) sendChunk
+{
+  int		(*oldHandler)(Display*, XErrorEvent*);
+  unsigned long	n = [_data length] - _pos;
+
+  if (n > _chunk)
+    n = _chunk;
+
+  appendFailure = NO;
+  oldHandler = XSetErrorHandler(xErrorHandler);
+  XChangeProperty(xDisplay, _window, _property, _type, 8, PropModeReplace,
+		  (unsigned char*)[_data bytes] + _pos, n);
+  XSync(xDisplay, False);
+  XSetErrorHandler(oldHandler);
+
+  _pos += n;
+  _lastActivity = [NSDate timeIntervalSinceReferenceDate];
+  if (appendFailure)
+    {
+      NSDebugLLog(@"Pbs", @"INCR transfer to window 0x%lx failed.",
+		  (unsigned long)_window);
+      [self finish];
+    }
+  else if (n == 0)
+    {
+      /* the zero length chunk is written */
+      [self finish];
+    }
+}
+
+- (void) checkTimeout: (NSTimer*)timer
+{
+  if ([NSDate timeIntervalSinceReferenceDate] - _lastActivity
+      > XPB_INCR_TIMEOUT)
+    {
+      NSDebugLLog(@"Pbs", @"INCR transfer to window 0x%lx timed out.",
+		  (unsigned long)_window);
+      [self finish];
+    }
+}
+
+- (void) finish
+{
+  int	(*oldHandler)(Display*, XErrorEvent*);
+
+  AUTORELEASE(RETAIN(self));
+  [_timer invalidate];
+  _timer = nil;
+  [incrSenders removeObjectIdenticalTo: self];
+
+  /* the window may be gone already */
+  if ([[self class] senderTo: _window property: None] == nil)
+    {
+      oldHandler = XSetErrorHandler(xErrorHandler);
+      XSelectInput(xDisplay, _window, NoEventMask);
+      XSync(xDisplay, False);
+      XSetErrorHandler(oldHandler);
+    }
+}
+
+@end
+
+
+
 // This are copies of functions from XGContextEvent.m. 
 // We should create a separate file for them.
 static inline
@@ -18,53 +18,288 @@
  *  MA 02110-1301, USA.
  */
 
+#include "config.h"
 #include "wraster.h"
+#include "alpha_combine.h"
+#include "cpu.h"
+
+#ifdef WRASTER_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/*
+ * The source is composed over the destination in premultiplied form and
+ * divided back by the resulting alpha:
+ *
+ *   alpha = sa + da * (255 - sa) / 255
+ *   c = (sc * sa + dc * (alpha - sa)) / alpha
+ *
+ * which is what the float ratios of the original code computed. The
+ * division is truncated like the float to int conversion was; the vector
+ * kernels divide in single precision, which is exact for these operands,
+ * so every kernel gives the same bytes.
+ */
+
+/* x * y / 255, rounded; the same rounding as the original code */
+#define MUL_255(x, y) (((((x) * (y) + 0x80) >> 8) + (x) * (y) + 0x80) >> 8)
+
+/***************************************************************************/
+/* Plain C kernels, also used for the tail of the vector ones */
+
+static void combine_row(unsigned char *d, const unsigned char *s, unsigned width, int opacity)
+{
+  unsigned sa, alpha, ca;
+
+  for (; width; width--, d += 4, s += 4) {
+    sa = s[3];
+    if (opacity != 255)
+      sa = MUL_255(sa, opacity);
+
+    if (sa == 0)
+      continue;
+
+    if (sa == 255) {
+      d[0] = s[0];
+      d[1] = s[1];
+      d[2] = s[2];
+      d[3] = 255;
+      continue;
+    }
+
+    alpha = sa + MUL_255(d[3], 255 - sa);
+    if (sa != alpha) {
+      ca = alpha - sa;
+      d[0] = (s[0] * sa + d[0] * ca) / alpha;
+      d[1] = (s[1] * sa + d[1] * ca) / alpha;
+      d[2] = (s[2] * sa + d[2] * ca) / alpha;
+    } else {
+      d[0] = s[0];
+      d[1] = s[1];
+      d[2] = s[2];
+    }
+    d[3] = alpha;
+  }
+}
+
+/* RGB source, all the pixels have the alpha 'sa' */
+static void combine_row_rgb(unsigned char *d, const unsigned char *s, unsigned width, unsigned sa)
+{
+  unsigned alpha, ca;
+
+  if (sa == 0)
+    return;
+
+  for (; width; width--, d += 4, s += 3) {
+    alpha = sa + MUL_255(d[3], 255 - sa);
+    if (sa != alpha) {
+      ca = alpha - sa;
+      d[0] = (s[0] * sa + d[0] * ca) / alpha;
+      d[1] = (s[1] * sa + d[1] * ca) / alpha;
+      d[2] = (s[2] * sa + d[2] * ca) / alpha;
+    } else {
+      d[0] = s[0];
+      d[1] = s[1];
+      d[2] = s[2];
+    }
+    d[3] = alpha;
+  }
+}
+
+/***************************************************************************/
+/* Vector kernels: one pixel per 32 bit lane, one channel at a time */
+
+#ifdef WRASTER_X86_SIMD
+
+/*
+ * The operands fit in 16 bits and their product too, so the 16 bit
+ * multiply is exact on lanes holding values below 256 and 65536.
+ */
+WRASTER_TARGET("sse2")
+static inline __m128i mul_255_sse2(__m128i x, __m128i y)
+{
+  __m128i t = _mm_add_epi32(_mm_mullo_epi16(x, y), _mm_set1_epi32(0x80));
+
+  return _mm_srli_epi32(_mm_add_epi32(_mm_srli_epi32(t, 8), t), 8);
+}
+
+WRASTER_TARGET("sse2")
+static inline __m128i select_sse2(__m128i mask, __m128i a, __m128i b)
+{
+  return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+WRASTER_TARGET("sse2")
+static void combine_row_sse2(unsigned char *d, const unsigned char *s, unsigned width, int opacity)
+{
+  const __m128i ff = _mm_set1_epi32(0xff);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i op = _mm_set1_epi32(opacity);
+  unsigned x;
+  int shift;
+
+  for (x = 0; x + 4 <= width; x += 4) {
+    __m128i sp = _mm_loadu_si128((const __m128i *)(s + x * 4));
+    __m128i dp, sa, da, alpha, ca, is_src, is_dst, out;
+    __m128 fa;
+
+    sa = _mm_srli_epi32(sp, 24);
+    if (opacity != 255)
+      sa = mul_255_sse2(sa, op);
+
+    /* transparent and opaque spans */
+    is_dst = _mm_cmpeq_epi32(sa, zero);
+    if (_mm_movemask_epi8(is_dst) == 0xffff)
+      continue;
+    if (_mm_movemask_epi8(_mm_cmpeq_epi32(sa, ff)) == 0xffff) {
+      _mm_storeu_si128((__m128i *)(d + x * 4), sp);
+      continue;
+    }
+
+    dp = _mm_loadu_si128((const __m128i *)(d + x * 4));
+    da = _mm_srli_epi32(dp, 24);
+    alpha = _mm_add_epi32(sa, mul_255_sse2(da, _mm_sub_epi32(ff, sa)));
+    ca = _mm_sub_epi32(alpha, sa);
+    is_src = _mm_cmpeq_epi32(sa, alpha);
+    fa = _mm_cvtepi32_ps(alpha);
+
+    out = _mm_slli_epi32(select_sse2(is_dst, da, alpha), 24);
+    for (shift = 0; shift < 24; shift += 8) {
+      __m128i sc = _mm_and_si128(_mm_srli_epi32(sp, shift), ff);
+      __m128i dc = _mm_and_si128(_mm_srli_epi32(dp, shift), ff);
+      __m128i n = _mm_add_epi32(_mm_mullo_epi16(sc, sa), _mm_mullo_epi16(dc, ca));
+      __m128i c = _mm_cvttps_epi32(_mm_div_ps(_mm_cvtepi32_ps(n), fa));
+
+      c = select_sse2(is_dst, dc, select_sse2(is_src, sc, c));
+      out = _mm_or_si128(out, _mm_slli_epi32(c, shift));
+    }
+    _mm_storeu_si128((__m128i *)(d + x * 4), out);
+  }
+  combine_row(d + x * 4, s + x * 4, width - x, opacity);
+}
+
+WRASTER_TARGET("avx2")
+static inline __m256i mul_255_avx2(__m256i x, __m256i y)
+{
+  __m256i t = _mm256_add_epi32(_mm256_mullo_epi16(x, y), _mm256_set1_epi32(0x80));
+
+  return _mm256_srli_epi32(_mm256_add_epi32(_mm256_srli_epi32(t, 8), t), 8);
+}
+
+WRASTER_TARGET("avx2")
+static void combine_row_avx2(unsigned char *d, const unsigned char *s, unsigned width, int opacity)
+{
+  const __m256i ff = _mm256_set1_epi32(0xff);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i op = _mm256_set1_epi32(opacity);
+  unsigned x;
+  int shift;
+
+  for (x = 0; x + 8 <= width; x += 8) {
+    __m256i sp = _mm256_loadu_si256((const __m256i *)(s + x * 4));
+    __m256i dp, sa, da, alpha, ca, is_src, is_dst, out;
+    __m256 fa;
+
+    sa = _mm256_srli_epi32(sp, 24);
+    if (opacity != 255)
+      sa = mul_255_avx2(sa, op);
+
+    /* transparent and opaque spans */
+    is_dst = _mm256_cmpeq_epi32(sa, zero);
+    if (_mm256_movemask_epi8(is_dst) == -1)
+      continue;
+    if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(sa, ff)) == -1) {
+      _mm256_storeu_si256((__m256i *)(d + x * 4), sp);
+      continue;
+    }
+
+    dp = _mm256_loadu_si256((const __m256i *)(d + x * 4));
+    da = _mm256_srli_epi32(dp, 24);
+    alpha = _mm256_add_epi32(sa, mul_255_avx2(da, _mm256_sub_epi32(ff, sa)));
+    ca = _mm256_sub_epi32(alpha, sa);
+    is_src = _mm256_cmpeq_epi32(sa, alpha);
+    fa = _mm256_cvtepi32_ps(alpha);
+
+    out = _mm256_slli_epi32(_mm256_blendv_epi8(alpha, da, is_dst), 24);
+    for (shift = 0; shift < 24; shift += 8) {
+      __m256i sc = _mm256_and_si256(_mm256_srli_epi32(sp, shift), ff);
+      __m256i dc = _mm256_and_si256(_mm256_srli_epi32(dp, shift), ff);
+      __m256i n = _mm256_add_epi32(_mm256_mullo_epi16(sc, sa), _mm256_mullo_epi16(dc, ca));
+      __m256i c = _mm256_cvttps_epi32(_mm256_div_ps(_mm256_cvtepi32_ps(n), fa));
+
+      c = _mm256_blendv_epi8(_mm256_blendv_epi8(c, sc, is_src), dc, is_dst);
+      out = _mm256_or_si256(out, _mm256_slli_epi32(c, shift));
+    }
+    _mm256_storeu_si256((__m256i *)(d + x * 4), out);
+  }
+  combine_row_sse2(d + x * 4, s + x * 4, width - x, opacity);
+}
+
+#endif /* WRASTER_X86_SIMD */
+
+/***************************************************************************/
+
+RCombineRowProc wraster_combine_row_proc(int level)
+{
+  (void)level;
+
+#ifdef WRASTER_X86_SIMD
+  if (level >= RCPUAVX2)
+    return combine_row_avx2;
+  if (level >= RCPUSSE2)
+    return combine_row_sse2;
+#endif
+  return combine_row;
+}
 
 void RCombineAlpha(unsigned char *d, unsigned char *s, int s_has_alpha, int width, int height,
                    int dwi, int swi, int opacity)
 {
-  int x, y;
-  int t, sa;
-  int alpha;
-  float ratio, cratio;
+  RCombineRowProc combine;
+  int y;
+
+  if (width <= 0)
+    return;
+
+  if (!s_has_alpha) {
+    unsigned sa = (opacity != 255) ? MUL_255(255, opacity) : 255;
 
+    for (y = 0; y < height; y++) {
+      combine_row_rgb(d, s, width, sa);
+      d += width * 4 + dwi;
+      s += width * 3 + swi;
+    }
+    return;
+  }
+
+  combine = wraster_combine_row_proc(wraster_cpu_level());
   for (y = 0; y < height; y++) {
-    for (x = 0; x < width; x++) {
-      sa = s_has_alpha ? *(s + 3) : 255;
+    combine(d, s, width, opacity);
+    d += width * 4 + dwi;
+    s += width * 4 + swi;
+  }
+}
 
-      if (opacity != 255) {
-        t = sa * opacity + 0x80;
-        sa = ((t >> 8) + t) >> 8;
-      }
+void wraster_combine_alpha_rgb(unsigned char *d, const unsigned char *s, int width, int height,
+                               int dwi, int swi, int opacity)
+{
+  int x, y;
+  unsigned alpha, calpha;
 
-      t = *(d + 3) * (255 - sa) + 0x80;
-      alpha = sa + (((t >> 8) + t) >> 8);
-
-      if (sa == 0 || alpha == 0) {
-        ratio = 0;
-        cratio = 1.0;
-      } else if (sa == alpha) {
-        ratio = 1.0;
-        cratio = 0;
-      } else {
-        ratio = (float)sa / alpha;
-        cratio = 1.0F - ratio;
+  for (y = 0; y < height; y++) {
+    for (x = 0; x < width; x++, d += 3, s += 4) {
+      alpha = (s[3] * opacity) >> 8;
+      if (alpha == 0)
+        continue;
+      if (alpha == 255) {
+        d[0] = s[0];
+        d[1] = s[1];
+        d[2] = s[2];
+        continue;
       }
-
-      *d = (int)*d * cratio + (int)*s * ratio;
-      s++;
-      d++;
-      *d = (int)*d * cratio + (int)*s * ratio;
-      s++;
-      d++;
-      *d = (int)*d * cratio + (int)*s * ratio;
-      s++;
-      d++;
-      *d = alpha;
-      d++;
-
-      if (s_has_alpha)
-        s++;
+      calpha = 255 - alpha;
+      d[0] = (d[0] * calpha + s[0] * alpha) >> 8;
+      d[1] = (d[1] * calpha + s[1] * alpha) >> 8;
+      d[2] = (d[2] * calpha + s[2] * alpha) >> 8;
     }
     d += dwi;
     s += swi;
@@ -0,0 +1,51 @@
+/*
+ * Raster graphics library
+ *
+ * Copyright (c) 2026 NEXTSPACE Team
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Library General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Library General Public
+ *  License along with this library.
+ */
+
+/*
+ * Alpha compositing kernels used by the RCombine* functions.
+ *
+ * The functions here are for WRaster library's internal use only,
+ * Please use functions in 'wraster.h' in applications
+ */
+
+#ifndef __WRASTER_ALPHA_COMBINE_H__
+#define __WRASTER_ALPHA_COMBINE_H__
+
+/*
+ * Composes a row of 'width' RGBA pixels over RGBA pixels, the source
+ * alpha being scaled by 'opacity' (0-255)
+ */
+typedef void (*RCombineRowProc)(unsigned char *d, const unsigned char *s, unsigned width,
+                                int opacity);
+
+/*
+ * Returns the RGBA over RGBA row kernel using at most the instruction
+ * set 'level' (see cpu.h). All of them give the same result.
+ */
+RCombineRowProc wraster_combine_row_proc(int level);
+
+/*
+ * Composes RGBA pixels over RGB ones. The source alpha is scaled by
+ * 'opacity'/256, so 256 uses it unchanged. 'dwi' and 'swi' are the bytes
+ * to skip at the end of each row, as for RCombineAlpha().
+ */
+void wraster_combine_alpha_rgb(unsigned char *d, const unsigned char *s, int width, int height,
+                               int dwi, int swi, int opacity);
+
+#endif
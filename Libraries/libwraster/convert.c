@@ -301,6 +301,10 @@ static RXImage *image2TrueColor(RContext *ctx, RImage *image)
     return NULL;
   }
 
+  /* common 16/24/32 bit layouts are written directly, without XPutPixel */
+  if (wraster_convert_truecolor(ctx, image, ximg))
+    return ximg;
+
   roffs = ctx->red_offset;
   goffs = ctx->green_offset;
   boffs = ctx->blue_offset;
@@ -35,5 +35,34 @@
  */
 void r_destroy_conversion_tables(void);
 
+/*
+ * TrueColor pixel layouts with a dedicated conversion routine,
+ * named after the pixel value from the most significant byte
+ */
+typedef enum {
+  RLayoutUnknown = 0,
+  RLayoutXRGB8888, /* red_mask 0xff0000, blue_mask 0xff */
+  RLayoutBGRX8888, /* red_mask 0xff00, blue_mask 0xff000000 */
+  RLayoutRGB565    /* red_mask 0xf800, green_mask 0x7e0, blue_mask 0x1f */
+} RTrueColorLayout;
+
+/*
+ * Converts one row of 'width' RGB or RGBA pixels into the device layout
+ */
+typedef void (*RConvertRowProc)(unsigned char *dst, const unsigned char *src, unsigned width);
+
+/*
+ * Returns the row converter for the layout and number of channels of the
+ * source image, using at most the instruction set 'level' (see cpu.h).
+ * Returns NULL if the layout is unknown.
+ */
+RConvertRowProc wraster_truecolor_row_proc(RTrueColorLayout layout, int channels, int level);
+
+/*
+ * Fills 'ximg' straight from the image data if the visual has one of the
+ * layouts above. Returns False if the generic conversion must be used.
+ */
+Bool wraster_convert_truecolor(RContext *ctx, RImage *image, RXImage *ximg);
+
 
 #endif
@@ -0,0 +1,346 @@
+/* convert_truecolor.c - direct RImage to XImage conversion for TrueColor
+ *
+ * Raster graphics library
+ *
+ * Copyright (c) 2026 NEXTSPACE Team
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Library General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Library General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+/*
+ * The generic TrueColor conversion in convert.c goes through XPutPixel()
+ * for every pixel. For the pixel layouts used by virtually every 16, 24
+ * and 32 bit visual the pixel value can be built with a few shifts, so
+ * rows are written straight into the XImage buffer here, with SSE2/AVX2
+ * variants selected at run time.
+ *
+ * The results are bit-identical to the generic code: 8 bit channels are
+ * copied as is, 5/6 bit channels use the same rounding as computeTable().
+ */
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "wraster.h"
+#include "convert.h"
+#include "cpu.h"
+
+#ifdef WRASTER_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#define HAS_ALPHA(I) ((I)->format == RRGBAFormat)
+
+/* (v * max + 0x7f) / 0xff, as in computeTable() */
+#define REDUCE(v, max) (((v) * (max) + 0x7f) / 0xff)
+
+/***************************************************************************/
+/* Plain C kernels, also used for the tail of the vector ones */
+
+static void xrgb8888_rgb(unsigned char *dst, const unsigned char *src, unsigned width)
+{
+  uint32_t *d = (uint32_t *)dst;
+
+  for (; width; width--, src += 3)
+    *d++ = ((uint32_t)src[0] << 16) | ((uint32_t)src[1] << 8) | src[2];
+}
+
+static void xrgb8888_rgba(unsigned char *dst, const unsigned char *src, unsigned width)
+{
+  uint32_t *d = (uint32_t *)dst;
+
+  for (; width; width--, src += 4)
+    *d++ = ((uint32_t)src[0] << 16) | ((uint32_t)src[1] << 8) | src[2];
+}
+
+static void bgrx8888_rgb(unsigned char *dst, const unsigned char *src, unsigned width)
+{
+  uint32_t *d = (uint32_t *)dst;
+
+  for (; width; width--, src += 3)
+    *d++ = ((uint32_t)src[2] << 24) | ((uint32_t)src[1] << 16) | ((uint32_t)src[0] << 8);
+}
+
+static void bgrx8888_rgba(unsigned char *dst, const unsigned char *src, unsigned width)
+{
+  uint32_t *d = (uint32_t *)dst;
+
+  for (; width; width--, src += 4)
+    *d++ = ((uint32_t)src[2] << 24) | ((uint32_t)src[1] << 16) | ((uint32_t)src[0] << 8);
+}
+
+static void rgb565_rgb(unsigned char *dst, const unsigned char *src, unsigned width)
+{
+  uint16_t *d = (uint16_t *)dst;
+
+  for (; width; width--, src += 3)
+    *d++ = (REDUCE(src[0], 0x1f) << 11) | (REDUCE(src[1], 0x3f) << 5) | REDUCE(src[2], 0x1f);
+}
+
+static void rgb565_rgba(unsigned char *dst, const unsigned char *src, unsigned width)
+{
+  uint16_t *d = (uint16_t *)dst;
+
+  for (; width; width--, src += 4)
+    *d++ = (REDUCE(src[0], 0x1f) << 11) | (REDUCE(src[1], 0x3f) << 5) | REDUCE(src[2], 0x1f);
+}
+
+/***************************************************************************/
+/* SSE2 kernels, RGBA sources only: SSE2 has no byte shuffle for RGB */
+
+#ifdef WRASTER_X86_SIMD
+
+WRASTER_TARGET("sse2")
+static void xrgb8888_rgba_sse2(unsigned char *dst, const unsigned char *src, unsigned width)
+{
+  const __m128i lo = _mm_set1_epi32(0xff);
+  const __m128i mid = _mm_set1_epi32(0xff00);
+  unsigned x;
+
+  for (x = 0; x + 4 <= width; x += 4) {
+    __m128i p = _mm_loadu_si128((const __m128i *)(src + x * 4));
+    __m128i r = _mm_slli_epi32(_mm_and_si128(p, lo), 16);
+    __m128i g = _mm_and_si128(p, mid);
+    __m128i b = _mm_and_si128(_mm_srli_epi32(p, 16), lo);
+
+    _mm_storeu_si128((__m128i *)(dst + x * 4), _mm_or_si128(_mm_or_si128(r, g), b));
+  }
+  xrgb8888_rgba(dst + x * 4, src + x * 4, width - x);
+}
+
+WRASTER_TARGET("sse2")
+static void bgrx8888_rgba_sse2(unsigned char *dst, const unsigned char *src, unsigned width)
+{
+  unsigned x;
+
+  /* little endian RGBA read as a 32 bit value is ABGR, shifting drops alpha */
+  for (x = 0; x + 4 <= width; x += 4) {
+    __m128i p = _mm_loadu_si128((const __m128i *)(src + x * 4));
+
+    _mm_storeu_si128((__m128i *)(dst + x * 4), _mm_slli_epi32(p, 8));
+  }
+  bgrx8888_rgba(dst + x * 4, src + x * 4, width - x);
+}
+
+/* exact (v * max + 0x7f) / 0xff on 16 bit lanes, valid while the product fits 16 bits */
+WRASTER_TARGET("sse2")
+static inline __m128i reduce_epi16(__m128i v, int max)
+{
+  __m128i t = _mm_add_epi16(_mm_mullo_epi16(v, _mm_set1_epi16(max)), _mm_set1_epi16(0x7f));
+
+  t = _mm_add_epi16(_mm_add_epi16(t, _mm_set1_epi16(1)), _mm_srli_epi16(t, 8));
+  return _mm_srli_epi16(t, 8);
+}
+
+WRASTER_TARGET("sse2")
+static void rgb565_rgba_sse2(unsigned char *dst, const unsigned char *src, unsigned width)
+{
+  const __m128i lo = _mm_set1_epi32(0xff);
+  unsigned x;
+
+  for (x = 0; x + 8 <= width; x += 8) {
+    __m128i p0 = _mm_loadu_si128((const __m128i *)(src + x * 4));
+    __m128i p1 = _mm_loadu_si128((const __m128i *)(src + x * 4 + 16));
+    __m128i r, g, b;
+
+    r = _mm_packs_epi32(_mm_and_si128(p0, lo), _mm_and_si128(p1, lo));
+    g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 8), lo),
+                        _mm_and_si128(_mm_srli_epi32(p1, 8), lo));
+    b = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 16), lo),
+                        _mm_and_si128(_mm_srli_epi32(p1, 16), lo));
+
+    r = _mm_slli_epi16(reduce_epi16(r, 0x1f), 11);
+    g = _mm_slli_epi16(reduce_epi16(g, 0x3f), 5);
+    b = reduce_epi16(b, 0x1f);
+
+    _mm_storeu_si128((__m128i *)(dst + x * 2), _mm_or_si128(_mm_or_si128(r, g), b));
+  }
+  rgb565_rgba(dst + x * 2, src + x * 4, width - x);
+}
+
+/***************************************************************************/
+/* AVX2 kernels, 8 pixels per step using in-lane byte shuffles */
+
+WRASTER_TARGET("avx2")
+static inline __m256i load_rgb_x8(const unsigned char *src)
+{
+  /* pixels 0-3 in the low lane, 4-7 in the high lane, 4 spare bytes each */
+  __m128i lo = _mm_loadu_si128((const __m128i *)src);
+  __m128i hi = _mm_loadu_si128((const __m128i *)(src + 12));
+
+  return _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+}
+
+#define Z -128 /* shuffle index producing 0 */
+
+WRASTER_TARGET("avx2")
+static void xrgb8888_rgb_avx2(unsigned char *dst, const unsigned char *src, unsigned width)
+{
+  const __m256i shuffle = _mm256_setr_epi8(2, 1, 0, Z, 5, 4, 3, Z, 8, 7, 6, Z, 11, 10, 9, Z,
+                                           2, 1, 0, Z, 5, 4, 3, Z, 8, 7, 6, Z, 11, 10, 9, Z);
+  unsigned x;
+
+  /* keep 2 pixels after the last step, load_rgb_x8() reads 4 bytes ahead */
+  for (x = 0; x + 10 <= width; x += 8) {
+    __m256i p = load_rgb_x8(src + x * 3);
+
+    _mm256_storeu_si256((__m256i *)(dst + x * 4), _mm256_shuffle_epi8(p, shuffle));
+  }
+  xrgb8888_rgb(dst + x * 4, src + x * 3, width - x);
+}
+
+WRASTER_TARGET("avx2")
+static void xrgb8888_rgba_avx2(unsigned char *dst, const unsigned char *src, unsigned width)
+{
+  const __m256i shuffle = _mm256_setr_epi8(2, 1, 0, Z, 6, 5, 4, Z, 10, 9, 8, Z, 14, 13, 12, Z,
+                                           2, 1, 0, Z, 6, 5, 4, Z, 10, 9, 8, Z, 14, 13, 12, Z);
+  unsigned x;
+
+  for (x = 0; x + 8 <= width; x += 8) {
+    __m256i p = _mm256_loadu_si256((const __m256i *)(src + x * 4));
+
+    _mm256_storeu_si256((__m256i *)(dst + x * 4), _mm256_shuffle_epi8(p, shuffle));
+  }
+  xrgb8888_rgba(dst + x * 4, src + x * 4, width - x);
+}
+
+WRASTER_TARGET("avx2")
+static void bgrx8888_rgb_avx2(unsigned char *dst, const unsigned char *src, unsigned width)
+{
+  const __m256i shuffle = _mm256_setr_epi8(Z, 0, 1, 2, Z, 3, 4, 5, Z, 6, 7, 8, Z, 9, 10, 11,
+                                           Z, 0, 1, 2, Z, 3, 4, 5, Z, 6, 7, 8, Z, 9, 10, 11);
+  unsigned x;
+
+  for (x = 0; x + 10 <= width; x += 8) {
+    __m256i p = load_rgb_x8(src + x * 3);
+
+    _mm256_storeu_si256((__m256i *)(dst + x * 4), _mm256_shuffle_epi8(p, shuffle));
+  }
+  bgrx8888_rgb(dst + x * 4, src + x * 3, width - x);
+}
+
+WRASTER_TARGET("avx2")
+static void bgrx8888_rgba_avx2(unsigned char *dst, const unsigned char *src, unsigned width)
+{
+  unsigned x;
+
+  for (x = 0; x + 8 <= width; x += 8) {
+    __m256i p = _mm256_loadu_si256((const __m256i *)(src + x * 4));
+
+    _mm256_storeu_si256((__m256i *)(dst + x * 4), _mm256_slli_epi32(p, 8));
+  }
+  bgrx8888_rgba(dst + x * 4, src + x * 4, width - x);
+}
+
+#undef Z
+
+#endif /* WRASTER_X86_SIMD */
+
+/***************************************************************************/
+
+RConvertRowProc wraster_truecolor_row_proc(RTrueColorLayout layout, int channels, int level)
+{
+  (void)level;
+
+  switch (layout) {
+    case RLayoutXRGB8888:
+#ifdef WRASTER_X86_SIMD
+      if (level >= RCPUAVX2)
+        return (channels == 4) ? xrgb8888_rgba_avx2 : xrgb8888_rgb_avx2;
+      if (level >= RCPUSSE2 && channels == 4)
+        return xrgb8888_rgba_sse2;
+#endif
+      return (channels == 4) ? xrgb8888_rgba : xrgb8888_rgb;
+
+    case RLayoutBGRX8888:
+#ifdef WRASTER_X86_SIMD
+      if (level >= RCPUAVX2)
+        return (channels == 4) ? bgrx8888_rgba_avx2 : bgrx8888_rgb_avx2;
+      if (level >= RCPUSSE2 && channels == 4)
+        return bgrx8888_rgba_sse2;
+#endif
+      return (channels == 4) ? bgrx8888_rgba : bgrx8888_rgb;
+
+    case RLayoutRGB565:
+#ifdef WRASTER_X86_SIMD
+      if (level >= RCPUSSE2 && channels == 4)
+        return rgb565_rgba_sse2;
+#endif
+      return (channels == 4) ? rgb565_rgba : rgb565_rgb;
+
+    default:
+      return NULL;
+  }
+}
+
+static RTrueColorLayout truecolor_layout(RContext *ctx, XImage *ximage)
+{
+  static const int one = 1;
+  const int host_order = (*(const char *)&one) ? LSBFirst : MSBFirst;
+  const unsigned long rmask = ctx->visual->red_mask;
+  const unsigned long gmask = ctx->visual->green_mask;
+  const unsigned long bmask = ctx->visual->blue_mask;
+
+  /* pixels are stored as native integers */
+  if (ximage->byte_order != host_order)
+    return RLayoutUnknown;
+
+  if (ximage->bits_per_pixel == 32) {
+    if (rmask == 0xff0000 && gmask == 0xff00 && bmask == 0xff)
+      return RLayoutXRGB8888;
+    if (rmask == 0xff00 && gmask == 0xff0000 && bmask == 0xff000000UL)
+      return RLayoutBGRX8888;
+  } else if (ximage->bits_per_pixel == 16) {
+    if (rmask == 0xf800 && gmask == 0x7e0 && bmask == 0x1f)
+      return RLayoutRGB565;
+  }
+
+  return RLayoutUnknown;
+}
+
+Bool wraster_convert_truecolor(RContext *ctx, RImage *image, RXImage *ximg)
+{
+  RTrueColorLayout layout;
+  RConvertRowProc convert;
+  int channels = (HAS_ALPHA(image) ? 4 : 3);
+  unsigned char *src, *dst;
+  int y;
+
+  layout = truecolor_layout(ctx, ximg->image);
+  if (layout == RLayoutUnknown)
+    return False;
+
+  /*
+   * With 8 bit channels dithering never has an error to spread, so the
+   * result is the same in both rendering modes. Not so for 5/6 bits.
+   */
+  if (layout == RLayoutRGB565 && ctx->attribs->render_mode != RBestMatchRendering)
+    return False;
+
+  convert = wraster_truecolor_row_proc(layout, channels, wraster_cpu_level());
+
+  src = image->data;
+  dst = (unsigned char *)ximg->image->data;
+  for (y = 0; y < image->height; y++) {
+    convert(dst, src, image->width);
+    src += image->width * channels;
+    dst += ximg->image->bytes_per_line;
+  }
+
+  return True;
+}
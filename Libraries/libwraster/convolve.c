@@ -22,9 +22,18 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#include <math.h>
 #include <X11/Xlib.h>
 
 #include "wraster.h"
+#include "cpu.h"
+#include "parallel.h"
+#include "rotate.h"
+
+#ifdef WRASTER_X86_SIMD
+#include <immintrin.h>
+#endif
 
 /*
  *----------------------------------------------------------------------
@@ -137,3 +146,581 @@ int RBlurImage(RImage *image)
 
   return True;
 }
+
+/***************************************************************************/
+/* Gaussian blur of any radius */
+
+/*
+ * The Gaussian is approximated by BLUR_PASSES box filters in each
+ * direction. A box filter is a running sum, so the cost per pixel does not
+ * depend on the radius. The passes are always made on the columns of a
+ * buffer with one accumulator per byte, which works for any number of
+ * channels and is vectorized along the rows; the rows are filtered as the
+ * columns of the transposed buffer (see rotate.c).
+ */
+#define BLUR_PASSES 3
+
+/* bytes of a row making a unit of work for the column passes */
+#define BLUR_CHUNK 64
+
+/* min. number of bytes worth giving to a thread */
+#define BLUR_BAND_BYTES (256 * 256)
+
+/*
+ * Writes a row of the box filtered columns: d = acc * scale rounded, then
+ * moves the boxes down by adding the row 'add' and removing the row 'sub'
+ */
+typedef void (*RBoxStepProc)(unsigned char *d, uint32_t *acc, const unsigned char *add,
+                             const unsigned char *sub, unsigned len, float scale);
+
+typedef struct {
+  const unsigned char *src;
+  unsigned char *dst;
+  uint32_t *acc; /* one accumulator per byte of a row */
+  size_t stride; /* bytes per row */
+  int height;
+  int radius;
+  RBoxStepProc step;
+} RBoxJob;
+
+/* radii of the box filters for a Gaussian of standard deviation 'sigma' */
+static void box_radii(float sigma, int radii[BLUR_PASSES])
+{
+  double v = 12.0 * sigma * sigma;
+  int low, m, i;
+
+  if (!(sigma > 0)) {
+    for (i = 0; i < BLUR_PASSES; i++)
+      radii[i] = 0;
+    return;
+  }
+
+  /* sizes low and low + 2 whose variances add up the closest to sigma^2 */
+  low = floor(sqrt(v / BLUR_PASSES + 1));
+  if (low % 2 == 0)
+    low--;
+  m = lround((v - BLUR_PASSES * (low * low + 4 * low + 3)) / (-4.0 * low - 4));
+
+  for (i = 0; i < BLUR_PASSES; i++)
+    radii[i] = ((i < m) ? low - 1 : low + 1) / 2;
+}
+
+static void box_step(unsigned char *d, uint32_t *acc, const unsigned char *add,
+                     const unsigned char *sub, unsigned len, float scale)
+{
+  unsigned i;
+
+  for (i = 0; i < len; i++) {
+    d[i] = (int)((float)acc[i] * scale + 0.5F);
+    acc[i] += add[i] - sub[i];
+  }
+}
+
+#ifdef WRASTER_X86_SIMD
+
+/* the sums are below 2^24, so they convert exactly to float */
+WRASTER_TARGET("sse2")
+static void box_step_sse2(unsigned char *d, uint32_t *acc, const unsigned char *add,
+                          const unsigned char *sub, unsigned len, float scale)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128 fscale = _mm_set1_ps(scale);
+  const __m128 half = _mm_set1_ps(0.5F);
+  unsigned i;
+  int k;
+
+  for (i = 0; i + 16 <= len; i += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(add + i));
+    __m128i s = _mm_loadu_si128((const __m128i *)(sub + i));
+    __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(s, zero));
+    __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(s, zero));
+    __m128i diff[4], out[4];
+
+    /* sign extension of the differences */
+    diff[0] = _mm_srai_epi32(_mm_unpacklo_epi16(lo, lo), 16);
+    diff[1] = _mm_srai_epi32(_mm_unpackhi_epi16(lo, lo), 16);
+    diff[2] = _mm_srai_epi32(_mm_unpacklo_epi16(hi, hi), 16);
+    diff[3] = _mm_srai_epi32(_mm_unpackhi_epi16(hi, hi), 16);
+
+    for (k = 0; k < 4; k++) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(acc + i + k * 4));
+
+      out[k] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(v), fscale), half));
+      _mm_storeu_si128((__m128i *)(acc + i + k * 4), _mm_add_epi32(v, diff[k]));
+    }
+    _mm_storeu_si128((__m128i *)(d + i), _mm_packus_epi16(_mm_packs_epi32(out[0], out[1]),
+                                                           _mm_packs_epi32(out[2], out[3])));
+  }
+  box_step(d + i, acc + i, add + i, sub + i, len - i, scale);
+}
+
+WRASTER_TARGET("avx2")
+static void box_step_avx2(unsigned char *d, uint32_t *acc, const unsigned char *add,
+                          const unsigned char *sub, unsigned len, float scale)
+{
+  const __m256 fscale = _mm256_set1_ps(scale);
+  const __m256 half = _mm256_set1_ps(0.5F);
+  const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+  unsigned i;
+  int k;
+
+  for (i = 0; i + 32 <= len; i += 32) {
+    __m256i out[4], packed;
+
+    for (k = 0; k < 4; k++) {
+      __m256i a = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(add + i + k * 8)));
+      __m256i s = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(sub + i + k * 8)));
+      __m256i v = _mm256_loadu_si256((const __m256i *)(acc + i + k * 8));
+
+      out[k] =
+          _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(v), fscale), half));
+      _mm256_storeu_si256((__m256i *)(acc + i + k * 8),
+                          _mm256_add_epi32(v, _mm256_sub_epi32(a, s)));
+    }
+    /* the packs work within 128 bit lanes, put the dwords back in order */
+    packed = _mm256_packus_epi16(_mm256_packs_epi32(out[0], out[1]),
+                                 _mm256_packs_epi32(out[2], out[3]));
+    _mm256_storeu_si256((__m256i *)(d + i), _mm256_permutevar8x32_epi32(packed, order));
+  }
+  box_step_sse2(d + i, acc + i, add + i, sub + i, len - i, scale);
+}
+
+#endif /* WRASTER_X86_SIMD */
+
+static RBoxStepProc box_step_proc(void)
+{
+#ifdef WRASTER_X86_SIMD
+  RCPULevel level = wraster_cpu_level();
+
+  if (level >= RCPUAVX2)
+    return box_step_avx2;
+  if (level >= RCPUSSE2)
+    return box_step_sse2;
+#endif
+  return box_step;
+}
+
+/* box filters the byte columns of the chunks [first, last) */
+static void box_columns(void *data, int first, int last)
+{
+  RBoxJob *job = data;
+  size_t start = (size_t)first * BLUR_CHUNK;
+  size_t end = (size_t)last * BLUR_CHUNK;
+  const unsigned char *src = job->src + start;
+  unsigned char *dst = job->dst + start;
+  uint32_t *acc = job->acc + start;
+  size_t stride = job->stride;
+  int height = job->height, r = job->radius;
+  unsigned len, i;
+  int y, k, below;
+
+  if (end > stride)
+    end = stride;
+  len = end - start;
+
+  /* the pixels beyond the edges repeat the edge ones */
+  for (i = 0; i < len; i++)
+    acc[i] = src[i] * (r + 1);
+  below = (r < height - 1) ? r : height - 1;
+  for (k = 1; k <= below; k++) {
+    const unsigned char *row = src + k * stride;
+
+    for (i = 0; i < len; i++)
+      acc[i] += row[i];
+  }
+  if (r > below) {
+    const unsigned char *row = src + (height - 1) * stride;
+
+    for (i = 0; i < len; i++)
+      acc[i] += row[i] * (r - below);
+  }
+
+  for (y = 0; y < height; y++) {
+    int add = (y + r + 1 < height) ? y + r + 1 : height - 1;
+    int sub = (y - r > 0) ? y - r : 0;
+
+    job->step(dst + y * stride, acc, src + add * stride, src + sub * stride, len,
+              1.0F / (2 * r + 1));
+  }
+}
+
+/*
+ * Weighting of the colors by alpha, and back. Dividing by alpha is done
+ * in single precision by all the versions, so they give the same bytes.
+ */
+#define PREMULTIPLY(c, a) ((((c) * (a) + 0x80) + (((c) * (a) + 0x80) >> 8)) >> 8)
+
+static void premultiply(unsigned char *ptr, size_t count)
+{
+  unsigned a;
+
+  for (; count; count--, ptr += 4) {
+    a = ptr[3];
+    ptr[0] = PREMULTIPLY(ptr[0], a);
+    ptr[1] = PREMULTIPLY(ptr[1], a);
+    ptr[2] = PREMULTIPLY(ptr[2], a);
+  }
+}
+
+static void unpremultiply(unsigned char *ptr, size_t count)
+{
+  unsigned a, c;
+  float f;
+  int i;
+
+  for (; count; count--, ptr += 4) {
+    a = ptr[3];
+    if (a == 255)
+      continue;
+    if (a == 0) {
+      ptr[0] = ptr[1] = ptr[2] = 0;
+      continue;
+    }
+    f = 255.0F / (float)a;
+    for (i = 0; i < 3; i++) {
+      c = (int)((float)ptr[i] * f + 0.5F);
+      ptr[i] = (c > 255) ? 255 : c;
+    }
+  }
+}
+
+#ifdef WRASTER_X86_SIMD
+
+WRASTER_TARGET("sse2")
+static void premultiply_sse2(unsigned char *ptr, size_t count)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i round = _mm_set1_epi16(0x80);
+  /* the alpha channel is multiplied by 255, which keeps it */
+  const __m128i keep = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
+
+  for (; count >= 4; count -= 4, ptr += 16) {
+    __m128i p = _mm_loadu_si128((const __m128i *)ptr);
+    __m128i lo = _mm_unpacklo_epi8(p, zero);
+    __m128i hi = _mm_unpackhi_epi8(p, zero);
+    __m128i alo = _mm_or_si128(_mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, 0xff), 0xff), keep);
+    __m128i ahi = _mm_or_si128(_mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, 0xff), 0xff), keep);
+
+    lo = _mm_add_epi16(_mm_mullo_epi16(lo, alo), round);
+    hi = _mm_add_epi16(_mm_mullo_epi16(hi, ahi), round);
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+    _mm_storeu_si128((__m128i *)ptr, _mm_packus_epi16(lo, hi));
+  }
+  premultiply(ptr, count);
+}
+
+WRASTER_TARGET("sse2")
+static void unpremultiply_sse2(unsigned char *ptr, size_t count)
+{
+  const __m128i ff = _mm_set1_epi32(0xff);
+  const __m128i alpha_mask = _mm_set1_epi32(0xff000000);
+  const __m128 f255 = _mm_set1_ps(255.0F);
+  const __m128 half = _mm_set1_ps(0.5F);
+  int shift;
+
+  for (; count >= 4; count -= 4, ptr += 16) {
+    __m128i p = _mm_loadu_si128((const __m128i *)ptr);
+    __m128i a = _mm_srli_epi32(p, 24);
+    __m128i out = _mm_and_si128(p, alpha_mask);
+    __m128i transparent = _mm_cmpeq_epi32(a, _mm_setzero_si128());
+    __m128 f;
+
+    if (_mm_movemask_epi8(_mm_cmpeq_epi32(a, ff)) == 0xffff)
+      continue;
+
+    /* 255 / 0 is inf, the transparent pixels are cleared below */
+    f = _mm_div_ps(f255, _mm_cvtepi32_ps(a));
+    for (shift = 0; shift < 24; shift += 8) {
+      __m128i c = _mm_and_si128(_mm_srli_epi32(p, shift), ff);
+
+      c = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(c), f), half));
+      /* c is at most 255, unless a is below it */
+      c = _mm_or_si128(_mm_and_si128(_mm_cmpgt_epi32(c, ff), ff),
+                       _mm_andnot_si128(_mm_cmpgt_epi32(c, ff), c));
+      out = _mm_or_si128(out, _mm_slli_epi32(_mm_andnot_si128(transparent, c), shift));
+    }
+    _mm_storeu_si128((__m128i *)ptr, out);
+  }
+  unpremultiply(ptr, count);
+}
+
+#endif /* WRASTER_X86_SIMD */
+
+static void premultiply_rows(void *data, int first, int last)
+{
+  RImage *image = data;
+  unsigned char *ptr = image->data + (size_t)first * image->width * 4;
+  size_t count = (size_t)(last - first) * image->width;
+
+#ifdef WRASTER_X86_SIMD
+  if (wraster_cpu_level() >= RCPUSSE2) {
+    premultiply_sse2(ptr, count);
+    return;
+  }
+#endif
+  premultiply(ptr, count);
+}
+
+static void unpremultiply_rows(void *data, int first, int last)
+{
+  RImage *image = data;
+  unsigned char *ptr = image->data + (size_t)first * image->width * 4;
+  size_t count = (size_t)(last - first) * image->width;
+
+#ifdef WRASTER_X86_SIMD
+  if (wraster_cpu_level() >= RCPUSSE2) {
+    unpremultiply_sse2(ptr, count);
+    return;
+  }
+#endif
+  unpremultiply(ptr, count);
+}
+
+/*
+ * Blurs a buffer of 'width' x 'height' pixels of 'bpp' bytes. If 'image'
+ * is given, it is the RGBA image of the buffer and its colors are weighted
+ * by alpha during the blur, or transparent pixels would bleed. Nothing is
+ * changed if it fails.
+ */
+static Bool blur_buffer(unsigned char *data, unsigned width, unsigned height, int bpp,
+                        float radius, RImage *image)
+{
+  int radii[BLUR_PASSES];
+  unsigned char *tmp, *cur, *other, *swap;
+  unsigned w, h, t, size;
+  uint32_t *acc;
+  RBoxJob job;
+  int dir, pass;
+
+  box_radii(radius, radii);
+  /* the radii are in increasing order */
+  if (radii[BLUR_PASSES - 1] == 0 || width == 0 || height == 0)
+    return True;
+
+  tmp = malloc((size_t)width * height * bpp);
+  acc = malloc((size_t)((width > height) ? width : height) * bpp * sizeof(uint32_t));
+  if (!tmp || !acc) {
+    free(tmp);
+    free(acc);
+    RErrorCode = RERR_NOMEMORY;
+    return False;
+  }
+
+  if (image)
+    wraster_run_bands(height, BLUR_BAND_BYTES / (width * 4) + 1, premultiply_rows, image);
+
+  job.acc = acc;
+  job.step = box_step_proc();
+  cur = data;
+  other = tmp;
+  w = width;
+  h = height;
+
+  /* the columns, then the rows as the columns of the transposed buffer */
+  for (dir = 0; dir < 2; dir++) {
+    job.stride = (size_t)w * bpp;
+    job.height = h;
+    size = (job.stride + BLUR_CHUNK - 1) / BLUR_CHUNK;
+    for (pass = 0; pass < BLUR_PASSES; pass++) {
+      if (radii[pass] == 0)
+        continue;
+      job.src = cur;
+      job.dst = other;
+      job.radius = radii[pass];
+      wraster_run_bands(size, BLUR_BAND_BYTES / ((size_t)h * BLUR_CHUNK) + 1, box_columns, &job);
+      swap = cur;
+      cur = other;
+      other = swap;
+    }
+
+    wraster_transform_pixels(other, cur, w, h, bpp, RTransformTranspose);
+    swap = cur;
+    cur = other;
+    other = swap;
+    t = w;
+    w = h;
+    h = t;
+  }
+
+  if (cur != data)
+    memcpy(data, cur, (size_t)width * height * bpp);
+
+  if (image)
+    wraster_run_bands(height, BLUR_BAND_BYTES / (width * 4) + 1, unpremultiply_rows, image);
+
+  free(tmp);
+  free(acc);
+
+  return True;
+}
+
+int RBlurImageRadius(RImage *image, float radius)
+{
+  if (image->format == RRGBAFormat)
+    return blur_buffer(image->data, image->width, image->height, 4, radius, image);
+
+  return blur_buffer(image->data, image->width, image->height, 3, radius, NULL);
+}
+
+/***************************************************************************/
+/* Shadows */
+
+/*
+ * A shadow extends beyond the shape by the sum of the radii of the boxes.
+ * As the box passes repeat the edges of the buffer, the margin also makes
+ * them work as if it was surrounded by transparent pixels: the first pixel
+ * of a row reaches the shape only in the last pass.
+ */
+int RShadowMargin(float radius)
+{
+  int radii[BLUR_PASSES], margin = 0, i;
+
+  box_radii(radius, radii);
+  for (i = 0; i < BLUR_PASSES; i++)
+    margin += radii[i];
+
+  return margin;
+}
+
+RImage *RMakeShadowImage(RImage *image, float radius, const RColor *color)
+{
+  int margin = RShadowMargin(radius);
+  unsigned width = image->width + 2 * margin;
+  unsigned height = image->height + 2 * margin;
+  unsigned char *mask, *ptr, *end, *src;
+  unsigned x, y, a, t;
+  RImage *shadow;
+
+  shadow = RCreateImage(width, height, True);
+  if (!shadow)
+    return NULL;
+  mask = calloc((size_t)width * height, 1);
+  if (!mask) {
+    RReleaseImage(shadow);
+    RErrorCode = RERR_NOMEMORY;
+    return NULL;
+  }
+
+  src = image->data;
+  for (y = 0; y < image->height; y++) {
+    ptr = mask + (size_t)(y + margin) * width + margin;
+    if (image->format == RRGBAFormat) {
+      for (x = 0; x < image->width; x++, src += 4)
+        ptr[x] = src[3];
+    } else {
+      memset(ptr, 255, image->width);
+    }
+  }
+
+  if (!blur_buffer(mask, width, height, 1, radius, NULL)) {
+    free(mask);
+    RReleaseImage(shadow);
+    return NULL;
+  }
+
+  ptr = shadow->data;
+  end = ptr + (size_t)width * height * 4;
+  for (src = mask; ptr < end; ptr += 4, src++) {
+    t = *src * color->alpha + 0x80;
+    a = ((t >> 8) + t) >> 8;
+    ptr[0] = color->red;
+    ptr[1] = color->green;
+    ptr[2] = color->blue;
+    ptr[3] = a;
+  }
+  free(mask);
+
+  return shadow;
+}
+
+/*
+ * The blur of a rectangle is the product of the blurs of its sides, which
+ * are filtered with the same boxes as the images.
+ */
+static float *shadow_profile(unsigned length, int margin, const int radii[BLUR_PASSES])
+{
+  unsigned size = length + 2 * margin;
+  float *buffer, *profile, *tmp, *swap;
+  double sum;
+  int pass, r, i;
+
+  buffer = calloc(size * 2, sizeof(float));
+  if (!buffer)
+    return NULL;
+  profile = buffer;
+  tmp = buffer + size;
+
+  for (i = margin; i < margin + (int)length; i++)
+    profile[i] = 1;
+
+  for (pass = 0; pass < BLUR_PASSES; pass++) {
+    r = radii[pass];
+    if (r == 0)
+      continue;
+    /* the values beyond the ends are 0 */
+    sum = 0;
+    for (i = 0; i < r && i < (int)size; i++)
+      sum += profile[i];
+    for (i = 0; i < (int)size; i++) {
+      if (i + r < (int)size)
+        sum += profile[i + r];
+      tmp[i] = sum / (2 * r + 1);
+      if (i - r >= 0)
+        sum -= profile[i - r];
+    }
+    swap = profile;
+    profile = tmp;
+    tmp = swap;
+  }
+
+  if (profile != buffer)
+    memcpy(buffer, profile, size * sizeof(float));
+
+  return buffer;
+}
+
+unsigned char *RMakeShadowMask(unsigned width, unsigned height, float radius, int opacity)
+{
+  int radii[BLUR_PASSES];
+  int margin = RShadowMargin(radius);
+  unsigned mask_width = width + 2 * margin;
+  unsigned mask_height = height + 2 * margin;
+  float *columns, *rows;
+  unsigned char *mask, *ptr;
+  unsigned x, y;
+
+  box_radii(radius, radii);
+
+  columns = shadow_profile(width, margin, radii);
+  rows = shadow_profile(height, margin, radii);
+  mask = malloc((size_t)mask_width * mask_height);
+  if (!columns || !rows || !mask) {
+    free(columns);
+    free(rows);
+    free(mask);
+    RErrorCode = RERR_NOMEMORY;
+    return NULL;
+  }
+
+  for (x = 0; x < mask_width; x++)
+    columns[x] *= opacity;
+
+  ptr = mask;
+  for (y = 0; y < mask_height; y++, ptr += mask_width) {
+    float f = rows[y];
+
+    /* rows in the middle of the shape are all alike */
+    if (y > 0 && f == rows[y - 1]) {
+      memcpy(ptr, ptr - mask_width, mask_width);
+      continue;
+    }
+    for (x = 0; x < mask_width; x++)
+      ptr[x] = (int)(columns[x] * f + 0.5F);
+  }
+
+  free(columns);
+  free(rows);
+
+  return mask;
+}
@@ -0,0 +1,61 @@
+/* cpu.c - run-time CPU feature detection
+ *
+ * Raster graphics library
+ *
+ * Copyright (c) 2026 NEXTSPACE Team
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Library General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Library General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu.h"
+
+static RCPULevel detect_cpu_level(void)
+{
+  RCPULevel level = RCPUGeneric;
+  const char *env;
+
+#ifdef WRASTER_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    level = RCPUAVX2;
+  else if (__builtin_cpu_supports("sse2"))
+    level = RCPUSSE2;
+#endif
+
+  env = getenv("WRASTER_SIMD");
+  if (env) {
+    if (strcmp(env, "generic") == 0 || strcmp(env, "none") == 0)
+      level = RCPUGeneric;
+    else if (strcmp(env, "sse2") == 0 && level > RCPUSSE2)
+      level = RCPUSSE2;
+  }
+
+  return level;
+}
+
+RCPULevel wraster_cpu_level(void)
+{
+  /* detection is idempotent, a concurrent first call just does it twice */
+  static int level = -1;
+
+  if (level < 0)
+    level = detect_cpu_level();
+
+  return (RCPULevel)level;
+}
@@ -0,0 +1,55 @@
+/*
+ * Raster graphics library
+ *
+ * Copyright (c) 2026 NEXTSPACE Team
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Library General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Library General Public
+ *  License along with this library.
+ */
+
+/*
+ * Run-time detection of the CPU vector extensions used by the
+ * optimized pixel kernels.
+ *
+ * The functions here are for WRaster library's internal use only,
+ * Please use functions in 'wraster.h' in applications
+ */
+
+#ifndef __WRASTER_CPU_H__
+#define __WRASTER_CPU_H__
+
+/*
+ * SSE2/AVX2 kernels are compiled with per-function target attributes,
+ * so the library itself can be built for the baseline architecture.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define WRASTER_X86_SIMD 1
+#define WRASTER_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+typedef enum {
+  RCPUGeneric = 0, /* plain C loops */
+  RCPUSSE2 = 1,
+  RCPUAVX2 = 2
+} RCPULevel;
+
+/*
+ * Returns the best instruction set supported by the running CPU.
+ *
+ * The result can be lowered (never raised) with the WRASTER_SIMD
+ * environment variable set to "generic", "sse2" or "avx2", which
+ * is handy for benchmarks and for comparing the kernels.
+ */
+RCPULevel wraster_cpu_level(void);
+
+#endif
@@ -21,139 +21,46 @@
  */
 
 #include <stdlib.h>
-#include <stdio.h>
-#include <string.h>
 
 #include <X11/Xlib.h>
 
 #include "wraster.h"
 #include "rotate.h"
 
-static RImage *r_flip_vertically(RImage *source);
-static RImage *r_flip_horizontally(RImage *source);
-
-/* Flip an image in the direction(s) specified */
-RImage *RFlipImage(RImage *source, int mode)
+static RTransform flip_transform(int mode)
 {
-  /* Security */
-  if (source == NULL)
-    return NULL;
-
-  switch (mode & (RVerticalFlip | RHorizontalFlip)) {
+  switch (mode) {
     case RHorizontalFlip:
-      return r_flip_horizontally(source);
+      return RTransformHorizontalFlip;
 
     case RVerticalFlip:
-      return r_flip_vertically(source);
-
-    case RHorizontalFlip | RVerticalFlip:
-      return wraster_rotate_image_180(source);
+      return RTransformVerticalFlip;
 
     default:
-      return RRetainImage(source);
+      /* both directions */
+      return RTransformRotate180;
   }
 }
 
-RImage *r_flip_vertically(RImage *source)
+/* Flip an image in the direction(s) specified */
+RImage *RFlipImage(RImage *source, int mode)
 {
-  RImage *target;
-  int nwidth, nheight;
-  int x, y;
-
-  nwidth = source->width;
-  nheight = source->height;
-
-  target = RCreateImage(nwidth, nheight, (source->format != RRGBFormat));
-  if (!target)
+  /* Security */
+  if (source == NULL)
     return NULL;
 
-  if (source->format == RRGBFormat) {
-    unsigned char *optr, *nptr;
-
-    optr = source->data;
-    nptr = target->data + 3 * (nwidth * nheight - nwidth);
+  mode &= RVerticalFlip | RHorizontalFlip;
+  if (mode == 0)
+    return RRetainImage(source);
 
-    for (y = 0; y < nheight; y++) {
-      for (x = 0; x < nwidth; x++) {
-        nptr[0] = optr[0];
-        nptr[1] = optr[1];
-        nptr[2] = optr[2];
-
-        optr += 3;
-        nptr += 3;
-      }
-      nptr -= (nwidth * 3) * 2;
-    }
-  } else {
-    unsigned char *optr, *nptr;
-
-    optr = source->data;
-    nptr = target->data + 4 * (nwidth * nheight - nwidth);
-
-    for (y = 0; y < nheight; y++) {
-      for (x = 0; x < nwidth; x++) {
-        nptr[0] = optr[0];
-        nptr[1] = optr[1];
-        nptr[2] = optr[2];
-        nptr[3] = optr[3];
-
-        optr += 4;
-        nptr += 4;
-      }
-      nptr -= (nwidth * 4) * 2;
-    }
-  }
-  return target;
+  return wraster_transform_image(source, flip_transform(mode));
 }
 
-RImage *r_flip_horizontally(RImage *source)
+int RFlipImageInPlace(RImage *image, int mode)
 {
-  RImage *target;
-  int nwidth, nheight;
-  int x, y;
-
-  nwidth = source->width;
-  nheight = source->height;
-
-  target = RCreateImage(nwidth, nheight, (source->format != RRGBFormat));
-  if (!target)
-    return NULL;
+  mode &= RVerticalFlip | RHorizontalFlip;
+  if (mode == 0)
+    return True;
 
-  if (source->format == RRGBFormat) {
-    unsigned char *optr, *nptr;
-
-    optr = source->data;
-    nptr = target->data + 3 * (nwidth - 1);
-
-    for (y = nheight; y; y--) {
-      for (x = 0; x < nwidth; x++) {
-        nptr[0] = optr[0];
-        nptr[1] = optr[1];
-        nptr[2] = optr[2];
-
-        optr += 3;
-        nptr -= 3;
-      }
-      nptr += (nwidth * 3) * 2;
-    }
-  } else {
-    unsigned char *optr, *nptr;
-
-    optr = source->data;
-    nptr = target->data + 4 * (nwidth - 1);
-
-    for (y = nheight; y; y--) {
-      for (x = 0; x < nwidth; x++) {
-        nptr[0] = optr[0];
-        nptr[1] = optr[1];
-        nptr[2] = optr[2];
-        nptr[3] = optr[3];
-
-        optr += 4;
-        nptr -= 4;
-      }
-      nptr += (nwidth * 4) * 2;
-    }
-  }
-  return target;
+  return wraster_transform_image_in_place(image, flip_transform(mode));
 }
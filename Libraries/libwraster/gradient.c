@@ -22,12 +22,259 @@
  */
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
+#include <pthread.h>
 
 #include <assert.h>
 
+#include "config.h"
 #include "wraster.h"
+#include "gradient.h"
+#include "cpu.h"
+
+#ifdef WRASTER_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/*
+ * The window manager renders the same gradients over and over for the
+ * titlebars, menus and switch panel, so the rendered images are cached,
+ * keyed by everything they are made of.
+ */
+typedef enum { RGradientTwoColors, RGradientMultiColors, RGradientInterwoven } RGradientKind;
+
+#define GRADIENT_CACHE_MAX_COLORS 16 /* gradients with more colors are not cached */
+
+typedef struct RGradientKey {
+  RGradientKind kind;
+  int style;
+  unsigned width, height;
+  int thickness1, thickness2; /* for interwoven gradients */
+  int count;
+  unsigned char colors[GRADIENT_CACHE_MAX_COLORS * 3]; /* RGB, the alpha isn't used */
+} RGradientKey;
+
+typedef struct RCachedGradient {
+  RGradientKey key;
+  RImage *image;
+  unsigned int hash;
+  unsigned long size; /* bytes of pixel data */
+
+  struct RCachedGradient *hash_next;  /* next entry in the same bucket */
+  struct RCachedGradient *prev, *next; /* LRU list, most recently used first */
+} RCachedGradient;
+
+#define GRADIENT_CACHE_DEFAULT_MEMORY (4 * 1024) /* in kilobytes */
+
+#define GRADIENT_CACHE_NBUCKETS 64 /* power of 2 */
+
+static long RGradientCacheMemory = -1; /* bytes, -1 until initialized */
+
+static RCachedGradient *RGradientCache[GRADIENT_CACHE_NBUCKETS];
+static RCachedGradient *RGradientCacheLRU, *RGradientCacheLRUTail;
+static RImageCacheStatistics RGradientCacheStats;
+
+/* protects all of the above, it is not held while rendering */
+static pthread_mutex_t RGradientCacheLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void init_cache(void)
+{
+  char *tmp;
+  int kbytes;
+
+  tmp = getenv("RGRADIENT_CACHE_MEMORY");
+  if (!tmp || sscanf(tmp, "%i", &kbytes) != 1)
+    kbytes = GRADIENT_CACHE_DEFAULT_MEMORY;
+  if (kbytes < 0)
+    kbytes = 0;
+  RGradientCacheMemory = (long)kbytes * 1024;
+
+  memset(&RGradientCacheStats, 0, sizeof(RGradientCacheStats));
+  RGradientCacheStats.budget = RGradientCacheMemory;
+}
+
+/* returns False if the gradient can't be cached */
+static Bool make_key(RGradientKey *key, RGradientKind kind, int style, unsigned width,
+                     unsigned height, const RColor **colors, int count)
+{
+  int i;
+
+  if (count > GRADIENT_CACHE_MAX_COLORS)
+    return False;
+
+  memset(key, 0, sizeof(RGradientKey));
+  key->kind = kind;
+  key->style = style;
+  key->width = width;
+  key->height = height;
+  key->count = count;
+  for (i = 0; i < count; i++) {
+    key->colors[i * 3] = colors[i]->red;
+    key->colors[i * 3 + 1] = colors[i]->green;
+    key->colors[i * 3 + 2] = colors[i]->blue;
+  }
+
+  return True;
+}
+
+static unsigned int hash_key(const RGradientKey *key)
+{
+  /* FNV-1a, the padding is zeroed by make_key() */
+  const unsigned char *ptr = (const unsigned char *)key;
+  unsigned int hash = 2166136261U;
+  size_t i;
+
+  for (i = 0; i < offsetof(RGradientKey, colors) + key->count * 3; i++) {
+    hash ^= ptr[i];
+    hash *= 16777619U;
+  }
+  return hash;
+}
+
+static Bool same_key(const RGradientKey *a, const RGradientKey *b)
+{
+  return memcmp(a, b, offsetof(RGradientKey, colors) + a->count * 3) == 0;
+}
+
+static RCachedGradient *find_entry(const RGradientKey *key, unsigned int hash)
+{
+  RCachedGradient *entry;
+
+  for (entry = RGradientCache[hash & (GRADIENT_CACHE_NBUCKETS - 1)]; entry;
+       entry = entry->hash_next) {
+    if (entry->hash == hash && same_key(&entry->key, key))
+      break;
+  }
+  return entry;
+}
+
+static void remove_entry(RCachedGradient *entry)
+{
+  RCachedGradient **ptr = &RGradientCache[entry->hash & (GRADIENT_CACHE_NBUCKETS - 1)];
+
+  while (*ptr != entry)
+    ptr = &(*ptr)->hash_next;
+  *ptr = entry->hash_next;
+
+  if (entry->prev)
+    entry->prev->next = entry->next;
+  else
+    RGradientCacheLRU = entry->next;
+  if (entry->next)
+    entry->next->prev = entry->prev;
+  else
+    RGradientCacheLRUTail = entry->prev;
+
+  RGradientCacheStats.entries--;
+  RGradientCacheStats.bytes -= entry->size;
+  RReleaseImage(entry->image);
+  free(entry);
+}
+
+/* returns a new reference to the cached gradient, or NULL */
+static RImage *cache_lookup(const RGradientKey *key)
+{
+  RCachedGradient *entry;
+  RImage *image = NULL;
+
+  pthread_mutex_lock(&RGradientCacheLock);
+  if (RGradientCacheMemory < 0)
+    init_cache();
+
+  entry = find_entry(key, hash_key(key));
+  if (entry) {
+    /* move to the front of the LRU list */
+    if (entry->prev) {
+      entry->prev->next = entry->next;
+      if (entry->next)
+        entry->next->prev = entry->prev;
+      else
+        RGradientCacheLRUTail = entry->prev;
+      entry->prev = NULL;
+      entry->next = RGradientCacheLRU;
+      RGradientCacheLRU->prev = entry;
+      RGradientCacheLRU = entry;
+    }
+    RGradientCacheStats.hits++;
+    image = RRetainImage(entry->image);
+  } else {
+    RGradientCacheStats.misses++;
+  }
+  pthread_mutex_unlock(&RGradientCacheLock);
+
+  return image;
+}
+
+static void cache_store(const RGradientKey *key, RImage *image)
+{
+  RCachedGradient *entry;
+  unsigned long size = image->width * image->height * 3;
+  unsigned int hash = hash_key(key), bucket;
+
+  pthread_mutex_lock(&RGradientCacheLock);
+
+  /*
+   * Big gradients, like desktop backgrounds, are rendered once: they would
+   * only push the small ones out.
+   */
+  if (size > RGradientCacheMemory / 4 || find_entry(key, hash)) {
+    pthread_mutex_unlock(&RGradientCacheLock);
+    return;
+  }
+
+  entry = malloc(sizeof(RCachedGradient));
+  if (!entry) {
+    pthread_mutex_unlock(&RGradientCacheLock);
+    return;
+  }
+  entry->key = *key;
+  entry->image = RRetainImage(image);
+  entry->hash = hash;
+  entry->size = size;
+
+  bucket = hash & (GRADIENT_CACHE_NBUCKETS - 1);
+  entry->hash_next = RGradientCache[bucket];
+  RGradientCache[bucket] = entry;
+
+  entry->prev = NULL;
+  entry->next = RGradientCacheLRU;
+  if (RGradientCacheLRU)
+    RGradientCacheLRU->prev = entry;
+  else
+    RGradientCacheLRUTail = entry;
+  RGradientCacheLRU = entry;
+
+  RGradientCacheStats.entries++;
+  RGradientCacheStats.bytes += size;
+
+  /* dump least recently used ones until we fit */
+  while (RGradientCacheLRUTail != entry && RGradientCacheStats.bytes > RGradientCacheMemory) {
+    RGradientCacheStats.evictions++;
+    remove_entry(RGradientCacheLRUTail);
+  }
+
+  pthread_mutex_unlock(&RGradientCacheLock);
+}
+
+void wraster_release_gradient_cache(void)
+{
+  pthread_mutex_lock(&RGradientCacheLock);
+  while (RGradientCacheLRU)
+    remove_entry(RGradientCacheLRU);
+  RGradientCacheMemory = -1;
+  pthread_mutex_unlock(&RGradientCacheLock);
+}
+
+void RGetGradientCacheStatistics(RImageCacheStatistics *stats)
+{
+  pthread_mutex_lock(&RGradientCacheLock);
+  if (RGradientCacheMemory < 0)
+    init_cache();
+  *stats = RGradientCacheStats;
+  pthread_mutex_unlock(&RGradientCacheLock);
+}
 
 static RImage *renderHGradient(unsigned width, unsigned height, int r0, int g0, int b0, int rf,
                                int gf, int bf);
@@ -40,8 +287,25 @@ static RImage *renderMHGradient(unsigned width, unsigned height, RColor **colors
 static RImage *renderMVGradient(unsigned width, unsigned height, RColor **colors, int count);
 static RImage *renderMDGradient(unsigned width, unsigned height, RColor **colors, int count);
 
+static RImage *renderMultiGradient(unsigned width, unsigned height, RColor **colors, int count,
+                                   RGradientStyle style)
+{
+  switch (style) {
+    case RHorizontalGradient:
+      return renderMHGradient(width, height, colors, count);
+    case RVerticalGradient:
+      return renderMVGradient(width, height, colors, count);
+    case RDiagonalGradient:
+      return renderMDGradient(width, height, colors, count);
+  }
+  assert(0);
+  return NULL;
+}
+
 RImage *RRenderMultiGradient(unsigned width, unsigned height, RColor **colors, RGradientStyle style)
 {
+  RGradientKey key;
+  RImage *image;
   int count;
 
   count = 0;
@@ -49,14 +313,18 @@ RImage *RRenderMultiGradient(unsigned width, unsigned height, RColor **colors, R
     count++;
 
   if (count > 2) {
-    switch (style) {
-      case RHorizontalGradient:
-        return renderMHGradient(width, height, colors, count);
-      case RVerticalGradient:
-        return renderMVGradient(width, height, colors, count);
-      case RDiagonalGradient:
-        return renderMDGradient(width, height, colors, count);
+    if (!make_key(&key, RGradientMultiColors, style, width, height, (const RColor **)colors,
+                  count))
+      return renderMultiGradient(width, height, colors, count, style);
+
+    image = cache_lookup(&key);
+    if (!image) {
+      image = renderMultiGradient(width, height, colors, count, style);
+      if (image)
+        cache_store(&key, image);
     }
+    /* the caller may modify the image, so it can't be the cached one */
+    return image ? RGetWritableImage(image) : NULL;
   } else if (count > 1) {
     return RRenderGradient(width, height, colors[0], colors[1], style);
   } else if (count > 0) {
@@ -66,8 +334,8 @@ RImage *RRenderMultiGradient(unsigned width, unsigned height, RColor **colors, R
   return NULL;
 }
 
-RImage *RRenderGradient(unsigned width, unsigned height, const RColor *from, const RColor *to,
-                        RGradientStyle style)
+static RImage *renderGradient(unsigned width, unsigned height, const RColor *from,
+                              const RColor *to, RGradientStyle style)
 {
   switch (style) {
     case RHorizontalGradient:
@@ -85,6 +353,54 @@ RImage *RRenderGradient(unsigned width, unsigned height, const RColor *from, con
   return NULL;
 }
 
+RImage *RRenderSharedGradient(unsigned width, unsigned height, const RColor *from,
+                              const RColor *to, RGradientStyle style)
+{
+  const RColor *colors[2] = {from, to};
+  RGradientKey key;
+  RImage *image;
+
+  make_key(&key, RGradientTwoColors, style, width, height, colors, 2);
+  image = cache_lookup(&key);
+  if (!image) {
+    image = renderGradient(width, height, from, to, style);
+    if (image)
+      cache_store(&key, image);
+  }
+  return image;
+}
+
+RImage *RRenderGradient(unsigned width, unsigned height, const RColor *from, const RColor *to,
+                        RGradientStyle style)
+{
+  RImage *image = RRenderSharedGradient(width, height, from, to, style);
+
+  /* the caller may modify the image, so it can't be the cached one */
+  return image ? RGetWritableImage(image) : NULL;
+}
+
+#define REPLICATE_BLOCK (64 * 1024) /* stays in the cache while it is copied */
+
+/*
+ * Copies the first line of 'image' to the other ones, doubling the copied
+ * block up to REPLICATE_BLOCK: a few large copies instead of one per line.
+ */
+static void replicateFirstLine(RImage *image)
+{
+  size_t lineSize = image->width * 3;
+  size_t total = lineSize * image->height;
+  size_t done = lineSize, block, count;
+
+  while (done < total) {
+    block = (done < REPLICATE_BLOCK) ? done : done - done % lineSize;
+    if (block > REPLICATE_BLOCK && lineSize <= REPLICATE_BLOCK)
+      block = REPLICATE_BLOCK - REPLICATE_BLOCK % lineSize;
+    count = (block < total - done) ? block : total - done;
+    memcpy(image->data + done, image->data, count);
+    done += count;
+  }
+}
+
 /*
  *----------------------------------------------------------------------
  * renderHGradient--
@@ -103,7 +419,6 @@ static RImage *renderHGradient(unsigned width, unsigned height, int r0, int g0,
 {
   int i;
   long r, g, b, dr, dg, db;
-  unsigned lineSize = width * 3;
   RImage *image;
   unsigned char *ptr;
 
@@ -130,10 +445,7 @@ static RImage *renderHGradient(unsigned width, unsigned height, int r0, int g0,
     b += db;
   }
 
-  /* copy the first line to the other lines */
-  for (i = 1; i < height; i++) {
-    memcpy(&(image->data[i * lineSize]), image->data, lineSize);
-  }
+  replicateFirstLine(image);
   return image;
 }
 
@@ -179,6 +491,52 @@ static inline unsigned char *renderGradientWidth(unsigned char *ptr, unsigned wi
   return ptr;
 }
 
+#ifdef WRASTER_X86_SIMD
+/* 16 pixels, that is three vectors, per iteration */
+WRASTER_TARGET("sse2")
+static unsigned char *renderGradientWidthSSE2(unsigned char *ptr, unsigned width,
+                                              unsigned char r, unsigned char g, unsigned char b)
+{
+  /* 4 pixels in 3 words */
+  unsigned w0 = r | g << 8 | b << 16 | (unsigned)r << 24;
+  unsigned w1 = g | b << 8 | r << 16 | (unsigned)g << 24;
+  unsigned w2 = b | r << 8 | g << 16 | (unsigned)b << 24;
+  __m128i v0, v1, v2;
+  unsigned char *end = ptr + width * 3;
+
+  if (width < 16)
+    return renderGradientWidth(ptr, width, r, g, b);
+
+  v0 = _mm_setr_epi32(w0, w1, w2, w0);
+  v1 = _mm_setr_epi32(w1, w2, w0, w1);
+  v2 = _mm_setr_epi32(w2, w0, w1, w2);
+  for (; ptr + 48 <= end; ptr += 48) {
+    _mm_storeu_si128((__m128i *)ptr, v0);
+    _mm_storeu_si128((__m128i *)(ptr + 16), v1);
+    _mm_storeu_si128((__m128i *)(ptr + 32), v2);
+  }
+  /* the last 16 pixels, overlapping the ones already there */
+  if (ptr < end) {
+    _mm_storeu_si128((__m128i *)(end - 48), v0);
+    _mm_storeu_si128((__m128i *)(end - 32), v1);
+    _mm_storeu_si128((__m128i *)(end - 16), v2);
+  }
+  return end;
+}
+#endif
+
+typedef unsigned char *RGradientWidthProc(unsigned char *ptr, unsigned width, unsigned char r,
+                                          unsigned char g, unsigned char b);
+
+static RGradientWidthProc *gradientWidthProc(void)
+{
+#ifdef WRASTER_X86_SIMD
+  if (wraster_cpu_level() >= RCPUSSE2)
+    return renderGradientWidthSSE2;
+#endif
+  return renderGradientWidth;
+}
+
 /*
  *----------------------------------------------------------------------
  * renderVGradient--
@@ -195,6 +553,7 @@ static inline unsigned char *renderGradientWidth(unsigned char *ptr, unsigned wi
 static RImage *renderVGradient(unsigned width, unsigned height, int r0, int g0, int b0, int rf,
                                int gf, int bf)
 {
+  RGradientWidthProc *renderWidth = gradientWidthProc();
   int i;
   long r, g, b, dr, dg, db;
   RImage *image;
@@ -215,7 +574,7 @@ static RImage *renderVGradient(unsigned width, unsigned height, int r0, int g0,
   db = ((bf - b0) << 16) / (int)height;
 
   for (i = 0; i < height; i++) {
-    ptr = renderGradientWidth(ptr, width, r >> 16, g >> 16, b >> 16);
+    ptr = renderWidth(ptr, width, r >> 16, g >> 16, b >> 16);
     r += dr;
     g += dg;
     b += db;
@@ -223,6 +582,26 @@ static RImage *renderVGradient(unsigned width, unsigned height, int r0, int g0,
   return image;
 }
 
+/*
+ * Fills the lines of 'image' with windows of 'line', a horizontal gradient
+ * of 2 * width - 1 pixels, sliding from its start to its end.
+ */
+static void slideLine(RImage *image, const unsigned char *line)
+{
+  unsigned width = image->width, height = image->height;
+  unsigned lineSize = width * 3;
+  unsigned char *ptr = image->data;
+  float a, offset;
+  unsigned j;
+
+  /* accumulated in a float and truncated, which gives the same windows as
+     the previous code; a fixed point step rounds differently and shifts
+     whole pixels */
+  a = ((float)(width - 1)) / ((float)(height - 1));
+  for (j = 0, offset = 0; j < height; j++, ptr += lineSize, offset += a)
+    memcpy(ptr, line + 3 * (int)offset, lineSize);
+}
+
 /*
  *----------------------------------------------------------------------
  * renderDGradient--
@@ -241,8 +620,6 @@ static RImage *renderDGradient(unsigned width, unsigned height, int r0, int g0,
                                int gf, int bf)
 {
   RImage *image, *tmp;
-  int j;
-  float a, offset;
   unsigned char *ptr;
 
   if (width == 1)
@@ -263,14 +640,7 @@ static RImage *renderDGradient(unsigned width, unsigned height, int r0, int g0,
 
   ptr = tmp->data;
 
-  a = ((float)(width - 1)) / ((float)(height - 1));
-  width = width * 3;
-
-  /* copy the first line to the other lines with corresponding offset */
-  for (j = 0, offset = 0.0; j < width * height; j += width) {
-    memcpy(&(image->data[j]), &ptr[3 * (int)offset], width);
-    offset += a;
-  }
+  slideLine(image, ptr);
 
   RReleaseImage(tmp);
   return image;
@@ -280,7 +650,6 @@ static RImage *renderMHGradient(unsigned width, unsigned height, RColor **colors
 {
   int i, j, k;
   long r, g, b, dr, dg, db;
-  unsigned lineSize = width * 3;
   RImage *image;
   unsigned char *ptr;
   unsigned width2;
@@ -331,15 +700,13 @@ static RImage *renderMHGradient(unsigned width, unsigned height, RColor **colors
     *ptr++ = (unsigned char)(b >> 16);
   }
 
-  /* copy the first line to the other lines */
-  for (i = 1; i < height; i++) {
-    memcpy(&(image->data[i * lineSize]), image->data, lineSize);
-  }
+  replicateFirstLine(image);
   return image;
 }
 
 static RImage *renderMVGradient(unsigned width, unsigned height, RColor **colors, int count)
 {
+  RGradientWidthProc *renderWidth = gradientWidthProc();
   int i, j, k;
   long r, g, b, dr, dg, db;
   unsigned lineSize = width * 3;
@@ -375,7 +742,7 @@ static RImage *renderMVGradient(unsigned width, unsigned height, RColor **colors
     db = ((int)(colors[i]->blue - colors[i - 1]->blue) << 16) / (int)height2;
 
     for (j = 0; j < height2; j++) {
-      ptr = renderGradientWidth(ptr, width, r >> 16, g >> 16, b >> 16);
+      ptr = renderWidth(ptr, width, r >> 16, g >> 16, b >> 16);
       r += dr;
       g += dg;
       b += db;
@@ -388,7 +755,7 @@ static RImage *renderMVGradient(unsigned width, unsigned height, RColor **colors
 
   if (k < height) {
     tmp = ptr;
-    ptr = renderGradientWidth(ptr, width, r >> 16, g >> 16, b >> 16);
+    ptr = renderWidth(ptr, width, r >> 16, g >> 16, b >> 16);
     for (j = k + 1; j < height; j++) {
       memcpy(ptr, tmp, lineSize);
       ptr += lineSize;
@@ -401,8 +768,6 @@ static RImage *renderMVGradient(unsigned width, unsigned height, RColor **colors
 static RImage *renderMDGradient(unsigned width, unsigned height, RColor **colors, int count)
 {
   RImage *image, *tmp;
-  float a, offset;
-  int j;
   unsigned char *ptr;
 
   assert(count > 2);
@@ -425,9 +790,8 @@ static RImage *renderMDGradient(unsigned width, unsigned height, RColor **colors
   if (count > 2)
     tmp = renderMHGradient(2 * width - 1, 1, colors, count);
   else
-    tmp = renderHGradient(2 * width - 1, 1, colors[0]->red << 8, colors[0]->green << 8,
-                          colors[0]->blue << 8, colors[1]->red << 8, colors[1]->green << 8,
-                          colors[1]->blue << 8);
+    tmp = renderHGradient(2 * width - 1, 1, colors[0]->red, colors[0]->green, colors[0]->blue,
+                          colors[1]->red, colors[1]->green, colors[1]->blue);
 
   if (!tmp) {
     RReleaseImage(image);
@@ -435,21 +799,16 @@ static RImage *renderMDGradient(unsigned width, unsigned height, RColor **colors
   }
   ptr = tmp->data;
 
-  a = ((float)(width - 1)) / ((float)(height - 1));
-  width = width * 3;
+  slideLine(image, ptr);
 
-  /* copy the first line to the other lines with corresponding offset */
-  for (j = 0, offset = 0; j < width * height; j += width) {
-    memcpy(&(image->data[j]), &ptr[3 * (int)offset], width);
-    offset += a;
-  }
   RReleaseImage(tmp);
   return image;
 }
 
-RImage *RRenderInterwovenGradient(unsigned width, unsigned height, RColor colors1[2],
-                                  int thickness1, RColor colors2[2], int thickness2)
+static RImage *renderInterwovenGradient(unsigned width, unsigned height, RColor colors1[2],
+                                        int thickness1, RColor colors2[2], int thickness2)
 {
+  RGradientWidthProc *renderWidth = gradientWidthProc();
   int i, k, l, ll;
   long r1, g1, b1, dr1, dg1, db1;
   long r2, g2, b2, dr2, dg2, db2;
@@ -480,9 +839,9 @@ RImage *RRenderInterwovenGradient(unsigned width, unsigned height, RColor colors
 
   for (i = 0, k = 0, l = 0, ll = thickness1; i < height; i++) {
     if (k == 0)
-      ptr = renderGradientWidth(ptr, width, r1 >> 16, g1 >> 16, b1 >> 16);
+      ptr = renderWidth(ptr, width, r1 >> 16, g1 >> 16, b1 >> 16);
     else
-      ptr = renderGradientWidth(ptr, width, r2 >> 16, g2 >> 16, b2 >> 16);
+      ptr = renderWidth(ptr, width, r2 >> 16, g2 >> 16, b2 >> 16);
 
     if (++l == ll) {
       if (k == 0) {
@@ -504,3 +863,24 @@ RImage *RRenderInterwovenGradient(unsigned width, unsigned height, RColor colors
   }
   return image;
 }
+
+RImage *RRenderInterwovenGradient(unsigned width, unsigned height, RColor colors1[2],
+                                  int thickness1, RColor colors2[2], int thickness2)
+{
+  const RColor *colors[4] = {&colors1[0], &colors1[1], &colors2[0], &colors2[1]};
+  RGradientKey key;
+  RImage *image;
+
+  make_key(&key, RGradientInterwoven, 0, width, height, colors, 4);
+  key.thickness1 = thickness1;
+  key.thickness2 = thickness2;
+
+  image = cache_lookup(&key);
+  if (!image) {
+    image = renderInterwovenGradient(width, height, colors1, thickness1, colors2, thickness2);
+    if (image)
+      cache_store(&key, image);
+  }
+  /* the caller may modify the image, so it can't be the cached one */
+  return image ? RGetWritableImage(image) : NULL;
+}
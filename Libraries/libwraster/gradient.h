@@ -0,0 +1,33 @@
+/*
+ * Raster graphics library
+ *
+ * Copyright (c) 2026 NEXTSPACE Team
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Library General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Library General Public
+ *  License along with this library.
+ */
+
+/*
+ * The functions here are for WRaster library's internal use only,
+ * Please use functions in 'wraster.h' in applications
+ */
+
+#ifndef __WRASTER_GRADIENT_H__
+#define __WRASTER_GRADIENT_H__
+
+/*
+ * Function to release the cached gradients (see RRenderSharedGradient)
+ */
+void wraster_release_gradient_cache(void);
+
+#endif
@@ -49,6 +49,9 @@ typedef enum {
 
 /*
  * Function for Loading in a specific format
+ *
+ * The loaders taking 'max_width' and 'max_height' scale the image down
+ * while decoding it, to fit in that size; 0 means no limit.
  */
 RImage *RLoadPPM(const char *file);
 
@@ -59,11 +62,11 @@ RImage *RLoadTIFF(const char *file, int index);
 #endif
 
 #ifdef USE_PNG
-RImage *RLoadPNG(RContext *context, const char *file);
+RImage *RLoadPNG(RContext *context, const char *file, unsigned max_width, unsigned max_height);
 #endif
 
 #ifdef USE_JPEG
-RImage *RLoadJPEG(const char *file);
+RImage *RLoadJPEG(const char *file, unsigned max_width, unsigned max_height);
 #endif
 
 #ifdef USE_GIF
@@ -71,7 +74,7 @@ RImage *RLoadGIF(const char *file, int index);
 #endif
 
 #ifdef USE_WEBP
-RImage *RLoadWEBP(const char *file);
+RImage *RLoadWEBP(const char *file, unsigned max_width, unsigned max_height);
 #endif
 
 #ifdef USE_MAGICK
@@ -98,4 +101,6 @@ Bool RSaveJPEG(RImage *image, const char *filename, char *title);
  */
 void RReleaseCache(void);
 
+void RReleaseImageRequests(void);
+
 #endif
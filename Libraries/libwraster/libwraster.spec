@@ -1,5 +1,5 @@
 %global toolchain clang
-%define WRASTER_VERSION 7.0.1
+%define WRASTER_VERSION 8.0.0
 
 Name:           libwraster
 Version:        %{WRASTER_VERSION}
@@ -25,7 +25,7 @@ BuildRequires:	libXext-devel
 BuildRequires:	libX11-devel
 
 Provides:	libwraster.so
-Provides:	libwraster.so.7
+Provides:	libwraster.so.8
 Provides:	libwraster.so.%{WRASTER_VERSION}
 
 Requires:	giflib >= 4.1.6
@@ -89,8 +89,8 @@ export CMAKE=%{CMAKE}
 #
 %files
 /usr/NextSpace/lib/libwraster.so
-/usr/NextSpace/lib/libwraster.so.7
-/usr/NextSpace/lib/libwraster.so.7.0.1
+/usr/NextSpace/lib/libwraster.so.8
+/usr/NextSpace/lib/libwraster.so.%{WRASTER_VERSION}
 
 %files devel
 /usr/NextSpace/include/wraster.h
@@ -31,36 +31,87 @@
 #include <string.h>
 #include <time.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include "config.h"
 #include "wraster.h"
 #include "imgformat.h"
+#include "reduce.h"
 #include "wr_i18n.h"
 
+#ifdef HAVE_INOTIFY
+#include <sys/inotify.h>
+#endif
+
 typedef struct RCachedImage {
   RImage *image;
   char *file;
-  time_t last_modif; /* last time file was modified */
-  time_t last_use;   /* last time image was used */
+  int index;
+  unsigned max_width, max_height; /* box given to RLoadImageScaled, 0 if none */
+  unsigned int hash;
+  unsigned long size; /* bytes of pixel data */
+  time_t last_modif;  /* last time file was modified, if not watched */
+  int watch;          /* inotify watch descriptor, -1 if none */
+
+  struct RCachedImage *hash_next;  /* next entry in the same bucket */
+  struct RCachedImage *prev, *next; /* LRU list, most recently used first */
 } RCachedImage;
 
 /*
- * Number of image to keep in the cache
+ * Max. number of images to keep in the cache
  */
 static int RImageCacheSize = -1;
 
-#define IMAGE_CACHE_DEFAULT_NBENTRIES 8
-#define IMAGE_CACHE_MAXIMUM_NBENTRIES 256
+#define IMAGE_CACHE_DEFAULT_NBENTRIES 1024
+#define IMAGE_CACHE_MAXIMUM_NBENTRIES 65536
 
 /*
  * Max. size of image (in pixels) to store in the cache
  */
 static int RImageCacheMaxImage = -1; /* 0 = any size */
 
-#define IMAGE_CACHE_DEFAULT_MAXPIXELS (64 * 64)
-#define IMAGE_CACHE_MAXIMUM_MAXPIXELS (256 * 256)
+#define IMAGE_CACHE_DEFAULT_MAXPIXELS (256 * 256)
+#define IMAGE_CACHE_MAXIMUM_MAXPIXELS (2048 * 2048)
+
+/*
+ * Max. memory (in bytes) used by the pixels of the cached images
+ */
+static unsigned long RImageCacheMemory;
+
+#define IMAGE_CACHE_DEFAULT_MEMORY (8 * 1024) /* in kilobytes */
 
-static RCachedImage *RImageCache;
+#define IMAGE_CACHE_NBUCKETS 512 /* power of 2 */
+
+static RCachedImage *RImageCache[IMAGE_CACHE_NBUCKETS];
+static RCachedImage *RImageCacheLRU, *RImageCacheLRUTail;
+static RImageCacheStatistics RImageCacheStats;
+
+static int RImageCacheNotify = -1; /* inotify descriptor */
+
+#ifdef HAVE_INOTIFY
+/*
+ * inotify returns the same descriptor for every watch of an inode, so the
+ * watches are counted: each cache entry and each load in progress holds
+ * one use. The events are counted too, for a load to know whether the file
+ * changed while it was decoded.
+ */
+typedef struct RFileWatch {
+  int wd;
+  int users;
+  unsigned long changes;
+  struct RFileWatch *next;
+} RFileWatch;
+
+#define WATCH_NBUCKETS 64 /* power of 2 */
+
+static RFileWatch *RImageCacheWatches[WATCH_NBUCKETS];
+#endif
+
+/*
+ * Protects all of the above, images can be loaded from several threads
+ * (see RLoadImageAsync). It is not held while decoding.
+ */
+static pthread_mutex_t RImageCacheLock = PTHREAD_MUTEX_INITIALIZER;
 
 static WRImgFormat identFile(const char *path);
 
@@ -102,6 +153,7 @@ char **RSupportedFileFormats(void)
 static void init_cache(void)
 {
   char *tmp;
+  int kbytes;
 
   tmp = getenv("RIMAGE_CACHE");
   if (!tmp || sscanf(tmp, "%i", &RImageCacheSize) != 1)
@@ -119,60 +171,381 @@ static void init_cache(void)
   if (RImageCacheMaxImage > IMAGE_CACHE_MAXIMUM_MAXPIXELS)
     RImageCacheMaxImage = IMAGE_CACHE_MAXIMUM_MAXPIXELS;
 
-  if (RImageCacheSize > 0) {
-    RImageCache = malloc(sizeof(RCachedImage) * RImageCacheSize);
-    if (RImageCache == NULL) {
-      fprintf(stderr, _("wrlib: out of memory for image cache\n"));
-      return;
+  tmp = getenv("RIMAGE_CACHE_MEMORY");
+  if (!tmp || sscanf(tmp, "%i", &kbytes) != 1)
+    kbytes = IMAGE_CACHE_DEFAULT_MEMORY;
+  if (kbytes < 0)
+    kbytes = 0;
+  RImageCacheMemory = (unsigned long)kbytes * 1024;
+  if (RImageCacheMemory == 0)
+    RImageCacheSize = 0;
+
+  memset(&RImageCacheStats, 0, sizeof(RImageCacheStats));
+  RImageCacheStats.budget = RImageCacheMemory;
+
+#ifdef HAVE_INOTIFY
+  /* watching the files saves a stat() on every cache hit */
+  tmp = getenv("RIMAGE_CACHE_INOTIFY");
+  if (RImageCacheSize > 0 && (!tmp || strcmp(tmp, "0") != 0))
+    RImageCacheNotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+}
+
+static unsigned int hash_file(const char *file, int index, unsigned max_width,
+                              unsigned max_height)
+{
+  /* FNV-1a */
+  unsigned int hash = 2166136261U;
+
+  while (*file) {
+    hash ^= (unsigned char)*file++;
+    hash *= 16777619U;
+  }
+  hash ^= (unsigned int)index;
+  hash *= 16777619U;
+  hash ^= max_width;
+  hash *= 16777619U;
+  hash ^= max_height;
+  hash *= 16777619U;
+
+  return hash;
+}
+
+#ifdef HAVE_INOTIFY
+static RFileWatch **find_watch(int wd)
+{
+  RFileWatch **ptr = &RImageCacheWatches[wd & (WATCH_NBUCKETS - 1)];
+
+  while (*ptr && (*ptr)->wd != wd)
+    ptr = &(*ptr)->next;
+
+  return ptr;
+}
+#endif
+
+static void unwatch_file(int watch)
+{
+#ifdef HAVE_INOTIFY
+  RFileWatch **ptr, *w;
+
+  if (watch < 0)
+    return;
+
+  ptr = find_watch(watch);
+  w = *ptr;
+  /* dropped by RReleaseCache() while the load was in progress */
+  if (!w)
+    return;
+  if (--w->users > 0)
+    return;
+
+  *ptr = w->next;
+  free(w);
+  inotify_rm_watch(RImageCacheNotify, watch);
+#else
+  (void)watch;
+#endif
+}
+
+/* returns the watch descriptor, and in 'changes' the events seen so far */
+static int watch_file(const char *file, unsigned long *changes)
+{
+#ifdef HAVE_INOTIFY
+  RFileWatch **ptr, *w;
+  int wd;
+
+  if (RImageCacheNotify < 0)
+    return -1;
+
+  wd = inotify_add_watch(RImageCacheNotify, file,
+                         IN_MODIFY | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF);
+  if (wd < 0)
+    return -1;
+
+  ptr = find_watch(wd);
+  w = *ptr;
+  if (!w) {
+    w = malloc(sizeof(RFileWatch));
+    if (!w) {
+      inotify_rm_watch(RImageCacheNotify, wd);
+      return -1;
     }
-    memset(RImageCache, 0, sizeof(RCachedImage) * RImageCacheSize);
+    w->wd = wd;
+    w->users = 0;
+    w->changes = 0;
+    w->next = NULL;
+    *ptr = w;
   }
+  w->users++;
+  *changes = w->changes;
+
+  return wd;
+#else
+  (void)file;
+  (void)changes;
+  return -1;
+#endif
 }
 
-void RReleaseCache(void)
+/* whether the file changed since watch_file() returned 'changes' */
+static Bool watch_changed(int watch, unsigned long changes)
 {
-  int i;
+#ifdef HAVE_INOTIFY
+  RFileWatch *w;
 
-  if (RImageCacheSize > 0) {
-    for (i = 0; i < RImageCacheSize; i++) {
-      if (RImageCache[i].file) {
-        RReleaseImage(RImageCache[i].image);
-        free(RImageCache[i].file);
-      }
+  if (watch < 0)
+    return False;
+
+  w = *find_watch(watch);
+  return !w || w->changes != changes;
+#else
+  (void)watch;
+  (void)changes;
+  return False;
+#endif
+}
+
+static void remove_entry(RCachedImage *entry)
+{
+  RCachedImage **ptr = &RImageCache[entry->hash & (IMAGE_CACHE_NBUCKETS - 1)];
+
+  while (*ptr != entry)
+    ptr = &(*ptr)->hash_next;
+  *ptr = entry->hash_next;
+
+  if (entry->prev)
+    entry->prev->next = entry->next;
+  else
+    RImageCacheLRU = entry->next;
+  if (entry->next)
+    entry->next->prev = entry->prev;
+  else
+    RImageCacheLRUTail = entry->prev;
+
+  RImageCacheStats.entries--;
+  RImageCacheStats.bytes -= entry->size;
+
+  unwatch_file(entry->watch);
+  RReleaseImage(entry->image);
+  free(entry->file);
+  free(entry);
+}
+
+static void invalidate_watch(int watch)
+{
+  RCachedImage *entry, *next;
+#ifdef HAVE_INOTIFY
+  RFileWatch *w = *find_watch(watch);
+
+  /* loads in progress must not store what they decoded */
+  if (w)
+    w->changes++;
+#endif
+
+  for (entry = RImageCacheLRU; entry; entry = next) {
+    next = entry->next;
+    if (entry->watch == watch) {
+      RImageCacheStats.invalidations++;
+      remove_entry(entry);
     }
-    free(RImageCache);
-    RImageCache = NULL;
-    RImageCacheSize = -1;
   }
 }
 
-RImage *RLoadImage(RContext *context, const char *file, int index)
+static void process_file_events(void)
 {
-  RImage *image = NULL;
-  int i;
+#ifdef HAVE_INOTIFY
+  char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t len;
+
+  if (RImageCacheNotify < 0)
+    return;
+
+  while ((len = read(RImageCacheNotify, buffer, sizeof(buffer))) > 0) {
+    char *ptr = buffer;
+
+    while (ptr < buffer + len) {
+      struct inotify_event *event = (struct inotify_event *)ptr;
+
+      invalidate_watch(event->wd);
+      ptr += sizeof(struct inotify_event) + event->len;
+    }
+  }
+#endif
+}
+
+static RCachedImage *find_entry(const char *file, int index, unsigned max_width,
+                               unsigned max_height, unsigned int hash)
+{
+  RCachedImage *entry;
+
+  for (entry = RImageCache[hash & (IMAGE_CACHE_NBUCKETS - 1)]; entry; entry = entry->hash_next) {
+    if (entry->hash == hash && entry->index == index && entry->max_width == max_width &&
+        entry->max_height == max_height && strcmp(file, entry->file) == 0)
+      break;
+  }
+
+  return entry;
+}
+
+/* returns the cached image, or NULL if absent or out of date */
+static RImage *cache_lookup(const char *file, int index, unsigned max_width,
+                           unsigned max_height)
+{
+  unsigned int hash = hash_file(file, index, max_width, max_height);
+  RCachedImage *entry;
   struct stat st;
 
-  assert(file != NULL);
+  process_file_events();
 
-  if (RImageCacheSize < 0)
-    init_cache();
+  entry = find_entry(file, index, max_width, max_height, hash);
+  if (!entry) {
+    RImageCacheStats.misses++;
+    return NULL;
+  }
 
-  if (RImageCacheSize > 0) {
-    for (i = 0; i < RImageCacheSize; i++) {
-      if (RImageCache[i].file && strcmp(file, RImageCache[i].file) == 0) {
-        if (stat(file, &st) == 0 && st.st_mtime == RImageCache[i].last_modif) {
-          RImageCache[i].last_use = time(NULL);
-
-          return RCloneImage(RImageCache[i].image);
-
-        } else {
-          free(RImageCache[i].file);
-          RImageCache[i].file = NULL;
-          RReleaseImage(RImageCache[i].image);
-        }
+  if (entry->watch < 0 && (stat(file, &st) != 0 || st.st_mtime != entry->last_modif)) {
+    RImageCacheStats.invalidations++;
+    RImageCacheStats.misses++;
+    remove_entry(entry);
+    return NULL;
+  }
+
+  /* move to the front of the LRU list */
+  if (entry->prev) {
+    entry->prev->next = entry->next;
+    if (entry->next)
+      entry->next->prev = entry->prev;
+    else
+      RImageCacheLRUTail = entry->prev;
+    entry->prev = NULL;
+    entry->next = RImageCacheLRU;
+    RImageCacheLRU->prev = entry;
+    RImageCacheLRU = entry;
+  }
+
+  RImageCacheStats.hits++;
+  return entry->image;
+}
+
+/* takes over one reference of 'image' */
+static void cache_store(const char *file, int index, unsigned max_width, unsigned max_height,
+                        RImage *image, int watch, unsigned long changes)
+{
+  RCachedImage *entry;
+  struct stat st;
+  unsigned int bucket;
+
+  process_file_events();
+
+  /* another thread may have loaded the same image meanwhile, or the file
+     changed while it was decoded */
+  if (watch_changed(watch, changes) ||
+      find_entry(file, index, max_width, max_height,
+                 hash_file(file, index, max_width, max_height))) {
+    RReleaseImage(image);
+    unwatch_file(watch);
+    return;
+  }
+
+  entry = malloc(sizeof(RCachedImage));
+  if (entry)
+    entry->file = strdup(file);
+  if (!entry || !entry->file) {
+    free(entry);
+    RReleaseImage(image);
+    unwatch_file(watch);
+    return;
+  }
+
+  entry->image = image;
+  entry->index = index;
+  entry->max_width = max_width;
+  entry->max_height = max_height;
+  entry->hash = hash_file(file, index, max_width, max_height);
+  entry->size = image->width * image->height * (image->format == RRGBAFormat ? 4 : 3);
+  entry->watch = watch;
+  entry->last_modif = 0;
+  if (watch < 0) {
+    if (stat(file, &st) != 0) {
+      /* If we can't get the info, at least use a valid time to reduce risk of problems */
+      st.st_mtime = time(NULL);
+    }
+    entry->last_modif = st.st_mtime;
+  }
+
+  bucket = entry->hash & (IMAGE_CACHE_NBUCKETS - 1);
+  entry->hash_next = RImageCache[bucket];
+  RImageCache[bucket] = entry;
+
+  entry->prev = NULL;
+  entry->next = RImageCacheLRU;
+  if (RImageCacheLRU)
+    RImageCacheLRU->prev = entry;
+  else
+    RImageCacheLRUTail = entry;
+  RImageCacheLRU = entry;
+
+  RImageCacheStats.entries++;
+  RImageCacheStats.bytes += entry->size;
+
+  /* dump least recently used ones until we fit */
+  while (RImageCacheLRUTail != entry && (RImageCacheStats.bytes > RImageCacheMemory ||
+                                          RImageCacheStats.entries > (unsigned long)RImageCacheSize)) {
+    RImageCacheStats.evictions++;
+    remove_entry(RImageCacheLRUTail);
+  }
+}
+
+void RReleaseCache(void)
+{
+  pthread_mutex_lock(&RImageCacheLock);
+
+  while (RImageCacheLRU)
+    remove_entry(RImageCacheLRU);
+
+#ifdef HAVE_INOTIFY
+  {
+    RFileWatch *w;
+    int i;
+
+    /* those of loads still in progress */
+    for (i = 0; i < WATCH_NBUCKETS; i++) {
+      while ((w = RImageCacheWatches[i])) {
+        RImageCacheWatches[i] = w->next;
+        free(w);
       }
     }
   }
+  if (RImageCacheNotify >= 0)
+    close(RImageCacheNotify);
+#endif
+  RImageCacheNotify = -1;
+  RImageCacheSize = -1;
+
+  pthread_mutex_unlock(&RImageCacheLock);
+}
+
+void RGetImageCacheStatistics(RImageCacheStatistics *stats)
+{
+  pthread_mutex_lock(&RImageCacheLock);
+
+  if (RImageCacheSize < 0)
+    init_cache();
+
+  *stats = RImageCacheStats;
+
+  pthread_mutex_unlock(&RImageCacheLock);
+}
+
+/*
+ * Decodes the file. JPEG, PNG and WebP images are scaled down to
+ * 'max_width'x'max_height' while they are decoded, the others once loaded.
+ */
+static RImage *load_image_file(RContext *context, const char *file, int index,
+                               unsigned max_width, unsigned max_height)
+{
+  RImage *image = NULL, *reduced;
+  unsigned width, height;
 
   switch (identFile(file)) {
     case IM_ERROR:
@@ -202,13 +575,13 @@ RImage *RLoadImage(RContext *context, const char *file, int index)
 
 #ifdef USE_PNG
     case IM_PNG:
-      image = RLoadPNG(context, file);
+      image = RLoadPNG(context, file, max_width, max_height);
       break;
 #endif /* USE_PNG */
 
 #ifdef USE_JPEG
     case IM_JPEG:
-      image = RLoadJPEG(file);
+      image = RLoadJPEG(file, max_width, max_height);
       break;
 #endif /* USE_JPEG */
 
@@ -220,7 +593,7 @@ RImage *RLoadImage(RContext *context, const char *file, int index)
 
 #ifdef USE_WEBP
     case IM_WEBP:
-      image = RLoadWEBP(file);
+      image = RLoadWEBP(file, max_width, max_height);
       break;
 #endif /* USE_WEBP */
 
@@ -238,50 +611,97 @@ RImage *RLoadImage(RContext *context, const char *file, int index)
   }
 #endif
 
-  /* store image in cache */
-  if (RImageCacheSize > 0 && image &&
-      (RImageCacheMaxImage == 0 || RImageCacheMaxImage >= image->width * image->height)) {
-    time_t oldest = time(NULL);
-    int oldest_idx = 0;
-    int done = 0;
+  if (image == NULL)
+    return NULL;
 
-    if (stat(file, &st) != 0) {
-      /* If we can't get the info, at least use a valid time to reduce risk of problems */
-      st.st_mtime = oldest;
-    }
+  wraster_fit_size(image->width, image->height, max_width, max_height, &width, &height);
+  if (width != image->width || height != image->height) {
+    reduced = wraster_reduce_image(image, width, height);
+    if (reduced)
+      reduced->background = image->background;
+    RReleaseImage(image);
+    image = reduced;
+  }
 
-    for (i = 0; i < RImageCacheSize; i++) {
-      if (!RImageCache[i].file) {
-        RImageCache[i].file = malloc(strlen(file) + 1);
-        strcpy(RImageCache[i].file, file);
-        RImageCache[i].image = RCloneImage(image);
-        RImageCache[i].last_modif = st.st_mtime;
-        RImageCache[i].last_use = time(NULL);
-        done = 1;
-        break;
-      } else {
-        if (oldest > RImageCache[i].last_use) {
-          oldest = RImageCache[i].last_use;
-          oldest_idx = i;
-        }
-      }
-    }
+  return image;
+}
 
-    /* if no slot available, dump least recently used one */
-    if (!done) {
-      free(RImageCache[oldest_idx].file);
-      RReleaseImage(RImageCache[oldest_idx].image);
-      RImageCache[oldest_idx].file = malloc(strlen(file) + 1);
-      strcpy(RImageCache[oldest_idx].file, file);
-      RImageCache[oldest_idx].image = RCloneImage(image);
-      RImageCache[oldest_idx].last_modif = st.st_mtime;
-      RImageCache[oldest_idx].last_use = time(NULL);
+/*
+ * Loads the image through the cache. The returned image is shared with
+ * the cache when it could be stored there.
+ */
+static RImage *load_cached_image(RContext *context, const char *file, int index,
+                                 unsigned max_width, unsigned max_height)
+{
+  RImage *image;
+  int watch = -1;
+  unsigned long changes = 0;
+
+  assert(file != NULL);
+
+  pthread_mutex_lock(&RImageCacheLock);
+
+  if (RImageCacheSize < 0)
+    init_cache();
+
+  if (RImageCacheSize > 0) {
+    image = cache_lookup(file, index, max_width, max_height);
+    if (image) {
+      RRetainImage(image);
+      pthread_mutex_unlock(&RImageCacheLock);
+      return image;
     }
+
+    /* watch before decoding, so a change during the load is not missed */
+    watch = watch_file(file, &changes);
   }
 
+  pthread_mutex_unlock(&RImageCacheLock);
+
+  image = load_image_file(context, file, index, max_width, max_height);
+
+  pthread_mutex_lock(&RImageCacheLock);
+
+  /* store image in cache */
+  if (RImageCacheSize > 0 && image &&
+      (RImageCacheMaxImage == 0 || RImageCacheMaxImage >= image->width * image->height) &&
+      image->width * image->height * 4 <= RImageCacheMemory) {
+    cache_store(file, index, max_width, max_height, RRetainImage(image), watch, changes);
+  } else {
+    unwatch_file(watch);
+  }
+
+  pthread_mutex_unlock(&RImageCacheLock);
+
   return image;
 }
 
+RImage *RLoadImageScaled(RContext *context, const char *file, int index, unsigned max_width,
+                         unsigned max_height)
+{
+  RImage *image, *copy;
+
+  image = load_cached_image(context, file, index, max_width, max_height);
+  if (!image || __atomic_load_n(&image->refCount, __ATOMIC_ACQUIRE) == 1)
+    return image;
+
+  /* the caller may modify the image, so it can't be the cached one */
+  copy = RCloneImage(image);
+  RReleaseImage(image);
+
+  return copy;
+}
+
+RImage *RLoadImage(RContext *context, const char *file, int index)
+{
+  return RLoadImageScaled(context, file, index, 0, 0);
+}
+
+RImage *RLoadSharedImage(RContext *context, const char *file, int index)
+{
+  return load_cached_image(context, file, index, 0, 0);
+}
+
 char *RGetImageFileFormat(const char *file)
 {
   switch (identFile(file)) {
@@ -0,0 +1,395 @@
+/* load_async.c - loading of images by a pool of threads
+ *
+ * Raster graphics library
+ *
+ * Copyright (c) 2026 NEXTSPACE Team
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Library General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Library General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "config.h"
+#include "wraster.h"
+#include "imgformat.h"
+#include "parallel.h"
+
+#define MAX_LOADERS 4
+
+typedef enum {
+  RRequestQueued,
+  RRequestRunning,
+  RRequestCancelled, /* while running, the loader frees it */
+  RRequestDone,
+  RRequestDispatched /* its callback is being called */
+} RRequestState;
+
+struct RImageRequest {
+  RContext *context;
+  char *file;
+  int index;
+  unsigned max_width, max_height;
+  RImageRequestPriority priority;
+  RImageLoadedProc *proc;
+  void *data;
+
+  RRequestState state;
+  Bool deferred; /* must be loaded by the thread dispatching the result */
+  RImage *image;
+  int error;
+
+  struct RImageRequest *prev, *next;
+};
+
+typedef struct {
+  RImageRequest *head, *tail;
+} RRequestList;
+
+/*
+ * All the pool state is protected by RequestLock; the loaders wait on
+ * RequestCond for queued requests.
+ */
+static pthread_mutex_t RequestLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t RequestCond = PTHREAD_COND_INITIALIZER;
+
+static RRequestList Queued[RHighPriority + 1];
+static RRequestList Done;
+
+static pthread_t Loaders[MAX_LOADERS];
+static int LoaderCount = -1; /* -1 until started */
+static Bool Quit = False;
+
+/* written when Done becomes non-empty, drained when it becomes empty */
+static int DoneFD[2] = {-1, -1};
+
+static void append_request(RRequestList *list, RImageRequest *request)
+{
+  request->next = NULL;
+  request->prev = list->tail;
+  if (list->tail)
+    list->tail->next = request;
+  else
+    list->head = request;
+  list->tail = request;
+}
+
+static void unlink_request(RRequestList *list, RImageRequest *request)
+{
+  if (request->prev)
+    request->prev->next = request->next;
+  else
+    list->head = request->next;
+  if (request->next)
+    request->next->prev = request->prev;
+  else
+    list->tail = request->prev;
+  request->prev = request->next = NULL;
+}
+
+static void free_request(RImageRequest *request)
+{
+  if (request->image)
+    RReleaseImage(request->image);
+  free(request->file);
+  free(request);
+}
+
+static Bool open_done_fd(void)
+{
+  if (DoneFD[0] >= 0)
+    return True;
+
+  if (pipe(DoneFD) != 0) {
+    DoneFD[0] = DoneFD[1] = -1;
+    return False;
+  }
+  fcntl(DoneFD[0], F_SETFL, O_NONBLOCK);
+  fcntl(DoneFD[1], F_SETFL, O_NONBLOCK);
+  fcntl(DoneFD[0], F_SETFD, FD_CLOEXEC);
+  fcntl(DoneFD[1], F_SETFD, FD_CLOEXEC);
+
+  return True;
+}
+
+static void finish_request(RImageRequest *request)
+{
+  char byte = 0;
+
+  request->state = RRequestDone;
+  if (!Done.head && DoneFD[1] >= 0) {
+    if (write(DoneFD[1], &byte, 1) < 0) {
+      /* the pipe can't be full, there is at most one byte in it */
+    }
+  }
+  append_request(&Done, request);
+}
+
+/*
+ * Images loaded through libXpm need the display connection, which the
+ * loaders can't use: Xlib may not be initialized for threads.
+ */
+static Bool needs_display(RImageRequest *request)
+{
+#if USE_XPM
+  char *format = RGetImageFileFormat(request->file);
+
+  return (format && strcmp(format, "XPM") == 0);
+#else
+  (void)request;
+  return False;
+#endif
+}
+
+static void load_request(RImageRequest *request)
+{
+  request->image = RLoadImageScaled(request->context, request->file, request->index,
+                                    request->max_width, request->max_height);
+  request->error = request->image ? RERR_NONE : RErrorCode;
+}
+
+static RImageRequest *next_request(void)
+{
+  RImageRequest *request;
+  int priority;
+
+  for (priority = RHighPriority; priority >= RLowPriority; priority--) {
+    request = Queued[priority].head;
+    if (request) {
+      unlink_request(&Queued[priority], request);
+      return request;
+    }
+  }
+
+  return NULL;
+}
+
+static void *loader_thread(void *arg)
+{
+  RImageRequest *request;
+
+  (void)arg;
+
+  pthread_mutex_lock(&RequestLock);
+  for (;;) {
+    while (!Quit && !(request = next_request()))
+      pthread_cond_wait(&RequestCond, &RequestLock);
+    if (Quit)
+      break;
+
+    request->state = RRequestRunning;
+    pthread_mutex_unlock(&RequestLock);
+
+    request->deferred = needs_display(request);
+    if (!request->deferred)
+      load_request(request);
+
+    pthread_mutex_lock(&RequestLock);
+    if (request->state == RRequestCancelled)
+      free_request(request);
+    else
+      finish_request(request);
+  }
+  pthread_mutex_unlock(&RequestLock);
+
+  return NULL;
+}
+
+static void start_loaders(void)
+{
+  char *tmp;
+  int count;
+
+  tmp = getenv("RIMAGE_LOADERS");
+  if (!tmp || sscanf(tmp, "%i", &count) != 1) {
+    count = wraster_thread_count();
+    if (count > MAX_LOADERS)
+      count = MAX_LOADERS;
+  }
+  if (count < 0)
+    count = 0;
+  if (count > MAX_LOADERS)
+    count = MAX_LOADERS;
+
+  Quit = False;
+  for (LoaderCount = 0; LoaderCount < count; LoaderCount++) {
+    if (pthread_create(&Loaders[LoaderCount], NULL, loader_thread, NULL) != 0)
+      break;
+  }
+}
+
+RImageRequest *RLoadImageAsync(RContext *context, const char *file, int index, unsigned max_width,
+                               unsigned max_height, RImageRequestPriority priority,
+                               RImageLoadedProc *proc, void *data)
+{
+  RImageRequest *request;
+
+  if (priority < RLowPriority)
+    priority = RLowPriority;
+  if (priority > RHighPriority)
+    priority = RHighPriority;
+
+  request = calloc(1, sizeof(RImageRequest));
+  if (request)
+    request->file = strdup(file);
+  if (!request || !request->file) {
+    free(request);
+    RErrorCode = RERR_NOMEMORY;
+    return NULL;
+  }
+  request->context = context;
+  request->index = index;
+  request->max_width = max_width;
+  request->max_height = max_height;
+  request->priority = priority;
+  request->proc = proc;
+  request->data = data;
+
+  pthread_mutex_lock(&RequestLock);
+
+  if (!open_done_fd()) {
+    pthread_mutex_unlock(&RequestLock);
+    free_request(request);
+    RErrorCode = RERR_INTERNAL;
+    return NULL;
+  }
+  if (LoaderCount < 0)
+    start_loaders();
+
+  if (LoaderCount > 0) {
+    request->state = RRequestQueued;
+    append_request(&Queued[priority], request);
+    pthread_cond_signal(&RequestCond);
+  } else {
+    /* no thread could be started, the result is still delivered later */
+    request->deferred = True;
+    finish_request(request);
+  }
+
+  pthread_mutex_unlock(&RequestLock);
+
+  return request;
+}
+
+void RCancelImageRequest(RImageRequest *request)
+{
+  pthread_mutex_lock(&RequestLock);
+
+  switch (request->state) {
+    case RRequestQueued:
+      unlink_request(&Queued[request->priority], request);
+      free_request(request);
+      break;
+
+    case RRequestRunning:
+      request->state = RRequestCancelled;
+      break;
+
+    case RRequestDone:
+      unlink_request(&Done, request);
+      free_request(request);
+      break;
+
+    default:
+      break;
+  }
+
+  pthread_mutex_unlock(&RequestLock);
+}
+
+int RImageRequestFD(void)
+{
+  int fd;
+
+  pthread_mutex_lock(&RequestLock);
+  fd = open_done_fd() ? DoneFD[0] : -1;
+  pthread_mutex_unlock(&RequestLock);
+
+  return fd;
+}
+
+int RDispatchImageRequests(void)
+{
+  RImageRequest *request;
+  char buffer[16];
+  int count = 0;
+
+  pthread_mutex_lock(&RequestLock);
+  if (DoneFD[0] >= 0) {
+    while (read(DoneFD[0], buffer, sizeof(buffer)) > 0)
+      ;
+  }
+
+  while ((request = Done.head) != NULL) {
+    RImage *image;
+
+    unlink_request(&Done, request);
+    request->state = RRequestDispatched;
+    pthread_mutex_unlock(&RequestLock);
+
+    if (request->deferred)
+      load_request(request);
+
+    /* the image now belongs to the callback */
+    image = request->image;
+    request->image = NULL;
+    request->proc(request, image, request->error, request->data);
+    free_request(request);
+    count++;
+
+    pthread_mutex_lock(&RequestLock);
+  }
+  pthread_mutex_unlock(&RequestLock);
+
+  return count;
+}
+
+void RReleaseImageRequests(void)
+{
+  RImageRequest *request;
+  int i;
+
+  pthread_mutex_lock(&RequestLock);
+  Quit = True;
+  pthread_cond_broadcast(&RequestCond);
+  pthread_mutex_unlock(&RequestLock);
+
+  for (i = 0; i < LoaderCount; i++)
+    pthread_join(Loaders[i], NULL);
+  LoaderCount = -1;
+
+  /* the loaders are gone, nothing else uses the lists now */
+  for (i = RLowPriority; i <= RHighPriority; i++) {
+    while ((request = Queued[i].head) != NULL) {
+      unlink_request(&Queued[i], request);
+      free_request(request);
+    }
+  }
+  while ((request = Done.head) != NULL) {
+    unlink_request(&Done, request);
+    free_request(request);
+  }
+
+  if (DoneFD[0] >= 0) {
+    close(DoneFD[0]);
+    close(DoneFD[1]);
+  }
+  DoneFD[0] = DoneFD[1] = -1;
+}
@@ -34,6 +34,7 @@
 
 #include "wraster.h"
 #include "imgformat.h"
+#include "reduce.h"
 
 /*
  * <setjmp.h> is used for the optional error recovery mechanism shown in
@@ -69,6 +70,12 @@ struct my_error_mgr {
   struct jpeg_error_mgr pub; /* "public" fields */
 
   jmp_buf setjmp_buffer; /* for return to caller */
+
+  /* what the load has allocated so far, released on error */
+  FILE *file;
+  JSAMPROW buffer;
+  RReducer *reducer;
+  RImage *image;
 };
 
 typedef struct my_error_mgr *my_error_ptr;
@@ -90,65 +97,123 @@ static noreturn void my_error_exit(j_common_ptr cinfo)
   longjmp(myerr->setjmp_buffer, 1);
 }
 
-static RImage *do_read_jpeg_file(struct jpeg_decompress_struct *cinfo, const char *file_name)
+/*
+ * Picks the largest DCT scaling that keeps the output at least as large
+ * as the requested size; decoding at 1/2, 1/4 or 1/8 is much faster and
+ * the rest of the reduction is done by box filtering.
+ */
+static void set_jpeg_scale(struct jpeg_decompress_struct *cinfo, unsigned width, unsigned height)
+{
+  unsigned denom;
+
+  for (denom = 8; denom > 1; denom /= 2) {
+    if ((cinfo->image_width + denom - 1) / denom >= width &&
+        (cinfo->image_height + denom - 1) / denom >= height)
+      break;
+  }
+  cinfo->scale_num = 1;
+  cinfo->scale_denom = denom;
+}
+
+static void release_resources(struct jpeg_decompress_struct *cinfo)
+{
+  my_error_ptr myerr = (my_error_ptr)cinfo->err;
+
+  jpeg_destroy_decompress(cinfo);
+  if (myerr->file)
+    fclose(myerr->file);
+  if (myerr->buffer)
+    free(myerr->buffer);
+  if (myerr->reducer)
+    wraster_reducer_free(myerr->reducer);
+  myerr->file = NULL;
+  myerr->buffer = NULL;
+  myerr->reducer = NULL;
+}
+
+static RImage *do_read_jpeg_file(struct jpeg_decompress_struct *cinfo, const char *file_name,
+                                 unsigned max_width, unsigned max_height)
 {
-  RImage *image = NULL;
+  /* the resources are kept in the error manager, for RLoadJPEG() to
+     release them if libjpeg fails */
+  my_error_ptr res = (my_error_ptr)cinfo->err;
+  RImage *image;
+  unsigned width, height;
   int i;
   unsigned char *ptr;
-  JSAMPROW buffer[1], bptr;
-  FILE *file;
+  JSAMPROW bptr;
 
-  file = fopen(file_name, "rb");
-  if (!file) {
+  res->file = fopen(file_name, "rb");
+  if (!res->file) {
     RErrorCode = RERR_OPEN;
     return NULL;
   }
 
   jpeg_create_decompress(cinfo);
-  jpeg_stdio_src(cinfo, file);
+  jpeg_stdio_src(cinfo, res->file);
   jpeg_read_header(cinfo, TRUE);
 
   if (cinfo->image_width < 1 || cinfo->image_height < 1) {
-    buffer[0] = NULL; /* Initialize pointer to avoid spurious free in cleanup code */
     RErrorCode = RERR_BADIMAGEFILE;
     goto abort_and_release_resources;
   }
 
-  buffer[0] = (JSAMPROW)malloc(cinfo->image_width * cinfo->num_components);
-  if (!buffer[0]) {
-    RErrorCode = RERR_NOMEMORY;
-    goto abort_and_release_resources;
-  }
-
   if (cinfo->jpeg_color_space == JCS_GRAYSCALE)
     cinfo->out_color_space = JCS_GRAYSCALE;
   else
     cinfo->out_color_space = JCS_RGB;
 
+  wraster_fit_size(cinfo->image_width, cinfo->image_height, max_width, max_height, &width,
+                   &height);
+  if (width != cinfo->image_width || height != cinfo->image_height)
+    set_jpeg_scale(cinfo, width, height);
+
   cinfo->quantize_colors = FALSE;
   cinfo->do_fancy_upsampling = FALSE;
   cinfo->do_block_smoothing = FALSE;
   jpeg_calc_output_dimensions(cinfo);
-  image = RCreateImage(cinfo->image_width, cinfo->image_height, False);
-  if (!image) {
+
+  res->buffer = (JSAMPROW)malloc(cinfo->output_width * cinfo->output_components);
+  if (!res->buffer) {
     RErrorCode = RERR_NOMEMORY;
     goto abort_and_release_resources;
   }
 
+  if (width < cinfo->output_width || height < cinfo->output_height) {
+    res->reducer = wraster_reducer_create(cinfo->output_width, cinfo->output_height, width,
+                                          height, cinfo->output_components);
+    if (!res->reducer)
+      goto abort_and_release_resources;
+  } else {
+    res->image = RCreateImage(cinfo->output_width, cinfo->output_height, False);
+    if (!res->image) {
+      RErrorCode = RERR_NOMEMORY;
+      goto abort_and_release_resources;
+    }
+  }
+
   jpeg_start_decompress(cinfo);
-  ptr = image->data;
-  if (cinfo->out_color_space == JCS_RGB) {
+  if (res->reducer) {
     while (cinfo->output_scanline < cinfo->output_height) {
-      jpeg_read_scanlines(cinfo, buffer, (JDIMENSION)1);
-      bptr = buffer[0];
-      memcpy(ptr, bptr, cinfo->image_width * 3);
-      ptr += cinfo->image_width * 3;
+      jpeg_read_scanlines(cinfo, &res->buffer, (JDIMENSION)1);
+      wraster_reducer_add_row(res->reducer, res->buffer);
+    }
+    res->image = wraster_reducer_finish(res->reducer);
+    res->reducer = NULL;
+  } else if (cinfo->out_color_space == JCS_RGB) {
+    ptr = res->image->data;
+    while (cinfo->output_scanline < cinfo->output_height) {
+      jpeg_read_scanlines(cinfo, &res->buffer, (JDIMENSION)1);
+      bptr = res->buffer;
+      memcpy(ptr, bptr, cinfo->output_width * 3);
+      ptr += cinfo->output_width * 3;
     }
   } else {
+    ptr = res->image->data;
     while (cinfo->output_scanline < cinfo->output_height) {
-      jpeg_read_scanlines(cinfo, buffer, (JDIMENSION)1);
-      bptr = buffer[0];
-      for (i = 0; i < cinfo->image_width; i++) {
+      jpeg_read_scanlines(cinfo, &res->buffer, (JDIMENSION)1);
+      bptr = res->buffer;
+      for (i = 0; i < cinfo->output_width; i++) {
         *ptr++ = *bptr;
         *ptr++ = *bptr;
         *ptr++ = *bptr++;
@@ -159,15 +224,14 @@ static RImage *do_read_jpeg_file(struct jpeg_decompress_struct *cinfo, const cha
   jpeg_finish_decompress(cinfo);
 
 abort_and_release_resources:
-  jpeg_destroy_decompress(cinfo);
-  fclose(file);
-  if (buffer[0])
-    free(buffer[0]);
+  release_resources(cinfo);
+  image = res->image;
+  res->image = NULL;
 
   return image;
 }
 
-RImage *RLoadJPEG(const char *file_name)
+RImage *RLoadJPEG(const char *file_name, unsigned max_width, unsigned max_height)
 {
   struct jpeg_decompress_struct cinfo;
   /* We use our private extension JPEG error handler.
@@ -178,14 +242,20 @@ RImage *RLoadJPEG(const char *file_name)
 
   cinfo.err = jpeg_std_error(&jerr.pub);
   jerr.pub.error_exit = my_error_exit;
+  jerr.file = NULL;
+  jerr.buffer = NULL;
+  jerr.reducer = NULL;
+  jerr.image = NULL;
   /* Establish the setjmp return context for my_error_exit to use. */
   if (setjmp(jerr.setjmp_buffer)) {
     /*
      * If we get here, the JPEG code has signaled an error.
      * We need to clean up the JPEG object, close the input file, and return.
      */
-    jpeg_destroy_decompress(&cinfo);
+    release_resources(&cinfo);
+    if (jerr.image)
+      RReleaseImage(jerr.image);
     return NULL;
   }
-  return do_read_jpeg_file(&cinfo, file_name);
+  return do_read_jpeg_file(&cinfo, file_name, max_width, max_height);
 }
\ No newline at end of file
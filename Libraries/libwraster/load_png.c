@@ -28,11 +28,17 @@
 
 #include "wraster.h"
 #include "imgformat.h"
+#include "reduce.h"
 
-RImage *RLoadPNG(RContext *context, const char *file)
+RImage *RLoadPNG(RContext *context, const char *file, unsigned max_width, unsigned max_height)
 {
   char *tmp;
-  RImage *image = NULL;
+  /* volatile: changed after setjmp() and used when libpng longjmps back */
+  RImage *volatile image = NULL;
+  RReducer *volatile reducer = NULL;
+  png_bytep volatile row = NULL;
+  png_bytep *volatile png_rows = NULL;
+  unsigned new_width, new_height;
   FILE *f;
   png_structp png;
   png_infop pinfo, einfo;
@@ -41,8 +47,7 @@ RImage *RLoadPNG(RContext *context, const char *file)
   int x, y, i;
   double gamma, sgamma;
   png_uint_32 width, height;
-  int depth, junk, color_type;
-  png_bytep *png_rows;
+  int depth, junk, color_type, interlace;
   unsigned char *ptr;
 
   f = fopen(file, "rb");
@@ -84,6 +89,15 @@ RImage *RLoadPNG(RContext *context, const char *file)
     png_destroy_read_struct(&png, &pinfo, &einfo);
     if (image)
       RReleaseImage(image);
+    if (reducer)
+      wraster_reducer_free(reducer);
+    if (row)
+      free(row);
+    if (png_rows) {
+      for (y = 0; y < height; y++)
+        free(png_rows[y]);
+      free(png_rows);
+    }
     return NULL;
   }
 
@@ -91,7 +105,7 @@ RImage *RLoadPNG(RContext *context, const char *file)
 
   png_read_info(png, pinfo);
 
-  png_get_IHDR(png, pinfo, &width, &height, &depth, &color_type, &junk, &junk, &junk);
+  png_get_IHDR(png, pinfo, &width, &height, &depth, &color_type, &interlace, &junk, &junk);
 
   /* sanity check */
   if (width < 1 || height < 1) {
@@ -107,12 +121,27 @@ RImage *RLoadPNG(RContext *context, const char *file)
   else
     alpha = (color_type & PNG_COLOR_MASK_ALPHA);
 
-  /* allocate RImage */
-  image = RCreateImage(width, height, alpha);
-  if (!image) {
-    fclose(f);
-    png_destroy_read_struct(&png, &pinfo, &einfo);
-    return NULL;
+  wraster_fit_size(width, height, max_width, max_height, &new_width, &new_height);
+
+  /*
+   * Non-interlaced images are reduced row by row while they are read;
+   * interlaced ones must be read entirely first.
+   */
+  if ((new_width != width || new_height != height) && interlace == PNG_INTERLACE_NONE) {
+    reducer = wraster_reducer_create(width, height, new_width, new_height, alpha ? 4 : 3);
+    if (!reducer) {
+      fclose(f);
+      png_destroy_read_struct(&png, &pinfo, &einfo);
+      return NULL;
+    }
+  } else {
+    /* allocate RImage */
+    image = RCreateImage(width, height, alpha);
+    if (!image) {
+      fclose(f);
+      png_destroy_read_struct(&png, &pinfo, &einfo);
+      return NULL;
+    }
   }
 
   /* normalize to 8bpp with alpha channel */
@@ -154,6 +183,25 @@ RImage *RLoadPNG(RContext *context, const char *file)
   /* do the transforms */
   png_read_update_info(png, pinfo);
 
+  if (reducer) {
+    row = malloc(png_get_rowbytes(png, pinfo));
+    if (!row) {
+      RErrorCode = RERR_NOMEMORY;
+      fclose(f);
+      wraster_reducer_free(reducer);
+      png_destroy_read_struct(&png, &pinfo, &einfo);
+      return NULL;
+    }
+    for (y = 0; y < height; y++) {
+      png_read_row(png, row, NULL);
+      wraster_reducer_add_row(reducer, row);
+    }
+    free(row);
+    row = NULL;
+    image = wraster_reducer_finish(reducer);
+    reducer = NULL;
+  }
+
   /* set background color */
   if (png_get_bKGD(png, pinfo, &bkcolor)) {
     image->background.red = bkcolor->red >> 8;
@@ -161,6 +209,13 @@ RImage *RLoadPNG(RContext *context, const char *file)
     image->background.blue = bkcolor->blue >> 8;
   }
 
+  if (image->width != width || image->height != height) {
+    png_read_end(png, einfo);
+    png_destroy_read_struct(&png, &pinfo, &einfo);
+    fclose(f);
+    return image;
+  }
+
   png_rows = calloc(height, sizeof(png_bytep));
   if (!png_rows) {
     RErrorCode = RERR_NOMEMORY;
@@ -212,5 +267,16 @@ RImage *RLoadPNG(RContext *context, const char *file)
     if (png_rows[y])
       free(png_rows[y]);
   free(png_rows);
+
+  if (new_width != width || new_height != height) {
+    /* interlaced image */
+    RImage *reduced = wraster_reduce_image(image, new_width, new_height);
+
+    if (reduced)
+      reduced->background = image->background;
+    RReleaseImage(image);
+    image = reduced;
+  }
+
   return image;
 }
@@ -29,6 +29,7 @@
 
 #include "wraster.h"
 #include "imgformat.h"
+#include "reduce.h"
 #include "wr_i18n.h"
 
 /*
@@ -47,7 +48,7 @@ static const char *webp_message_from_status(VP8StatusCode status)
       [VP8_STATUS_SUSPENDED] = N_("operation suspended"),
       [VP8_STATUS_USER_ABORT] = N_("aborted by user"),
       [VP8_STATUS_NOT_ENOUGH_DATA] = N_("not enough data")};
-  static char custom_message[128];
+  static __thread char custom_message[128];
 
   if (status >= 0 && status < sizeof(known_message) / sizeof(known_message[0]))
     if (known_message[status] != NULL)
@@ -57,17 +58,17 @@ static const char *webp_message_from_status(VP8StatusCode status)
   return custom_message;
 }
 
-RImage *RLoadWEBP(const char *file_name)
+RImage *RLoadWEBP(const char *file_name, unsigned max_width, unsigned max_height)
 {
   FILE *file;
   RImage *image = NULL;
   char buffer[20];
   int raw_data_size;
-  int r;
+  int r, bpp;
+  unsigned width, height;
   uint8_t *raw_data;
   VP8StatusCode status;
-  WebPBitstreamFeatures features;
-  uint8_t *ret = NULL;
+  WebPDecoderConfig config;
 
   file = fopen(file_name, "rb");
   if (!file) {
@@ -123,7 +124,13 @@ RImage *RLoadWEBP(const char *file_name)
     return NULL;
   }
 
-  status = WebPGetFeatures(raw_data, raw_data_size, &features);
+  if (!WebPInitDecoderConfig(&config)) {
+    RErrorCode = RERR_INTERNAL;
+    free(raw_data);
+    return NULL;
+  }
+
+  status = WebPGetFeatures(raw_data, raw_data_size, &config.input);
   if (status != VP8_STATUS_OK) {
     fprintf(stderr, _("wrlib: could not get features from WebP file \"%s\", %s\n"), file_name,
             webp_message_from_status(status));
@@ -132,30 +139,37 @@ RImage *RLoadWEBP(const char *file_name)
     return NULL;
   }
 
-  if (features.has_alpha) {
-    image = RCreateImage(features.width, features.height, True);
-    if (!image) {
-      RErrorCode = RERR_NOMEMORY;
-      free(raw_data);
-      return NULL;
-    }
-    ret = WebPDecodeRGBAInto(raw_data, raw_data_size, image->data,
-                             features.width * features.height * 4, features.width * 4);
-  } else {
-    image = RCreateImage(features.width, features.height, False);
-    if (!image) {
-      RErrorCode = RERR_NOMEMORY;
-      free(raw_data);
-      return NULL;
-    }
-    ret = WebPDecodeRGBInto(raw_data, raw_data_size, image->data,
-                            features.width * features.height * 3, features.width * 3);
+  /* let the decoder scale down, so the full size image is never allocated */
+  wraster_fit_size(config.input.width, config.input.height, max_width, max_height, &width,
+                   &height);
+  if (width != (unsigned)config.input.width || height != (unsigned)config.input.height) {
+    config.options.use_scaling = 1;
+    config.options.scaled_width = width;
+    config.options.scaled_height = height;
   }
 
+  image = RCreateImage(width, height, config.input.has_alpha);
+  if (!image) {
+    RErrorCode = RERR_NOMEMORY;
+    free(raw_data);
+    return NULL;
+  }
+
+  bpp = config.input.has_alpha ? 4 : 3;
+  config.output.colorspace = config.input.has_alpha ? MODE_RGBA : MODE_RGB;
+  config.output.is_external_memory = 1;
+  config.output.u.RGBA.rgba = image->data;
+  config.output.u.RGBA.stride = width * bpp;
+  config.output.u.RGBA.size = width * height * bpp;
+
+  status = WebPDecode(raw_data, raw_data_size, &config);
+  WebPFreeDecBuffer(&config.output);
+
   free(raw_data);
 
-  if (!ret) {
-    fprintf(stderr, _("wrlib: failed to decode WebP from file \"%s\"\n"), file_name);
+  if (status != VP8_STATUS_OK) {
+    fprintf(stderr, _("wrlib: failed to decode WebP from file \"%s\", %s\n"), file_name,
+            webp_message_from_status(status));
     RErrorCode = RERR_BADIMAGEFILE;
     RReleaseImage(image);
     return NULL;
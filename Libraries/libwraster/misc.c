@@ -26,6 +26,8 @@
 #include "wraster.h"
 #include "imgformat.h"
 #include "convert.h"
+#include "scale.h"
+#include "gradient.h"
 #include "wr_i18n.h"
 
 void RBevelImage(RImage *image, int bevel_type)
@@ -271,6 +273,10 @@ void RShutdown(void)
 #ifdef USE_MAGICK
   RReleaseMagick();
 #endif
+  /* stop the loaders first, they use the cache */
+  RReleaseImageRequests();
   RReleaseCache();
   r_destroy_conversion_tables();
+  wraster_release_scale_tables();
+  wraster_release_gradient_cache();
 }
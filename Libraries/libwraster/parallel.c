@@ -0,0 +1,113 @@
+/* parallel.c - band-parallel execution of image operations
+ *
+ * Raster graphics library
+ *
+ * Copyright (c) 2026 NEXTSPACE Team
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Library General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Library General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "parallel.h"
+
+#define MAX_THREADS 8
+
+typedef struct {
+  RBandProc proc;
+  void *data;
+  int first, last;
+} RBand;
+
+int wraster_thread_count(void)
+{
+  static int count = 0;
+  char *tmp;
+  long n;
+
+  if (count > 0)
+    return count;
+
+  tmp = getenv("WRASTER_THREADS");
+  if (!tmp || sscanf(tmp, "%li", &n) != 1) {
+    n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n > MAX_THREADS)
+      n = MAX_THREADS;
+  }
+  if (n < 1)
+    n = 1;
+  if (n > 4 * MAX_THREADS)
+    n = 4 * MAX_THREADS;
+
+  count = (int)n;
+
+  return count;
+}
+
+static void *run_band(void *arg)
+{
+  RBand *band = arg;
+
+  band->proc(band->data, band->first, band->last);
+
+  return NULL;
+}
+
+void wraster_run_bands(int count, int grain, RBandProc proc, void *data)
+{
+  RBand bands[4 * MAX_THREADS];
+  pthread_t threads[4 * MAX_THREADS];
+  int started[4 * MAX_THREADS];
+  int nbands, i, size;
+
+  if (count <= 0)
+    return;
+  if (grain < 1)
+    grain = 1;
+
+  nbands = count / grain;
+  if (nbands > wraster_thread_count())
+    nbands = wraster_thread_count();
+
+  if (nbands <= 1) {
+    proc(data, 0, count);
+    return;
+  }
+
+  size = count / nbands;
+  for (i = 0; i < nbands; i++) {
+    bands[i].proc = proc;
+    bands[i].data = data;
+    bands[i].first = i * size;
+    bands[i].last = (i == nbands - 1) ? count : (i + 1) * size;
+  }
+
+  /* band 0 is done by the caller, or any band a thread could not be started for */
+  for (i = 1; i < nbands; i++)
+    started[i] = (pthread_create(&threads[i], NULL, run_band, &bands[i]) == 0);
+
+  run_band(&bands[0]);
+
+  for (i = 1; i < nbands; i++) {
+    if (started[i])
+      pthread_join(threads[i], NULL);
+    else
+      run_band(&bands[i]);
+  }
+}
@@ -0,0 +1,51 @@
+/*
+ * Raster graphics library
+ *
+ * Copyright (c) 2026 NEXTSPACE Team
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Library General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Library General Public
+ *  License along with this library.
+ */
+
+/*
+ * Splitting of large image operations in bands processed by several
+ * threads.
+ *
+ * The functions here are for WRaster library's internal use only,
+ * Please use functions in 'wraster.h' in applications
+ */
+
+#ifndef __WRASTER_PARALLEL_H__
+#define __WRASTER_PARALLEL_H__
+
+/*
+ * Processes the items [first, last) of a band
+ */
+typedef void (*RBandProc)(void *data, int first, int last);
+
+/*
+ * Returns the max. number of threads used for an operation: the number
+ * of online CPUs (at most 8), or the value of WRASTER_THREADS.
+ */
+int wraster_thread_count(void);
+
+/*
+ * Splits [0, count) in consecutive bands of at least 'grain' items and
+ * runs 'proc' on them, using the calling thread and up to
+ * wraster_thread_count() - 1 helper threads. Returns when all the bands
+ * are done. The bands must not write to shared data, so the result is
+ * the same whatever the number of threads.
+ */
+void wraster_run_bands(int count, int grain, RBandProc proc, void *data);
+
+#endif
@@ -27,10 +27,11 @@
 #include <assert.h>
 
 #include "wraster.h"
+#include "alpha_combine.h"
 
 char *WRasterLibVersion = "0.9";
 
-int RErrorCode = RERR_NONE;
+__thread int RErrorCode = RERR_NONE;
 
 #define HAS_ALPHA(I) ((I)->format == RRGBAFormat)
 
@@ -76,8 +77,9 @@ RImage *RCreateImage(unsigned width, unsigned height, int alpha)
 
 RImage *RRetainImage(RImage *image)
 {
+  /* images may be shared between threads through the image cache */
   if (image)
-    image->refCount++;
+    __atomic_add_fetch(&image->refCount, 1, __ATOMIC_RELAXED);
 
   return image;
 }
@@ -86,14 +88,27 @@ void RReleaseImage(RImage *image)
 {
   assert(image != NULL);
 
-  image->refCount--;
-
-  if (image->refCount < 1) {
+  if (__atomic_sub_fetch(&image->refCount, 1, __ATOMIC_ACQ_REL) < 1) {
     free(image->data);
     free(image);
   }
 }
 
+RImage *RGetWritableImage(RImage *image)
+{
+  RImage *copy;
+
+  assert(image != NULL);
+
+  if (__atomic_load_n(&image->refCount, __ATOMIC_ACQUIRE) == 1)
+    return image;
+
+  copy = RCloneImage(image);
+  RReleaseImage(image);
+
+  return copy;
+}
+
 RImage *RCloneImage(RImage *image)
 {
   RImage *new_image;
@@ -175,29 +190,14 @@ void RCombineImages(RImage *image, RImage *src)
       }
     }
   } else {
-    register int i;
     unsigned char *d;
     unsigned char *s;
-    int alpha, calpha;
 
     d = image->data;
     s = src->data;
 
     if (!HAS_ALPHA(image)) {
-      for (i = 0; i < image->height * image->width; i++) {
-        alpha = *(s + 3);
-        calpha = 255 - alpha;
-        *d = (((int)*d * calpha) + ((int)*s * alpha)) / 256;
-        d++;
-        s++;
-        *d = (((int)*d * calpha) + ((int)*s * alpha)) / 256;
-        d++;
-        s++;
-        *d = (((int)*d * calpha) + ((int)*s * alpha)) / 256;
-        d++;
-        s++;
-        s++;
-      }
+      wraster_combine_alpha_rgb(d, s, image->width, image->height, 0, 0, 256);
     } else {
       RCombineAlpha(d, s, 1, image->width, image->height, 0, 0, 255);
     }
@@ -239,22 +239,8 @@ void RCombineImagesWithOpaqueness(RImage *image, RImage *src, int opaqueness)
       RCombineAlpha(d, s, 0, image->width, image->height, 0, 0, OP);
     }
   } else {
-    int tmp;
-
     if (!HAS_ALPHA(image)) {
-      for (i = 0; i < image->width * image->height; i++) {
-        tmp = (*(s + 3) * opaqueness) / 256;
-        *d = (((int)*d * (255 - tmp)) + ((int)*s * tmp)) / 256;
-        d++;
-        s++;
-        *d = (((int)*d * (255 - tmp)) + ((int)*s * tmp)) / 256;
-        d++;
-        s++;
-        *d = (((int)*d * (255 - tmp)) + ((int)*s * tmp)) / 256;
-        d++;
-        s++;
-        s++;
-      }
+      wraster_combine_alpha_rgb(d, s, image->width, image->height, 0, 0, opaqueness);
     } else {
       RCombineAlpha(d, s, 1, image->width, image->height, 0, 0, opaqueness);
     }
@@ -303,7 +289,6 @@ void RCombineArea(RImage *image, RImage *src, int sx, int sy, unsigned width, un
   int x, y, dwi, swi;
   unsigned char *d;
   unsigned char *s;
-  int alpha, calpha;
 
   if (!calculateCombineArea(image, &sx, &sy, &width, &height, &dx, &dy))
     return;
@@ -353,24 +338,7 @@ void RCombineArea(RImage *image, RImage *src, int sx, int sy, unsigned width, un
     }
 
     if (!dalpha) {
-      for (y = 0; y < height; y++) {
-        for (x = 0; x < width; x++) {
-          alpha = *(s + 3);
-          calpha = 255 - alpha;
-          *d = (((int)*d * calpha) + ((int)*s * alpha)) / 256;
-          s++;
-          d++;
-          *d = (((int)*d * calpha) + ((int)*s * alpha)) / 256;
-          s++;
-          d++;
-          *d = (((int)*d * calpha) + ((int)*s * alpha)) / 256;
-          s++;
-          d++;
-          s++;
-        }
-        d += dwi;
-        s += swi;
-      }
+      wraster_combine_alpha_rgb(d, s, width, height, dwi, swi, 256);
     } else {
       RCombineAlpha(d, s, 1, width, height, dwi, swi, 255);
     }
@@ -496,29 +464,11 @@ void RCombineAreaWithOpaqueness(RImage *image, RImage *src, int sx, int sy, unsi
       RCombineAlpha(d, s, 0, width, height, dwi, swi, OP);
     }
   } else {
-    int tmp;
-
     s = src->data + (sy * src->width + sx) * 4;
     swi = (src->width - width) * 4;
 
     if (!dalpha) {
-      for (y = 0; y < height; y++) {
-        for (x = 0; x < width; x++) {
-          tmp = (*(s + 3) * opaqueness) / 256;
-          *d = (((int)*d * (255 - tmp)) + ((int)*s * tmp)) / 256;
-          d++;
-          s++;
-          *d = (((int)*d * (255 - tmp)) + ((int)*s * tmp)) / 256;
-          d++;
-          s++;
-          *d = (((int)*d * (255 - tmp)) + ((int)*s * tmp)) / 256;
-          d++;
-          s++;
-          s++;
-        }
-        d += dwi;
-        s += swi;
-      }
+      wraster_combine_alpha_rgb(d, s, width, height, dwi, swi, opaqueness);
     } else {
       RCombineAlpha(d, s, 1, width, height, dwi, swi, OP);
     }
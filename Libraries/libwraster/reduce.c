@@ -0,0 +1,257 @@
+/* reduce.c - box downsampling of images while they are decoded
+ *
+ * Raster graphics library
+ *
+ * Copyright (c) 2026 NEXTSPACE Team
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Library General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Library General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "wraster.h"
+#include "reduce.h"
+
+/*
+ * Every destination pixel is the average of a box of source pixels. The
+ * boxes of a row are accumulated while the source rows come in and the
+ * destination row is written when its last source row was added.
+ */
+struct RReducer {
+  RImage *image;
+  unsigned src_width, src_height;
+  int channels;
+
+  unsigned y;         /* next source row */
+  unsigned dst_y;     /* destination row being accumulated */
+  unsigned row_start; /* first source row of dst_y */
+  unsigned row_end;   /* first source row of dst_y + 1 */
+
+  unsigned *column; /* destination column of every source column */
+  unsigned *span;   /* number of source columns of every destination column */
+  uint64_t *sums;   /* 4 accumulators per destination column */
+};
+
+void wraster_fit_size(unsigned width, unsigned height, unsigned max_width, unsigned max_height,
+                      unsigned *new_width, unsigned *new_height)
+{
+  uint64_t w, h;
+
+  if (max_width == 0 || max_width > width)
+    max_width = width;
+  if (max_height == 0 || max_height > height)
+    max_height = height;
+
+  if (max_width == width && max_height == height) {
+    *new_width = width;
+    *new_height = height;
+    return;
+  }
+
+  if ((uint64_t)width * max_height > (uint64_t)height * max_width) {
+    w = max_width;
+    h = ((uint64_t)height * max_width + width / 2) / width;
+  } else {
+    h = max_height;
+    w = ((uint64_t)width * max_height + height / 2) / height;
+  }
+
+  *new_width = (w > 0) ? w : 1;
+  *new_height = (h > 0) ? h : 1;
+}
+
+RReducer *wraster_reducer_create(unsigned src_width, unsigned src_height, unsigned width,
+                                 unsigned height, int channels)
+{
+  RReducer *reducer;
+  unsigned x, sx, end;
+
+  if (width > src_width)
+    width = src_width;
+  if (height > src_height)
+    height = src_height;
+
+  reducer = calloc(1, sizeof(RReducer));
+  if (!reducer) {
+    RErrorCode = RERR_NOMEMORY;
+    return NULL;
+  }
+
+  reducer->image = RCreateImage(width, height, channels == 4);
+  reducer->column = malloc(src_width * sizeof(unsigned));
+  reducer->span = malloc(width * sizeof(unsigned));
+  reducer->sums = calloc(width * 4, sizeof(uint64_t));
+  if (!reducer->image || !reducer->column || !reducer->span || !reducer->sums) {
+    wraster_reducer_free(reducer);
+    RErrorCode = RERR_NOMEMORY;
+    return NULL;
+  }
+
+  reducer->src_width = src_width;
+  reducer->src_height = src_height;
+  reducer->channels = channels;
+  reducer->row_end = src_height / height;
+
+  for (x = 0, sx = 0; x < width; x++) {
+    end = (uint64_t)(x + 1) * src_width / width;
+    reducer->span[x] = end - sx;
+    for (; sx < end; sx++)
+      reducer->column[sx] = x;
+  }
+
+  return reducer;
+}
+
+static void write_row(RReducer *reducer)
+{
+  RImage *image = reducer->image;
+  unsigned rows = reducer->y - reducer->row_start;
+  uint64_t *sums = reducer->sums;
+  unsigned char *ptr;
+  uint64_t area;
+  unsigned x;
+
+  if (image->format == RRGBAFormat) {
+    ptr = image->data + reducer->dst_y * image->width * 4;
+    for (x = 0; x < image->width; x++, sums += 4) {
+      uint64_t a = sums[3];
+
+      area = (uint64_t)reducer->span[x] * rows;
+      if (a == 0) {
+        ptr[0] = ptr[1] = ptr[2] = 0;
+      } else {
+        /* the colors are weighted by alpha, transparent pixels don't count */
+        ptr[0] = (sums[0] + a / 2) / a;
+        ptr[1] = (sums[1] + a / 2) / a;
+        ptr[2] = (sums[2] + a / 2) / a;
+      }
+      ptr[3] = (a + area / 2) / area;
+      ptr += 4;
+    }
+  } else if (reducer->channels == 1) {
+    ptr = image->data + reducer->dst_y * image->width * 3;
+    for (x = 0; x < image->width; x++, sums += 4) {
+      area = (uint64_t)reducer->span[x] * rows;
+      ptr[0] = ptr[1] = ptr[2] = (sums[0] + area / 2) / area;
+      ptr += 3;
+    }
+  } else {
+    ptr = image->data + reducer->dst_y * image->width * 3;
+    for (x = 0; x < image->width; x++, sums += 4) {
+      area = (uint64_t)reducer->span[x] * rows;
+      ptr[0] = (sums[0] + area / 2) / area;
+      ptr[1] = (sums[1] + area / 2) / area;
+      ptr[2] = (sums[2] + area / 2) / area;
+      ptr += 3;
+    }
+  }
+
+  memset(reducer->sums, 0, image->width * 4 * sizeof(uint64_t));
+  reducer->dst_y++;
+  reducer->row_start = reducer->y;
+  reducer->row_end = (uint64_t)(reducer->dst_y + 1) * reducer->src_height / image->height;
+}
+
+void wraster_reducer_add_row(RReducer *reducer, const unsigned char *row)
+{
+  const unsigned *column = reducer->column;
+  uint64_t *sums = reducer->sums;
+  unsigned x;
+
+  if (reducer->y >= reducer->src_height)
+    return;
+
+  switch (reducer->channels) {
+    case 1:
+      for (x = 0; x < reducer->src_width; x++)
+        sums[column[x] * 4] += row[x];
+      break;
+
+    case 3:
+      for (x = 0; x < reducer->src_width; x++, row += 3) {
+        uint64_t *s = sums + column[x] * 4;
+
+        s[0] += row[0];
+        s[1] += row[1];
+        s[2] += row[2];
+      }
+      break;
+
+    default:
+      for (x = 0; x < reducer->src_width; x++, row += 4) {
+        uint64_t *s = sums + column[x] * 4;
+        unsigned a = row[3];
+
+        s[0] += row[0] * a;
+        s[1] += row[1] * a;
+        s[2] += row[2] * a;
+        s[3] += a;
+      }
+      break;
+  }
+
+  reducer->y++;
+  if (reducer->y == reducer->row_end)
+    write_row(reducer);
+}
+
+RImage *wraster_reducer_finish(RReducer *reducer)
+{
+  RImage *image = reducer->image;
+  int bpp = (image->format == RRGBAFormat) ? 4 : 3;
+
+  if (reducer->dst_y < image->height) {
+    /* truncated image: use what we got for the current row, clear the others */
+    if (reducer->y > reducer->row_start)
+      write_row(reducer);
+    if (reducer->dst_y < image->height)
+      memset(image->data + reducer->dst_y * image->width * bpp, 0,
+             (image->height - reducer->dst_y) * image->width * bpp);
+  }
+
+  reducer->image = NULL;
+  wraster_reducer_free(reducer);
+
+  return image;
+}
+
+void wraster_reducer_free(RReducer *reducer)
+{
+  if (reducer->image)
+    RReleaseImage(reducer->image);
+  free(reducer->column);
+  free(reducer->span);
+  free(reducer->sums);
+  free(reducer);
+}
+
+RImage *wraster_reduce_image(RImage *image, unsigned width, unsigned height)
+{
+  RReducer *reducer;
+  int channels = (image->format == RRGBAFormat) ? 4 : 3;
+  unsigned y;
+
+  reducer = wraster_reducer_create(image->width, image->height, width, height, channels);
+  if (!reducer)
+    return NULL;
+
+  for (y = 0; y < image->height; y++)
+    wraster_reducer_add_row(reducer, image->data + y * image->width * channels);
+
+  return wraster_reducer_finish(reducer);
+}
@@ -0,0 +1,72 @@
+/*
+ * Raster graphics library
+ *
+ * Copyright (c) 2026 NEXTSPACE Team
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Library General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Library General Public
+ *  License along with this library.
+ */
+
+/*
+ * Box downsampling of images while they are decoded, so the loaders only
+ * need memory for one source row and for the reduced image.
+ *
+ * The functions here are for WRaster library's internal use only,
+ * Please use functions in 'wraster.h' in applications
+ */
+
+#ifndef __WRASTER_REDUCE_H__
+#define __WRASTER_REDUCE_H__
+
+typedef struct RReducer RReducer;
+
+/*
+ * Computes the size of a 'width'x'height' image scaled down to fit in
+ * 'max_width'x'max_height', keeping the aspect ratio. A max. of 0 means
+ * no limit for that dimension. Images are never enlarged.
+ */
+void wraster_fit_size(unsigned width, unsigned height, unsigned max_width, unsigned max_height,
+                      unsigned *new_width, unsigned *new_height);
+
+/*
+ * Creates a reducer from 'src_width'x'src_height' to the smaller or equal
+ * 'width'x'height'. The source rows have 'channels' bytes per pixel:
+ * 1 (gray), 3 (RGB) or 4 (RGBA, the result then has an alpha channel).
+ * Returns NULL and sets RErrorCode if there is not enough memory.
+ */
+RReducer *wraster_reducer_create(unsigned src_width, unsigned src_height, unsigned width,
+                                 unsigned height, int channels);
+
+/*
+ * Adds the next source row. Rows past 'src_height' are ignored.
+ */
+void wraster_reducer_add_row(RReducer *reducer, const unsigned char *row);
+
+/*
+ * Frees the reducer and returns the reduced image. The rows that were not
+ * added (truncated file) are left black.
+ */
+RImage *wraster_reducer_finish(RReducer *reducer);
+
+/*
+ * Frees the reducer and its image, when the load failed.
+ */
+void wraster_reducer_free(RReducer *reducer);
+
+/*
+ * Returns a box-filtered copy of 'image' with the given smaller or equal
+ * size, or NULL if there is not enough memory.
+ */
+RImage *wraster_reduce_image(RImage *image, unsigned width, unsigned height);
+
+#endif
@@ -23,403 +23,770 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#include <stddef.h>
 #include <math.h>
 
 #include <X11/Xlib.h>
 
 #include "wraster.h"
 #include "rotate.h"
+#include "cpu.h"
+#include "parallel.h"
+
+#ifdef WRASTER_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/*
+ * Angle steps below this value would represent a rotation
+ * of less than 1 pixel for a 4k wide image, so not worth
+ * bothering the difference. That makes it a perfect
+ * candidate for an Epsilon when trying to compare angle
+ * to known values
+ */
+static const float min_usable_angle = 0.00699F;
+
+/* pixels of the side of the tiles moved at once by the quarter turns */
+#define TRANSFORM_TILE 32
+
+/* min. number of target pixels worth giving to a thread */
+#define TRANSFORM_BAND_PIXELS (128 * 128)
+
+/* 1.0 in the 32.32 fixed point of the coordinates in the source image */
+#define FIXED_ONE ((int64_t)1 << 32)
 
-static RImage *rotate_image_90(RImage *source);
-static RImage *rotate_image_270(RImage *source);
 static RImage *rotate_image_any(RImage *source, float angle);
 
+/*
+ * Returns 'angle' in [0, 360) and the number of quarter turns it makes,
+ * or -1 if it is not a multiple of 90 degrees
+ */
+static int quarter_turns(float *angle)
+{
+  int turns;
+
+  *angle = fmod(*angle, 360.0);
+  if (*angle < 0.0F)
+    *angle += 360.0F;
+
+  for (turns = 0; turns < 4; turns++) {
+    if (*angle > turns * 90.0F - min_usable_angle && *angle < turns * 90.0F + min_usable_angle)
+      return turns;
+  }
+  if (*angle > 360.0F - min_usable_angle)
+    return 0;
+
+  return -1;
+}
+
 RImage *RRotateImage(RImage *image, float angle)
 {
-  /*
-   * Angle steps below this value would represent a rotation
-   * of less than 1 pixel for a 4k wide image, so not worth
-   * bothering the difference. That makes it a perfect
-   * candidate for an Epsilon when trying to compare angle
-   * to known values
-   */
-  static const float min_usable_angle = 0.00699F;
+  switch (quarter_turns(&angle)) {
+    case 0:
+      return RCloneImage(image);
 
-  angle = fmod(angle, 360.0);
-  if (angle < 0.0F)
-    angle += 360.0F;
+    case 1:
+      return wraster_transform_image(image, RTransformRotate90);
 
-  if (angle < min_usable_angle) {
-    /* Rotate by 0 degree */
-    return RCloneImage(image);
+    case 2:
+      return wraster_transform_image(image, RTransformRotate180);
 
-  } else if ((angle > 90.0F - min_usable_angle) && (angle < 90.0F + min_usable_angle)) {
-    return rotate_image_90(image);
+    case 3:
+      return wraster_transform_image(image, RTransformRotate270);
 
-  } else if ((angle > 180.0F - min_usable_angle) && (angle < 180.0F + min_usable_angle)) {
-    return wraster_rotate_image_180(image);
+    default:
+      return rotate_image_any(image, angle);
+  }
+}
+
+int RRotateImageInPlace(RImage *image, float angle)
+{
+  RImage *rotated;
+
+  switch (quarter_turns(&angle)) {
+    case 0:
+      return True;
+
+    case 1:
+      return wraster_transform_image_in_place(image, RTransformRotate90);
+
+    case 2:
+      return wraster_transform_image_in_place(image, RTransformRotate180);
+
+    case 3:
+      return wraster_transform_image_in_place(image, RTransformRotate270);
+
+    default:
+      /* the image gets larger and an alpha channel */
+      rotated = rotate_image_any(image, angle);
+      if (!rotated)
+        return False;
+      free(image->data);
+      image->data = rotated->data;
+      image->width = rotated->width;
+      image->height = rotated->height;
+      image->format = rotated->format;
+      rotated->data = NULL;
+      RReleaseImage(rotated);
+      return True;
+  }
+}
 
-  } else if ((angle > 270.0F - min_usable_angle) && (angle < 270.0F + min_usable_angle)) {
-    return rotate_image_270(image);
+/***************************************************************************/
+/* Flips and quarter turns */
 
-  } else {
-    return rotate_image_any(image, angle);
+/*
+ * The pixel (x, y) of the target is the pixel base + x * xstep + y * ystep
+ * of the source. The flips copy rows, the quarter turns read the source
+ * columns by tiles that stay in the cache.
+ */
+typedef struct {
+  unsigned char *dst;
+  const unsigned char *src;
+  unsigned dst_width;
+  int bpp;
+  ptrdiff_t base, xstep, ystep;
+  Bool simd;
+} RTransformJob;
+
+/* copies 'count' pixels 'step' pixels apart in the source */
+static inline void copy_pixels(unsigned char *d, const unsigned char *s, ptrdiff_t step,
+                               unsigned count, int bpp)
+{
+  unsigned i;
+
+  switch (bpp) {
+    case 1:
+      for (i = 0; i < count; i++)
+        d[i] = s[i * step];
+      break;
+
+    case 3:
+      for (i = 0; i < count; i++, d += 3, s += step * 3) {
+        d[0] = s[0];
+        d[1] = s[1];
+        d[2] = s[2];
+      }
+      break;
+
+    default: {
+      uint32_t *d32 = (uint32_t *)d;
+      const uint32_t *s32 = (const uint32_t *)s;
+
+      for (i = 0; i < count; i++)
+        d32[i] = s32[i * step];
+      break;
+    }
   }
 }
 
-static RImage *rotate_image_90(RImage *source)
+static inline void swap_pixels(unsigned char *a, unsigned char *b, int bpp)
 {
-  RImage *target;
-  int nwidth, nheight;
-  int x, y;
+  unsigned char t;
+  uint32_t t32;
+
+  switch (bpp) {
+    case 1:
+      t = *a;
+      *a = *b;
+      *b = t;
+      break;
+
+    case 3:
+      t = a[0], a[0] = b[0], b[0] = t;
+      t = a[1], a[1] = b[1], b[1] = t;
+      t = a[2], a[2] = b[2], b[2] = t;
+      break;
+
+    default:
+      t32 = *(uint32_t *)a;
+      *(uint32_t *)a = *(uint32_t *)b;
+      *(uint32_t *)b = t32;
+      break;
+  }
+}
 
-  nwidth = source->height;
-  nheight = source->width;
+#ifdef WRASTER_X86_SIMD
 
-  target = RCreateImage(nwidth, nheight, (source->format != RRGBFormat));
-  if (!target)
-    return NULL;
+/* transposes a block of 4 x 4 pixels of 4 bytes */
+WRASTER_TARGET("sse2")
+static inline void transpose_block_sse2(uint32_t *d, ptrdiff_t dw, const uint32_t *s,
+                                        ptrdiff_t sw)
+{
+  __m128i r0 = _mm_loadu_si128((const __m128i *)s);
+  __m128i r1 = _mm_loadu_si128((const __m128i *)(s + sw));
+  __m128i r2 = _mm_loadu_si128((const __m128i *)(s + 2 * sw));
+  __m128i r3 = _mm_loadu_si128((const __m128i *)(s + 3 * sw));
+  __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+  __m128i t1 = _mm_unpacklo_epi32(r2, r3);
+  __m128i t2 = _mm_unpackhi_epi32(r0, r1);
+  __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+
+  _mm_storeu_si128((__m128i *)d, _mm_unpacklo_epi64(t0, t1));
+  _mm_storeu_si128((__m128i *)(d + dw), _mm_unpackhi_epi64(t0, t1));
+  _mm_storeu_si128((__m128i *)(d + 2 * dw), _mm_unpacklo_epi64(t2, t3));
+  _mm_storeu_si128((__m128i *)(d + 3 * dw), _mm_unpackhi_epi64(t2, t3));
+}
+
+/*
+ * Tile of a quarter turn of pixels of 4 bytes: ystep is 1 or -1, so every
+ * row of a block of the target is a column of a block of the source.
+ */
+WRASTER_TARGET("sse2")
+static void transform_tile_sse2(RTransformJob *job, unsigned x0, unsigned y0, unsigned x1,
+                                unsigned y1)
+{
+  uint32_t *dst = (uint32_t *)job->dst;
+  const uint32_t *src = (const uint32_t *)job->src;
+  ptrdiff_t dw = job->dst_width;
+  unsigned x, y, from;
+  unsigned x_end = x0 + ((x1 - x0) & ~3U);
+  unsigned y_end = y0 + ((y1 - y0) & ~3U);
+
+  for (y = y0; y < y_end; y += 4) {
+    for (x = x0; x < x_end; x += 4) {
+      const uint32_t *s = src + job->base + x * job->xstep + y * job->ystep;
+
+      if (job->ystep > 0)
+        transpose_block_sse2(dst + y * dw + x, dw, s, job->xstep);
+      else
+        transpose_block_sse2(dst + (y + 3) * dw + x, -dw, s - 3, job->xstep);
+    }
+  }
 
-  if (source->format == RRGBFormat) {
-    unsigned char *optr, *nptr;
+  /* the right and bottom edges */
+  for (y = y0; y < y1; y++) {
+    from = (y < y_end) ? x_end : x0;
+    copy_pixels((unsigned char *)(dst + y * dw + from),
+                (const unsigned char *)(src + job->base + from * job->xstep + y * job->ystep),
+                job->xstep, x1 - from, 4);
+  }
+}
 
-    optr = source->data;
-    for (x = nwidth; x; x--) {
-      nptr = target->data + 3 * (x - 1);
-      for (y = nheight; y; y--) {
-        nptr[0] = *optr++;
-        nptr[1] = *optr++;
-        nptr[2] = *optr++;
+#endif /* WRASTER_X86_SIMD */
 
-        nptr += 3 * nwidth;
-      }
+static void transform_rows(void *data, int first, int last)
+{
+  RTransformJob *job = data;
+  unsigned dw = job->dst_width;
+  int bpp = job->bpp;
+  unsigned x0, x1, y0, y1, y;
+
+  if (job->xstep == 1 || job->xstep == -1) {
+    for (y = first; y < last; y++) {
+      unsigned char *d = job->dst + (size_t)y * dw * bpp;
+      const unsigned char *s = job->src + (job->base + y * job->ystep) * bpp;
+
+      if (job->xstep == 1)
+        memcpy(d, s, (size_t)dw * bpp);
+      else
+        copy_pixels(d, s, -1, dw, bpp);
     }
+    return;
+  }
 
-  } else {
-    unsigned char *optr, *nptr;
+  for (y0 = first; y0 < last; y0 += TRANSFORM_TILE) {
+    y1 = (y0 + TRANSFORM_TILE < last) ? y0 + TRANSFORM_TILE : last;
 
-    optr = source->data;
-    for (x = nwidth; x; x--) {
-      nptr = target->data + 4 * (x - 1);
-      for (y = nheight; y; y--) {
-        nptr[0] = *optr++;
-        nptr[1] = *optr++;
-        nptr[2] = *optr++;
-        nptr[3] = *optr++;
+    for (x0 = 0; x0 < dw; x0 += TRANSFORM_TILE) {
+      x1 = (x0 + TRANSFORM_TILE < dw) ? x0 + TRANSFORM_TILE : dw;
 
-        nptr += 4 * nwidth;
+#ifdef WRASTER_X86_SIMD
+      if (job->simd && bpp == 4) {
+        transform_tile_sse2(job, x0, y0, x1, y1);
+        continue;
       }
+#endif
+      for (y = y0; y < y1; y++)
+        copy_pixels(job->dst + ((size_t)y * dw + x0) * bpp,
+                    job->src + (job->base + x0 * job->xstep + y * job->ystep) * bpp, job->xstep,
+                    x1 - x0, bpp);
     }
   }
+}
 
-  return target;
+void wraster_transform_pixels(unsigned char *dst, const unsigned char *src, unsigned width,
+                              unsigned height, int bpp, RTransform transform)
+{
+  RTransformJob job;
+  ptrdiff_t w = width, h = height;
+  unsigned dst_height = height;
+
+  job.dst = dst;
+  job.src = src;
+  job.dst_width = width;
+  job.bpp = bpp;
+  job.simd = (wraster_cpu_level() >= RCPUSSE2);
+
+  switch (transform) {
+    case RTransformHorizontalFlip:
+      job.base = w - 1;
+      job.xstep = -1;
+      job.ystep = w;
+      break;
+
+    case RTransformVerticalFlip:
+      job.base = (h - 1) * w;
+      job.xstep = 1;
+      job.ystep = -w;
+      break;
+
+    case RTransformRotate180:
+      job.base = h * w - 1;
+      job.xstep = -1;
+      job.ystep = -w;
+      break;
+
+    case RTransformRotate90:
+      job.base = (h - 1) * w;
+      job.xstep = -w;
+      job.ystep = 1;
+      break;
+
+    case RTransformRotate270:
+      job.base = w - 1;
+      job.xstep = w;
+      job.ystep = -1;
+      break;
+
+    default:
+      job.base = 0;
+      job.xstep = w;
+      job.ystep = 1;
+      break;
+  }
+
+  if (transform >= RTransformRotate90) {
+    job.dst_width = height;
+    dst_height = width;
+  }
+
+  wraster_run_bands(dst_height, TRANSFORM_BAND_PIXELS / job.dst_width + 1, transform_rows, &job);
 }
 
-RImage *wraster_rotate_image_180(RImage *source)
+RImage *wraster_transform_image(RImage *source, RTransform transform)
 {
   RImage *target;
-  int nwidth, nheight;
-  int x, y;
-
-  nwidth = source->width;
-  nheight = source->height;
+  int bpp = (source->format == RRGBAFormat) ? 4 : 3;
 
-  target = RCreateImage(nwidth, nheight, (source->format != RRGBFormat));
+  if (transform >= RTransformRotate90)
+    target = RCreateImage(source->height, source->width, bpp == 4);
+  else
+    target = RCreateImage(source->width, source->height, bpp == 4);
   if (!target)
     return NULL;
 
-  if (source->format == RRGBFormat) {
-    unsigned char *optr, *nptr;
+  wraster_transform_pixels(target->data, source->data, source->width, source->height, bpp,
+                           transform);
 
-    optr = source->data;
-    nptr = target->data + nwidth * nheight * 3 - 3;
+  return target;
+}
 
-    for (y = 0; y < nheight; y++) {
-      for (x = 0; x < nwidth; x++) {
-        nptr[0] = optr[0];
-        nptr[1] = optr[1];
-        nptr[2] = optr[2];
+/* In place */
 
-        optr += 3;
-        nptr -= 3;
-      }
+typedef struct {
+  unsigned char *data;
+  unsigned width, height;
+  int bpp;
+} RInPlaceJob;
+
+static void reverse_rows(void *data, int first, int last)
+{
+  RInPlaceJob *job = data;
+  size_t stride = (size_t)job->width * job->bpp;
+  unsigned x;
+  int y;
+
+  for (y = first; y < last; y++) {
+    unsigned char *row = job->data + y * stride;
+
+    for (x = 0; x < job->width / 2; x++)
+      swap_pixels(row + x * job->bpp, row + (job->width - 1 - x) * job->bpp, job->bpp);
+  }
+}
+
+/* swaps the rows [first, last) of the top half with the ones of the bottom half */
+static void swap_rows(void *data, int first, int last)
+{
+  RInPlaceJob *job = data;
+  size_t stride = (size_t)job->width * job->bpp;
+  unsigned char buffer[1024];
+  size_t done, count;
+  int y;
+
+  for (y = first; y < last; y++) {
+    unsigned char *top = job->data + y * stride;
+    unsigned char *bottom = job->data + (job->height - 1 - y) * stride;
+
+    for (done = 0; done < stride; done += count) {
+      count = (stride - done < sizeof(buffer)) ? stride - done : sizeof(buffer);
+      memcpy(buffer, top + done, count);
+      memcpy(top + done, bottom + done, count);
+      memcpy(bottom + done, buffer, count);
+    }
+  }
+}
+
+/* swaps the rows of the top half with the reversed ones of the bottom half */
+static void swap_reversed_rows(void *data, int first, int last)
+{
+  RInPlaceJob *job = data;
+  size_t stride = (size_t)job->width * job->bpp;
+  int bpp = job->bpp;
+  unsigned x, w = job->width;
+  int y;
+
+  for (y = first; y < last; y++) {
+    unsigned char *top = job->data + y * stride;
+    unsigned char *bottom = job->data + (job->height - 1 - y) * stride;
+
+    if (top == bottom) {
+      for (x = 0; x < w / 2; x++)
+        swap_pixels(top + x * bpp, top + (w - 1 - x) * bpp, bpp);
+    } else {
+      for (x = 0; x < w; x++)
+        swap_pixels(top + x * bpp, bottom + (w - 1 - x) * bpp, bpp);
     }
+  }
+}
 
-  } else {
-    unsigned char *optr, *nptr;
+/*
+ * Transposes a square image: the tile (tx, ty) is swapped with (ty, tx),
+ * for the rows of tiles [first, last)
+ */
+static void transpose_tiles(void *data, int first, int last)
+{
+  RInPlaceJob *job = data;
+  size_t stride = (size_t)job->width * job->bpp;
+  unsigned size = job->width, tx, ty, x, y, x1, y1;
+  int bpp = job->bpp;
 
-    optr = source->data;
-    nptr = target->data + nwidth * nheight * 4 - 4;
+  for (ty = first * TRANSFORM_TILE; ty < last * TRANSFORM_TILE && ty < size;
+       ty += TRANSFORM_TILE) {
+    y1 = (ty + TRANSFORM_TILE < size) ? ty + TRANSFORM_TILE : size;
 
-    for (y = nheight * nwidth - 1; y >= 0; y--) {
-      nptr[0] = optr[0];
-      nptr[1] = optr[1];
-      nptr[2] = optr[2];
-      nptr[3] = optr[3];
+    for (tx = ty; tx < size; tx += TRANSFORM_TILE) {
+      x1 = (tx + TRANSFORM_TILE < size) ? tx + TRANSFORM_TILE : size;
 
-      optr += 4;
-      nptr -= 4;
+      for (y = ty; y < y1; y++) {
+        for (x = (tx > y) ? tx : y + 1; x < x1; x++)
+          swap_pixels(job->data + y * stride + x * bpp, job->data + x * stride + y * bpp, bpp);
+      }
     }
   }
+}
 
-  return target;
+Bool wraster_transform_image_in_place(RImage *image, RTransform transform)
+{
+  RInPlaceJob job;
+  int bpp = (image->format == RRGBAFormat) ? 4 : 3;
+  unsigned char *data;
+  unsigned tiles, grain;
+
+  if (transform >= RTransformRotate90 && image->width != image->height) {
+    /* the extra bytes are the ones of RCreateImage() */
+    data = malloc((size_t)image->width * image->height * bpp + 4);
+    if (!data) {
+      RErrorCode = RERR_NOMEMORY;
+      return False;
+    }
+    wraster_transform_pixels(data, image->data, image->width, image->height, bpp, transform);
+    free(image->data);
+    image->data = data;
+    tiles = image->width;
+    image->width = image->height;
+    image->height = tiles;
+    return True;
+  }
+
+  job.data = image->data;
+  job.width = image->width;
+  job.height = image->height;
+  job.bpp = bpp;
+  grain = TRANSFORM_BAND_PIXELS / image->width + 1;
+
+  if (transform >= RTransformRotate90) {
+    tiles = (image->width + TRANSFORM_TILE - 1) / TRANSFORM_TILE;
+    wraster_run_bands(tiles, grain / TRANSFORM_TILE + 1, transpose_tiles, &job);
+  }
+
+  switch (transform) {
+    case RTransformHorizontalFlip:
+    case RTransformRotate90:
+      /* a quarter turn clockwise is the transposition flipped horizontally */
+      wraster_run_bands(image->height, grain, reverse_rows, &job);
+      break;
+
+    case RTransformVerticalFlip:
+    case RTransformRotate270:
+      wraster_run_bands(image->height / 2, grain, swap_rows, &job);
+      break;
+
+    case RTransformRotate180:
+      wraster_run_bands((image->height + 1) / 2, grain, swap_reversed_rows, &job);
+      break;
+
+    default:
+      break;
+  }
+
+  return True;
 }
 
-static RImage *rotate_image_270(RImage *source)
+/***************************************************************************/
+/* Rotation by any angle */
+
+/*
+ * Every target pixel is interpolated from the 4 source pixels around the
+ * point it comes from. The source pixels out of the image take the color
+ * of the nearest one and are transparent, so the edges are antialiased.
+ * Each row of the target is clipped into the span showing the source,
+ * its border where some of the 4 pixels are missing and its inside where
+ * none is, which is interpolated without checks.
+ */
+typedef struct {
+  RImage *src, *dst;
+  double x0, y0;    /* source position of the target pixel (0, 0) */
+  double cos, sin;  /* source moves for each target pixel to the right: (cos, -sin) */
+  Bool simd;
+} RRotateJob;
+
+/*
+ * Bilinear interpolation with 8 bit weights. The vector kernel does the
+ * same operations, so the results are the same.
+ */
+#define LERP(a, b, w) (((a) * (256 - (w)) + (b) * (w) + 128) >> 8)
+
+static inline void interpolate(unsigned char *d, const unsigned char *p00,
+                               const unsigned char *p01, const unsigned char *p10,
+                               const unsigned char *p11, unsigned fx, unsigned fy, int channels)
 {
-  RImage *target;
-  int nwidth, nheight;
-  int x, y;
+  int c;
 
-  nwidth = source->height;
-  nheight = source->width;
+  for (c = 0; c < channels; c++)
+    d[c] = LERP(LERP(p00[c], p10[c], fy), LERP(p01[c], p11[c], fy), fx);
+}
 
-  target = RCreateImage(nwidth, nheight, (source->format != RRGBFormat));
-  if (!target)
-    return NULL;
+/* target pixel whose source pixels may be out of the image */
+static void sample_border(unsigned char *d, const RImage *src, int64_t sx, int64_t sy)
+{
+  int bpp = (src->format == RRGBAFormat) ? 4 : 3;
+  int ix = sx >> 32, iy = sy >> 32;
+  unsigned char taps[4][4];
+  int k, tx, ty, cx, cy;
+
+  for (k = 0; k < 4; k++) {
+    const unsigned char *p;
+
+    tx = ix + (k & 1);
+    ty = iy + (k >> 1);
+    cx = (tx < 0) ? 0 : (tx >= (int)src->width) ? (int)src->width - 1 : tx;
+    cy = (ty < 0) ? 0 : (ty >= (int)src->height) ? (int)src->height - 1 : ty;
+    p = src->data + ((size_t)cy * src->width + cx) * bpp;
+
+    taps[k][0] = p[0];
+    taps[k][1] = p[1];
+    taps[k][2] = p[2];
+    if (tx != cx || ty != cy)
+      taps[k][3] = 0;
+    else
+      taps[k][3] = (bpp == 4) ? p[3] : 255;
+  }
 
-  if (source->format == RRGBFormat) {
-    unsigned char *optr, *nptr;
+  interpolate(d, taps[0], taps[1], taps[2], taps[3], (sx >> 24) & 0xff, (sy >> 24) & 0xff, 4);
+}
 
-    optr = source->data;
-    for (x = nwidth; x; x--) {
-      nptr = target->data + 3 * nwidth * nheight - x * 3;
-      for (y = nheight; y; y--) {
-        nptr[0] = *optr++;
-        nptr[1] = *optr++;
-        nptr[2] = *optr++;
+/* 'count' target pixels whose source pixels are all in the image */
+static void sample_span(unsigned char *d, const RImage *src, int64_t sx, int64_t sy, int64_t ux,
+                        int64_t uy, int count)
+{
+  int bpp = (src->format == RRGBAFormat) ? 4 : 3;
+  size_t stride = (size_t)src->width * bpp;
 
-        nptr -= 3 * nwidth;
-      }
-    }
+  for (; count; count--, d += 4, sx += ux, sy += uy) {
+    const unsigned char *p = src->data + (size_t)(sy >> 32) * stride + (size_t)(sx >> 32) * bpp;
 
-  } else {
-    unsigned char *optr, *nptr;
+    interpolate(d, p, p + bpp, p + stride, p + stride + bpp, (sx >> 24) & 0xff, (sy >> 24) & 0xff,
+                bpp);
+    if (bpp == 3)
+      d[3] = 255;
+  }
+}
 
-    optr = source->data;
-    for (x = nwidth; x; x--) {
-      nptr = target->data + 4 * nwidth * nheight - x * 4;
-      for (y = nheight; y; y--) {
-        nptr[0] = *optr++;
-        nptr[1] = *optr++;
-        nptr[2] = *optr++;
-        nptr[3] = *optr++;
+#ifdef WRASTER_X86_SIMD
 
-        nptr -= 4 * nwidth;
-      }
+/*
+ * The pixel pairs are loaded with 8 bytes, which RCreateImage() allows past
+ * the last RGB pixel. The 16 bit operations don't overflow: the weights
+ * add up to 256.
+ */
+WRASTER_TARGET("sse2")
+static void sample_span_sse2(unsigned char *d, const RImage *src, int64_t sx, int64_t sy,
+                             int64_t ux, int64_t uy, int count)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i round = _mm_set1_epi16(128);
+  int bpp = (src->format == RRGBAFormat) ? 4 : 3;
+  size_t stride = (size_t)src->width * bpp;
+  uint32_t opaque = (bpp == 3) ? 0xff000000 : 0;
+
+  for (; count; count--, d += 4, sx += ux, sy += uy) {
+    const unsigned char *p = src->data + (size_t)(sy >> 32) * stride + (size_t)(sx >> 32) * bpp;
+    short fx = (sx >> 24) & 0xff, fy = (sy >> 24) & 0xff;
+    __m128i top = _mm_loadl_epi64((const __m128i *)p);
+    __m128i bottom = _mm_loadl_epi64((const __m128i *)(p + stride));
+    __m128i v, h;
+    uint32_t out;
+
+    if (bpp == 3) {
+      /* r0 g0 b0 r1 g1 b1 -> r0 g0 b0 . r1 g1 b1 . */
+      top = _mm_unpacklo_epi32(top, _mm_srli_si128(top, 3));
+      bottom = _mm_unpacklo_epi32(bottom, _mm_srli_si128(bottom, 3));
     }
+    top = _mm_unpacklo_epi8(top, zero);
+    bottom = _mm_unpacklo_epi8(bottom, zero);
+
+    /* left pixel in the low half, right pixel in the high half */
+    v = _mm_add_epi16(_mm_mullo_epi16(top, _mm_set1_epi16(256 - fy)),
+                      _mm_mullo_epi16(bottom, _mm_set1_epi16(fy)));
+    v = _mm_srli_epi16(_mm_add_epi16(v, round), 8);
+
+    h = _mm_mullo_epi16(v, _mm_set_epi16(fx, fx, fx, fx, 256 - fx, 256 - fx, 256 - fx, 256 - fx));
+    h = _mm_add_epi16(_mm_add_epi16(h, _mm_srli_si128(h, 8)), round);
+    h = _mm_srli_epi16(h, 8);
+
+    out = _mm_cvtsi128_si32(_mm_packus_epi16(h, h)) | opaque;
+    memcpy(d, &out, 4);
   }
+}
 
-  return target;
+#endif /* WRASTER_X86_SIMD */
+
+static inline Bool in_span(int64_t pos, int64_t step, int64_t lo, int64_t hi, int x)
+{
+  int64_t v = pos + x * step;
+
+  return (v >= lo && v < hi);
 }
 
 /*
- * Image rotation through Bresenham's line algorithm:
- *
- * If a square must be rotate by angle a, like in:
- *  _______
- * |    B  |
- * |   /4\ |
- * |  /3 8\|
- * | /2 7 /|
- * |A1 6 / |      A_______B
- * | \5 / a| <--- |1 2 3 4|
- * |__C/_)_|      |5 6 7 8|
- *                C-------
- *
- * for each point P1 in the line from C to A
- *	for each point P2 in the perpendicular line starting at P1
- *		get pixel from the source and plot at P2
- *		increment pixel location from source
- *
+ * Narrows [*first, *last) to the x for which lo <= pos + x * step < hi.
+ * The bounds computed in floating point are adjusted with exact tests.
  */
-
-#if 0
-static void
-copyLine(int x1, int y1, int x2, int y2, int nwidth, int format, unsigned char *dst, unsigned char **src)
+static void clip_span(int64_t pos, int64_t step, int64_t lo, int64_t hi, int *first, int *last)
 {
-	unsigned char *s = *src;
-	int dx, dy;
-	int xi, yi;
-	int offset;
-	int dpr, dpru, p;
-
-	dx = abs(x2 - x1);
-	dy = abs(y2 - y1);
-
-	if (x1 > x2)
-		xi = -1;
-	else
-		xi = 1;
-	if (y1 > y2)
-		yi = -1;
-	else
-		yi = 1;
-
-	if (dx >= dy) {
-
-		dpr = dy << 1;
-		dpru = dpr - (dx << 1);
-		p = dpr - dx;
-
-		while (dx-- >= 0) {
-			/* fetch and draw the pixel */
-			offset = (x1 + y1 * nwidth) << 2;
-			dst[offset++] = *s++;
-			dst[offset++] = *s++;
-			dst[offset++] = *s++;
-			if (format == RRGBAFormat)
-				dst[offset++] = *s++;
-			else
-				dst[offset++] = 255;
-
-			/* calc next step */
-			if (p > 0) {
-				x1 += xi;
-				y1 += yi;
-				p += dpru;
-			} else {
-				x1 += xi;
-				p += dpr;
-			}
-		}
-	} else {
-
-		dpr = dx << 1;
-		dpru = dpr - (dy << 1);
-		p = dpr - dy;
-
-		while (dy-- >= 0) {
-			/* fetch and draw the pixel */
-			offset = (x1 + y1 * nwidth) << 2;
-			dst[offset++] = *s++;
-			dst[offset++] = *s++;
-			dst[offset++] = *s++;
-			if (format == RRGBAFormat)
-				dst[offset++] = *s++;
-			else
-				dst[offset++] = 255;
-
-			/* calc next step */
-			if (p > 0) {
-				x1 += xi;
-				y1 += yi;
-				p += dpru;
-			} else {
-				y1 += yi;
-				p += dpr;
-			}
-		}
-	}
-
-	*src = s;
+  double a, b, t;
+  int x0, x1;
+
+  if (*first >= *last)
+    return;
+
+  if (step == 0) {
+    if (pos < lo || pos >= hi)
+      *last = *first;
+    return;
+  }
+
+  a = (double)(lo - pos) / step;
+  b = (double)(hi - pos) / step;
+  if (a > b) {
+    t = a;
+    a = b;
+    b = t;
+  }
+  a = (a < *first) ? *first : (a > *last) ? *last : ceil(a);
+  b = (b < *first) ? *first : (b > *last) ? *last : ceil(b);
+  x0 = a;
+  x1 = b;
+
+  while (x0 < x1 && !in_span(pos, step, lo, hi, x0))
+    x0++;
+  while (x0 > *first && in_span(pos, step, lo, hi, x0 - 1))
+    x0--;
+  while (x1 > x0 && !in_span(pos, step, lo, hi, x1 - 1))
+    x1--;
+  while (x1 < *last && in_span(pos, step, lo, hi, x1))
+    x1++;
+
+  *first = x0;
+  *last = x1;
 }
+
+static void rotate_rows(void *data, int first, int last)
+{
+  RRotateJob *job = data;
+  RImage *src = job->src, *dst = job->dst;
+  int64_t w = src->width, h = src->height;
+  int64_t ux = llround(job->cos * FIXED_ONE), uy = llround(-job->sin * FIXED_ONE);
+  int x, y, x0, x1, in0, in1;
+
+  for (y = first; y < last; y++) {
+    unsigned char *row = dst->data + (size_t)y * dst->width * 4;
+    int64_t sx = llround((job->x0 + y * job->sin) * FIXED_ONE);
+    int64_t sy = llround((job->y0 + y * job->cos) * FIXED_ONE);
+
+    /* the pixels with a source pixel around */
+    x0 = 0;
+    x1 = dst->width;
+    clip_span(sx, ux, -FIXED_ONE, w * FIXED_ONE, &x0, &x1);
+    clip_span(sy, uy, -FIXED_ONE, h * FIXED_ONE, &x0, &x1);
+
+    /* the ones with the 4 of them */
+    in0 = x0;
+    in1 = x1;
+    clip_span(sx, ux, 0, (w - 1) * FIXED_ONE, &in0, &in1);
+    clip_span(sy, uy, 0, (h - 1) * FIXED_ONE, &in0, &in1);
+    if (in0 >= in1)
+      in0 = in1 = x1;
+
+    memset(row, 0, x0 * 4);
+    for (x = x0; x < in0; x++)
+      sample_border(row + x * 4, src, sx + x * ux, sy + x * uy);
+#ifdef WRASTER_X86_SIMD
+    if (job->simd)
+      sample_span_sse2(row + in0 * 4, src, sx + in0 * ux, sy + in0 * uy, ux, uy, in1 - in0);
+    else
 #endif
+      sample_span(row + in0 * 4, src, sx + in0 * ux, sy + in0 * uy, ux, uy, in1 - in0);
+    for (x = in1; x < x1; x++)
+      sample_border(row + x * 4, src, sx + x * ux, sy + x * uy);
+    memset(row + x1 * 4, 0, (dst->width - x1) * 4);
+  }
+}
 
 static RImage *rotate_image_any(RImage *source, float angle)
 {
-  (void)angle;
-  puts("NOT FULLY IMPLEMENTED");
-  return RCloneImage(source);
-#if 0
-	RImage *img;
-	int nwidth, nheight;
-	int x1, y1;
-	int x2, y2;
-	int dx, dy;
-	int xi, yi;
-	int xx, yy;
-	unsigned char *src, *dst;
-	int dpr, dpru, p;
-
-	/* only 180o for now */
-	if (angle > 180.0F)
-		angle -= 180.0F;
-
-	angle = (angle * WM_PI) / 180.0;
-
-	nwidth = ceil(abs(cos(angle) * image->width))
-	    + ceil(abs(cos(WM_PI / 2 - angle) * image->width));
-
-	nheight = ceil(abs(sin(angle) * image->height))
-	    + ceil(abs(cos(WM_PI / 2 - angle) * image->height));
-
-	img = RCreateImage(nwidth, nheight, True);
-	if (!img)
-		return NULL;
-
-	src = image->data;
-	dst = img->data;
-
-	x1 = floor(abs(cos(WM_PI / 2 - angle) * image->width));
-	y1 = 0;
-
-	x2 = 0;
-	y2 = floor(abs(sin(WM_PI / 2 - angle) * image->width));
-
-	xx = floor(abs(cos(angle) * image->height)) - 1;
-	yy = nheight - 1;
-
-	printf("%ix%i, %i %i     %i %i %i\n", nwidth, nheight, x1, y1, x2, y2, (int)((angle * 180.0) / WM_PI));
-
-	dx = abs(x2 - x1);
-	dy = abs(y2 - y1);
-
-	if (x1 > x2)
-		xi = -1;
-	else
-		xi = 1;
-	if (y1 > y2)
-		yi = -1;
-	else
-		yi = 1;
-
-	if (dx >= dy) {
-		dpr = dy << 1;
-		dpru = dpr - (dx << 1);
-		p = dpr - dx;
-
-		while (dx-- >= 0) {
-
-			copyLine(x1, y1, xx, yy, nwidth, image->format, dst, &src);
-
-			/* calc next step */
-
-			if (p > 0) {
-				x1 += xi;
-				y1 += yi;
-				xx += xi;
-				yy += yi;
-				p += dpru;
-			} else {
-				x1 += xi;
-				xx += xi;
-				p += dpr;
-			}
-		}
-	} else {
-		dpr = dx << 1;
-		dpru = dpr - (dy << 1);
-		p = dpr - dy;
-
-		while (dy-- >= 0) {
-			xx = abs(x1 * sin(angle * WM_PI / 180.0));
-			yy = abs(y1 * cos(angle * WM_PI / 180.0));
-
-			copyLine(x1, y1, xx, yy, nwidth, image->format, dst, &src);
-
-			/* calc next step */
-			if (p > 0) {
-				x1 += xi;
-				y1 += yi;
-				p += dpru;
-			} else {
-				y1 += yi;
-				p += dpr;
-			}
-		}
-	}
-
-	return img;
-#endif
+  RRotateJob job;
+  RImage *target;
+  double a = angle * M_PI / 180.0;
+  double c = cos(a), s = sin(a);
+  unsigned width, height;
+
+  /* the bounding box of the rotated image */
+  width = ceil(fabs(source->width * c) + fabs(source->height * s) - 0.001);
+  height = ceil(fabs(source->width * s) + fabs(source->height * c) - 0.001);
+
+  target = RCreateImage(width ? width : 1, height ? height : 1, True);
+  if (!target)
+    return NULL;
+
+  /*
+   * The rotation is clockwise like the quarter turns. The pixel centers
+   * of the target are mapped back to the source around the centers of
+   * the images.
+   */
+  job.src = source;
+  job.dst = target;
+  job.cos = c;
+  job.sin = s;
+  job.x0 = c * (0.5 - target->width / 2.0) + s * (0.5 - target->height / 2.0) +
+           source->width / 2.0 - 0.5;
+  job.y0 = -s * (0.5 - target->width / 2.0) + c * (0.5 - target->height / 2.0) +
+           source->height / 2.0 - 0.5;
+  job.simd = (wraster_cpu_level() >= RCPUSSE2);
+
+  wraster_run_bands(target->height, TRANSFORM_BAND_PIXELS / target->width + 1, rotate_rows, &job);
+
+  return target;
 }
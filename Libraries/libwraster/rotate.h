@@ -21,8 +21,35 @@
 #define __WRASTER_ROTATE_H__
 
 /*
- * Returns a new image, rotated by 180 degrees
+ * The ways to move the pixels of an image without resampling them
  */
-RImage *wraster_rotate_image_180(RImage *source);
+typedef enum {
+  RTransformHorizontalFlip,
+  RTransformVerticalFlip,
+  RTransformRotate180,
+  /* the ones below swap the width and the height */
+  RTransformRotate90, /* clockwise */
+  RTransformRotate270,
+  RTransformTranspose /* about the diagonal from the top left corner */
+} RTransform;
+
+/*
+ * Writes to 'dst' the 'width' x 'height' pixels of 'bpp' (1, 3 or 4)
+ * bytes of 'src', transformed. The buffers must not overlap.
+ */
+void wraster_transform_pixels(unsigned char *dst, const unsigned char *src, unsigned width,
+                              unsigned height, int bpp, RTransform transform);
+
+/*
+ * Returns a new image, 'source' transformed
+ */
+RImage *wraster_transform_image(RImage *source, RTransform transform);
+
+/*
+ * Transforms 'image' itself. It is done in place except for the
+ * rotations by a quarter turn of images that are not square, which move
+ * the pixels to a new buffer. Returns False if it can't be allocated.
+ */
+Bool wraster_transform_image_in_place(RImage *image, RTransform transform);
 
 #endif
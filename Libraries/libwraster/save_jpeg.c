@@ -37,7 +37,7 @@
 Bool RSaveJPEG(RImage *img, const char *filename, char *title)
 {
   FILE *file;
-  int x, y, img_depth;
+  int x, y;
   char *buffer;
   RColor pixel;
   struct jpeg_compress_struct cinfo;
@@ -50,11 +50,6 @@ Bool RSaveJPEG(RImage *img, const char *filename, char *title)
     return False;
   }
 
-  if (img->format == RRGBAFormat)
-    img_depth = 4;
-  else
-    img_depth = 3;
-
   /* collect separate RGB values to a buffer */
   buffer = malloc(sizeof(char) * 3 * img->width * img->height);
   for (y = 0; y < img->height; y++) {
@@ -87,7 +82,7 @@ Bool RSaveJPEG(RImage *img, const char *filename, char *title)
     jpeg_write_marker(&cinfo, JPEG_COM, (const JOCTET *)title, strlen(title));
 
   while (cinfo.next_scanline < cinfo.image_height) {
-    row_pointer = (JSAMPROW)&buffer[cinfo.next_scanline * img_depth * img->width];
+    row_pointer = (JSAMPROW)&buffer[cinfo.next_scanline * 3 * img->width];
     jpeg_write_scanlines(&cinfo, &row_pointer, 1);
   }
 
@@ -25,10 +25,17 @@
 #include <string.h>
 #include <X11/Xlib.h>
 #include <math.h>
+#include <pthread.h>
 
 #include "config.h"
 #include "wraster.h"
 #include "scale.h"
+#include "cpu.h"
+#include "parallel.h"
+
+#ifdef WRASTER_X86_SIMD
+#include <emmintrin.h>
+#endif
 
 /*
  *----------------------------------------------------------------------
@@ -273,218 +280,425 @@ void wraster_change_filter(RScalingFilter type)
 
 /*
  *	image rescaling routine
+ *
+ * The filter is applied in two passes, horizontally into an intermediate
+ * image and then vertically, as in the original Graphics Gems code. The
+ * contributions are 2.14 fixed point weights on contiguous source ranges
+ * (the pixels mirrored at the edges are folded into the range), computed
+ * once per (source size, target size, filter) and kept in a small cache,
+ * as the same sizes are scaled again and again (icons, previews). Large
+ * images are processed in bands by several threads.
  */
 
-typedef struct {
-  int pixel;
-  double weight;
-} CONTRIB;
+#define WEIGHT_BITS 14
 
-typedef struct {
-  int n;      /* number of contributors */
-  CONTRIB *p; /* pointer to list of contributions */
-} CLIST;
+typedef struct RScaleTable {
+  unsigned src_len, dst_len;
+  double (*filter)(double);
+  double support;
 
-/* clamp the input to the specified range */
-#define CLAMP(v, l, h) ((v) < (l) ? (l) : (v) > (h) ? (h) : v)
+  int *start;     /* first source pixel of each target pixel */
+  int *count;     /* number of source pixels */
+  short *weights; /* 'stride' weights per target pixel, 0 padded */
+  int stride;
 
-/* return of calloc is not checked if NULL in the function below! */
-RImage *RSmoothScaleImage(RImage *src, unsigned new_width, unsigned new_height)
+  int refCount;
+  struct RScaleTable *next;
+} RScaleTable;
+
+#define SCALE_TABLE_CACHE_SIZE 16
+
+static RScaleTable *scaleTables = NULL;
+static pthread_mutex_t scaleTablesLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void release_table(RScaleTable *table)
 {
-  CLIST *contrib;             /* array of contribution lists */
-  RImage *tmp;                /* intermediate image */
-  double xscale, yscale;      /* zoom scale factors */
-  int i, j, k;                /* loop variables */
-  int n;                      /* pixel number */
-  double center, left, right; /* filter calculation variables */
-  double width, fscale;       /* filter calculation variables */
-  double rweight, gweight, bweight;
-  RImage *dst;
-  unsigned char *p;
-  unsigned char *sp;
-  int sch = src->format == RRGBAFormat ? 4 : 3;
+  pthread_mutex_lock(&scaleTablesLock);
+  table->refCount--;
+  if (table->refCount > 0)
+    table = NULL;
+  pthread_mutex_unlock(&scaleTablesLock);
+
+  if (table) {
+    free(table->start);
+    free(table->count);
+    free(table->weights);
+    free(table);
+  }
+}
 
-  dst = RCreateImage(new_width, new_height, False);
+static RScaleTable *compute_table(unsigned src_len, unsigned dst_len, double (*filter)(double),
+                                  double support)
+{
+  RScaleTable *table;
+  double scale = (double)dst_len / (double)src_len;
+  double width, fscale;
+  double *fold;
+  int i, j, n, lo, hi;
+
+  /* pre-calculate filter contributions for a row/column */
+  if (scale < 1.0) {
+    width = support / scale;
+    fscale = 1.0 / scale;
+  } else {
+    width = support;
+    fscale = 1.0;
+  }
 
-  /* create intermediate image to hold horizontal zoom */
-  tmp = RCreateImage(dst->width, src->height, False);
-  xscale = (double)new_width / (double)src->width;
-  yscale = (double)new_height / (double)src->height;
-
-  /* pre-calculate filter contributions for a row */
-  contrib = (CLIST *)calloc(new_width, sizeof(CLIST));
-  if (xscale < 1.0) {
-    width = fwidth / xscale;
-    fscale = 1.0 / xscale;
-    for (i = 0; i < new_width; ++i) {
-      contrib[i].n = 0;
-      contrib[i].p = (CONTRIB *)calloc((int)ceil(width * 2 + 1), sizeof(CONTRIB));
-      center = (double)i / xscale;
-      left = ceil(center - width);
-      right = floor(center + width);
-      for (j = left; j <= right; ++j) {
-        rweight = center - (double)j;
-        rweight = (*filterf)(rweight / fscale) / fscale;
-        if (j < 0) {
-          n = -j;
-        } else if (j >= src->width) {
-          n = (src->width - j) + src->width - 1;
-        } else {
-          n = j;
-        }
-        k = contrib[i].n++;
-        contrib[i].p[k].pixel = n * sch;
-        contrib[i].p[k].weight = rweight;
+  table = calloc(1, sizeof(RScaleTable));
+  fold = calloc(src_len, sizeof(double));
+  if (!table || !fold) {
+    free(table);
+    free(fold);
+    return NULL;
+  }
+  table->src_len = src_len;
+  table->dst_len = dst_len;
+  table->filter = filter;
+  table->support = support;
+  table->refCount = 1;
+  table->stride = ((int)ceil(width * 2 + 1) + 2) & ~1;
+  table->start = malloc(dst_len * sizeof(int));
+  table->count = malloc(dst_len * sizeof(int));
+  table->weights = calloc(dst_len * table->stride, sizeof(short));
+  if (!table->start || !table->count || !table->weights) {
+    free(fold);
+    release_table(table);
+    return NULL;
+  }
+
+  for (i = 0; i < dst_len; ++i) {
+    double center = (double)i / scale;
+    int left = ceil(center - width);
+    int right = floor(center + width);
+    short *w = table->weights + i * table->stride;
+
+    lo = src_len;
+    hi = -1;
+    for (j = left; j <= right; ++j) {
+      double weight = (*filter)((center - (double)j) / fscale) / fscale;
+
+      if (j < 0)
+        n = -j;
+      else if (j >= (int)src_len)
+        n = 2 * (int)src_len - 1 - j;
+      else
+        n = j;
+      /* only happens when the filter is wider than the whole image */
+      if (n < 0)
+        n = 0;
+      else if (n >= (int)src_len)
+        n = src_len - 1;
+
+      fold[n] += weight;
+      if (n < lo)
+        lo = n;
+      if (n > hi)
+        hi = n;
+    }
+    if (hi < lo)
+      lo = hi = 0;
+
+    table->start[i] = lo;
+    table->count[i] = hi - lo + 1;
+    for (n = lo; n <= hi; n++) {
+      w[n - lo] = lrint(fold[n] * (1 << WEIGHT_BITS));
+      fold[n] = 0.0;
+    }
+  }
+  free(fold);
+
+  return table;
+}
+
+static RScaleTable *get_table(unsigned src_len, unsigned dst_len)
+{
+  RScaleTable *table, *prev = NULL;
+  int count = 0;
+
+  pthread_mutex_lock(&scaleTablesLock);
+  for (table = scaleTables; table; prev = table, table = table->next) {
+    if (table->src_len == src_len && table->dst_len == dst_len && table->filter == filterf &&
+        table->support == fwidth) {
+      /* move to front */
+      if (prev) {
+        prev->next = table->next;
+        table->next = scaleTables;
+        scaleTables = table;
       }
+      table->refCount++;
+      pthread_mutex_unlock(&scaleTablesLock);
+      return table;
     }
-  } else {
-    for (i = 0; i < new_width; ++i) {
-      contrib[i].n = 0;
-      contrib[i].p = (CONTRIB *)calloc((int)ceil(fwidth * 2 + 1), sizeof(CONTRIB));
-      center = (double)i / xscale;
-      left = ceil(center - fwidth);
-      right = floor(center + fwidth);
-      for (j = left; j <= right; ++j) {
-        rweight = center - (double)j;
-        rweight = (*filterf)(rweight);
-        if (j < 0) {
-          n = -j;
-        } else if (j >= src->width) {
-          n = (src->width - j) + src->width - 1;
-        } else {
-          n = j;
-        }
-        k = contrib[i].n++;
-        contrib[i].p[k].pixel = n * sch;
-        contrib[i].p[k].weight = rweight;
+  }
+  pthread_mutex_unlock(&scaleTablesLock);
+
+  table = compute_table(src_len, dst_len, filterf, fwidth);
+  if (!table)
+    return NULL;
+
+  pthread_mutex_lock(&scaleTablesLock);
+  table->refCount++; /* one for the cache, one for the caller */
+  table->next = scaleTables;
+  scaleTables = table;
+
+  /* drop the least recently used ones */
+  for (prev = table; prev->next; prev = prev->next) {
+    if (++count == SCALE_TABLE_CACHE_SIZE) {
+      RScaleTable *old = prev->next;
+
+      prev->next = NULL;
+      pthread_mutex_unlock(&scaleTablesLock);
+      while (old) {
+        RScaleTable *next = old->next;
+
+        release_table(old);
+        old = next;
       }
+      return table;
     }
   }
+  pthread_mutex_unlock(&scaleTablesLock);
 
-  /* apply filter to zoom horizontally from src to tmp */
-  p = tmp->data;
+  return table;
+}
 
-  for (k = 0; k < tmp->height; ++k) {
-    CONTRIB *pp;
+void wraster_release_scale_tables(void)
+{
+  RScaleTable *table;
 
-    sp = src->data + src->width * k * sch;
+  pthread_mutex_lock(&scaleTablesLock);
+  table = scaleTables;
+  scaleTables = NULL;
+  pthread_mutex_unlock(&scaleTablesLock);
 
-    for (i = 0; i < tmp->width; ++i) {
-      rweight = gweight = bweight = 0.0;
+  while (table) {
+    RScaleTable *next = table->next;
 
-      pp = contrib[i].p;
+    release_table(table);
+    table = next;
+  }
+}
 
-      for (j = 0; j < contrib[i].n; ++j) {
-        rweight += sp[pp[j].pixel] * pp[j].weight;
-        gweight += sp[pp[j].pixel + 1] * pp[j].weight;
-        bweight += sp[pp[j].pixel + 2] * pp[j].weight;
-      }
-      *p++ = CLAMP(rweight, 0, 255);
-      *p++ = CLAMP(gweight, 0, 255);
-      *p++ = CLAMP(bweight, 0, 255);
+static inline unsigned char clamp_weighted(int v)
+{
+  v >>= WEIGHT_BITS;
+  return (v < 0) ? 0 : (v > 255) ? 255 : v;
+}
+
+/* horizontal pass: 'count' RGB(A) pixels of 'src' into RGB pixels of 'dst' */
+static void scale_row(unsigned char *dst, const unsigned char *src, int sch,
+                      const RScaleTable *table)
+{
+  int i, k;
+
+  for (i = 0; i < table->dst_len; i++) {
+    const unsigned char *sp = src + table->start[i] * sch;
+    const short *w = table->weights + i * table->stride;
+    int r = 0, g = 0, b = 0;
+
+    for (k = 0; k < table->count[i]; k++, sp += sch) {
+      r += sp[0] * w[k];
+      g += sp[1] * w[k];
+      b += sp[2] * w[k];
     }
+    *dst++ = clamp_weighted(r);
+    *dst++ = clamp_weighted(g);
+    *dst++ = clamp_weighted(b);
   }
+}
 
-  /* free the memory allocated for horizontal filter weights */
-  for (i = 0; i < new_width; ++i) {
-    free(contrib[i].p);
+/*
+ * vertical pass: 'len' bytes of a row from the rows of the intermediate
+ * image, which are 'stride' bytes long
+ */
+static void scale_column(unsigned char *dst, const unsigned char *src, int stride, int len,
+                         int start, int count, const short *w)
+{
+  int x, k;
+
+  src += start * stride;
+  for (x = 0; x < len; x++) {
+    const unsigned char *sp = src + x;
+    int v = 0;
+
+    for (k = 0; k < count; k++, sp += stride)
+      v += *sp * w[k];
+    *dst++ = clamp_weighted(v);
   }
-  free(contrib);
-
-  /* pre-calculate filter contributions for a column */
-  contrib = (CLIST *)calloc(dst->height, sizeof(CLIST));
-  if (yscale < 1.0) {
-    width = fwidth / yscale;
-    fscale = 1.0 / yscale;
-    for (i = 0; i < dst->height; ++i) {
-      contrib[i].n = 0;
-      contrib[i].p = (CONTRIB *)calloc((int)ceil(width * 2 + 1), sizeof(CONTRIB));
-      center = (double)i / yscale;
-      left = ceil(center - width);
-      right = floor(center + width);
-      for (j = left; j <= right; ++j) {
-        rweight = center - (double)j;
-        rweight = (*filterf)(rweight / fscale) / fscale;
-        if (j < 0) {
-          n = -j;
-        } else if (j >= tmp->height) {
-          n = (tmp->height - j) + tmp->height - 1;
-        } else {
-          n = j;
-        }
-        k = contrib[i].n++;
-        contrib[i].p[k].pixel = n * 3;
-        contrib[i].p[k].weight = rweight;
-      }
+}
+
+#ifdef WRASTER_X86_SIMD
+
+WRASTER_TARGET("sse2")
+static inline __m128i load_pixel(const unsigned char *p)
+{
+  int v;
+
+  /* for RGB this reads one byte ahead, RCreateImage() leaves 4 spare bytes */
+  memcpy(&v, p, sizeof(v));
+  return _mm_cvtsi32_si128(v);
+}
+
+/*
+ * Both SSE2 passes multiply two source pixels at once with pmaddwd,
+ * interleaving their channels as 16 bit values next to a pair of weights.
+ */
+WRASTER_TARGET("sse2")
+static void scale_row_sse2(unsigned char *dst, const unsigned char *src, int sch,
+                           const RScaleTable *table)
+{
+  const __m128i zero = _mm_setzero_si128();
+  int i, k;
+
+  for (i = 0; i < table->dst_len; i++) {
+    const unsigned char *sp = src + table->start[i] * sch;
+    const short *w = table->weights + i * table->stride;
+    const int count = table->count[i];
+    __m128i acc = zero;
+    int v;
+
+    for (k = 0; k < count; k += 2, sp += 2 * sch) {
+      __m128i p0 = load_pixel(sp);
+      __m128i p1 = (k + 1 < count) ? load_pixel(sp + sch) : zero;
+      __m128i pw;
+
+      /* weights are 0 padded, so w[k + 1] is valid */
+      memcpy(&v, w + k, sizeof(v));
+      pw = _mm_set1_epi32(v);
+      p0 = _mm_unpacklo_epi8(_mm_unpacklo_epi8(p0, p1), zero);
+      acc = _mm_add_epi32(acc, _mm_madd_epi16(p0, pw));
     }
-  } else {
-    for (i = 0; i < dst->height; ++i) {
-      contrib[i].n = 0;
-      contrib[i].p = (CONTRIB *)calloc((int)ceil(fwidth * 2 + 1), sizeof(CONTRIB));
-      center = (double)i / yscale;
-      left = ceil(center - fwidth);
-      right = floor(center + fwidth);
-      for (j = left; j <= right; ++j) {
-        rweight = center - (double)j;
-        rweight = (*filterf)(rweight);
-        if (j < 0) {
-          n = -j;
-        } else if (j >= tmp->height) {
-          n = (tmp->height - j) + tmp->height - 1;
-        } else {
-          n = j;
-        }
-        k = contrib[i].n++;
-        contrib[i].p[k].pixel = n * 3;
-        contrib[i].p[k].weight = rweight;
-      }
+    acc = _mm_srai_epi32(acc, WEIGHT_BITS);
+    acc = _mm_packus_epi16(_mm_packs_epi32(acc, acc), zero);
+    v = _mm_cvtsi128_si32(acc);
+    *dst++ = v;
+    *dst++ = v >> 8;
+    *dst++ = v >> 16;
+  }
+}
+
+WRASTER_TARGET("sse2")
+static void scale_column_sse2(unsigned char *dst, const unsigned char *src, int stride, int len,
+                              int start, int count, const short *w)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const unsigned char *row = src + start * stride;
+  int x, k;
+
+  for (x = 0; x + 8 <= len; x += 8) {
+    const unsigned char *sp = row + x;
+    __m128i lo = zero, hi = zero;
+
+    for (k = 0; k < count; k += 2, sp += 2 * stride) {
+      __m128i r0 = _mm_loadl_epi64((const __m128i *)sp);
+      __m128i r1 = (k + 1 < count) ? _mm_loadl_epi64((const __m128i *)(sp + stride)) : zero;
+      __m128i pw;
+      int v;
+
+      memcpy(&v, w + k, sizeof(v));
+      pw = _mm_set1_epi32(v);
+      r0 = _mm_unpacklo_epi8(r0, r1);
+      lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi8(r0, zero), pw));
+      hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi8(r0, zero), pw));
     }
+    lo = _mm_packs_epi32(_mm_srai_epi32(lo, WEIGHT_BITS), _mm_srai_epi32(hi, WEIGHT_BITS));
+    _mm_storel_epi64((__m128i *)(dst + x), _mm_packus_epi16(lo, zero));
   }
+  scale_column(dst + x, src + x, stride, len - x, start, count, w);
+}
 
-  /* apply filter to zoom vertically from tmp to dst */
-  sp = malloc(tmp->height * 3);
+#endif /* WRASTER_X86_SIMD */
 
-  for (k = 0; k < new_width; ++k) {
-    CONTRIB *pp;
+typedef struct {
+  RImage *src, *tmp, *dst;
+  RScaleTable *xtable, *ytable;
+  int simd;
+} RSmoothScaleJob;
 
-    p = dst->data + k * 3;
+static void scale_rows(void *data, int first, int last)
+{
+  RSmoothScaleJob *job = data;
+  int sch = job->src->format == RRGBAFormat ? 4 : 3;
+  int y;
+
+  for (y = first; y < last; y++) {
+    unsigned char *d = job->tmp->data + y * job->tmp->width * 3;
+    unsigned char *s = job->src->data + y * job->src->width * sch;
+
+#ifdef WRASTER_X86_SIMD
+    if (job->simd)
+      scale_row_sse2(d, s, sch, job->xtable);
+    else
+#endif
+      scale_row(d, s, sch, job->xtable);
+  }
+}
 
-    /* copy a column into a row */
-    {
-      int i;
-      unsigned char *p, *d;
+static void scale_columns(void *data, int first, int last)
+{
+  RSmoothScaleJob *job = data;
+  RScaleTable *table = job->ytable;
+  int len = job->dst->width * 3;
+  int y;
+
+  for (y = first; y < last; y++) {
+    unsigned char *d = job->dst->data + y * len;
+    const short *w = table->weights + y * table->stride;
+
+#ifdef WRASTER_X86_SIMD
+    if (job->simd)
+      scale_column_sse2(d, job->tmp->data, len, len, table->start[y], table->count[y], w);
+    else
+#endif
+      scale_column(d, job->tmp->data, len, len, table->start[y], table->count[y], w);
+  }
+}
 
-      d = sp;
-      for (i = tmp->height, p = tmp->data + k * 3; i-- > 0; p += tmp->width * 3) {
-        *d++ = *p;
-        *d++ = *(p + 1);
-        *d++ = *(p + 2);
-      }
-    }
-    for (i = 0; i < new_height; ++i) {
-      rweight = gweight = bweight = 0.0;
+/* min. number of target pixels worth giving to a thread */
+#define SCALE_BAND_PIXELS (128 * 128)
 
-      pp = contrib[i].p;
+RImage *RSmoothScaleImage(RImage *src, unsigned new_width, unsigned new_height)
+{
+  RSmoothScaleJob job;
+  RImage *tmp, *dst;
 
-      for (j = 0; j < contrib[i].n; ++j) {
-        rweight += sp[pp[j].pixel] * pp[j].weight;
-        gweight += sp[pp[j].pixel + 1] * pp[j].weight;
-        bweight += sp[pp[j].pixel + 2] * pp[j].weight;
-      }
-      *p = CLAMP(rweight, 0, 255);
-      *(p + 1) = CLAMP(gweight, 0, 255);
-      *(p + 2) = CLAMP(bweight, 0, 255);
-      p += new_width * 3;
-    }
+  dst = RCreateImage(new_width, new_height, False);
+  if (!dst)
+    return NULL;
+
+  /* create intermediate image to hold horizontal zoom */
+  tmp = RCreateImage(new_width, src->height, False);
+  if (!tmp) {
+    RReleaseImage(dst);
+    return NULL;
   }
-  free(sp);
 
-  /* free the memory allocated for vertical filter weights */
-  for (i = 0; i < dst->height; ++i) {
-    free(contrib[i].p);
+  job.src = src;
+  job.tmp = tmp;
+  job.dst = dst;
+  job.xtable = get_table(src->width, new_width);
+  job.ytable = get_table(src->height, new_height);
+  job.simd = (wraster_cpu_level() >= RCPUSSE2);
+  if (!job.xtable || !job.ytable) {
+    if (job.xtable)
+      release_table(job.xtable);
+    if (job.ytable)
+      release_table(job.ytable);
+    RReleaseImage(tmp);
+    RReleaseImage(dst);
+    RErrorCode = RERR_NOMEMORY;
+    return NULL;
   }
-  free(contrib);
 
+  /* apply filter to zoom horizontally from src to tmp */
+  wraster_run_bands(tmp->height, SCALE_BAND_PIXELS / tmp->width + 1, scale_rows, &job);
+
+  /* apply filter to zoom vertically from tmp to dst */
+  wraster_run_bands(dst->height, SCALE_BAND_PIXELS / dst->width + 1, scale_columns, &job);
+
+  release_table(job.xtable);
+  release_table(job.ytable);
   RReleaseImage(tmp);
 
   return dst;
@@ -25,4 +25,9 @@
  */
 void wraster_change_filter(RScalingFilter type);
 
+/*
+ * Function to release the cached filter contribution tables
+ */
+void wraster_release_scale_tables(void);
+
 #endif
@@ -0,0 +1,105 @@
+/*
+ * Micro-benchmark of the TrueColor row converters used by RConvertImage.
+ *
+ * Runs headless: the kernels are timed on memory buffers, no X server
+ * is needed. Every vector kernel is also checked against the plain C one.
+ *
+ * usage: benchconvert [width height [iterations]]
+ */
+
+#include <X11/Xlib.h>
+#include "wraster.h"
+#include "convert.h"
+#include "cpu.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const char *layout_names[] = { "?", "xRGB8888", "BGRx8888", "RGB565" };
+static const char *level_names[] = { "generic", "sse2", "avx2" };
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	int width = 1920, height = 1080, iterations = 20;
+	int layout, channels, level, max_level, i, y;
+	unsigned char *src, *dst, *ref;
+	int status = 0;
+
+	if (argc > 2) {
+		width = atoi(argv[1]);
+		height = atoi(argv[2]);
+	}
+	if (argc > 3)
+		iterations = atoi(argv[3]);
+	if (width < 1 || height < 1 || iterations < 1) {
+		fprintf(stderr, "usage: %s [width height [iterations]]\n", argv[0]);
+		exit(1);
+	}
+
+	/* +4 like RCreateImage(), the RGB kernels may read a little ahead */
+	src = malloc(width * height * 4 + 4);
+	dst = malloc(width * height * 4);
+	ref = malloc(width * height * 4);
+	if (!src || !dst || !ref) {
+		fprintf(stderr, "Cannot allocate memory!\n");
+		exit(1);
+	}
+	srand(1);
+	for (i = 0; i < width * height * 4 + 4; i++)
+		src[i] = rand();
+
+	max_level = wraster_cpu_level();
+	printf("%dx%d, %d iterations, cpu level %s\n", width, height, iterations,
+	       level_names[max_level]);
+
+	for (layout = RLayoutXRGB8888; layout <= RLayoutRGB565; layout++) {
+		int bpp = (layout == RLayoutRGB565) ? 2 : 4;
+
+		for (channels = 3; channels <= 4; channels++) {
+			RConvertRowProc generic = wraster_truecolor_row_proc(layout, channels, RCPUGeneric);
+
+			for (y = 0; y < height; y++)
+				generic(ref + y * width * bpp, src + y * width * channels, width);
+
+			for (level = RCPUGeneric; level <= max_level; level++) {
+				RConvertRowProc proc = wraster_truecolor_row_proc(layout, channels, level);
+				double start, elapsed;
+
+				/* skip levels falling back to the same kernel */
+				if (level > RCPUGeneric &&
+				    proc == wraster_truecolor_row_proc(layout, channels, level - 1))
+					continue;
+
+				memset(dst, 0, width * height * bpp);
+				start = now();
+				for (i = 0; i < iterations; i++) {
+					for (y = 0; y < height; y++)
+						proc(dst + y * width * bpp, src + y * width * channels, width);
+				}
+				elapsed = now() - start;
+
+				printf("%-9s %s %-8s %8.1f Mpixel/s%s\n", layout_names[layout],
+				       channels == 4 ? "RGBA" : "RGB ", level_names[level],
+				       (double)width * height * iterations / elapsed / 1e6,
+				       memcmp(dst, ref, width * height * bpp) ? "  MISMATCH" : "");
+				if (memcmp(dst, ref, width * height * bpp))
+					status = 1;
+			}
+		}
+	}
+
+	free(src);
+	free(dst);
+	free(ref);
+
+	return status;
+}
@@ -0,0 +1,671 @@
+/*
+ * Benchmark of the libwraster operations, usable as a regression gate.
+ *
+ * Times the loading of every format the library can save (and of the
+ * files given with -i), RScaleImage(), RSmoothScaleImage() with each
+ * filter, the gradients, RCombineArea(), RRotateImage(), the blurs and
+ * RConvertImage() at several image sizes. RConvertImage() needs an X
+ * display, Xvfb is enough (xvfb-run benchwraster); the rest runs
+ * headless. The results are written as JSON, one benchmark per line.
+ *
+ * Compared with a previous run (-b, or -c for two saved runs), the
+ * benchmarks whose median time grew by more than the threshold are
+ * reported and the exit status is 1.
+ *
+ * usage: benchwraster [-s WxH,...] [-t seconds] [-m pattern] [-i image]...
+ *                     [-o results.json] [-b baseline.json] [-T percent]
+ *        benchwraster -c baseline.json results.json [-T percent]
+ */
+
+#include "config.h"
+#include <X11/Xlib.h>
+#include "wraster.h"
+#include "imgformat.h"
+#include "scale.h"
+#include "cpu.h"
+#include "parallel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#define MIN_RUNS 3
+#define MAX_RUNS 10000
+#define MAX_FILES 16
+
+/* smaller changes are the resolution of the clock, not regressions */
+#define MIN_REGRESSION_MS 0.01
+
+static const char *level_names[] = { "generic", "sse2", "avx2" };
+
+typedef struct {
+	char name[64];
+	unsigned width, height;
+	double median, min; /* milliseconds */
+	int runs;
+} Result;
+
+typedef struct {
+	Result *items;
+	int count, size;
+} ResultList;
+
+/* returns False if the operation failed, the benchmark is then skipped */
+typedef Bool BenchProc(void *data);
+
+static ResultList Results;
+static double MinTime = 0.25;
+static const char *Pattern = NULL;
+
+static RContext *Context;
+static unsigned Width, Height;
+static RImage *Source;    /* RGBA */
+static RImage *SourceRGB; /* the same without alpha */
+static RImage *Target;    /* for the compositing */
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compare_times(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static Result *add_result(ResultList *list, const char *name, unsigned width, unsigned height)
+{
+	Result *result;
+
+	if (list->count == list->size) {
+		list->size = list->size ? list->size * 2 : 64;
+		list->items = realloc(list->items, list->size * sizeof(Result));
+		if (!list->items) {
+			fprintf(stderr, "Cannot allocate memory!\n");
+			exit(2);
+		}
+	}
+	result = &list->items[list->count++];
+	memset(result, 0, sizeof(Result));
+	snprintf(result->name, sizeof(result->name), "%s", name);
+	result->width = width;
+	result->height = height;
+
+	return result;
+}
+
+static Result *find_result(ResultList *list, const char *name, unsigned width, unsigned height)
+{
+	int i;
+
+	for (i = 0; i < list->count; i++) {
+		if (strcmp(list->items[i].name, name) == 0 && list->items[i].width == width &&
+		    list->items[i].height == height)
+			return &list->items[i];
+	}
+
+	return NULL;
+}
+
+/* runs 'proc' for at least MinTime seconds and records the median time */
+static void measure(const char *name, BenchProc *proc, void *data)
+{
+	static double times[MAX_RUNS];
+	double start, total = 0;
+	Result *result;
+	int runs = 0;
+
+	if (Pattern && !strstr(name, Pattern))
+		return;
+
+	/* the first run fills the caches and builds the tables */
+	if (!proc(data)) {
+		fprintf(stderr, "%-26s %5ux%-5u skipped: %s\n", name, Width, Height,
+			RMessageForError(RErrorCode));
+		return;
+	}
+
+	while ((runs < MIN_RUNS || total < MinTime) && runs < MAX_RUNS) {
+		start = now();
+		proc(data);
+		times[runs] = (now() - start) * 1000;
+		total += times[runs] / 1000;
+		runs++;
+	}
+	qsort(times, runs, sizeof(double), compare_times);
+
+	result = add_result(&Results, name, Width, Height);
+	result->median = (runs & 1) ? times[runs / 2] : (times[runs / 2 - 1] + times[runs / 2]) / 2;
+	result->min = times[0];
+	result->runs = runs;
+
+	fprintf(stderr, "%-26s %5ux%-5u %10.3f ms %10.3f Mpixel/s\n", name, Width, Height,
+		result->median, Width * Height / result->median / 1000);
+}
+
+/***************************************************************************/
+
+static Bool bench_load(void *data)
+{
+	RImage *image = RLoadImage(Context, (const char *)data, 0);
+
+	RReleaseImage(image);
+	return image != NULL;
+}
+
+static Bool bench_scale(void *data)
+{
+	float factor = *(float *)data;
+
+	RReleaseImage(RScaleImage(Source, Width * factor, Height * factor));
+	return True;
+}
+
+static Bool bench_smooth_scale(void *data)
+{
+	float factor = *(float *)data;
+
+	RReleaseImage(RSmoothScaleImage(Source, Width * factor, Height * factor));
+	return True;
+}
+
+static Bool bench_gradient(void *data)
+{
+	static const RColor from = { 0x20, 0x40, 0x80, 0xff }, to = { 0xf0, 0xe0, 0x10, 0xff };
+
+	RReleaseImage(RRenderGradient(Width, Height, &from, &to, *(RGradientStyle *)data));
+	return True;
+}
+
+static Bool bench_multi_gradient(void *data)
+{
+	RColor c1 = { 0x20, 0x40, 0x80, 0xff }, c2 = { 0xf0, 0xe0, 0x10, 0xff };
+	RColor c3 = { 0x00, 0x90, 0x30, 0xff }, c4 = { 0xc0, 0x00, 0xc0, 0xff };
+	RColor *colors[] = { &c1, &c2, &c3, &c4, NULL };
+
+	RReleaseImage(RRenderMultiGradient(Width, Height, colors, *(RGradientStyle *)data));
+	return True;
+}
+
+static Bool bench_interwoven_gradient(void *data)
+{
+	RColor colors1[2] = { { 0x20, 0x40, 0x80, 0xff }, { 0xf0, 0xe0, 0x10, 0xff } };
+	RColor colors2[2] = { { 0x00, 0x90, 0x30, 0xff }, { 0xc0, 0x00, 0xc0, 0xff } };
+
+	(void)data;
+	RReleaseImage(RRenderInterwovenGradient(Width, Height, colors1, 8, colors2, 5));
+	return True;
+}
+
+static Bool bench_combine(void *data)
+{
+	RImage *dst = (RImage *)data;
+
+	RCombineArea(dst, Source, 0, 0, Width, Height, 0, 0);
+	return True;
+}
+
+static Bool bench_combine_opacity(void *data)
+{
+	RImage *dst = (RImage *)data;
+
+	RCombineAreaWithOpaqueness(dst, Source, 0, 0, Width, Height, 0, 0, 160);
+	return True;
+}
+
+static Bool bench_rotate(void *data)
+{
+	RReleaseImage(RRotateImage(Source, *(float *)data));
+	return True;
+}
+
+static Bool bench_blur(void *data)
+{
+	(void)data;
+	return RBlurImage(Target);
+}
+
+static Bool bench_blur_radius(void *data)
+{
+	return RBlurImageRadius(Target, *(float *)data);
+}
+
+static Bool bench_convert(void *data)
+{
+	Pixmap pixmap;
+
+	if (!RConvertImage(Context, (RImage *)data, &pixmap))
+		return False;
+	XFreePixmap(Context->dpy, pixmap);
+	/* the pixels are only in the pixmap once the server has them */
+	XSync(Context->dpy, False);
+	return True;
+}
+
+/***************************************************************************/
+
+/* a photograph-like image: smooth shades, edges and some noise */
+static RImage *make_source(unsigned width, unsigned height)
+{
+	RImage *image = RCreateImage(width, height, True);
+	unsigned char *p = image->data;
+	unsigned x, y;
+
+	for (y = 0; y < height; y++) {
+		for (x = 0; x < width; x++, p += 4) {
+			int noise = rand() % 16;
+			int band = ((x / 37 + y / 23) & 1) ? 40 : 0;
+
+			p[0] = (x * 255 / width + noise + band) & 0xff;
+			p[1] = (y * 255 / height + noise) & 0xff;
+			p[2] = ((x + y) * 127 / (width + height) + band) & 0xff;
+			p[3] = (x * 2 < width) ? 255 : (((x ^ y) >> 3) & 1) ? 128 + noise * 8 : 0;
+		}
+	}
+
+	return image;
+}
+
+static Bool save_ppm(RImage *image, const char *file)
+{
+	FILE *f = fopen(file, "wb");
+	unsigned char *p = image->data;
+	int i, count = image->width * image->height;
+
+	if (!f)
+		return False;
+	fprintf(f, "P6\n%u %u\n255\n", image->width, image->height);
+	for (i = 0; i < count; i++, p += 4)
+		fwrite(p, 1, 3, f);
+
+	return fclose(f) == 0;
+}
+
+static Bool save_image(RImage *image, const char *file, const char *format)
+{
+#ifdef USE_PNG
+	if (strcmp(format, "PNG") == 0)
+		return RSavePNG(image, file, NULL);
+#endif
+#ifdef USE_JPEG
+	if (strcmp(format, "JPEG") == 0)
+		return RSaveJPEG(image, file, NULL);
+#endif
+	if (strcmp(format, "XPM") == 0)
+		return RSaveXPM(image, file);
+	if (strcmp(format, "PPM") == 0)
+		return save_ppm(image, file);
+
+	RErrorCode = RERR_BADFORMAT;
+	return False;
+}
+
+static void bench_loads(const char *dir, char **files, int file_count)
+{
+	static const struct {
+		const char *format, *extension;
+	} formats[] = { { "PNG", "png" }, { "JPEG", "jpeg" }, { "XPM", "xpm" }, { "PPM", "ppm" } };
+	char file[1024], name[64];
+	RImage *image;
+	int i, j;
+
+	for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+		snprintf(name, sizeof(name), "load/%s", formats[i].extension);
+		if (Pattern && !strstr(name, Pattern))
+			continue;
+
+		snprintf(file, sizeof(file), "%s/image-%ux%u.%s", dir, Width, Height,
+			 formats[i].extension);
+		if (strcmp(formats[i].format, "XPM") == 0) {
+			/* a few colors, the XPM code can't handle millions of them */
+			unsigned char *p;
+
+			image = RCloneImage(Source);
+			for (p = image->data, j = 0; j < Width * Height; j++, p += 4) {
+				p[0] &= 0xe0;
+				p[1] &= 0xe0;
+				p[2] &= 0xc0;
+				p[3] = p[3] < 128 ? 0 : 255;
+			}
+		} else {
+			image = RRetainImage(Source);
+		}
+
+		if (!save_image(image, file, formats[i].format)) {
+			fprintf(stderr, "%-26s %5ux%-5u skipped: %s\n", name, Width, Height,
+				RMessageForError(RErrorCode));
+		} else {
+			measure(name, bench_load, file);
+		}
+		unlink(file);
+		RReleaseImage(image);
+	}
+
+	for (i = 0; i < file_count; i++) {
+		char *format = RGetImageFileFormat(files[i]);
+
+		snprintf(name, sizeof(name), "load/%s", format ? format : files[i]);
+		image = RLoadImage(Context, files[i], 0);
+		if (image) {
+			/* the size of the image, not the current one */
+			unsigned width = Width, height = Height;
+
+			Width = image->width;
+			Height = image->height;
+			measure(name, bench_load, files[i]);
+			Width = width;
+			Height = height;
+			RReleaseImage(image);
+		} else {
+			fprintf(stderr, "%s: %s\n", files[i], RMessageForError(RErrorCode));
+		}
+	}
+}
+
+static void run_benchmarks(unsigned width, unsigned height, const char *dir, char **files,
+			   int file_count)
+{
+	static const char *filter_names[] = { "box", "triangle", "bell", "bspline", "lanczos3",
+					      "mitchell" };
+	static float half = 0.5F, up = 1.5F;
+	static float angles[] = { 90, 180, 30 };
+	static float radius = 8;
+	static RGradientStyle styles[] = { RHorizontalGradient, RVerticalGradient,
+					   RDiagonalGradient };
+	static const char *style_names[] = { "horizontal", "vertical", "diagonal" };
+	char name[64];
+	RImage *rgb_target;
+	int i;
+
+	Width = width;
+	Height = height;
+	Source = make_source(width, height);
+	SourceRGB = RCreateImage(width, height, False);
+	for (i = 0; i < width * height; i++)
+		memcpy(SourceRGB->data + i * 3, Source->data + i * 4, 3);
+	Target = RCloneImage(Source);
+	rgb_target = RCloneImage(SourceRGB);
+
+	bench_loads(dir, files, file_count);
+
+	measure("scale/down", bench_scale, &half);
+	measure("scale/up", bench_scale, &up);
+	for (i = RBoxFilter; i <= RMitchellFilter; i++) {
+		wraster_change_filter(i);
+		snprintf(name, sizeof(name), "smoothscale/%s", filter_names[i]);
+		measure(name, bench_smooth_scale, &half);
+	}
+	wraster_change_filter(RMitchellFilter);
+	measure("smoothscale/up", bench_smooth_scale, &up);
+
+	for (i = 0; i < sizeof(styles) / sizeof(styles[0]); i++) {
+		snprintf(name, sizeof(name), "gradient/%s", style_names[i]);
+		measure(name, bench_gradient, &styles[i]);
+		snprintf(name, sizeof(name), "gradient/multi-%s", style_names[i]);
+		measure(name, bench_multi_gradient, &styles[i]);
+	}
+	measure("gradient/interwoven", bench_interwoven_gradient, NULL);
+
+	measure("combine/rgba", bench_combine, Target);
+	measure("combine/rgba-opacity", bench_combine_opacity, Target);
+	measure("combine/rgb", bench_combine, rgb_target);
+
+	for (i = 0; i < sizeof(angles) / sizeof(angles[0]); i++) {
+		snprintf(name, sizeof(name), "rotate/%g", angles[i]);
+		measure(name, bench_rotate, &angles[i]);
+	}
+
+	measure("blur/3x3", bench_blur, NULL);
+	measure("blur/radius", bench_blur_radius, &radius);
+
+	if (Context->dpy) {
+		measure("convert/rgb", bench_convert, SourceRGB);
+		measure("convert/rgba", bench_convert, Source);
+	}
+
+	RReleaseImage(Source);
+	RReleaseImage(SourceRGB);
+	RReleaseImage(Target);
+	RReleaseImage(rgb_target);
+}
+
+/***************************************************************************/
+
+static Bool write_results(ResultList *list, const char *file)
+{
+	FILE *f = file ? fopen(file, "w") : stdout;
+	int i;
+
+	if (!f) {
+		perror(file);
+		return False;
+	}
+
+	fprintf(f, "{\n");
+	fprintf(f, "  \"cpu_level\": \"%s\",\n", level_names[wraster_cpu_level()]);
+	fprintf(f, "  \"threads\": %d,\n", wraster_thread_count());
+	fprintf(f, "  \"display\": %s,\n", Context->dpy ? "true" : "false");
+	fprintf(f, "  \"results\": [\n");
+	for (i = 0; i < list->count; i++) {
+		Result *r = &list->items[i];
+
+		fprintf(f,
+			"    { \"name\": \"%s\", \"width\": %u, \"height\": %u, \"median_ms\": %.4f, "
+			"\"min_ms\": %.4f, \"runs\": %d }%s\n",
+			r->name, r->width, r->height, r->median, r->min, r->runs,
+			i + 1 < list->count ? "," : "");
+	}
+	fprintf(f, "  ]\n}\n");
+
+	if (file)
+		return fclose(f) == 0;
+	return True;
+}
+
+/* reads the results written by write_results(), one per line */
+static Bool read_results(ResultList *list, const char *file)
+{
+	FILE *f = fopen(file, "r");
+	char line[512];
+
+	if (!f) {
+		perror(file);
+		return False;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		char name[64];
+		unsigned width, height;
+		double median, min;
+		int runs;
+		Result *result;
+
+		if (sscanf(line,
+			   " { \"name\": \"%63[^\"]\", \"width\": %u, \"height\": %u, "
+			   "\"median_ms\": %lf, \"min_ms\": %lf, \"runs\": %d",
+			   name, &width, &height, &median, &min, &runs) != 6)
+			continue;
+		result = add_result(list, name, width, height);
+		result->median = median;
+		result->min = min;
+		result->runs = runs;
+	}
+	fclose(f);
+
+	if (list->count == 0) {
+		fprintf(stderr, "%s: no benchmark results\n", file);
+		return False;
+	}
+
+	return True;
+}
+
+/* returns the number of regressions */
+static int compare_results(FILE *f, ResultList *baseline, ResultList *current, double threshold)
+{
+	int i, regressions = 0;
+
+	fprintf(f, "%-26s %11s %10s %10s %8s\n", "benchmark", "size", "before", "after", "change");
+	for (i = 0; i < current->count; i++) {
+		Result *r = &current->items[i];
+		Result *base = find_result(baseline, r->name, r->width, r->height);
+		char size[24];
+		double change;
+		Bool regression;
+
+		if (!base || base->median <= 0)
+			continue;
+
+		change = (r->median - base->median) * 100 / base->median;
+		regression = (change > threshold && r->median - base->median > MIN_REGRESSION_MS);
+		snprintf(size, sizeof(size), "%ux%u", r->width, r->height);
+		fprintf(f, "%-26s %11s %7.3f ms %7.3f ms %+7.1f%%%s\n", r->name, size, base->median,
+			r->median, change, regression ? "  REGRESSION" : "");
+		if (regression)
+			regressions++;
+	}
+
+	if (regressions)
+		fprintf(f, "%d regressions beyond %g%%\n", regressions, threshold);
+	else
+		fprintf(f, "no regression beyond %g%%\n", threshold);
+
+	return regressions;
+}
+
+static void usage(const char *program)
+{
+	fprintf(stderr,
+		"usage: %s [-s WxH,...] [-t seconds] [-m pattern] [-i image]...\n"
+		"          [-o results.json] [-b baseline.json] [-T percent]\n"
+		"       %s -c baseline.json results.json [-T percent]\n",
+		program, program);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	const char *sizes = "64x64,512x512,1920x1080";
+	const char *output = NULL, *baseline_file = NULL;
+	char *files[MAX_FILES];
+	int file_count = 0, compare = 0;
+	double threshold = 10;
+	char dir[] = "/tmp/benchwrasterXXXXXX";
+	RContextAttributes attributes;
+	RContext headless;
+	Display *dpy;
+	const char *s;
+	int c, status = 0;
+
+	while ((c = getopt(argc, argv, "s:t:m:i:o:b:T:c")) != -1) {
+		switch (c) {
+		case 's':
+			sizes = optarg;
+			break;
+		case 't':
+			MinTime = atof(optarg);
+			break;
+		case 'm':
+			Pattern = optarg;
+			break;
+		case 'i':
+			if (file_count < MAX_FILES)
+				files[file_count++] = optarg;
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'b':
+			baseline_file = optarg;
+			break;
+		case 'T':
+			threshold = atof(optarg);
+			break;
+		case 'c':
+			compare = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (compare) {
+		ResultList baseline = { NULL, 0, 0 }, current = { NULL, 0, 0 };
+
+		if (argc - optind != 2)
+			usage(argv[0]);
+		if (!read_results(&baseline, argv[optind]) || !read_results(&current, argv[optind + 1]))
+			return 2;
+		return compare_results(stdout, &baseline, &current, threshold) ? 1 : 0;
+	}
+	if (optind != argc)
+		usage(argv[0]);
+
+	/* every load must read the file */
+	setenv("RIMAGE_CACHE", "0", 1);
+
+	dpy = XOpenDisplay(NULL);
+	if (dpy) {
+		Context = RCreateContext(dpy, DefaultScreen(dpy), NULL);
+		if (!Context) {
+			fprintf(stderr, "could not create a context: %s\n",
+				RMessageForError(RErrorCode));
+			return 2;
+		}
+	} else {
+		/* enough for the loaders, which only look at the gamma settings */
+		fprintf(stderr, "no X display, RConvertImage() is not measured\n");
+		memset(&attributes, 0, sizeof(attributes));
+		memset(&headless, 0, sizeof(headless));
+		headless.attribs = &attributes;
+		headless.depth = 24;
+		Context = &headless;
+	}
+
+	if (!mkdtemp(dir)) {
+		perror(dir);
+		return 2;
+	}
+
+	srand(1);
+	fprintf(stderr, "cpu level %s, %d threads\n", level_names[wraster_cpu_level()],
+		wraster_thread_count());
+
+	for (s = sizes; *s; s += strcspn(s, ",") + (s[strcspn(s, ",")] == ',')) {
+		unsigned width, height;
+
+		if (sscanf(s, "%ux%u", &width, &height) != 2 || width < 2 || height < 2) {
+			fprintf(stderr, "bad size '%.*s'\n", (int)strcspn(s, ","), s);
+			rmdir(dir);
+			return 2;
+		}
+		run_benchmarks(width, height, dir, files, file_count);
+	}
+	rmdir(dir);
+
+	if (!write_results(&Results, output))
+		return 2;
+
+	if (baseline_file) {
+		ResultList baseline = { NULL, 0, 0 };
+
+		if (!read_results(&baseline, baseline_file))
+			return 2;
+		/* stdout may hold the results */
+		if (compare_results(output ? stdout : stderr, &baseline, &Results, threshold))
+			status = 1;
+	}
+
+	if (Context != &headless) {
+		RDestroyContext(Context);
+		XCloseDisplay(dpy);
+	}
+
+	return status;
+}
@@ -0,0 +1,277 @@
+/*
+ * Regression test of the alpha compositing kernels.
+ *
+ * The RCombine* functions are compared with the float implementation they
+ * replaced: every channel must be within 1 of it. The vector kernels must
+ * also give exactly the same bytes as the plain C one.
+ *
+ * usage: testcombine [iterations]
+ */
+
+#include <X11/Xlib.h>
+#include "wraster.h"
+#include "alpha_combine.h"
+#include "cpu.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *level_names[] = { "generic", "sse2", "avx2" };
+
+static int failures = 0;
+
+/* RCombineAlpha() before the integer kernels */
+static void old_combine_alpha(unsigned char *d, unsigned char *s, int s_has_alpha, int width,
+			      int height, int dwi, int swi, int opacity)
+{
+	int x, y;
+	int t, sa;
+	int alpha;
+	float ratio, cratio;
+
+	for (y = 0; y < height; y++) {
+		for (x = 0; x < width; x++) {
+			sa = s_has_alpha ? *(s + 3) : 255;
+
+			if (opacity != 255) {
+				t = sa * opacity + 0x80;
+				sa = ((t >> 8) + t) >> 8;
+			}
+
+			t = *(d + 3) * (255 - sa) + 0x80;
+			alpha = sa + (((t >> 8) + t) >> 8);
+
+			if (sa == 0 || alpha == 0) {
+				ratio = 0;
+				cratio = 1.0;
+			} else if (sa == alpha) {
+				ratio = 1.0;
+				cratio = 0;
+			} else {
+				ratio = (float)sa / alpha;
+				cratio = 1.0F - ratio;
+			}
+
+			*d = (int)*d * cratio + (int)*s * ratio;
+			s++;
+			d++;
+			*d = (int)*d * cratio + (int)*s * ratio;
+			s++;
+			d++;
+			*d = (int)*d * cratio + (int)*s * ratio;
+			s++;
+			d++;
+			*d = alpha;
+			d++;
+
+			if (s_has_alpha)
+				s++;
+		}
+		d += dwi;
+		s += swi;
+	}
+}
+
+/* RGBA over RGB as RCombineArea() and RCombineAreaWithOpaqueness() did it */
+static void old_combine_rgb(unsigned char *d, unsigned char *s, int count, int opacity)
+{
+	int i, alpha;
+
+	for (i = 0; i < count; i++, d += 3, s += 4) {
+		alpha = (opacity < 0) ? s[3] : (s[3] * opacity) / 256;
+		d[0] = ((int)d[0] * (255 - alpha) + (int)s[0] * alpha) / 256;
+		d[1] = ((int)d[1] * (255 - alpha) + (int)s[1] * alpha) / 256;
+		d[2] = ((int)d[2] * (255 - alpha) + (int)s[2] * alpha) / 256;
+	}
+}
+
+/* random pixels, with runs of opaque and transparent ones */
+static void fill(RImage *image)
+{
+	int i, channels = (image->format == RRGBAFormat) ? 4 : 3;
+	int count = image->width * image->height;
+	int run = 0, kind = 0;
+
+	for (i = 0; i < count * channels; i++)
+		image->data[i] = rand();
+
+	if (channels == 3)
+		return;
+
+	for (i = 0; i < count; i++) {
+		if (run-- <= 0) {
+			run = rand() % 24;
+			kind = rand() % 4;
+		}
+		if (kind == 0)
+			image->data[i * 4 + 3] = 0;
+		else if (kind == 1)
+			image->data[i * 4 + 3] = 255;
+	}
+}
+
+static void compare(const char *what, RImage *image, unsigned char *expected, int exact)
+{
+	int i, size = image->width * image->height * ((image->format == RRGBAFormat) ? 4 : 3);
+	int diff, max_diff = 0;
+
+	for (i = 0; i < size; i++) {
+		diff = abs((int)image->data[i] - (int)expected[i]);
+		if (diff > max_diff)
+			max_diff = diff;
+	}
+
+	if (max_diff > (exact ? 0 : 1)) {
+		printf("FAIL %s: max. difference %d\n", what, max_diff);
+		failures++;
+	}
+}
+
+static void test_kernels(int width, int height)
+{
+	RImage *src = RCreateImage(width, height, True);
+	RImage *dst = RCreateImage(width, height, True);
+	RImage *ref = RCreateImage(width, height, True);
+	RImage *generic = RCreateImage(width, height, True);
+	int level, opacity, y;
+	char what[64];
+
+	fill(src);
+	fill(dst);
+
+	for (opacity = 0; opacity <= 255; opacity += 51) {
+		memcpy(ref->data, dst->data, width * height * 4);
+		old_combine_alpha(ref->data, src->data, 1, width, height, 0, 0, opacity);
+
+		for (level = RCPUGeneric; level <= wraster_cpu_level(); level++) {
+			RCombineRowProc combine = wraster_combine_row_proc(level);
+			RImage *out = (level == RCPUGeneric) ? generic : RCreateImage(width, height, True);
+
+			memcpy(out->data, dst->data, width * height * 4);
+			for (y = 0; y < height; y++)
+				combine(out->data + y * width * 4, src->data + y * width * 4, width, opacity);
+
+			sprintf(what, "%s kernel, opacity %d", level_names[level], opacity);
+			compare(what, out, ref->data, 0);
+			if (level != RCPUGeneric) {
+				strcat(what, " vs generic");
+				compare(what, out, generic->data, 1);
+				RReleaseImage(out);
+			}
+		}
+	}
+
+	RReleaseImage(src);
+	RReleaseImage(dst);
+	RReleaseImage(ref);
+	RReleaseImage(generic);
+}
+
+static void test_functions(int width, int height)
+{
+	RImage *src = RCreateImage(width, height, True);
+	RImage *rgb_src = RCreateImage(width, height, False);
+	RImage *dst = RCreateImage(width + 7, height + 5, True);
+	RImage *rgb_dst = RCreateImage(width + 7, height + 5, False);
+	RImage *out;
+	unsigned char *expected;
+	int dx = 3, dy = 2, y, dwidth = width + 7;
+
+	fill(src);
+	fill(rgb_src);
+	fill(dst);
+	fill(rgb_dst);
+
+	expected = malloc(dst->width * dst->height * 4);
+
+	/* RGBA over RGBA */
+	out = RCloneImage(dst);
+	memcpy(expected, dst->data, dst->width * dst->height * 4);
+	RCombineArea(out, src, 0, 0, width, height, dx, dy);
+	old_combine_alpha(expected + (dy * dwidth + dx) * 4, src->data, 1, width, height,
+			  (dwidth - width) * 4, 0, 255);
+	compare("RCombineArea RGBA", out, expected, 0);
+	RReleaseImage(out);
+
+	out = RCloneImage(dst);
+	memcpy(expected, dst->data, dst->width * dst->height * 4);
+	RCombineAreaWithOpaqueness(out, src, 0, 0, width, height, dx, dy, 100);
+	old_combine_alpha(expected + (dy * dwidth + dx) * 4, src->data, 1, width, height,
+			  (dwidth - width) * 4, 0, 100);
+	compare("RCombineAreaWithOpaqueness RGBA", out, expected, 0);
+	RReleaseImage(out);
+
+	/* RGB over RGBA */
+	out = RCloneImage(dst);
+	memcpy(expected, dst->data, dst->width * dst->height * 4);
+	RCombineAreaWithOpaqueness(out, rgb_src, 0, 0, width, height, dx, dy, 180);
+	old_combine_alpha(expected + (dy * dwidth + dx) * 4, rgb_src->data, 0, width, height,
+			  (dwidth - width) * 4, 0, 180);
+	compare("RCombineAreaWithOpaqueness RGB over RGBA", out, expected, 0);
+	RReleaseImage(out);
+
+	/* RGBA over RGB */
+	out = RCloneImage(rgb_dst);
+	memcpy(expected, rgb_dst->data, rgb_dst->width * rgb_dst->height * 3);
+	RCombineArea(out, src, 0, 0, width, height, dx, dy);
+	for (y = 0; y < height; y++)
+		old_combine_rgb(expected + ((dy + y) * dwidth + dx) * 3, src->data + y * width * 4,
+				width, -1);
+	compare("RCombineArea RGBA over RGB", out, expected, 0);
+	RReleaseImage(out);
+
+	out = RCloneImage(rgb_dst);
+	memcpy(expected, rgb_dst->data, rgb_dst->width * rgb_dst->height * 3);
+	RCombineAreaWithOpaqueness(out, src, 0, 0, width, height, dx, dy, 200);
+	for (y = 0; y < height; y++)
+		old_combine_rgb(expected + ((dy + y) * dwidth + dx) * 3, src->data + y * width * 4,
+				width, 200);
+	compare("RCombineAreaWithOpaqueness RGBA over RGB", out, expected, 0);
+	RReleaseImage(out);
+
+	/* whole images */
+	out = RGetSubImage(dst, 0, 0, width, height);
+	memcpy(expected, out->data, width * height * 4);
+	RCombineImages(out, src);
+	old_combine_alpha(expected, src->data, 1, width, height, 0, 0, 255);
+	compare("RCombineImages", out, expected, 0);
+	RReleaseImage(out);
+
+	out = RGetSubImage(dst, 0, 0, width, height);
+	memcpy(expected, out->data, width * height * 4);
+	RCombineImagesWithOpaqueness(out, src, 64);
+	old_combine_alpha(expected, src->data, 1, width, height, 0, 0, 64);
+	compare("RCombineImagesWithOpaqueness", out, expected, 0);
+	RReleaseImage(out);
+
+	free(expected);
+	RReleaseImage(src);
+	RReleaseImage(rgb_src);
+	RReleaseImage(dst);
+	RReleaseImage(rgb_dst);
+}
+
+int main(int argc, char **argv)
+{
+	int iterations = 20, i;
+
+	if (argc > 1)
+		iterations = atoi(argv[1]);
+
+	srand(1);
+	printf("cpu level %s\n", level_names[wraster_cpu_level()]);
+
+	for (i = 0; i < iterations; i++) {
+		int width = 1 + rand() % 97, height = 1 + rand() % 31;
+
+		test_kernels(width, height);
+		test_functions(width, height);
+	}
+
+	if (failures)
+		printf("%d failures\n", failures);
+	else
+		printf("all results within 1 of the float implementation\n");
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,239 @@
+/*
+ * Regression test of the rotation and flip engine.
+ *
+ * Flips and rotations by quarter turns are compared pixel by pixel with
+ * the mapping they implement, for the functions returning a new image as
+ * well as the ones changing the image itself. Rotations by other angles
+ * print checksums, which must be the same with every WRASTER_SIMD level.
+ *
+ * usage: testtransform [iterations]
+ */
+
+#include <X11/Xlib.h>
+#include "wraster.h"
+#include "rotate.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int failures = 0;
+
+/* where the pixel (x, y) of the result comes from */
+static void source_pixel(RImage *src, RTransform transform, int x, int y, int *sx, int *sy)
+{
+	int w = src->width, h = src->height;
+
+	switch (transform) {
+	case RTransformHorizontalFlip:
+		*sx = w - 1 - x;
+		*sy = y;
+		break;
+	case RTransformVerticalFlip:
+		*sx = x;
+		*sy = h - 1 - y;
+		break;
+	case RTransformRotate180:
+		*sx = w - 1 - x;
+		*sy = h - 1 - y;
+		break;
+	case RTransformRotate90:
+		*sx = y;
+		*sy = h - 1 - x;
+		break;
+	case RTransformRotate270:
+		*sx = w - 1 - y;
+		*sy = x;
+		break;
+	case RTransformTranspose:
+		*sx = y;
+		*sy = x;
+		break;
+	}
+}
+
+static void check(const char *what, RImage *src, RImage *out, RTransform transform)
+{
+	int bpp = (src->format == RRGBAFormat) ? 4 : 3;
+	int swap = (transform >= RTransformRotate90);
+	int x, y, sx = 0, sy = 0;
+
+	if (!out) {
+		printf("FAIL %s %ux%u: no image\n", what, src->width, src->height);
+		failures++;
+		return;
+	}
+	if (out->width != (swap ? src->height : src->width) ||
+	    out->height != (swap ? src->width : src->height)) {
+		printf("FAIL %s %ux%u: size %ux%u\n", what, src->width, src->height,
+		       out->width, out->height);
+		failures++;
+		return;
+	}
+
+	for (y = 0; y < out->height; y++) {
+		for (x = 0; x < out->width; x++) {
+			source_pixel(src, transform, x, y, &sx, &sy);
+			if (memcmp(out->data + (y * out->width + x) * bpp,
+				   src->data + (sy * src->width + sx) * bpp, bpp) != 0) {
+				printf("FAIL %s %ux%u: pixel %i,%i\n", what, src->width,
+				       src->height, x, y);
+				failures++;
+				return;
+			}
+		}
+	}
+}
+
+static void test_transforms(int width, int height, int alpha)
+{
+	static const struct {
+		const char *name;
+		float angle;
+		RTransform transform;
+	} rotations[] = {
+		{ "rotation by 90", 90, RTransformRotate90 },
+		{ "rotation by 180", 180, RTransformRotate180 },
+		{ "rotation by 270", 270, RTransformRotate270 },
+		{ "rotation by -90", -90, RTransformRotate270 }
+	};
+	static const struct {
+		const char *name;
+		int mode;
+		RTransform transform;
+	} flips[] = {
+		{ "horizontal flip", RHorizontalFlip, RTransformHorizontalFlip },
+		{ "vertical flip", RVerticalFlip, RTransformVerticalFlip },
+		{ "double flip", RHorizontalFlip | RVerticalFlip, RTransformRotate180 }
+	};
+	RImage *src = RCreateImage(width, height, alpha);
+	RImage *out;
+	char what[64];
+	int i;
+
+	for (i = 0; i < width * height * (alpha ? 4 : 3); i++)
+		src->data[i] = rand();
+
+	for (i = 0; i < sizeof(rotations) / sizeof(rotations[0]); i++) {
+		out = RRotateImage(src, rotations[i].angle);
+		check(rotations[i].name, src, out, rotations[i].transform);
+		RReleaseImage(out);
+
+		out = RCloneImage(src);
+		RRotateImageInPlace(out, rotations[i].angle);
+		sprintf(what, "%s in place", rotations[i].name);
+		check(what, src, out, rotations[i].transform);
+		RReleaseImage(out);
+	}
+
+	for (i = 0; i < sizeof(flips) / sizeof(flips[0]); i++) {
+		out = RFlipImage(src, flips[i].mode);
+		check(flips[i].name, src, out, flips[i].transform);
+		RReleaseImage(out);
+
+		out = RCloneImage(src);
+		RFlipImageInPlace(out, flips[i].mode);
+		sprintf(what, "%s in place", flips[i].name);
+		check(what, src, out, flips[i].transform);
+		RReleaseImage(out);
+	}
+
+	out = wraster_transform_image(src, RTransformTranspose);
+	check("transposition", src, out, RTransformTranspose);
+	RReleaseImage(out);
+
+	RReleaseImage(src);
+}
+
+static unsigned long checksum(RImage *image)
+{
+	unsigned long sum = 0;
+	int i;
+
+	for (i = 0; i < image->width * image->height * 4; i++)
+		sum = sum * 31 + image->data[i];
+
+	return sum;
+}
+
+/* rotations resampling the image, which must vary smoothly with the angle */
+static void test_angles(void)
+{
+	static const float angles[] = { 1, 17.5, 45, 133, 211.3, 300 };
+	RImage *src = RCreateImage(200, 120, False);
+	RImage *quarter, *out;
+	unsigned char *p, *q;
+	int x, y, c, diff, max_diff = 0;
+	int i;
+
+	for (y = 0; y < src->height; y++) {
+		for (x = 0; x < src->width; x++) {
+			p = src->data + (y * src->width + x) * 3;
+			p[0] = x;
+			p[1] = y * 2;
+			p[2] = (x + y) / 2;
+		}
+	}
+
+	/* almost a quarter turn: the result is a pixel wider and higher */
+	quarter = RRotateImage(src, 90);
+	out = RRotateImage(src, 89.9);
+	for (y = 20; y < quarter->height - 20; y++) {
+		for (x = 20; x < quarter->width - 20; x++) {
+			p = out->data + (y * out->width + x) * 4;
+			q = quarter->data + (y * quarter->width + x) * 3;
+			for (c = 0; c < 3; c++) {
+				diff = abs((int)p[c] - (int)q[c]);
+				if (diff > max_diff)
+					max_diff = diff;
+			}
+			if (p[3] != 255)
+				max_diff = 255;
+		}
+	}
+	if (max_diff > 1) {
+		printf("FAIL rotation by 89.9: max. difference %d with 90\n", max_diff);
+		failures++;
+	}
+	RReleaseImage(quarter);
+	RReleaseImage(out);
+
+	/* compare with the output of another WRASTER_SIMD level */
+	for (i = 0; i < sizeof(angles) / sizeof(angles[0]); i++) {
+		out = RRotateImage(src, angles[i]);
+		if (out->data[3] != 0) {
+			printf("FAIL rotation by %g: opaque corner\n", angles[i]);
+			failures++;
+		}
+		printf("rotation by %g: %ux%u, checksum %lx\n", angles[i], out->width, out->height,
+		       checksum(out));
+		RReleaseImage(out);
+	}
+
+	RReleaseImage(src);
+}
+
+int main(int argc, char **argv)
+{
+	int iterations = 20, i;
+
+	if (argc > 1)
+		iterations = atoi(argv[1]);
+
+	srand(1);
+
+	for (i = 0; i < iterations; i++) {
+		int width = 1 + rand() % 150, height = 1 + rand() % 150;
+
+		test_transforms(width, height, i & 1);
+		test_transforms(width, width, i & 1);
+	}
+
+	test_angles();
+
+	if (failures)
+		printf("%d failures\n", failures);
+	else
+		printf("all the transformations are exact\n");
+
+	return failures ? 1 : 0;
+}
@@ -34,13 +34,36 @@
  * preceded by a hash to the variable name as in
  * WRASTER_GAMMA#1
  * for screen number 1
+ *
+ *
+ * RIMAGE_CACHE <count>
+ * max. number of images kept in the RLoadImage cache, 0 disables it
+ *
+ * RIMAGE_CACHE_SIZE <pixels>
+ * max. size of an image to be cached, 0 for any size
+ *
+ * RIMAGE_CACHE_MEMORY <kilobytes>
+ * max. memory used by the pixels of the cached images
+ *
+ * RIMAGE_CACHE_INOTIFY 0
+ * check the modification time of the file on each cache hit instead
+ * of being notified of changes by inotify
+ *
+ * RIMAGE_LOADERS <count>
+ * number of threads decoding the images requested with RLoadImageAsync
+ *
+ * Default:
+ * RIMAGE_CACHE 1024
+ * RIMAGE_CACHE_SIZE 65536
+ * RIMAGE_CACHE_MEMORY 8192
+ * RIMAGE_LOADERS number of CPUs, at most 4
  */
 
 #ifndef __WRASTER_WRASTER_H__
 #define __WRASTER_WRASTER_H__
 
 /* version of the header for the library */
-#define WRASTER_HEADER_VERSION 25
+#define WRASTER_HEADER_VERSION 26
 
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
@@ -207,6 +230,20 @@ typedef struct RHSVColor {
   unsigned char value;      /* 0-255 */
 } RHSVColor;
 
+/*
+ * counters of the image cache used by RLoadImage(), RLoadImageScaled() and
+ * RLoadSharedImage(), and of the gradient cache
+ */
+typedef struct RImageCacheStatistics {
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long evictions;     /* dropped to stay within the limits */
+  unsigned long invalidations; /* dropped because the file changed */
+  unsigned long entries;       /* images currently cached */
+  unsigned long bytes;         /* memory used by their pixels */
+  unsigned long budget;        /* max. memory, see RIMAGE_CACHE_MEMORY */
+} RImageCacheStatistics;
+
 typedef struct RPoint {
   int x, y;
 } RPoint;
@@ -229,6 +266,24 @@ typedef struct RImage {
   int refCount;
 } RImage;
 
+/*
+ * Asynchronous image loading, see RLoadImageAsync()
+ */
+typedef struct RImageRequest RImageRequest;
+
+typedef enum {
+  RLowPriority = 0,
+  RNormalPriority = 1,
+  RHighPriority = 2
+} RImageRequestPriority;
+
+/*
+ * Called by RDispatchImageRequests() when a request is done. The image
+ * belongs to the callee; it is NULL if the load failed and 'error' is the
+ * RErrorCode of the loader then.
+ */
+typedef void RImageLoadedProc(RImageRequest *request, RImage *image, int error, void *data);
+
 /*
  * internal wrapper for XImage. Used for shm abstraction
  */
@@ -339,8 +394,70 @@ RImage *RCreateImageFromDrawable(RContext *context, Drawable drawable,
 RImage *RLoadImage(RContext *context, const char *file,
                    int index) __wrlib_useresult __wrlib_nonalias __wrlib_nonnull(1, 2);
 
+/*
+ * Loads an image scaled down to fit in 'max_width'x'max_height', keeping
+ * its aspect ratio; 0 means no limit for that dimension. The image is never
+ * enlarged. JPEG, PNG and WebP files are reduced while they are decoded, so
+ * the full size image is not kept in memory. The result is cached apart
+ * from the full size image.
+ */
+RImage *RLoadImageScaled(RContext *context, const char *file, int index, unsigned max_width,
+                         unsigned max_height) __wrlib_useresult __wrlib_nonalias
+    __wrlib_nonnull(1, 2);
+
+/*
+ * Same as RLoadImage, but the returned image may be shared with the image
+ * cache and must not be modified; use RGetWritableImage() to get an image
+ * that can be changed. This avoids copying the image on every cache hit.
+ */
+RImage *RLoadSharedImage(RContext *context, const char *file,
+                         int index) __wrlib_useresult __wrlib_nonnull(1, 2);
+
+void RGetImageCacheStatistics(RImageCacheStatistics *stats) __wrlib_nonnull(1);
+
+/*
+ * Queues the loading of an image, like RLoadImageScaled (0 for no size
+ * limit), to be done by a pool of threads. Higher priority requests are
+ * started first, requests of the same priority in order.
+ *
+ * 'proc' is called from RDispatchImageRequests() in the thread calling it,
+ * which should be done when the descriptor returned by RImageRequestFD()
+ * becomes readable. The context must stay valid until then.
+ *
+ * Returns NULL if the request can't be queued.
+ */
+RImageRequest *RLoadImageAsync(RContext *context, const char *file, int index, unsigned max_width,
+                               unsigned max_height, RImageRequestPriority priority,
+                               RImageLoadedProc *proc, void *data) __wrlib_nonnull(1, 2, 7);
+
+/*
+ * Cancels a request whose callback was not called yet; the callback will
+ * never be called for it. The request can't be used anymore afterwards.
+ */
+void RCancelImageRequest(RImageRequest *request) __wrlib_nonnull(1);
+
+/*
+ * Returns a descriptor that becomes readable when finished requests wait
+ * for RDispatchImageRequests(), for select()/poll() or a run loop source.
+ * Returns -1 if it can't be created.
+ */
+int RImageRequestFD(void);
+
+/*
+ * Calls the callbacks of the finished requests. Returns the number of
+ * callbacks called.
+ */
+int RDispatchImageRequests(void);
+
 RImage *RRetainImage(RImage *image);
 
+/*
+ * Copy-on-write: returns 'image' if the caller holds its only reference,
+ * otherwise releases one reference and returns a private copy (NULL if
+ * there is not enough memory for it).
+ */
+RImage *RGetWritableImage(RImage *image) __wrlib_useresult __wrlib_nonnull(1);
+
 void RReleaseImage(RImage *image) __wrlib_nonnull(1);
 
 RImage *RGetImageFromXPMData(RContext *context, char **xpmData) __wrlib_useresult __wrlib_nonalias
@@ -393,6 +510,18 @@ RImage *RRotateImage(RImage *image, float angle) __wrlib_useresult __wrlib_nonal
 
 RImage *RFlipImage(RImage *image, int mode) __wrlib_useresult __wrlib_nonalias;
 
+/*
+ * Same as RRotateImage() and RFlipImage(), but they change the image
+ * itself, which must not be shared (see RGetWritableImage()). Flips and
+ * half turns are done in place, as well as quarter turns of square
+ * images. The other rotations give the image a new size and buffer, and
+ * an alpha channel for angles that are not multiples of 90 degrees.
+ * Return False if there is not enough memory, the image is then unchanged.
+ */
+int RRotateImageInPlace(RImage *image, float angle) __wrlib_nonnull(1);
+
+int RFlipImageInPlace(RImage *image, int mode) __wrlib_nonnull(1);
+
 RImage *RMakeTiledImage(RImage *tile, unsigned width,
                         unsigned height) __wrlib_useresult __wrlib_nonalias __wrlib_nonnull(1);
 
@@ -466,6 +595,19 @@ RImage *RRenderInterwovenGradient(unsigned width, unsigned height, RColor colors
                                   int thickness1, RColor colors2[2],
                                   int thickness2) __wrlib_nonalias __wrlib_useresult;
 
+/*
+ * Same as RRenderGradient, but the returned image may be shared with the
+ * gradient cache and must not be modified; use RGetWritableImage() to get
+ * an image that can be changed. The rendered gradients are cached by all
+ * the functions above, within RGRADIENT_CACHE_MEMORY kilobytes (4096 by
+ * default).
+ */
+RImage *RRenderSharedGradient(unsigned width, unsigned height, const RColor *from,
+                              const RColor *to, RGradientStyle style) __wrlib_useresult
+    __wrlib_nonnull(3, 4);
+
+void RGetGradientCacheStatistics(RImageCacheStatistics *stats) __wrlib_nonnull(1);
+
 /*
  * Convertion into X Pixmaps
  */
@@ -493,9 +635,41 @@ const char *RMessageForError(int errorCode) __wrlib_useresult;
 
 int RBlurImage(RImage *image);
 
+/*
+ * Blurs the image with a Gaussian of standard deviation 'radius' pixels.
+ * It is approximated with box filters, so the time taken does not depend
+ * on the radius. The pixels beyond the edges repeat the edge ones.
+ */
+int RBlurImageRadius(RImage *image, float radius) __wrlib_nonnull(1);
+
+/*
+ * Number of pixels a shadow made with 'radius' extends beyond the shape
+ * on every side.
+ */
+int RShadowMargin(float radius);
+
+/*
+ * Makes the drop shadow of an image: its alpha channel (all of the image
+ * if it has none) blurred with RBlurImageRadius(), in 'color' with the
+ * opacity color->alpha. The shadow is RShadowMargin(radius) pixels larger
+ * than the image on every side.
+ */
+RImage *RMakeShadowImage(RImage *image, float radius, const RColor *color)
+    __wrlib_nonalias __wrlib_useresult __wrlib_nonnull(1, 3);
+
+/*
+ * Alpha only version of RMakeShadowImage() for a 'width' x 'height'
+ * rectangle, with the opacity 0-255. Returns (width + 2 * margin) x
+ * (height + 2 * margin) bytes, one per pixel, to be released with free().
+ */
+unsigned char *RMakeShadowMask(unsigned width, unsigned height, float radius, int opacity)
+    __wrlib_useresult;
+
 /****** Global Variables *******/
 
-extern int RErrorCode;
+/* error code of the last failed call made by the calling thread; a TLS
+   symbol since libwraster 8 */
+extern __thread int RErrorCode;
 
 #ifdef __cplusplus
 }